@@ -3,4 +3,6 @@ TEMPLATE = subdirs
 SUBDIRS += \
 	VSPController \
 	VSPSetup \
-	VSPClient
+	VSPClient \
+	VSPCtl \
+	VSPDaemon
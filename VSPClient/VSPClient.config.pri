@@ -60,20 +60,10 @@ vsp_framework {
 DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000
 DEFINES += VSP_DEBUG
 
-QMAKE_LFLAGS         = -Wl,-rpath,@executable_path/../Frameworks/
-QMAKE_LFLAGS_SONAME	 = -Wl,-install_name,@executable_path/../Frameworks/
-
 QMAKE_CXXFLAGS      += -fno-omit-frame-pointer
 QMAKE_CXXFLAGS      += -funwind-tables
 QMAKE_CXXFLAGS      += -ggdb3
 
-#otool -L
-LIBS += -dead_strip
-LIBS += -liconv
-
-LIBS += -F$$OUT_PWD/../VSPController -framework VSPController
-LIBS += -F$$OUT_PWD/../VSPSetup      -framework VSPSetup
-
 INCLUDEPATH += $$OUT_PWD/../../VSPController
 INCLUDEPATH += $$OUT_PWD/../../VSPSetup
 
@@ -82,6 +72,16 @@ INCLUDEPATH += $$OUT_PWD/../../VSPSetup
 mac {
 	QMAKE_MACOSX_DEPLOYMENT_TARGET = 12.2
 
+	QMAKE_LFLAGS         = -Wl,-rpath,@executable_path/../Frameworks/
+	QMAKE_LFLAGS_SONAME	 = -Wl,-install_name,@executable_path/../Frameworks/
+
+	#otool -L
+	LIBS += -dead_strip
+	LIBS += -liconv
+
+	LIBS += -F$$OUT_PWD/../VSPController -framework VSPController
+	LIBS += -F$$OUT_PWD/../VSPSetup      -framework VSPSetup
+
 	#QMAKE_PROVISIONING_PROFILE
 	#QMAKE_OSX_ARCHITECTURES="x86_64;arm64"
 
@@ -109,6 +109,15 @@ mac {
 	QMAKE_BUNDLE_DATA += icons
 }
 
+# Linux: VSPController with the in-process loopback driver
+linux {
+	QMAKE_LFLAGS += -Wl,-rpath,$$OUT_PWD/../VSPController
+	QMAKE_LFLAGS += -Wl,-rpath,$$OUT_PWD/../VSPSetup
+
+	LIBS += -L$$OUT_PWD/../VSPController -lVSPController
+	LIBS += -L$$OUT_PWD/../VSPSetup      -lVSPSetup
+}
+
 mac:vsp_framework {
 	QMAKE_FRAMEWORK_VERSION = 2.1
 	QMAKE_BUNDLE_EXTENSION = .framework
@@ -10,29 +10,71 @@
 #include <QTimer>
 #include <vspdriverclient.h>
 
+// kIOReturnTimeout of a request the driver never completed
+#define kIOErrorTimeout -536870186
+
 VSPDriverClient::VSPDriverClient(QObject* parent)
     : QObject(parent)
     , VSPController()
     , VSPDriverSetup()
     , m_portList(this)
     , m_linkList(this)
+    , m_fetchLinks(false)
+    , m_synced(false)
+    , m_generation(0)
+    , m_eventGeneration(0)
+    , m_catchUp(false)
+    , m_cacheValid(false)
+    , m_cacheMsecs(TOPOLOGY_CACHE_MSECS)
+    , m_cacheTime()
+    , m_reading(vspLastCommand)
+    , m_cacheHits(0)
+    , m_cacheMisses(0)
+    , m_cacheJoins(0)
 {
+    // driver completions are received on the control thread and
+    // dispatched in the UI thread, see OnCompletionsPending()
+    SetControlThread(true);
+
+    // a restarted driver is matched again within a second and gets
+    // the ports and links back which this client created
+    SetReconnect(25, 800);
+    SetTopologyReplay(true);
 }
 
 VSPDriverClient::~VSPDriverClient()
 {
-    //
+    // no driver callbacks into a destroyed client
+    DisconnectDriver();
 }
 
 void VSPDriverClient::OnConnected()
 {
+    m_synced = false;
+    m_catchUp = false;
+    m_cacheValid = false;
+    m_reading = vspLastCommand;
+    m_eventGeneration = 0;
     m_linkList.resetModel();
     m_portList.resetModel();
     emit connected();
+
+    // not within the connect notification of the driver
+    QMetaObject::invokeMethod(
+       this,
+       [this]() {
+           Subscribe(VSP_EVENT_ALL);
+       },
+       Qt::QueuedConnection);
 }
 
 void VSPDriverClient::OnDisconnected()
 {
+    m_synced = false;
+    m_catchUp = false;
+    m_cacheValid = false;
+    m_reading = vspLastCommand;
+    m_eventGeneration = 0;
     m_linkList.resetModel();
     m_portList.resetModel();
     emit disconnected();
@@ -53,6 +95,99 @@ void VSPDriverClient::OnNeedsUserApproval()
     emit needsUserApproval();
 }
 
+bool VSPDriverClient::updateTopology()
+{
+    if (m_synced) {
+        return GetChanges(m_generation);
+    }
+    return GetStatus();
+}
+
+bool VSPDriverClient::readTopology(TVSPControlCommand command)
+{
+    // the topology of a GetStatus covers both lists
+    if (m_reading == command || m_reading == vspControlGetStatus) {
+        m_cacheJoins++;
+        return true;
+    }
+
+    if (m_synced && m_cacheValid && m_cacheTime.isValid() && m_cacheTime.elapsed() < m_cacheMsecs) {
+        QByteArray buffer;
+        QTextStream text(&buffer);
+
+        m_cacheHits++;
+        text << "Topology cache.: command " << command << " age " << m_cacheTime.elapsed() << " ms" << Qt::endl;
+        printCacheStats(text);
+
+        // in the order of a driver result, after the caller returned
+        QMetaObject::invokeMethod(
+           this,
+           [this, command, buffer]() {
+               emit updateStatusLog(buffer);
+               emit updateButtons(true);
+               emit commandResult(command, &m_portList, &m_linkList);
+               emit complete();
+           },
+           Qt::QueuedConnection);
+        return true;
+    }
+
+    bool submitted;
+    switch (command) {
+        case vspControlGetStatus: {
+            submitted = updateTopology();
+            break;
+        }
+        case vspControlGetPortList: {
+            submitted = GetPortList();
+            break;
+        }
+        case vspControlGetLinkList: {
+            submitted = GetLinkList();
+            break;
+        }
+        default: {
+            return false;
+        }
+    }
+
+    if (submitted) {
+        m_cacheMisses++;
+        m_reading = command;
+    }
+    return submitted;
+}
+
+void VSPDriverClient::invalidateTopology()
+{
+    m_cacheValid = false;
+}
+
+// end of the request chain, the models are as good as they get
+void VSPDriverClient::finishRequest()
+{
+    m_reading = vspLastCommand;
+    emit updateButtons(true);
+    emit complete();
+}
+
+void VSPDriverClient::printCacheStats(QTextStream& text) const
+{
+    text << "Cache hits.....: " << m_cacheHits << " misses " << m_cacheMisses //
+         << " joined " << m_cacheJoins << Qt::endl;
+}
+
+// called on the control thread, run the callbacks in our own thread
+void VSPDriverClient::OnCompletionsPending()
+{
+    QMetaObject::invokeMethod(
+       this,
+       [this]() {
+           DispatchCompletions();
+       },
+       Qt::QueuedConnection);
+}
+
 // called in sync of request
 void VSPDriverClient::OnDataReady(void*)
 {
@@ -61,8 +196,52 @@ void VSPDriverClient::OnDataReady(void*)
 // called async of request
 void VSPDriverClient::OnIOUCCallback(int result, void* args, uint32_t size)
 {
-    const TVSPControllerData* data = (TVSPControllerData*) (args);
+    // Dispatched in our own thread, the copy keeps the models safe if
+    // the control thread is disabled.
+    const TVSPControllerData response = *(TVSPControllerData*) (args);
+
+    QMetaObject::invokeMethod(
+       this,
+       [this, result, response, size]() {
+           processResult(result, &response, size);
+       },
+       Qt::AutoConnection);
+}
+
+// called async of subscription
+void VSPDriverClient::OnEvent(const TVSPEvent* event)
+{
+    const TVSPEvent copy = *event;
+
+    QMetaObject::invokeMethod(
+       this,
+       [this, copy]() {
+           processEvent(copy);
+       },
+       Qt::AutoConnection);
+}
+
+void VSPDriverClient::processEvent(const TVSPEvent& event)
+{
+    if (event.kind == vspEventModemSignal) {
+        emit modemSignal(event.id, event.modemLines);
+        return;
+    }
+
+    // Topology events carry no port names, fetch the changes up to
+    // the event. Events during that request are picked up once the
+    // response arrived.
+    if (event.generation > m_eventGeneration) {
+        m_eventGeneration = event.generation;
+    }
+    m_cacheValid = false;
+    if (m_synced && !m_catchUp && m_eventGeneration > m_generation) {
+        m_catchUp = GetChanges(m_generation);
+    }
+}
 
+void VSPDriverClient::processResult(int result, const TVSPControllerData* data, uint32_t size)
+{
     QByteArray buffer;
     QTextStream text(&buffer);
 
@@ -89,71 +268,176 @@ void VSPDriverClient::OnIOUCCallback(int result, void* args, uint32_t size)
     text << "Port count.....: " << data->ports.count << Qt::endl;
     text << "Link count.....: " << data->links.count << Qt::endl;
 
-    if (data->ports.count) {
-        m_portList.resetModel();
+    // batch response carries the operation results in the port list
+    if (data->command == vspControlBatch) {
+        TVSPBatchOperation ops[MAX_BATCH_OPS];
+        const uint8_t count = GetBatchResults(data, ops);
+        for (uint i = 0; i < count; i++) {
+            text << "Batch item.....: " << i << " cmd " << ops[i].command //
+                 << " " << ops[i].source << " " << ops[i].target       //
+                 << " status " << Qt::hex << ops[i].status << Qt::dec << Qt::endl;
+        }
+        emit updateStatusLog(buffer);
+        if (result != 0) {
+            emit errorOccured(result, txStatus);
+        }
+        // load topology changes of the batch
+        m_cacheValid = false;
+        if (!updateTopology()) {
+            finishRequest();
+        }
+        return;
+    }
+
+    // subscription state only, the events follow through OnEvent
+    if (data->command == vspControlSubscribe) {
+        emit updateStatusLog(buffer);
+        if (result != 0) {
+            emit errorOccured(result, txStatus);
+        }
+        return;
+    }
+
+    if (data->command == vspControlGetChanges) {
+        m_catchUp = false;
+        // changes expired in the driver, reload the topology
+        if (result == kIOErrorOverrun) {
+            m_synced = false;
+            emit updateStatusLog(buffer);
+            if (!GetStatus()) {
+                finishRequest();
+            }
+            return;
+        }
+        if (result == 0) {
+            processChanges(data, text);
+            // more changes or events while we asked
+            if (data->ports.next || m_eventGeneration > m_generation) {
+                emit updateStatusLog(buffer);
+                if (!(m_catchUp = GetChanges(m_generation))) {
+                    finishRequest();
+                }
+                return;
+            }
+        }
+    }
+
+    // GetStatus and the port / link commands respond the first page of
+    // the topology, GetPortList and GetLinkList the page at the cursor.
+    const bool topology = (data->command == vspControlGetStatus || //
+                           (data->command >= vspControlCreatePort && data->command <= vspControlUnlinkPorts));
+
+    // also changes not submitted through the UI
+    if (topology && data->command != vspControlGetStatus) {
+        m_cacheValid = false;
+    }
+
+    // Our own change of a known topology, fetch the delta instead of
+    // reloading all pages.
+    if (topology && result == 0 && m_synced && data->command != vspControlGetStatus) {
+        emit updateStatusLog(buffer);
+        if (!GetChanges(m_generation)) {
+            finishRequest();
+        }
+        return;
+    }
+
+    const bool portPage = (result == 0 && (topology || data->command == vspControlGetPortList));
+    const bool linkPage = (result == 0 && (topology || data->command == vspControlGetLinkList));
+    if (result != 0) {
+        m_fetchLinks = false;
+        // a failed read leaves the models incomplete
+        switch (data->command) {
+            case vspControlGetStatus:
+            case vspControlGetPortList:
+            case vspControlGetLinkList:
+            case vspControlGetChanges: {
+                m_synced = false;
+                break;
+            }
+        }
+    }
+    else if (topology) {
+        m_generation = data->generation;
+        m_synced = true;
+    }
+
+    text << "Port total.....: " << data->ports.total << " next " << data->ports.next << Qt::endl;
+    text << "Link total.....: " << data->links.total << " next " << data->links.next << Qt::endl;
+
+    if (portPage) {
+        QList<VSPDataModel::TPortItem> ports;
+        if (topology || data->parameter.cursor == 0) {
+            m_portList.resetModel();
+        }
         for (uint i = 0; i < data->ports.count; i++) {
             TVSPPortListItem pli = data->ports.list[i];
             QString name = strlen(pli.name) == 0 //
                               ? tr("Port %1").arg(pli.id)
                               : tr("%1").arg(pli.name);
             text << "Port item......: " << pli.id << " " << name << Qt::endl;
-            m_portList.append(VSPDataModel::TPortItem({pli.id, name}));
-            continue;
+            ports.append(VSPDataModel::TPortItem({pli.id, name}));
         }
+        m_portList.append(ports);
     }
-    else if (data->command == vspControlRemovePort) {
-        if (m_portList.rowCount() > 0) {
-            m_portList.resetModel();
+
+    // Links refer to the port names, so load them after the last port
+    // page. A first link page of a topology response is fetched again.
+    if (portPage && data->ports.next) {
+        m_fetchLinks = m_fetchLinks || topology;
+        emit updateStatusLog(buffer);
+        if (!GetPortList(data->ports.next)) {
+            finishRequest();
         }
+        return;
     }
 
-    if (data->links.count) {
-        m_linkList.resetModel();
+    if (linkPage) {
+        QList<VSPDataModel::TPortLink> links;
+        if (topology || data->parameter.cursor == 0) {
+            m_linkList.resetModel();
+        }
         for (uint i = 0; i < data->links.count; i++) {
-            const uint8_t _lid = (data->links.list[i] >> 16) & 0x000000ff;
-            const uint8_t _src = (data->links.list[i] >> 8) & 0x000000ff;
-            const uint8_t _tgt = (data->links.list[i]) & 0x000000ff;
-            VSPDataModel::TPortItem p1 = {};
-            VSPDataModel::TPortItem p2 = {};
-            QString name = tr("[Port A: %1 <-> Port B: %2]").arg(_src).arg(_tgt);
-            text << "Link item......: " << _lid << " " << name << Qt::endl;
-            for (int i = 0; i < m_portList.rowCount(); i++) {
-                VSPDataModel::TDataRecord r = m_portList.at(i).value<VSPDataModel::TDataRecord>();
-                if (r.port.id == _src) {
-                    p1 = r.port;
-                }
-                if (r.port.id == _tgt) {
-                    p2 = r.port;
-                }
-                if (p1.id && p2.id) {
-                    break;
-                }
-            }
-            m_linkList.append(VSPDataModel::TPortLink(
-               {_lid, //
-                tr("Port Link %1 %2").arg(_lid).arg(name),
-                p1,
-                p2}));
-            continue;
+            const quint16 _lid = VSP_LINK_ID(data->links.list[i]);
+            const quint16 _src = VSP_LINK_SOURCE(data->links.list[i]);
+            const quint16 _tgt = VSP_LINK_TARGET(data->links.list[i]);
+            text << "Link item......: " << _lid << " " << _src << " <-> " << _tgt << Qt::endl;
+            links.append(portLink(_lid, _src, _tgt));
         }
+        m_linkList.append(links);
     }
-    else if (data->command == vspControlUnlinkPorts) {
-        if (m_linkList.rowCount() > 0) {
-            m_linkList.resetModel();
+
+    if ((linkPage && data->links.next) || m_fetchLinks) {
+        const quint16 cursor = (m_fetchLinks ? 0 : data->links.next);
+        m_fetchLinks = false;
+        emit updateStatusLog(buffer);
+        if (!GetLinkList(cursor)) {
+            finishRequest();
         }
+        return;
     }
 
+    // last page of a complete topology, reads are answered by the
+    // models from now on
+    if (result == 0 && m_synced && m_eventGeneration <= m_generation) {
+        m_cacheValid = true;
+        m_cacheTime.start();
+    }
+    printCacheStats(text);
+
     // Overlay-Größe anpassen
     QTimer* t = new QTimer(this);
-    connect(t, &QTimer::timeout, this, [this, txStatus, buffer, data, result]() {
+    const TVSPControlCommand command = static_cast<TVSPControlCommand>(data->command);
+    connect(t, &QTimer::timeout, this, [this, txStatus, buffer, command, result]() {
+        m_reading = vspLastCommand;
         emit updateStatusLog(buffer);
         emit updateButtons(true);
         if (result != 0) {
             emit errorOccured(result, txStatus);
         }
         else {
-            emit commandResult(                                //
-               static_cast<TVSPControlCommand>(data->command), //
+            emit commandResult( //
+               command,
                &m_portList,
                &m_linkList);
         }
@@ -164,7 +448,71 @@ void VSPDriverClient::OnIOUCCallback(int result, void* args, uint32_t size)
     t->start(150);
 }
 
+void VSPDriverClient::processChanges(const TVSPControllerData* data, QTextStream& text)
+{
+    TVSPChangeItem changes[MAX_CHANGE_ITEMS];
+    const uint8_t count = GetChangeItems(data, changes);
+
+    // apply in order of occurrence, a link is removed before its port
+    for (uint i = 0; i < count; i++) {
+        const TVSPChangeItem& c = changes[i];
+        text << "Change item....: " << (uint) c.kind << " " << c.id << " " //
+             << c.source << " " << c.target << Qt::endl;
+        switch (c.kind) {
+            case vspChangePortAdded: {
+                QString name = strnlen(c.name, MAX_PORT_NAME) == 0 //
+                                  ? tr("Port %1").arg(c.id)
+                                  : QString::fromLatin1(c.name, strnlen(c.name, MAX_PORT_NAME));
+                m_portList.append(VSPDataModel::TPortItem({c.id, name}));
+                break;
+            }
+            case vspChangePortRemoved: {
+                m_portList.remove(c.id);
+                break;
+            }
+            case vspChangeLinkAdded: {
+                m_linkList.append(portLink(c.id, c.source, c.target));
+                break;
+            }
+            case vspChangeLinkRemoved: {
+                m_linkList.remove(c.id);
+                break;
+            }
+        }
+    }
+
+    m_generation = data->generation;
+}
+
+VSPDataModel::TPortLink VSPDriverClient::portLink(quint16 id, quint16 source, quint16 target) const
+{
+    VSPDataModel::TPortItem p1 = m_portList.byId(source).value<VSPDataModel::TDataRecord>().port;
+    VSPDataModel::TPortItem p2 = m_portList.byId(target).value<VSPDataModel::TDataRecord>().port;
+    QString name = tr("[Port A: %1 <-> Port B: %2]").arg(source).arg(target);
+
+    // port list not loaded yet
+    if (!p1.id) {
+        p1 = {source, tr("Port %1").arg(source)};
+    }
+    if (!p2.id) {
+        p2 = {target, tr("Port %1").arg(target)};
+    }
+
+    return VSPDataModel::TPortLink(
+       {id, //
+        tr("Port Link %1 %2").arg(id).arg(name),
+        p1,
+        p2});
+}
+
 void VSPDriverClient::OnErrorOccured(int error, const char* message)
 {
     emit errorOccured(error, message);
+
+    // no completion follows, end the request chain so the window
+    // takes down its overlay
+    if (error == kIOErrorTimeout) {
+        m_cacheValid = false;
+        finishRequest();
+    }
 }
@@ -6,12 +6,18 @@
 // SPDX-License-Identifier: MIT
 // ********************************************************************
 #pragma once
+#include <QElapsedTimer>
 #include <QObject>
+#include <QTextStream>
 #include <vspcontroller.hpp>
 #include <vspdatamodel.h>
 #include <vspdriversetup.hpp>
 
 #define kIOErrorNotFound -536870160
+#define kIOErrorOverrun  -536870168
+
+// models answer topology reads without the driver for this long
+#define TOPOLOGY_CACHE_MSECS 2000
 
 using namespace VSPClient;
 
@@ -34,6 +40,25 @@ public:
         return &m_linkList;
     }
 
+    // Bring the models up to date, either by the changes since the
+    // last known topology generation or by a full GetStatus.
+    bool updateTopology();
+
+    // GetStatus, GetPortList or GetLinkList answered by the models
+    // while they are fresh. A read while the same one is in flight
+    // is answered by that one.
+    bool readTopology(TVSPControlCommand command);
+
+    // The next read goes to the driver, called before a topology
+    // change is submitted.
+    void invalidateTopology();
+
+    // Freshness deadline of the models, 0 = no cache
+    inline void setCacheFreshness(int msecs)
+    {
+        m_cacheMsecs = msecs;
+    }
+
     // Interface VSPSetup.framework
     void OnDidFailWithError(uint32_t /*code*/, const char* /*message*/) override;
     void OnDidFinishWithResult(uint32_t /*code*/, const char* /*message*/) override;
@@ -53,6 +78,8 @@ signals:
     void complete();
     // --
     void commandResult(TVSPControlCommand command, VSPPortListModel* portModel, VSPLinkListModel* linkModel);
+    // driver event of the subscription
+    void modemSignal(quint16 port, quint32 modemLines);
 
 protected:
     // Interface VSPController.framework
@@ -61,10 +88,38 @@ protected:
     void OnIOUCCallback(int result, void* args, uint32_t numArgs) override;
     void OnErrorOccured(int error, const char* message) override;
     void OnDataReady(void* data) override;
+    void OnEvent(const TVSPEvent* event) override;
+    void OnCompletionsPending() override;
 
 private:
     VSPPortListModel m_portList;
     VSPLinkListModel m_linkList;
+    // load all link pages after the last port page
+    bool m_fetchLinks;
+    // models match the driver topology of m_generation
+    bool m_synced;
+    quint32 m_generation;
+    // latest generation announced by a driver event
+    quint32 m_eventGeneration;
+    // GetChanges of a driver event in flight
+    bool m_catchUp;
+    // models answer reads until invalidated or m_cacheMsecs passed
+    bool m_cacheValid;
+    int m_cacheMsecs;
+    QElapsedTimer m_cacheTime;
+    // read in flight, vspLastCommand = none
+    TVSPControlCommand m_reading;
+    quint64 m_cacheHits;
+    quint64 m_cacheMisses;
+    quint64 m_cacheJoins;
+
+private:
+    inline void processResult(int result, const TVSPControllerData* data, uint32_t size);
+    inline void processChanges(const TVSPControllerData* data, QTextStream& text);
+    inline void processEvent(const TVSPEvent& event);
+    inline void finishRequest();
+    inline void printCacheStats(QTextStream& text) const;
+    inline VSPDataModel::TPortLink portLink(quint16 id, quint16 source, quint16 target) const;
 };
 Q_DECLARE_METATYPE(TVSPControllerData)
 Q_DECLARE_METATYPE(TVSPPortParameters)
@@ -147,39 +147,87 @@ void VSPDataModel::resetModel()
 {
     beginResetModel();
     m_records.clear();
+    m_rows.clear();
     endResetModel();
 }
 
 void VSPDataModel::append(const TPortItem& port)
+{
+    append(QList<TPortItem>({port}));
+}
+
+void VSPDataModel::append(const TPortLink& link)
+{
+    append(QList<TPortLink>({link}));
+}
+
+void VSPDataModel::append(const QList<TPortItem>& ports)
 {
     if (dataType() != TDataType::PortItem)
         return;
 
-    foreach (auto r, m_records) {
-        if (r.port.id == port.id) {
-            qWarning() << "Serial port" << port.id << "already assigned, skip.";
-            return;
-        }
+    QList<TDataRecord> records;
+    foreach (auto port, ports) {
+        records.append({TDataType::PortItem, port, {}});
     }
-    beginResetModel();
-    m_records.append({TDataType::PortItem, port, {}});
-    endResetModel();
+    appendRecords(records);
 }
 
-void VSPDataModel::append(const TPortLink& link)
+void VSPDataModel::append(const QList<TPortLink>& links)
 {
     if (dataType() != TDataType::PortLink)
         return;
 
-    foreach (auto r, m_records) {
-        if (r.link.id == link.id) {
-            qWarning() << "Port link" << link.id << "already assigned, skip.";
-            return;
+    QList<TDataRecord> records;
+    foreach (auto link, links) {
+        records.append({TDataType::PortLink, {}, link});
+    }
+    appendRecords(records);
+}
+
+inline quint16 VSPDataModel::recordId(const TDataRecord& r) const
+{
+    return (r.type == TDataType::PortItem ? r.port.id : r.link.id);
+}
+
+inline void VSPDataModel::appendRecords(const QList<TDataRecord>& records)
+{
+    QList<TDataRecord> added;
+
+    foreach (auto r, records) {
+        const quint16 id = recordId(r);
+        if (m_rows.contains(id)) {
+            qWarning() << "Record" << id << "already assigned, skip.";
+            continue;
         }
+        m_rows.insert(id, m_records.size() + added.size());
+        added.append(r);
     }
-    beginResetModel();
-    m_records.append({TDataType::PortLink, {}, link});
-    endResetModel();
+
+    if (added.isEmpty()) {
+        return;
+    }
+
+    beginInsertRows(QModelIndex(), m_records.size(), m_records.size() + added.size() - 1);
+    m_records.append(added);
+    endInsertRows();
+}
+
+void VSPDataModel::remove(quint16 id)
+{
+    const int row = m_rows.value(id, -1);
+    if (row < 0) {
+        return;
+    }
+
+    beginRemoveRows(QModelIndex(), row, row);
+    m_records.removeAt(row);
+    m_rows.remove(id);
+    // rows below moved up
+    for (int i = row; i < m_records.size(); i++) {
+        m_rows.insert(recordId(m_records.at(i)), i);
+    }
+    endRemoveRows();
 }
 
 QVariant VSPDataModel::at(int index) const
@@ -189,3 +237,8 @@ QVariant VSPDataModel::at(int index) const
     }
     return QVariant::fromValue(m_records.at(index));
 }
+
+QVariant VSPDataModel::byId(quint16 id) const
+{
+    return at(m_rows.value(id, -1));
+}
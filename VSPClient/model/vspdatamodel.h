@@ -1,6 +1,7 @@
 #pragma once
 
 #include <QAbstractItemModel>
+#include <QHash>
 
 class VSPDataModel: public QAbstractTableModel
 {
@@ -14,12 +15,12 @@ public:
     Q_ENUM(TDataType)
 
     typedef struct {
-        quint8 id;
+        quint16 id;
         QString name;
     } TPortItem;
 
     typedef struct {
-        quint8 id;
+        quint16 id;
         QString name;
         TPortItem source;
         TPortItem target;
@@ -51,13 +52,26 @@ public:
     virtual void resetModel();
     virtual void append(const TPortItem& port);
     virtual void append(const TPortLink& link);
+    // Append one page of a driver list with a single row insertion
+    virtual void append(const QList<TPortItem>& ports);
+    virtual void append(const QList<TPortLink>& links);
+    // Remove the record of the given port or link id
+    virtual void remove(quint16 id);
     QVariant at(int index) const;
+    // Record of the given port or link id
+    QVariant byId(quint16 id) const;
 
 protected:
     virtual TDataType dataType() const = 0;
 
 private:
     QList<TDataRecord> m_records;
+    // port or link id -> row
+    QHash<quint16, int> m_rows;
+
+private:
+    inline quint16 recordId(const TDataRecord& r) const;
+    inline void appendRecords(const QList<TDataRecord>& records);
 };
 Q_DECLARE_METATYPE(VSPDataModel::TPortItem)
 Q_DECLARE_METATYPE(VSPDataModel::TPortLink)
@@ -6,6 +6,7 @@
 // SPDX-License-Identifier: MIT
 // ********************************************************************
 #include "ui_pglkcreate.h"
+#include <QSet>
 #include <pglkcreate.h>
 #include <vspabstractpage.h>
 
@@ -41,7 +42,7 @@ void PGLKCreate::update(TVSPControlCommand command, VSPPortListModel* portModel,
 
     Q_UNUSED(command);
 
-    QList<quint8> linkedPorts;
+    QSet<quint16> linkedPorts;
 
     ui->cbPort1->clear();
     ui->cbPort2->clear();
@@ -49,12 +50,8 @@ void PGLKCreate::update(TVSPControlCommand command, VSPPortListModel* portModel,
     // load port IDs already linked
     for (int i = 0; i < linkModel->rowCount(); i++) {
         VSPDataModel::TDataRecord r = linkModel->at(i).value<VSPDataModel::TDataRecord>();
-        if (!linkedPorts.contains(r.link.source.id)) {
-            linkedPorts.append(r.link.source.id);
-        }
-        if (!linkedPorts.contains(r.link.target.id)) {
-            linkedPorts.append(r.link.target.id);
-        }
+        linkedPorts.insert(r.link.source.id);
+        linkedPorts.insert(r.link.target.id);
     }
 
     // load port IDs into comboboxes and skip already linked ports
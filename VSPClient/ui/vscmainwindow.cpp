@@ -40,6 +40,7 @@ VSCMainWindow::VSCMainWindow(QWidget* parent)
     connect(m_vsp, &VSPDriverClient::updateButtons, this, &VSCMainWindow::onUpdateButtons);
     connect(m_vsp, &VSPDriverClient::commandResult, this, &VSCMainWindow::onCommandResult);
     connect(m_vsp, &VSPDriverClient::complete, this, &VSCMainWindow::onComplete);
+    connect(m_vsp, &VSPDriverClient::modemSignal, this, &VSCMainWindow::onModemSignal);
 
     QSplitter* splitter = new QSplitter(Qt::Vertical, ui->pnlContent);
     ui->pnlContent->layout()->addWidget(splitter);
@@ -210,6 +211,11 @@ inline void VSCMainWindow::showOverlay()
 
     qDebug("CTRLWIN::showOverlay():\n");
 
+    // a read joined to the one in flight shares its overlay
+    if (property("overlay").value<QWidget*>()) {
+        return;
+    }
+
     // Overlay-Widget erstellen
     overlay = new QWidget(centralWidget());
 
@@ -434,6 +440,18 @@ void VSCMainWindow::onComplete()
     removeOverlay();
 }
 
+void VSCMainWindow::onModemSignal(quint16 port, quint32 modemLines)
+{
+    qDebug("CTRLWIN::onModemSignal(): port=%u lines=0x%02x\n", port, modemLines);
+
+    ui->textBrowser->append(
+       tr("Port %1 modem signals: CTS=%2 DSR=%3 DCD=%4")
+          .arg(port)
+          .arg((modemLines & VSP_SIGNAL_CTS) ? 1 : 0)
+          .arg((modemLines & VSP_SIGNAL_DSR) ? 1 : 0)
+          .arg((modemLines & VSP_SIGNAL_DCD) ? 1 : 0));
+}
+
 void VSCMainWindow::onSelectPage()
 {
     QPushButton* button;
@@ -455,6 +473,12 @@ void VSCMainWindow::onSelectPage()
     // show selected page
     ui->stackedWidget->setCurrentWidget(page);
 
+    // models follow the driver events, no round trip needed
+    if (m_vsp->IsSubscribed()) {
+        onCommandResult(vspControlGetStatus, m_vsp->portList(), m_vsp->linkList());
+        return;
+    }
+
     // force data model update
     onActionExecute(vspControlGetStatus, {});
 }
@@ -471,9 +495,16 @@ void VSCMainWindow::onActionExecute(const TVSPControlCommand command, const QVar
 
     showOverlay();
 
+    // a topology change outdates the models answering the reads below
+    if (command >= vspControlCreatePort && command <= vspControlUnlinkPorts) {
+        m_vsp->invalidateTopology();
+    }
+
     switch (command) {
-        case vspControlGetStatus: {
-            if (!m_vsp->GetStatus()) {
+        case vspControlGetStatus:
+        case vspControlGetPortList:
+        case vspControlGetLinkList: {
+            if (!m_vsp->readTopology(command)) {
                 goto error_exit;
             }
             break;
@@ -513,18 +544,6 @@ void VSCMainWindow::onActionExecute(const TVSPControlCommand command, const QVar
             }
             break;
         }
-        case vspControlGetPortList: {
-            if (!m_vsp->GetPortList()) {
-                goto error_exit;
-            }
-            break;
-        }
-        case vspControlGetLinkList: {
-            if (!m_vsp->GetLinkList()) {
-                goto error_exit;
-            }
-            break;
-        }
         case vspControlEnableChecks: {
             VSPDataModel::TDataRecord r = data.value<VSPDataModel::TDataRecord>();
             if (!m_vsp->EnableChecks(r.port.id)) {
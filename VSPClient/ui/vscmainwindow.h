@@ -44,6 +44,7 @@ private slots:
     void onUpdateButtons(bool enabled = false);
     void onCommandResult(VSPClient::TVSPControlCommand command, VSPPortListModel* portModel, VSPLinkListModel* linkModel);
     void onComplete();
+    void onModemSignal(quint16 port, quint32 modemLines);
 
     void onSetupFailWithError(uint32_t code, const char* message);
     void onSetupFinishWithResult(uint32_t code, const char* message);
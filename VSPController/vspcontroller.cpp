@@ -5,20 +5,31 @@
 // Copyright © 2024 Apple Inc. (some copied parts)
 // SPDX-License-Identifier: MIT
 // ********************************************************************
-#include <CoreFoundation/CoreFoundation.h>
-#include <IOKit/IOKitLib.h>
-#include <IOKit/IOTypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
 #include <vspcontroller.hpp>
 #include <vspcontrollerpriv.hpp>
+#include <vsptrace.hpp>
+#include <vsptransport.hpp>
 
 #define BIT(x) (1 << x)
 
-#ifndef VSP_DEBUG
-#define VSP_DEBUG
-#endif
-
 namespace VSPClient {
 
+// Call() binding of the command method running on this thread
+static thread_local std::shared_ptr<TVSPCall>* t_boundCall = nullptr;
+
+// Route() target of the command method running on this thread
+static thread_local uint8_t t_route = MAX_INSTANCES;
+
+static inline uint64_t MonotonicUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>( //
+              std::chrono::steady_clock::now().time_since_epoch())
+       .count();
+}
+
 VSPController::VSPController()
 {
     p = new VSPControllerPriv(this);
@@ -29,6 +40,30 @@ VSPController::~VSPController()
     delete p;
 }
 
+// -------------------------------------------------------------------
+//
+//
+bool VSPController::SetControlThread(const bool enable)
+{
+    return p->SetControlThread(enable);
+}
+
+// -------------------------------------------------------------------
+//
+//
+uint32_t VSPController::DispatchCompletions()
+{
+    return p->DispatchCompletions();
+}
+
+// -------------------------------------------------------------------
+//
+//
+bool VSPController::SetDaemonSocket(const char* path)
+{
+    return p->SetDaemonSocket(path);
+}
+
 // -------------------------------------------------------------------
 //
 //
@@ -37,6 +72,14 @@ bool VSPController::ConnectDriver()
     return p->ConnectDriver();
 }
 
+// -------------------------------------------------------------------
+//
+//
+void VSPController::DisconnectDriver()
+{
+    p->DisconnectDriver();
+}
+
 // -------------------------------------------------------------------
 //
 //
@@ -64,7 +107,7 @@ bool VSPController::CreatePort(TVSPPortParameters* parameters)
 // -------------------------------------------------------------------
 //
 //
-bool VSPController::RemovePort(const uint8_t id)
+bool VSPController::RemovePort(const uint16_t id)
 {
     return p->RemovePort(id);
 }
@@ -72,23 +115,23 @@ bool VSPController::RemovePort(const uint8_t id)
 // -------------------------------------------------------------------
 //
 //
-bool VSPController::GetPortList()
+bool VSPController::GetPortList(const uint16_t cursor)
 {
-    return p->GetPortList();
+    return p->GetPortList(cursor);
 }
 
 // -------------------------------------------------------------------
 //
 //
-bool VSPController::GetLinkList()
+bool VSPController::GetLinkList(const uint16_t cursor)
 {
-    return p->GetLinkList();
+    return p->GetLinkList(cursor);
 }
 
 // -------------------------------------------------------------------
 //
 //
-bool VSPController::LinkPorts(const uint8_t source, const uint8_t target)
+bool VSPController::LinkPorts(const uint16_t source, const uint16_t target)
 {
     return p->LinkPorts(source, target);
 }
@@ -96,7 +139,7 @@ bool VSPController::LinkPorts(const uint8_t source, const uint8_t target)
 // -------------------------------------------------------------------
 //
 //
-bool VSPController::UnlinkPorts(const uint8_t source, const uint8_t target)
+bool VSPController::UnlinkPorts(const uint16_t source, const uint16_t target)
 {
     return p->UnlinkPorts(source, target);
 }
@@ -104,7 +147,7 @@ bool VSPController::UnlinkPorts(const uint8_t source, const uint8_t target)
 // -------------------------------------------------------------------
 //
 //
-bool VSPController::EnableChecks(const uint8_t port)
+bool VSPController::EnableChecks(const uint16_t port)
 {
     return p->EnableChecks(port);
 }
@@ -112,7 +155,7 @@ bool VSPController::EnableChecks(const uint8_t port)
 // -------------------------------------------------------------------
 //
 //
-bool VSPController::EnableTrace(const uint8_t port)
+bool VSPController::EnableTrace(const uint16_t port)
 {
     return p->EnableTrace(port);
 }
@@ -120,589 +163,2872 @@ bool VSPController::EnableTrace(const uint8_t port)
 // -------------------------------------------------------------------
 //
 //
-int VSPController::GetConnection()
+bool VSPController::ExecuteBatch(const TVSPBatchOperation* operations, const uint8_t count)
 {
-    return p->m_connection;
+    return p->ExecuteBatch(operations, count);
 }
 
 // -------------------------------------------------------------------
 //
 //
-const TVSPSystemError VSPController::GetSystemError(int error) const
+uint8_t VSPController::GetBatchResults(const TVSPControllerData* response, TVSPBatchOperation* operations)
 {
-    return {
-       .system = err_get_system(error),
-       .sub = err_get_sub(error),
-       .code = err_get_code(error),
-    };
+    if (!response || !operations || response->command != vspControlBatch || response->ports.count > MAX_BATCH_OPS) {
+        return 0;
+    }
+    // ports.list is byte aligned
+    memcpy(operations, response->ports.list, response->ports.count * sizeof(TVSPBatchOperation));
+    return response->ports.count;
 }
 
 // -------------------------------------------------------------------
 //
 //
-const char* VSPController::DeviceName() const
+bool VSPController::GetChanges(const uint32_t generation)
 {
-    return p->DeviceName();
+    return p->GetChanges(generation);
 }
 
 // -------------------------------------------------------------------
 //
 //
-const char* VSPController::DevicePath() const
+bool VSPController::Subscribe(const uint32_t mask)
 {
-    return p->DevicePath();
+    return p->Subscribe(mask);
 }
 
 // -------------------------------------------------------------------
-// MARK: Private Section
-// -------------------------------------------------------------------
-
-#ifdef VSP_DEBUG
-static inline void PrintArray(const char* ctx, const int64_t* ptr, const uint32_t length)
+//
+//
+bool VSPController::Unsubscribe()
 {
-    if (ptr && length) {
-        printf("[%s] --------------------------\n{\n", ctx);
-        for (uint32_t idx = 0; idx < length; ++idx) {
-            printf("\tptr[%02u] = %llu\n", idx, ptr[idx]);
-        }
-        printf("}\n");
-    }
+    return p->Subscribe(0);
 }
 
-static inline void PrintStruct(const char* ctx, const TVSPControllerData* ptr)
+// -------------------------------------------------------------------
+//
+//
+bool VSPController::IsSubscribed() const
 {
-    if (ptr) {
-        printf("[%s] --------------------------\n{\n", ctx);
-        printf("\t.context = %u,\n", ptr->context);
-        printf("\t.command = %u,\n", ptr->command);
-        printf("\t.parameter.flags = 0x%llx,\n", ptr->parameter.flags);
-        printf("\t.ppl.sourceId = %u,\n", ptr->parameter.link.source);
-        printf("\t.ppl.targetId = %u,\n", ptr->parameter.link.target);
-        printf("\t.status.code = %u,\n", ptr->status.code);
-        printf("\t.status.flags = 0x%llx,\n", ptr->status.flags);
-        printf("}\n");
-    }
+    return p->IsSubscribed();
 }
-#endif
 
 // -------------------------------------------------------------------
+// Subclasses not interested in driver events keep this one
 //
-//
-static inline void PrintErrorDetails(kern_return_t ret, const char* message)
+void VSPController::OnEvent(const TVSPEvent* event)
 {
-    fprintf(stderr, "[VSP Driver Error] ---------------------------------\n");
-    fprintf(stderr, "\t%s\n", message);
-    fprintf(stderr, "\tSystem...: 0x%02x\n", err_get_system(ret));
-    fprintf(stderr, "\tSubsystem: 0x%03x\n", err_get_sub(ret));
-    fprintf(stderr, "\tCode.....: 0x%04x\n", err_get_code(ret));
+    (void) event;
 }
 
-VSPControllerPriv::VSPControllerPriv(VSPController* parent)
-    : m_machNotificationPort(0L)
-    , m_runLoop(NULL)
-    , m_runLoopSource(NULL)
-    , m_deviceAddedIter(IO_OBJECT_NULL)
-    , m_deviceRemovedIter(IO_OBJECT_NULL)
-    , m_notificationPort(NULL)
-    , m_connection(0L)
-    , m_controller(parent)
-    , m_vspResponse(NULL)
+// -------------------------------------------------------------------
+// Subclasses polling DispatchCompletions() keep this one
+//
+void VSPController::OnCompletionsPending()
 {
 }
 
-VSPControllerPriv::~VSPControllerPriv()
+// -------------------------------------------------------------------
+//
+//
+uint8_t VSPController::GetChangeItems(const TVSPControllerData* response, TVSPChangeItem* changes)
 {
-    UserClientTeardown();
+    if (!response || !changes || response->command != vspControlGetChanges || response->ports.count > MAX_CHANGE_ITEMS) {
+        return 0;
+    }
+    // ports.list is byte aligned
+    memcpy(changes, response->ports.list, response->ports.count * sizeof(TVSPChangeItem));
+    return response->ports.count;
 }
 
 // -------------------------------------------------------------------
 //
 //
-bool VSPControllerPriv::ConnectDriver()
+const TVSPMappingStats VSPController::GetMappingStats() const
 {
-    UserClientSetup(this);
-    return IsConnected();
+    return p->GetMappingStats();
 }
 
 // -------------------------------------------------------------------
 //
 //
-bool VSPControllerPriv::IsConnected()
+const TVSPWireStats VSPController::GetWireStats() const
 {
-    return (m_connection != 0L);
+    return p->GetWireStats();
 }
 
 // -------------------------------------------------------------------
 //
 //
-bool VSPControllerPriv::GetStatus()
+uint32_t VSPController::LastRequestId() const
 {
-    TVSPControllerData input = {};
-    input.context = vspContextPort;
-    input.command = vspControlGetStatus;
-
-    return DoAsyncCall(&input);
+    return p->LastRequestId();
 }
 
 // -------------------------------------------------------------------
 //
 //
-bool VSPControllerPriv::CreatePort(TVSPPortParameters* parameters)
+const TVSPStatistics VSPController::GetStatistics() const
 {
-    if (!parameters)
-        return false;
-
-    TVSPControllerData input = {};
-    input.context = vspContextPort;
-    input.command = vspControlCreatePort;
-    input.parameter.link.source = 1;
-    input.parameter.link.target = 1;
+    return p->GetStatistics();
+}
 
-    if (sizeof(TVSPPortParameters) <= MAX_SERIAL_PORTS) {
-        input.ports.count = sizeof(TVSPPortParameters);
-        input.parameter.flags = 0xff01;
-        memcpy(input.ports.list, parameters, input.ports.count);
+// -------------------------------------------------------------------
+// HDR style bucket: the power of two of the value selects a group
+// of 4 buckets, the next 2 bits below the leading one the bucket.
+//
+uint32_t VSPController::LatencyBucket(const uint64_t us)
+{
+    if (us < 4) {
+        return (uint32_t) us;
     }
 
-    return DoAsyncCall(&input);
+    const uint32_t msb = 63 - __builtin_clzll(us);
+    const uint32_t bucket = 4 * (msb - 1) + ((us >> (msb - 2)) & 3);
+    return (bucket < VSP_LATENCY_BUCKETS ? bucket : VSP_LATENCY_BUCKETS - 1);
 }
 
 // -------------------------------------------------------------------
 //
 //
-bool VSPControllerPriv::RemovePort(const uint8_t id)
+uint64_t VSPController::LatencyBucketLow(const uint32_t bucket)
 {
-    TVSPControllerData input = {};
-    input.context = vspContextPort;
-    input.command = vspControlRemovePort;
-    input.parameter.link.source = id;
-    input.parameter.link.target = id;
-
-    return DoAsyncCall(&input);
+    if (bucket < 4) {
+        return bucket;
+    }
+    return (uint64_t) (4 + (bucket & 3)) << (bucket / 4 - 1);
 }
 
 // -------------------------------------------------------------------
+// Upper bound of the bucket reaching the percentile, limited by the
+// largest latency seen.
 //
-//
-bool VSPControllerPriv::GetPortList()
+uint64_t VSPController::LatencyPercentile(const TVSPCommandStats* stats, const double percent)
 {
-    TVSPControllerData input = {};
-    input.context = vspContextPort;
-    input.command = vspControlGetPortList;
+    if (!stats || !stats->completed) {
+        return 0;
+    }
 
-    return DoAsyncCall(&input);
+    const double limit = stats->completed * (percent / 100.0);
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < VSP_LATENCY_BUCKETS; i++) {
+        count += stats->buckets[i];
+        if (count >= limit && count > 0) {
+            if (i + 1 >= VSP_LATENCY_BUCKETS) {
+                return stats->maxUs;
+            }
+            const uint64_t high = LatencyBucketLow(i + 1) - 1;
+            return (high < stats->maxUs ? high : stats->maxUs);
+        }
+    }
+    return stats->maxUs;
 }
 
 // -------------------------------------------------------------------
 //
 //
-bool VSPControllerPriv::GetLinkList()
+void VSPController::SetTraceLevel(const TVSPTraceLevel level)
 {
-    TVSPControllerData input = {};
-    input.context = vspContextPort;
-    input.command = vspControlGetLinkList;
-
-    return DoAsyncCall(&input);
+    p->SetTraceLevel(level);
 }
 
 // -------------------------------------------------------------------
 //
 //
-bool VSPControllerPriv::LinkPorts(const uint8_t source, const uint8_t target)
+TVSPTraceLevel VSPController::TraceLevel() const
 {
-    TVSPControllerData input = {};
-    input.context = vspContextPort;
-    input.command = vspControlLinkPorts;
-    input.parameter.link.source = source;
-    input.parameter.link.target = target;
-
-    return DoAsyncCall(&input);
+    return p->TraceLevel();
 }
 
 // -------------------------------------------------------------------
 //
 //
-bool VSPControllerPriv::UnlinkPorts(const uint8_t source, const uint8_t target)
+uint32_t VSPController::ReadTrace(TVSPTraceRecord* records, const uint32_t count, uint64_t* cursor) const
 {
-    TVSPControllerData input = {};
-    input.context = vspContextPort;
-    input.command = vspControlUnlinkPorts;
-    input.parameter.link.source = source;
-    input.parameter.link.target = target;
-
-    return DoAsyncCall(&input);
+    return p->ReadTrace(records, count, cursor);
 }
 
 // -------------------------------------------------------------------
 //
 //
-bool VSPControllerPriv::EnableChecks(const uint8_t port)
+bool VSPController::SaveTrace(const char* path) const
 {
-    TVSPControllerData input = {};
-    input.context = vspContextPort;
-    input.command = vspControlEnableChecks;
-    input.parameter.link.source = port;
-    input.parameter.link.target = port;
-
-    return DoAsyncCall(&input);
+    return p->SaveTrace(path);
 }
 
 // -------------------------------------------------------------------
 //
 //
-bool VSPControllerPriv::EnableTrace(const uint8_t port)
+uint32_t VSPController::PendingRequests() const
 {
-    TVSPControllerData input = {};
-    input.context = vspContextPort;
-    input.command = vspControlEnableTrace;
-    input.parameter.link.source = port;
-    input.parameter.link.target = port;
-
-    return DoAsyncCall(&input);
+    return p->PendingRequests();
 }
 
 // -------------------------------------------------------------------
 //
 //
-const char* VSPControllerPriv::DeviceName() const
+bool VSPController::Call(const TVSPCommandCall& call, const uint32_t timeout, const TVSPCompletion& completion)
 {
-    return m_deviceName;
+    return p->Call(call, timeout, completion);
 }
 
 // -------------------------------------------------------------------
 //
 //
-const char* VSPControllerPriv::DevicePath() const
+void VSPController::SetRequestTimeout(const uint32_t timeout)
 {
-    return m_devicePath;
+    p->SetRequestTimeout(timeout);
 }
 
-// -------------------------------------------------------------------
-// MARK: Private Asynchronous Events
-// -------------------------------------------------------------------
-
 // -------------------------------------------------------------------
 //
 //
-static void DeviceAdded(void* refcon, io_iterator_t iterator)
+std::future<TVSPResult> VSPController::Async(const TVSPCommandCall& call, const uint32_t timeout)
 {
-    VSPControllerPriv* p = (VSPControllerPriv*) refcon;
-    kern_return_t ret = kIOReturnNotFound;
-    io_connect_t connection = IO_OBJECT_NULL;
-    io_service_t device = IO_OBJECT_NULL;
-    bool clientFound = false;
-    io_name_t deviceName = {};
-    io_name_t devicePath = {};
-
-    while ((device = IOIteratorNext(iterator)) != IO_OBJECT_NULL) {
-        // attemptedToMatchDevice = true;
-        if ((ret = IORegistryEntryGetName(device, deviceName)) != kIOReturnSuccess) {
-            p->ReportError(ret, "Get service registry name failed.");
-        }
-        if ((ret = IORegistryEntryGetPath(device, kIOServicePlane, devicePath)) != kIOReturnSuccess) {
-            p->ReportError(ret, "Get service registry path failed.");
-        }
-        if (strlen(deviceName) > 0 && strlen(devicePath) > 0) {
-            p->SetNameAndPath(deviceName, devicePath);
-        }
-
-        // Open a connection to this user client as a server
-        // to that client, and store the instance in "service"
-        if ((ret = IOServiceOpen(device, mach_task_self_, 0, &connection)) != kIOReturnSuccess) {
-            if (ret == kIOReturnNotPermitted) {
-                p->ReportError(ret, "Operation 'IOServiceOpen' not permitted.");
-            }
-            else {
-                p->ReportError(ret, "Open service failed.");
-            }
-            IOObjectRelease(device);
-            continue;
-        }
-
-        IOObjectRelease(device);
-
-        //-> SwiftDeviceAdded(refcon, connection);
-        p->SetConnection(connection);
-
-        clientFound = true;
-        ret = kIOReturnSuccess;
-    }
-
-    if (!clientFound) {
-        p->ReportError(kIOReturnNotFound, "Unable to find VSPDriver extensions.");
+    std::shared_ptr<std::promise<TVSPResult>> promise = std::make_shared<std::promise<TVSPResult>>();
+    std::future<TVSPResult> future = promise->get_future();
+
+    const bool submitted = p->Call(call, timeout, [promise](const TVSPResult& result) {
+        promise->set_value(result);
+    });
+    if (!submitted) {
+        TVSPResult result = {};
+        result.result = (IsConnected() ? kIOReturnError : kIOReturnNotOpen);
+        promise->set_value(result);
     }
+    return future;
 }
 
 // -------------------------------------------------------------------
 //
 //
-static void DeviceRemoved(void* refcon, io_iterator_t iterator)
+bool VSPController::Reconcile(const TVSPTopologySpec& spec, const uint32_t timeout, const TVSPReconcileCompletion& completion)
 {
-    VSPControllerPriv* p = (VSPControllerPriv*) refcon;
-    io_service_t device = IO_OBJECT_NULL;
-
-    while ((device = IOIteratorNext(iterator)) != IO_OBJECT_NULL) {
-        IOObjectRelease(device);
-        p->SetConnection(0L);
-    }
+    return p->Reconcile(spec, timeout, completion);
 }
 
 // -------------------------------------------------------------------
-// For more detail on this callback format, view the format of:
-// IOAsyncCallback, IOAsyncCallback0, IOAsyncCallback1, IOAsyncCallback2
-// Note that the variant of IOAsyncCallback called is based on the
-// number of arguments being returned
-// 0  - IOAsyncCallback0
-// 1  - IOAsyncCallback1
-// 2  - IOAsyncCallback2
-// 3+ - IOAsyncCallback
-// This is an example of the "IOAsyncCallback" format.
-// refcon will be the value you placed in asyncRef[kIOAsyncCalloutRefconIndex]
-static void AsyncCallback(void* refcon, IOReturn result, void** args, UInt32 numArgs)
+//
+//
+int VSPController::GetConnection()
 {
-    //-> App API callback SwiftAsyncCallback(refcon, result, args, numArgs);
-    VSPControllerPriv* p = (VSPControllerPriv*) refcon;
-    p->AsyncCallback(result, args, numArgs);
+    return p->m_connection.load();
 }
 
 // -------------------------------------------------------------------
-// MARK: Private API Implementation
-// -------------------------------------------------------------------
+//
+//
+const TVSPSystemError VSPController::GetSystemError(int error) const
+{
+    return {
+       .system = err_get_system(error),
+       .sub = err_get_sub(error),
+       .code = err_get_code(error),
+    };
+}
 
 // -------------------------------------------------------------------
 //
 //
-void VSPControllerPriv::ReportError(IOReturn error, const char* message)
+const char* VSPController::DeviceName() const
 {
-    PrintErrorDetails(error, message);
-    m_controller->OnErrorOccured(error, message);
+    return p->DeviceName();
 }
 
 // -------------------------------------------------------------------
 //
 //
-void VSPControllerPriv::SetNameAndPath(const char* name, const char* path)
+const char* VSPController::DevicePath() const
 {
-    strncpy(m_deviceName, name, sizeof(m_deviceName) - 1);
-    strncpy(m_devicePath, path, sizeof(m_devicePath) - 1);
+    return p->DevicePath();
 }
 
 // -------------------------------------------------------------------
 //
 //
-bool VSPControllerPriv::UserClientSetup(void* refcon)
+uint8_t VSPController::InstanceCount() const
 {
-    kern_return_t ret = kIOReturnSuccess;
-
-    m_runLoop = CFRunLoopGetCurrent();
-    if (m_runLoop == NULL) {
-        ReportError(kIOReturnError, "Failed to initialize run loop.");
-        return false;
-    }
-    CFRetain(m_runLoop);
-
-    if (__builtin_available(macOS 12.0, *)) {
-        m_notificationPort = IONotificationPortCreate(kIOMainPortDefault);
-    }
-    else {
-        return false;
-    }
-    if (m_notificationPort == NULL) {
-        ReportError(kIOReturnError, "Failed to initialize motification port.");
-        UserClientTeardown();
-        return false;
-    }
-
-    m_machNotificationPort = IONotificationPortGetMachPort(m_notificationPort);
-    if (m_machNotificationPort == 0) {
-        ReportError(kIOReturnError, "Failed to initialize mach notification port.");
-        UserClientTeardown();
-        return false;
-    }
-
-    m_runLoopSource = IONotificationPortGetRunLoopSource(m_notificationPort);
-    if (m_runLoopSource == NULL) {
-        ReportError(kIOReturnError, "Failed to initialize run loop source.");
-        return false;
-    }
-
-    // Establish our notifications in the run loop, so we can get callbacks.
-    CFRunLoopAddSource(m_runLoop, m_runLoopSource, kCFRunLoopDefaultMode);
-
-    /// - Tag: SetUpMatchingNotification
-    CFMutableDictionaryRef matchingDictionary = IOServiceNameMatching(dextIdentifier);
-    if (matchingDictionary == NULL) {
-        ReportError(kIOReturnError, "Failed to initialize matching dictionary.");
-        UserClientTeardown();
-        return false;
-    }
-    matchingDictionary = (CFMutableDictionaryRef) CFRetain(matchingDictionary);
-    matchingDictionary = (CFMutableDictionaryRef) CFRetain(matchingDictionary);
-
-    ret = IOServiceAddMatchingNotification(
-       m_notificationPort, kIOFirstMatchNotification, matchingDictionary, DeviceAdded, refcon, &m_deviceAddedIter);
-    if (ret != kIOReturnSuccess) {
-        ReportError(ret, "Add matching notification failed.");
-        UserClientTeardown();
-        return false;
-    }
-    DeviceAdded(refcon, m_deviceAddedIter);
-
-    ret = IOServiceAddMatchingNotification(
-       m_notificationPort, kIOTerminatedNotification, matchingDictionary, DeviceRemoved, refcon, &m_deviceRemovedIter);
-    if (ret != kIOReturnSuccess) {
-        ReportError(ret, "Add termination notification failed.");
-        UserClientTeardown();
-        return false;
-    }
-    DeviceRemoved(refcon, m_deviceRemovedIter);
-
-    return true;
+    return p->InstanceCount();
 }
 
 // -------------------------------------------------------------------
 //
 //
-void VSPControllerPriv::UserClientTeardown(void)
+uint8_t VSPController::GetInstances(TVSPInstanceInfo* infos, const uint8_t count) const
 {
-    if (m_runLoopSource) {
-        CFRunLoopRemoveSource(m_runLoop, m_runLoopSource, kCFRunLoopDefaultMode);
-        m_runLoopSource = NULL;
-    }
-
-    if (m_notificationPort) {
-        IONotificationPortDestroy(m_notificationPort);
-        m_notificationPort = NULL;
-        m_machNotificationPort = 0;
-    }
-
-    if (m_runLoop) {
-        CFRelease(m_runLoop);
-        m_runLoop = NULL;
-    }
-
-    m_deviceAddedIter = IO_OBJECT_NULL;
-    m_deviceRemovedIter = IO_OBJECT_NULL;
-    m_connection = IO_OBJECT_NULL;
+    return p->GetInstances(infos, count);
 }
 
 // -------------------------------------------------------------------
 //
 //
-inline bool VSPControllerPriv::DoAsyncCall(TVSPControllerData* input)
+bool VSPController::GetInstance(const char* devicePath, TVSPInstanceInfo* info) const
 {
-    kern_return_t ret = kIOReturnSuccess;
-    io_async_ref64_t asyncRef = {};
-
-    // set magic control
-    input->status.flags = (MAGIC_CONTROL | BIT(input->command));
-
-    // Establish our "AsyncCallback" function as the function that will be called
-    // by our Dext when it calls its "AsyncCompletion" function.
-    // We'll use kIOAsyncCalloutFuncIndex and kIOAsyncCalloutRefconIndex
-    // to define the parameters for our async callback. This is your callback
-    // function. Check the definition for more details.
-    asyncRef[kIOAsyncCalloutFuncIndex] = (io_user_reference_t) VSPClient::AsyncCallback;
-
-    // Use this for context on the return. We'll pass the refcon so we can
-    // talk back to the view model.
-    asyncRef[kIOAsyncCalloutRefconIndex] = (io_user_reference_t) this;
-
-    // Instant response of the DEXT user client instance
-    // Allocate response IOMemoryDescriptor at driver site
-    // to response data above 128 bytes. This will filled,
-    // by DEXT.
-    m_vspResponse = nullptr;
-    size_t resultSize = VSP_UCD_SIZE;
-    mach_vm_address_t address = 0;
-    mach_vm_size_t size = 0;
-    ret = IOConnectMapMemory64(m_connection, input->command, mach_task_self(), &address, &size, kIOMapAnywhere);
-    if (ret != kIOReturnSuccess) {
-        ReportError(ret, "Failed to get drivers mapped memory.");
-        return false;
-    }
-    else if (!address || !size) {
-        ReportError(ret, "Invalid memory address mapping.");
-        return false;
-    }
-    else {
-        m_vspResponse = reinterpret_cast<TVSPControllerData*>(address);
-    }
-
-    // - do it --
-    ret = IOConnectCallAsyncStructMethod(
-       m_connection,
-       input->command,
-       m_machNotificationPort,
-       asyncRef,
-       kIOAsyncCalloutCount,
-       input,
-       VSP_UCD_SIZE,
-       m_vspResponse,
-       &resultSize);
-    if (ret != kIOReturnSuccess) {
-        ReportError(ret, "Driver async call failed.");
-        return false;
-    }
-
-#ifdef VSP_DEBUG
-    PrintStruct("doAsyncCall-Request", input);
-    PrintStruct("doAsyncCall-Return", m_vspResponse);
-#endif
-
-    m_controller->OnDataReady(m_vspResponse);
-    return true;
+    return p->GetInstance(devicePath, info);
 }
 
 // -------------------------------------------------------------------
 //
 //
-void VSPControllerPriv::SetConnection(io_connect_t connection)
+bool VSPController::Route(const char* devicePath, const TVSPCommandCall& call)
 {
-    if (connection == 0) {
-        m_connection = 0L;
-        m_controller->OnDisconnected();
-        return;
-    }
+    return p->Route(devicePath, call);
+}
 
-    if (connection != m_connection) {
-        m_connection = connection;
-        m_controller->OnConnected();
-    }
+// -------------------------------------------------------------------
+//
+//
+bool VSPController::SetReconnect(const uint32_t minDelay, const uint32_t maxDelay)
+{
+    return p->SetReconnect(minDelay, maxDelay);
 }
 
 // -------------------------------------------------------------------
 //
 //
-void VSPControllerPriv::AsyncCallback(IOReturn result, void** args, UInt32 numArgs)
+void VSPController::SetTopologyReplay(const bool enable)
 {
-    const int64_t* msg = (const int64_t*) args;
+    p->SetTopologyReplay(enable);
+}
 
-    // invalid driver message
-    if (numArgs < 2 || !args) {
-        ReportError(result, "Invalid driver message.");
+// -------------------------------------------------------------------
+//
+//
+const TVSPReconnectStats VSPController::GetReconnectStats() const
+{
+    return p->GetReconnectStats();
+}
+
+// -------------------------------------------------------------------
+// MARK: Private Section
+// -------------------------------------------------------------------
+
+// -------------------------------------------------------------------
+//
+//
+static inline void PrintErrorDetails(kern_return_t ret, const char* message)
+{
+    fprintf(stderr, "[VSP Driver Error] ---------------------------------\n");
+    fprintf(stderr, "\t%s\n", message);
+    fprintf(stderr, "\tSystem...: 0x%02x\n", err_get_system(ret));
+    fprintf(stderr, "\tSubsystem: 0x%03x\n", err_get_sub(ret));
+    fprintf(stderr, "\tCode.....: 0x%04x\n", err_get_code(ret));
+}
+
+VSPControllerPriv::VSPControllerPriv(VSPController* parent)
+    : m_transport(NULL)
+    , m_connection(0L)
+    , m_controller(parent)
+    , m_deviceName()
+    , m_devicePath()
+    , m_nameIndex(0)
+    , m_instanceLock()
+    , m_instances()
+    , m_instanceCount(0)
+    , m_primary(MAX_INSTANCES)
+    , m_requests()
+    , m_nextRequest(0)
+    , m_lastRequest(0)
+    , m_pending(0)
+    , m_backlogLock()
+    , m_backlog()
+    , m_backlogCount(0)
+    , m_backlogBusy(false)
+    , m_backlogKick(false)
+    , m_subscription(nullptr)
+    , m_stats()
+    , m_trace()
+    , m_controlThread(false)
+    , m_dispatch()
+    , m_dispatchPending(false)
+    , m_deadlineLock()
+    , m_deadlineSignal()
+    , m_deadlines(VSP_TIMER_TICK_US)
+    , m_deadlineThread()
+    , m_deadlineRunning(false)
+    , m_deadlineWakeUs(UINT64_MAX)
+    , m_requestTimeout(VSP_REQUEST_TIMEOUT)
+    , m_reconnectLock()
+    , m_reconnectSignal()
+    , m_reconnectThread()
+    , m_reconnectRunning(false)
+    , m_reconnectMin(0)
+    , m_reconnectMax(0)
+    , m_lost()
+    , m_reconnectStats()
+    , m_topologyLock()
+    , m_replay(false)
+    , m_topology()
+{
+    m_transport = VSPTransport::Create(this);
+}
+
+VSPControllerPriv::~VSPControllerPriv()
+{
+    UserClientTeardown();
+    delete m_transport;
+
+    {
+        std::lock_guard<std::mutex> lock(m_deadlineLock);
+        m_deadlineRunning = false;
+    }
+    m_deadlineSignal.notify_all();
+    if (m_deadlineThread.joinable()) {
+        m_deadlineThread.join();
+    }
+
+    // callbacks never dispatched
+    TVSPQueueLink* link;
+    while ((link = m_dispatch.Pop())) {
+        delete reinterpret_cast<TVSPDispatch*>(link);
+    }
+}
+
+// -------------------------------------------------------------------
+//
+//
+bool VSPControllerPriv::ConnectDriver()
+{
+    UserClientSetup();
+    return IsConnected();
+}
+
+// -------------------------------------------------------------------
+//
+//
+bool VSPControllerPriv::SetControlThread(const bool enable)
+{
+    if (IsConnected() || !m_transport) {
+        return false;
+    }
+
+    m_controlThread = enable;
+    m_transport->UseControlThread(enable);
+    return true;
+}
+
+// -------------------------------------------------------------------
+// The transport is replaced before the first connection only, no
+// request slot refers to it yet.
+//
+bool VSPControllerPriv::SetDaemonSocket(const char* path)
+{
+    if (IsConnected()) {
+        return false;
+    }
+
+    // an open transport waiting for its first match is closed
+    UserClientTeardown();
+    delete m_transport;
+    m_transport = (path ? VSPTransport::CreateSocket(this, path) : VSPTransport::Create(this));
+    m_transport->UseControlThread(m_controlThread);
+    return true;
+}
+
+// -------------------------------------------------------------------
+// Reset the pending flag before draining, a callback queued while we
+// drain notifies the caller again.
+//
+uint32_t VSPControllerPriv::DispatchCompletions()
+{
+    TVSPQueueLink* link;
+    uint32_t count = 0;
+
+    m_dispatchPending.store(false, std::memory_order_release);
+    while ((link = m_dispatch.Pop())) {
+        TVSPDispatch* d = reinterpret_cast<TVSPDispatch*>(link);
+        Deliver(d);
+        delete d;
+        count++;
+    }
+    return count;
+}
+
+// -------------------------------------------------------------------
+//
+//
+void VSPControllerPriv::DisconnectDriver()
+{
+    UserClientTeardown();
+}
+
+// -------------------------------------------------------------------
+//
+//
+bool VSPControllerPriv::IsConnected()
+{
+    return (m_connection.load() != 0L);
+}
+
+// -------------------------------------------------------------------
+//
+//
+bool VSPControllerPriv::GetStatus()
+{
+    TVSPControllerData input = {};
+    input.context = vspContextPort;
+    input.command = vspControlGetStatus;
+
+    return DoAsyncCall(&input);
+}
+
+// -------------------------------------------------------------------
+//
+//
+bool VSPControllerPriv::CreatePort(TVSPPortParameters* parameters)
+{
+    if (!parameters)
+        return false;
+
+    TVSPControllerData input = {};
+    input.context = vspContextPort;
+    input.command = vspControlCreatePort;
+    input.parameter.link.source = 1;
+    input.parameter.link.target = 1;
+
+    if (sizeof(TVSPPortParameters) <= MAX_SERIAL_PORTS) {
+        input.ports.count = sizeof(TVSPPortParameters);
+        input.parameter.flags = 0xff01;
+        memcpy(input.ports.list, parameters, input.ports.count);
+    }
+
+    return DoAsyncCall(&input);
+}
+
+// -------------------------------------------------------------------
+//
+//
+bool VSPControllerPriv::RemovePort(const uint16_t id)
+{
+    TVSPControllerData input = {};
+    input.context = vspContextPort;
+    input.command = vspControlRemovePort;
+    input.parameter.link.source = id;
+    input.parameter.link.target = id;
+
+    return DoAsyncCall(&input);
+}
+
+// -------------------------------------------------------------------
+//
+//
+bool VSPControllerPriv::GetPortList(const uint16_t cursor)
+{
+    TVSPControllerData input = {};
+    input.context = vspContextPort;
+    input.command = vspControlGetPortList;
+    input.parameter.cursor = cursor;
+
+    return DoAsyncCall(&input);
+}
+
+// -------------------------------------------------------------------
+//
+//
+bool VSPControllerPriv::GetLinkList(const uint16_t cursor)
+{
+    TVSPControllerData input = {};
+    input.context = vspContextPort;
+    input.command = vspControlGetLinkList;
+    input.parameter.cursor = cursor;
+
+    return DoAsyncCall(&input);
+}
+
+// -------------------------------------------------------------------
+//
+//
+bool VSPControllerPriv::LinkPorts(const uint16_t source, const uint16_t target)
+{
+    TVSPControllerData input = {};
+    input.context = vspContextPort;
+    input.command = vspControlLinkPorts;
+    input.parameter.link.source = source;
+    input.parameter.link.target = target;
+
+    return DoAsyncCall(&input);
+}
+
+// -------------------------------------------------------------------
+//
+//
+bool VSPControllerPriv::UnlinkPorts(const uint16_t source, const uint16_t target)
+{
+    TVSPControllerData input = {};
+    input.context = vspContextPort;
+    input.command = vspControlUnlinkPorts;
+    input.parameter.link.source = source;
+    input.parameter.link.target = target;
+
+    return DoAsyncCall(&input);
+}
+
+// -------------------------------------------------------------------
+//
+//
+bool VSPControllerPriv::EnableChecks(const uint16_t port)
+{
+    TVSPControllerData input = {};
+    input.context = vspContextPort;
+    input.command = vspControlEnableChecks;
+    input.parameter.link.source = port;
+    input.parameter.link.target = port;
+
+    return DoAsyncCall(&input);
+}
+
+// -------------------------------------------------------------------
+//
+//
+bool VSPControllerPriv::EnableTrace(const uint16_t port)
+{
+    TVSPControllerData input = {};
+    input.context = vspContextPort;
+    input.command = vspControlEnableTrace;
+    input.parameter.link.source = port;
+    input.parameter.link.target = port;
+
+    return DoAsyncCall(&input);
+}
+
+// -------------------------------------------------------------------
+//
+//
+bool VSPControllerPriv::ExecuteBatch(const TVSPBatchOperation* operations, const uint8_t count)
+{
+    if (!operations || !count || count > MAX_BATCH_OPS)
+        return false;
+
+    TVSPControllerData input = {};
+    input.context = vspContextPort;
+    input.command = vspControlBatch;
+
+    // operations are passed through ports.list like port parameters
+    input.ports.count = count;
+    memcpy(input.ports.list, operations, count * sizeof(TVSPBatchOperation));
+
+    return DoAsyncCall(&input);
+}
+
+// -------------------------------------------------------------------
+//
+//
+bool VSPControllerPriv::GetChanges(const uint32_t generation)
+{
+    TVSPControllerData input = {};
+    input.context = vspContextPort;
+    input.command = vspControlGetChanges;
+    input.generation = generation;
+
+    return DoAsyncCall(&input);
+}
+
+// -------------------------------------------------------------------
+// The request slot of a subscription receives a completion for each
+// driver event. A new subscription or mask 0 ends the current one,
+// its slot is completed with kIOReturnAborted by the driver then.
+//
+bool VSPControllerPriv::Subscribe(const uint32_t mask)
+{
+    TVSPControllerData input = {};
+    input.context = vspContextPort;
+    input.command = vspControlSubscribe;
+    input.parameter.flags = mask;
+
+    return DoAsyncCall(&input);
+}
+
+// -------------------------------------------------------------------
+//
+//
+bool VSPControllerPriv::IsSubscribed() const
+{
+    return m_subscription.load() != nullptr;
+}
+
+// -------------------------------------------------------------------
+//
+//
+const TVSPMappingStats VSPControllerPriv::GetMappingStats() const
+{
+    if (!m_transport) {
+        return {};
+    }
+    return m_transport->MappingStats();
+}
+
+// -------------------------------------------------------------------
+//
+//
+const TVSPWireStats VSPControllerPriv::GetWireStats() const
+{
+    if (!m_transport) {
+        return {};
+    }
+    return m_transport->WireStats();
+}
+
+// -------------------------------------------------------------------
+//
+//
+const TVSPStatistics VSPControllerPriv::GetStatistics() const
+{
+    TVSPStatistics stats = {};
+
+    for (uint32_t i = 0; i < vspLastCommand; i++) {
+        const TVSPCommandCounters& c = m_stats[i];
+        TVSPCommandStats& s = stats.commands[i];
+        s.completed = c.completed.load(std::memory_order_relaxed);
+        s.errors = c.errors.load(std::memory_order_relaxed);
+        s.rejected = c.rejected.load(std::memory_order_relaxed);
+        s.timeouts = c.timeouts.load(std::memory_order_relaxed);
+        s.late = c.late.load(std::memory_order_relaxed);
+        s.sumUs = c.sumUs.load(std::memory_order_relaxed);
+        s.minUs = c.minUs.load(std::memory_order_relaxed);
+        s.maxUs = c.maxUs.load(std::memory_order_relaxed);
+        for (uint32_t b = 0; b < VSP_LATENCY_BUCKETS; b++) {
+            s.buckets[b] = c.buckets[b].load(std::memory_order_relaxed);
+        }
+    }
+    return stats;
+}
+
+// -------------------------------------------------------------------
+//
+//
+void VSPControllerPriv::SetTraceLevel(const TVSPTraceLevel level)
+{
+    m_trace.SetLevel(level);
+}
+
+// -------------------------------------------------------------------
+//
+//
+TVSPTraceLevel VSPControllerPriv::TraceLevel() const
+{
+    return (TVSPTraceLevel) m_trace.Level();
+}
+
+// -------------------------------------------------------------------
+//
+//
+uint32_t VSPControllerPriv::ReadTrace(TVSPTraceRecord* records, const uint32_t count, uint64_t* cursor) const
+{
+    if (!records || !cursor) {
+        return 0;
+    }
+    return m_trace.Read(records, count, cursor);
+}
+
+// -------------------------------------------------------------------
+// Snapshot of the ring, writers keep going meanwhile.
+//
+bool VSPControllerPriv::SaveTrace(const char* path) const
+{
+    std::vector<TVSPTraceRecord> records(VSP_TRACE_RECORDS);
+    uint64_t cursor = 0;
+    FILE* file;
+
+    const uint32_t count = m_trace.Read(records.data(), VSP_TRACE_RECORDS, &cursor);
+    if (!path || !(file = fopen(path, "wb"))) {
+        return false;
+    }
+    const bool success = VSPTraceWrite(file, records.data(), count);
+    return (fclose(file) == 0 && success);
+}
+
+// -------------------------------------------------------------------
+//
+//
+uint32_t VSPControllerPriv::LastRequestId() const
+{
+    return m_lastRequest.load();
+}
+
+// -------------------------------------------------------------------
+//
+//
+uint32_t VSPControllerPriv::PendingRequests() const
+{
+    // the subscription stays pending until cancelled
+    return m_pending.load() + m_backlogCount.load() - (IsSubscribed() ? 1 : 0);
+}
+
+// -------------------------------------------------------------------
+// The command method runs on this thread, DoAsyncCall() binds the
+// completion to the first request it submits. The result tells if
+// the completion is called, not what the command method returned: a
+// bound request completes even if a later one of the method failed.
+//
+bool VSPControllerPriv::Call(const TVSPCommandCall& call, const uint32_t timeout, const TVSPCompletion& completion)
+{
+    if (!call || !completion) {
+        return false;
+    }
+
+    std::shared_ptr<TVSPCall> bound = std::make_shared<TVSPCall>();
+    bound->done.store(false);
+    bound->accepted = false;
+    bound->instance = 0;
+    bound->request = 0;
+    bound->timeout = timeout;
+    bound->completion = completion;
+
+    std::shared_ptr<TVSPCall>* outer = t_boundCall;
+    t_boundCall = &bound;
+    const bool submitted = call();
+    t_boundCall = outer;
+
+    if (bound->accepted) {
+        return true;
+    }
+    if (!submitted) {
+        return false;
+    }
+
+    // the command method succeeded without a request to bind
+    FinishCall(bound, kIOReturnUnsupported, nullptr);
+    return true;
+}
+
+// -------------------------------------------------------------------
+// Requests submitted before keep their deadline.
+//
+void VSPControllerPriv::SetRequestTimeout(const uint32_t timeout)
+{
+    m_requestTimeout.store(timeout);
+}
+
+// -------------------------------------------------------------------
+//
+//
+const char* VSPControllerPriv::DeviceName() const
+{
+    return m_deviceName[m_nameIndex.load(std::memory_order_acquire)];
+}
+
+// -------------------------------------------------------------------
+//
+//
+const char* VSPControllerPriv::DevicePath() const
+{
+    return m_devicePath[m_nameIndex.load(std::memory_order_acquire)];
+}
+
+// -------------------------------------------------------------------
+//
+//
+uint8_t VSPControllerPriv::InstanceCount() const
+{
+    return m_instanceCount.load();
+}
+
+// -------------------------------------------------------------------
+//
+//
+uint8_t VSPControllerPriv::GetInstances(TVSPInstanceInfo* infos, const uint8_t count) const
+{
+    std::lock_guard<std::mutex> lock(m_instanceLock);
+    uint8_t n = 0;
+
+    if (!infos) {
+        return 0;
+    }
+    for (uint8_t i = 0; i < MAX_INSTANCES && n < count; i++) {
+        if (m_instances[i].connection.load()) {
+            FillInstanceInfo(i, &infos[n++]);
+        }
+    }
+    return n;
+}
+
+// -------------------------------------------------------------------
+//
+//
+bool VSPControllerPriv::GetInstance(const char* devicePath, TVSPInstanceInfo* info) const
+{
+    std::lock_guard<std::mutex> lock(m_instanceLock);
+
+    if (!devicePath || !info) {
+        return false;
+    }
+    for (uint8_t i = 0; i < MAX_INSTANCES; i++) {
+        if (m_instances[i].connection.load() && strcmp(m_instances[i].path, devicePath) == 0) {
+            FillInstanceInfo(i, info);
+            return true;
+        }
+    }
+    return false;
+}
+
+// -------------------------------------------------------------------
+// Like Call(), DoAsyncCall() sends the requests of the command method
+// running on this thread to the routed instance.
+//
+bool VSPControllerPriv::Route(const char* devicePath, const TVSPCommandCall& call)
+{
+    uint8_t index = MAX_INSTANCES;
+
+    if (!devicePath || !call) {
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_instanceLock);
+        for (uint8_t i = 0; i < MAX_INSTANCES; i++) {
+            if (m_instances[i].connection.load() && strcmp(m_instances[i].path, devicePath) == 0) {
+                index = i;
+                break;
+            }
+        }
+    }
+    if (index >= MAX_INSTANCES) {
+        return false;
+    }
+
+    const uint8_t outer = t_route;
+    t_route = index;
+    const bool submitted = call();
+    t_route = outer;
+
+    return submitted;
+}
+
+// -------------------------------------------------------------------
+// MARK: Private API Implementation
+// -------------------------------------------------------------------
+
+// -------------------------------------------------------------------
+// With the trace off the error goes to OnErrorOccured only, tools
+// flooding the driver on purpose keep stderr clean that way.
+//
+void VSPControllerPriv::ReportError(IOReturn error, const char* message)
+{
+    if (m_trace.Enabled(vspTraceError)) {
+        PrintErrorDetails(error, message);
+
+        TVSPTraceRecord record = {};
+        record.timeUs = MonotonicUs();
+        record.point = vspTraceFailure;
+        record.command = 0xff;
+        record.status = (uint32_t) error;
+        m_trace.Write(&record);
+    }
+    NotifyError(error, message);
+}
+
+// -------------------------------------------------------------------
+// The connection of a new instance is stored last, so readers skip
+// the slot until name and path are complete.
+//
+void VSPControllerPriv::AttachInstance(const uint8_t index, const uint32_t connection, const char* name, const char* path)
+{
+    TVSPDeviceName matched = {};
+    int transition;
+
+    if (index >= MAX_INSTANCES || !connection) {
+        ReportError(kIOReturnBadArgument, "Invalid driver instance.");
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_instanceLock);
+        TVSPInstance* instance = &m_instances[index];
+
+        if (!instance->connection.load()) {
+            memset(instance->name, 0, sizeof(TVSPDeviceName));
+            memset(instance->path, 0, sizeof(TVSPDeviceName));
+            strncpy(instance->name, (name ? name : ""), sizeof(TVSPDeviceName) - 1);
+            strncpy(instance->path, (path ? path : ""), sizeof(TVSPDeviceName) - 1);
+            instance->ports.store(0);
+            instance->links.store(0);
+            instance->submitted.store(0);
+            instance->completed.store(0);
+            instance->errors.store(0);
+            instance->rejected.store(0);
+            instance->sumUs.store(0);
+            m_instanceCount++;
+        }
+        instance->connection.store(connection);
+        strncpy(matched, instance->path, sizeof(TVSPDeviceName) - 1);
+        transition = SelectPrimary();
+    }
+
+    if (transition) {
+        NotifyConnection(transition > 0);
+    }
+
+    MatchLostInstance(index, matched);
+}
+
+// -------------------------------------------------------------------
+// The driver never completes the requests in flight on a removed
+// instance, they are completed with kIOReturnNotOpen here. Runs on
+// the transport thread which delivers the completions too.
+//
+void VSPControllerPriv::DetachInstance(const uint8_t index)
+{
+    TVSPDeviceName removed = {};
+    int transition;
+
+    if (index >= MAX_INSTANCES) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_instanceLock);
+        if (!m_instances[index].connection.exchange(0)) {
+            return;
+        }
+        m_instanceCount--;
+        strncpy(removed, m_instances[index].path, sizeof(TVSPDeviceName) - 1);
+        transition = SelectPrimary();
+    }
+
+    LoseInstance(index, removed);
+
+    for (uint32_t i = 0; i < MAX_REQUESTS; i++) {
+        TVSPRequest* request = &m_requests[i];
+        const uint32_t id = request->id.load();
+        if (!id || request->instance.load() != index || !ClaimRequest(request, id)) {
+            continue;
+        }
+
+        TVSPRequest* expected = request;
+        if (m_subscription.compare_exchange_strong(expected, nullptr)) {
+            ReleaseRequest(request);
+            continue;
+        }
+
+        std::shared_ptr<TVSPCall> call = std::move(request->call);
+        if (call) {
+            FinishCall(call, kIOReturnNotOpen, nullptr);
+        }
+        else {
+            NotifyResult(kIOReturnNotOpen, &request->response);
+        }
+        ReleaseRequest(request);
+    }
+
+    if (transition) {
+        NotifyConnection(transition > 0);
+    }
+}
+
+// -------------------------------------------------------------------
+// The lowest connected slot is the primary instance. Returns 1 if the
+// controller got connected, -1 if disconnected, 0 otherwise. Caller
+// holds m_instanceLock.
+//
+inline int VSPControllerPriv::SelectPrimary()
+{
+    uint8_t primary = MAX_INSTANCES;
+    uint32_t connection = 0;
+
+    for (uint8_t i = 0; i < MAX_INSTANCES; i++) {
+        if ((connection = m_instances[i].connection.load())) {
+            primary = i;
+            break;
+        }
+    }
+
+    if (primary != m_primary.load() && primary < MAX_INSTANCES) {
+        SetNameAndPath(m_instances[primary].name, m_instances[primary].path);
+    }
+    m_primary.store(primary);
+
+    const uint32_t previous = m_connection.exchange(connection);
+    if (!previous && connection) {
+        return 1;
+    }
+    if (previous && !connection) {
+        return -1;
+    }
+    return 0;
+}
+
+// -------------------------------------------------------------------
+// Caller holds m_instanceLock
+//
+inline void VSPControllerPriv::SetNameAndPath(const char* name, const char* path)
+{
+    const uint8_t next = !m_nameIndex.load(std::memory_order_relaxed);
+
+    memset(m_deviceName[next], 0, sizeof(TVSPDeviceName));
+    memset(m_devicePath[next], 0, sizeof(TVSPDeviceName));
+    strncpy(m_deviceName[next], name, sizeof(TVSPDeviceName) - 1);
+    strncpy(m_devicePath[next], path, sizeof(TVSPDeviceName) - 1);
+    m_nameIndex.store(next, std::memory_order_release);
+}
+
+// -------------------------------------------------------------------
+// Caller holds m_instanceLock
+//
+inline void VSPControllerPriv::FillInstanceInfo(const uint8_t index, TVSPInstanceInfo* info) const
+{
+    const TVSPInstance* instance = &m_instances[index];
+    const uint32_t ports = instance->ports.load(std::memory_order_relaxed);
+    const uint32_t links = instance->links.load(std::memory_order_relaxed);
+
+    memset(info, 0, sizeof(TVSPInstanceInfo));
+    info->index = index;
+    info->ports = (uint16_t) (ports < UINT16_MAX ? ports : UINT16_MAX);
+    info->links = (uint16_t) (links < UINT16_MAX ? links : UINT16_MAX);
+    info->submitted = instance->submitted.load(std::memory_order_relaxed);
+    info->completed = instance->completed.load(std::memory_order_relaxed);
+    info->errors = instance->errors.load(std::memory_order_relaxed);
+    info->rejected = instance->rejected.load(std::memory_order_relaxed);
+    info->sumUs = instance->sumUs.load(std::memory_order_relaxed);
+    strncpy(info->name, instance->name, sizeof(info->name) - 1);
+    strncpy(info->path, instance->path, sizeof(info->path) - 1);
+}
+
+// -------------------------------------------------------------------
+//
+//
+bool VSPControllerPriv::UserClientSetup()
+{
+    if (!m_transport) {
+        ReportError(kIOReturnUnsupported, "No driver transport available.");
+        return false;
+    }
+
+    return m_transport->Open();
+}
+
+// -------------------------------------------------------------------
+//
+//
+void VSPControllerPriv::UserClientTeardown(void)
+{
+    // no rematch of a closed transport
+    StopReconnect();
+
+    if (m_transport) {
+        m_transport->Close();
+    }
+
+    // requests waiting for a slot are never submitted, taken out first
+    // so the slots released below do not submit them
+    std::deque<TVSPBacklogItem> backlog;
+    {
+        std::lock_guard<std::mutex> lock(m_backlogLock);
+        backlog.swap(m_backlog);
+        m_backlogCount.store(0);
+    }
+
+    // completions of a closed connection never arrive, a request the
+    // deadline thread claimed is released by that thread
+    for (uint32_t i = 0; i < MAX_REQUESTS; i++) {
+        TVSPRequest* request = &m_requests[i];
+        const uint32_t id = request->id.load();
+        if (!id || !ClaimRequest(request, id)) {
+            continue;
+        }
+
+        TVSPRequest* expected = request;
+        if (m_subscription.compare_exchange_strong(expected, nullptr)) {
+            ReleaseRequest(request);
+            continue;
+        }
+
+        std::shared_ptr<TVSPCall> call = std::move(request->call);
+        if (call) {
+            FinishCall(call, kIOReturnAborted, nullptr);
+        }
+        else {
+            NotifyResult(kIOReturnAborted, &request->response);
+        }
+        ReleaseRequest(request);
+    }
+    m_subscription.store(nullptr);
+
+    {
+        std::lock_guard<std::mutex> lock(m_instanceLock);
+        for (uint8_t i = 0; i < MAX_INSTANCES; i++) {
+            m_instances[i].connection.store(0);
+        }
+        m_instanceCount.store(0);
+        m_primary.store(MAX_INSTANCES);
+        m_connection.store(0L);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_topologyLock);
+        for (uint8_t i = 0; i < MAX_INSTANCES; i++) {
+            m_topology[i].ports.clear();
+            m_topology[i].links.clear();
+        }
+    }
+
+    for (TVSPBacklogItem& item : backlog) {
+        if (item.call) {
+            FinishCall(item.call, kIOReturnAborted, nullptr);
+        }
+        else {
+            NotifyResult(kIOReturnAborted, &item.input);
+        }
+    }
+}
+
+// -------------------------------------------------------------------
+// Callers on any thread: each request takes its own slot, requests
+// beyond MAX_REQUESTS in flight wait in the backlog.
+//
+inline bool VSPControllerPriv::DoAsyncCall(TVSPControllerData* input)
+{
+    std::shared_ptr<TVSPCall> call;
+    uint8_t instance;
+    IOReturn ret;
+
+    if (!m_transport || !IsConnected()) {
+        m_stats[input->command % vspLastCommand].rejected++;
+        ReportError(kIOReturnNotOpen, "Driver not connected.");
+        return false;
+    }
+
+    if ((instance = SelectInstance(input->command)) >= MAX_INSTANCES) {
+        m_stats[input->command % vspLastCommand].rejected++;
+        ReportError(kIOReturnNotOpen, "Driver instance not connected.");
+        return false;
+    }
+
+    // completion of Call(), the first request of the call only
+    if (t_boundCall && !(*t_boundCall)->accepted) {
+        call = *t_boundCall;
+        call->command = input->command;
+        call->instance = instance;
+    }
+
+    // the backlog goes first, so requests keep their order
+    ret = (m_backlogCount.load() ? kIOReturnNoResources : SubmitRequest(input, instance, call));
+    const bool queued = (ret == kIOReturnNoResources);
+    if (queued) {
+        // waits on the deadline of SetRequestTimeout() like a slot
+        if (call && !call->timeout) {
+            call->timeout = m_requestTimeout.load();
+        }
+        ret = QueueRequest(input, instance, call);
+    }
+    if (ret != kIOReturnSuccess) {
+        return false;
+    }
+
+    // a submitted request runs on the deadline of its slot
+    if (call) {
+        call->accepted = true;
+        if (queued && call->timeout) {
+            ArmDeadline(call);
+        }
+    }
+    return true;
+}
+
+// -------------------------------------------------------------------
+// Target of Route(), otherwise the primary instance. New ports go to
+// the instance with the fewest ports, its count is raised at once so
+// concurrent creations spread too. The next response of the driver
+// corrects the count.
+//
+inline uint8_t VSPControllerPriv::SelectInstance(const uint8_t command)
+{
+    if (t_route < MAX_INSTANCES) {
+        return (m_instances[t_route].connection.load() ? t_route : MAX_INSTANCES);
+    }
+    if (command != vspControlCreatePort || m_instanceCount.load() < 2) {
+        return m_primary.load();
+    }
+
+    uint8_t index = MAX_INSTANCES;
+    uint32_t fewest = UINT32_MAX;
+    for (uint8_t i = 0; i < MAX_INSTANCES; i++) {
+        const uint32_t ports = m_instances[i].ports.load(std::memory_order_relaxed);
+        if (m_instances[i].connection.load() && ports < fewest) {
+            fewest = ports;
+            index = i;
+        }
+    }
+    if (index < MAX_INSTANCES) {
+        m_instances[index].ports.fetch_add(1, std::memory_order_relaxed);
+    }
+    return index;
+}
+
+// -------------------------------------------------------------------
+// Returns kIOReturnNoResources without touching the driver if all
+// request slots are in flight.
+//
+inline IOReturn VSPControllerPriv::SubmitRequest(TVSPControllerData* input, const uint8_t instance, const std::shared_ptr<TVSPCall>& call)
+{
+    IOReturn ret = kIOReturnSuccess;
+    TVSPRequest* request;
+
+    if (!(request = AcquireRequest(input->command))) {
+        return kIOReturnNoResources;
+    }
+
+    // set magic control and request identifier
+    input->status.flags = (MAGIC_CONTROL | BIT(input->command));
+    input->request = request->id.load();
+    request->instance.store(instance);
+    request->call = call;
+    // before Submit(), the completion may read it at once
+    if (call) {
+        call->request = input->request;
+    }
+    if (input->command == vspControlCreatePort) {
+        memcpy(&request->parameters, input->ports.list, sizeof(TVSPPortParameters));
+    }
+
+    // Instant response of the driver instance is
+    // stored in the response slot of this request.
+    Trace(vspTraceSubmit, vspTraceRequest, instance, input, 0, 0);
+    request->submitted = MonotonicUs();
+    if ((ret = m_transport->Submit(input, request)) != kIOReturnSuccess) {
+        m_stats[input->command % vspLastCommand].rejected++;
+        m_instances[instance].rejected++;
+        request->call.reset();
+        if (call) {
+            call->request = 0;
+        }
+        request->waiting.store(0);
+        request->holds.store(0);
+        // no backlog here, the caller continues with it
+        if (request->id.exchange(0) != 0) {
+            m_pending--;
+        }
+        return ret;
+    }
+
+    // a subscription waits for events, it has no deadline
+    if (input->command != vspControlSubscribe) {
+        ArmRequest(request, input->request, (call && call->timeout ? call->timeout : m_requestTimeout.load()));
+    }
+
+    m_instances[instance].submitted++;
+    Trace(vspTraceResponse, vspTraceVerbose, instance, &request->response, request->response.status.code, 0);
+
+    m_lastRequest.store(input->request);
+    m_controller->OnDataReady(&request->response);
+
+    // the completion may have run already, the slot is ours until here
+    ReleaseRequest(request);
+    return kIOReturnSuccess;
+}
+
+// -------------------------------------------------------------------
+//
+//
+inline IOReturn VSPControllerPriv::QueueRequest(const TVSPControllerData* input, const uint8_t instance, const std::shared_ptr<TVSPCall>& call)
+{
+    const uint32_t timeout = (call && call->timeout ? call->timeout : m_requestTimeout.load());
+    const uint64_t due = (timeout ? MonotonicUs() + (uint64_t) timeout * 1000 : 0);
+    bool queued = false;
+
+    {
+        std::lock_guard<std::mutex> lock(m_backlogLock);
+        if (m_backlog.size() < VSP_MAX_BACKLOG) {
+            m_backlog.push_back({*input, instance, call, due});
+            m_backlogCount++;
+            queued = true;
+        }
+    }
+
+    if (!queued) {
+        m_stats[input->command % vspLastCommand].rejected++;
+        ReportError(kIOReturnNoResources, "Too many outstanding driver requests.");
+        return kIOReturnNoResources;
+    }
+
+    // a slot may have been released before we queued
+    SubmitBacklog();
+    return kIOReturnSuccess;
+}
+
+// -------------------------------------------------------------------
+// Runs on the releasing thread. The backlog lock is not held during
+// the submission, a request taken out is put back at the front if
+// the slots are in flight again. Whoever releases a slot afterwards
+// submits it then. Only one thread submits at a time, so a request
+// taken out is sent before the ones behind it. A caller finding the
+// loop busy, a nested one too, kicks it to run once more. Requests
+// whose deadline passed in the backlog are not submitted.
+//
+inline void VSPControllerPriv::SubmitBacklog()
+{
+    m_backlogKick.store(true);
+    while (m_backlogKick.load() && !m_backlogBusy.exchange(true)) {
+        m_backlogKick.store(false);
+        DrainBacklog();
+        m_backlogBusy.store(false);
+    }
+}
+
+// -------------------------------------------------------------------
+// Caller is the one thread of SubmitBacklog()
+//
+inline void VSPControllerPriv::DrainBacklog()
+{
+    while (m_backlogCount.load()) {
+        TVSPBacklogItem item;
+        {
+            std::lock_guard<std::mutex> lock(m_backlogLock);
+            if (m_backlog.empty()) {
+                break;
+            }
+            item = std::move(m_backlog.front());
+            m_backlog.pop_front();
+        }
+
+        // the deadline thread finished the call already
+        if (item.call && item.call->done.load()) {
+            m_backlogCount--;
+            continue;
+        }
+        if (item.due && MonotonicUs() >= item.due) {
+            m_backlogCount--;
+            ExpireBacklog(&item);
+            continue;
+        }
+
+        const IOReturn ret = SubmitRequest(&item.input, item.instance, item.call);
+        if (ret == kIOReturnNoResources) {
+            {
+                std::lock_guard<std::mutex> lock(m_backlogLock);
+                m_backlog.push_front(std::move(item));
+            }
+            // released meanwhile, the releasing thread found no item
+            if (m_pending.load() < MAX_REQUESTS) {
+                continue;
+            }
+            break;
+        }
+
+        m_backlogCount--;
+        if (ret != kIOReturnSuccess && item.call) {
+            FinishCall(item.call, ret, nullptr);
+        }
+    }
+}
+
+// -------------------------------------------------------------------
+// Backlog request without a slot, a plain request is reported like
+// an expired slot.
+//
+inline void VSPControllerPriv::ExpireBacklog(const TVSPBacklogItem* item)
+{
+    if (item->call) {
+        FinishCall(item->call, kIOReturnTimeout, nullptr);
+        return;
+    }
+    m_stats[item->input.command % vspLastCommand].timeouts++;
+    ReportError(kIOReturnTimeout, "Driver request timed out in the backlog.");
+}
+
+// -------------------------------------------------------------------
+// Reserve a free response slot for a new request. The identifier
+// selects the first slot to probe, so slots are reused round robin.
+//
+inline TVSPRequest* VSPControllerPriv::AcquireRequest(const uint8_t command)
+{
+    for (uint32_t probe = 0; probe < MAX_REQUESTS; probe++) {
+        uint32_t id = ++m_nextRequest;
+        if (id == 0) {
+            id = ++m_nextRequest;
+        }
+
+        TVSPRequest* request = &m_requests[id % MAX_REQUESTS];
+        uint32_t expected = 0;
+        if (!request->id.compare_exchange_strong(expected, id)) {
+            continue;
+        }
+
+        request->transport = m_transport;
+        request->command = command;
+        request->call.reset();
+        memset(&request->response, 0, sizeof(request->response));
+        request->response.request = id;
+        request->waiting.store(id);
+        request->holds.store(2);
+        m_pending++;
+        return request;
+    }
+    return nullptr;
+}
+
+// -------------------------------------------------------------------
+// Called once by the submitter and once by the claimer of the
+// request, the second call frees the slot.
+//
+inline void VSPControllerPriv::ReleaseRequest(TVSPRequest* request)
+{
+    if (request->holds.fetch_sub(1) != 1) {
+        return;
+    }
+
+    request->waiting.store(0);
+    if (request->id.exchange(0) != 0) {
+        m_pending--;
+        if (m_backlogCount.load()) {
+            SubmitBacklog();
+        }
+    }
+}
+
+// -------------------------------------------------------------------
+//
+//
+void VSPControllerPriv::AsyncCallback(TVSPRequest* request, IOReturn result, void** args, uint32_t numArgs)
+{
+    const int64_t* msg = (const int64_t*) args;
+
+    // invalid driver message
+    if (numArgs < 2 || !args) {
+        ReportError(result, "Invalid driver message.");
+        return;
+    }
+
+    // An expired change generation and the end of a subscription are
+    // reported to the caller only.
+    const bool expected = //
+       (result == kIOReturnOverrun && msg[VSP_ARG_COMMAND] == vspControlGetChanges) ||
+       (result == kIOReturnAborted && msg[VSP_ARG_COMMAND] == vspControlSubscribe);
+    if (result != kIOReturnSuccess && !expected) {
+        ReportError(result, "Driver error occured.");
+    }
+
+    // invalid driver signature
+    if ((msg[0] & MAGIC_CONTROL) != MAGIC_CONTROL) {
+        ReportError(result, "Invalid driver signature.");
+        return;
+    }
+
+    // request slot unknown to us
+    if (!request || request < m_requests || request >= m_requests + MAX_REQUESTS) {
+        NotifyError(kIOReturnNoSpace, "[UC] No async result buffer.");
+        return;
+    }
+
+    // Late completion after the deadline, teardown or the removal of
+    // the instance, the slot is free or serves a newer request.
+    const uint32_t id = request->id.load();
+    TVSPCommandCounters& c = m_stats[(uint8_t) msg[VSP_ARG_COMMAND] % vspLastCommand];
+    if (!id || (numArgs > VSP_ARG_REQUEST && msg[VSP_ARG_REQUEST] && (uint32_t) msg[VSP_ARG_REQUEST] != id)) {
+        c.late.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    if (request->command == vspControlSubscribe) {
+        SubscriptionCallback(request, result, msg, numArgs);
+        return;
+    }
+
+    // the deadline thread finished the request meanwhile
+    if (!ClaimRequest(request, id)) {
+        c.late.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    CompleteRequest(request, result);
+    ReleaseRequest(request);
+}
+
+// -------------------------------------------------------------------
+// Completions of a subscription slot: the driver events, the result
+// of the Subscribe request itself and kIOReturnAborted when ended.
+//
+inline void VSPControllerPriv::SubscriptionCallback(TVSPRequest* request, IOReturn result, const int64_t* msg, uint32_t numArgs)
+{
+    if (numArgs >= VSP_EVENT_ARGS && msg[VSP_ARG_EVENT]) {
+        TVSPEvent event = {};
+        VSPEventFromArgs(msg, &event);
+        TraceEvent(&event);
+        SnapshotEvent(request->instance.load(), &event);
+        NotifyEvent(&event);
+        return;
+    }
+
+    if (result == kIOReturnAborted) {
+        TVSPRequest* expected = request;
+        m_subscription.compare_exchange_strong(expected, nullptr);
+        ReleaseRequest(request);
+        return;
+    }
+
+    // slot is kept for the events of an active subscription
+    const bool active = (result == kIOReturnSuccess && request->response.parameter.flags != 0);
+    if (active) {
+        m_subscription.store(request);
+    }
+
+    CompleteRequest(request, result);
+
+    if (!active) {
+        ReleaseRequest(request);
+    }
+}
+
+// -------------------------------------------------------------------
+// MARK: Trace
+// -------------------------------------------------------------------
+
+// -------------------------------------------------------------------
+// One record without formatting, the cost is a clock read and a
+// slot claim in the ring.
+//
+inline void VSPControllerPriv::Trace(const uint8_t point, const uint8_t level, const uint8_t instance, const TVSPControllerData* data, const uint32_t status, const uint64_t latency)
+{
+    if (!m_trace.Enabled(level)) {
+        return;
+    }
+
+    TVSPTraceRecord record = {};
+    record.timeUs = MonotonicUs();
+    record.flags = data->status.flags;
+    record.parameter = data->parameter.flags;
+    record.request = data->request;
+    record.status = (point == vspTraceComplete ? status : data->status.code);
+    record.generation = data->generation;
+    record.latencyUs = (uint32_t) (latency < UINT32_MAX ? latency : UINT32_MAX);
+    record.source = data->parameter.link.source;
+    record.target = data->parameter.link.target;
+    record.cursor = data->parameter.cursor;
+    record.point = point;
+    record.command = data->command;
+    record.instance = instance;
+    m_trace.Write(&record);
+}
+
+// -------------------------------------------------------------------
+//
+//
+inline void VSPControllerPriv::TraceEvent(const TVSPEvent* event)
+{
+    if (!m_trace.Enabled(vspTraceVerbose)) {
+        return;
+    }
+
+    TVSPTraceRecord record = {};
+    record.timeUs = MonotonicUs();
+    record.parameter = event->modemLines;
+    record.generation = event->generation;
+    record.source = event->source;
+    record.target = event->target;
+    record.cursor = event->id;
+    record.point = vspTraceEvent;
+    record.command = event->kind;
+    m_trace.Write(&record);
+}
+
+// -------------------------------------------------------------------
+// MARK: Bound Completions
+// -------------------------------------------------------------------
+
+// -------------------------------------------------------------------
+// Completing thread only, plain relaxed counters. Min and max retry
+// on a concurrent completion of the same command.
+//
+inline uint64_t VSPControllerPriv::RecordLatency(const TVSPRequest* request, IOReturn result)
+{
+    TVSPCommandCounters& c = m_stats[request->command % vspLastCommand];
+    TVSPInstance& instance = m_instances[request->instance.load() % MAX_INSTANCES];
+    const uint64_t now = MonotonicUs();
+    const uint64_t us = (now > request->submitted ? now - request->submitted : 0);
+    const bool failed = (result != kIOReturnSuccess || request->response.status.code != 0);
+
+    instance.completed.fetch_add(1, std::memory_order_relaxed);
+    instance.sumUs.fetch_add(us, std::memory_order_relaxed);
+    if (failed) {
+        instance.errors.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    c.completed.fetch_add(1, std::memory_order_relaxed);
+    if (failed) {
+        c.errors.fetch_add(1, std::memory_order_relaxed);
+    }
+    c.sumUs.fetch_add(us, std::memory_order_relaxed);
+    c.buckets[VSPController::LatencyBucket(us)].fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t value = c.minUs.load(std::memory_order_relaxed);
+    while ((value == 0 || us < value) && !c.minUs.compare_exchange_weak(value, (us ? us : 1), std::memory_order_relaxed)) {
+    }
+    value = c.maxUs.load(std::memory_order_relaxed);
+    while (us > value && !c.maxUs.compare_exchange_weak(value, us, std::memory_order_relaxed)) {
+    }
+    return us;
+}
+
+// -------------------------------------------------------------------
+// Port and link totals of the responses carrying the topology, they
+// steer the placement of new ports.
+//
+inline void VSPControllerPriv::CountTopology(const TVSPRequest* request, IOReturn result)
+{
+    TVSPInstance& instance = m_instances[request->instance.load() % MAX_INSTANCES];
+    const TVSPControllerData* response = &request->response;
+
+    // no totals in a batch response, count its operations each
+    // with its own status
+    if (request->command == vspControlBatch) {
+        TVSPBatchOperation ops[MAX_BATCH_OPS];
+        const uint8_t count = VSPController::GetBatchResults(response, ops);
+        for (uint8_t i = 0; i < count; i++) {
+            if (ops[i].status != kIOReturnSuccess) {
+                continue;
+            }
+            switch (ops[i].command) {
+                case vspControlCreatePort: {
+                    instance.ports.fetch_add(1, std::memory_order_relaxed);
+                    break;
+                }
+                case vspControlRemovePort: {
+                    instance.ports.fetch_sub(1, std::memory_order_relaxed);
+                    break;
+                }
+                case vspControlLinkPorts: {
+                    instance.links.fetch_add(1, std::memory_order_relaxed);
+                    break;
+                }
+                case vspControlUnlinkPorts: {
+                    instance.links.fetch_sub(1, std::memory_order_relaxed);
+                    break;
+                }
+            }
+        }
+        return;
+    }
+
+    if (result != kIOReturnSuccess || response->status.code != 0) {
+        return;
+    }
+
+    switch (request->command) {
+        case vspControlGetStatus:
+        case vspControlCreatePort:
+        case vspControlRemovePort:
+        case vspControlLinkPorts:
+        case vspControlUnlinkPorts: {
+            instance.ports.store(response->ports.total, std::memory_order_relaxed);
+            instance.links.store(response->links.total, std::memory_order_relaxed);
+            break;
+        }
+        case vspControlGetPortList: {
+            instance.ports.store(response->ports.total, std::memory_order_relaxed);
+            break;
+        }
+        case vspControlGetLinkList: {
+            instance.links.store(response->links.total, std::memory_order_relaxed);
+            break;
+        }
+    }
+}
+
+// -------------------------------------------------------------------
+// Requests of Call() complete their own completion, all others go to
+// OnIOUCCallback.
+//
+inline void VSPControllerPriv::CompleteRequest(TVSPRequest* request, IOReturn result)
+{
+    const uint64_t us = RecordLatency(request, result);
+    Trace(vspTraceComplete, vspTraceRequest, request->instance.load(), &request->response, (uint32_t) result, us);
+    CountTopology(request, result);
+    SnapshotResult(request, result);
+
+    std::shared_ptr<TVSPCall> call = std::move(request->call);
+    if (!call) {
+        NotifyResult(result, &request->response);
+        return;
+    }
+    FinishCall(call, result, &request->response);
+}
+
+// -------------------------------------------------------------------
+// First one wins, a late driver completion after the deadline is
+// dropped.
+//
+inline void VSPControllerPriv::FinishCall(const std::shared_ptr<TVSPCall>& call, IOReturn result, const TVSPControllerData* response)
+{
+    if (call->done.exchange(true)) {
+        return;
+    }
+
+    if (result == kIOReturnTimeout && !response) {
+        m_stats[call->command % vspLastCommand].timeouts++;
+    }
+
+    if (call->timeout) {
+        std::lock_guard<std::mutex> lock(m_deadlineLock);
+        m_deadlines.Remove(&call->timer);
+        call->armed.reset();
+    }
+
+    TVSPDispatch* d = new TVSPDispatch();
+    d->kind = vspDispatchCall;
+    d->result = result;
+    d->call = call;
+    if (response) {
+        d->response = *response;
+    }
+
+    if (!m_controlThread) {
+        Deliver(d);
+        delete d;
+        return;
+    }
+    Enqueue(d);
+}
+
+// -------------------------------------------------------------------
+// Deadline of a call waiting in the backlog for a free slot, the
+// call keeps itself alive until the deadline is disarmed.
+//
+inline void VSPControllerPriv::ArmDeadline(const std::shared_ptr<TVSPCall>& call)
+{
+    std::lock_guard<std::mutex> lock(m_deadlineLock);
+
+    if (call->done.load()) {
+        return;
+    }
+    call->armed = call;
+    ArmTimer(&call->timer, call->timeout);
+}
+
+// -------------------------------------------------------------------
+// Deadline of the driver completion of a submitted request. The
+// driver may complete it before, then the slot may serve a newer
+// request already.
+//
+inline void VSPControllerPriv::ArmRequest(TVSPRequest* request, const uint32_t id, const uint32_t timeout)
+{
+    if (!timeout) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_deadlineLock);
+    if (request->waiting.load() != id) {
+        return;
+    }
+    request->armed = id;
+    ArmTimer(&request->timer, timeout);
+}
+
+// -------------------------------------------------------------------
+// Caller holds m_deadlineLock. The thread is woken only if the new
+// deadline is due before it wakes anyway.
+//
+inline void VSPControllerPriv::ArmTimer(TVSPTimerLink* link, const uint32_t timeout)
+{
+    m_deadlines.Add(link, MonotonicUs(), (uint64_t) timeout * 1000);
+
+    if (!m_deadlineRunning) {
+        m_deadlineRunning = true;
+        m_deadlineThread = std::thread(&VSPControllerPriv::DeadlineThread, this);
+    }
+    if (link->due * VSP_TIMER_TICK_US < m_deadlineWakeUs) {
+        m_deadlineSignal.notify_one();
+    }
+}
+
+// -------------------------------------------------------------------
+// The driver completion, the deadline, the removal of the instance
+// and teardown race for a submitted request, the one claiming it
+// finishes and releases it.
+//
+inline bool VSPControllerPriv::ClaimRequest(TVSPRequest* request, const uint32_t id)
+{
+    // 0 is the claimed state, never a request
+    if (!id) {
+        return false;
+    }
+
+    uint32_t expected = id;
+    if (!request->waiting.compare_exchange_strong(expected, 0)) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_deadlineLock);
+    m_deadlines.Remove(&request->timer);
+    return true;
+}
+
+// -------------------------------------------------------------------
+// The request slot is free for the next request, a late completion
+// of the driver is dropped by AsyncCallback().
+//
+inline void VSPControllerPriv::ExpireRequest(TVSPRequest* request, const uint32_t id)
+{
+    if (!ClaimRequest(request, id)) {
+        return;
+    }
+
+    Trace(vspTraceComplete, vspTraceRequest, request->instance.load(), &request->response, (uint32_t) kIOReturnTimeout, 0);
+
+    std::shared_ptr<TVSPCall> call = std::move(request->call);
+    if (call) {
+        FinishCall(call, kIOReturnTimeout, nullptr);
+    }
+    else {
+        m_stats[request->command % vspLastCommand].timeouts++;
+        ReportError(kIOReturnTimeout, "Driver request timed out.");
+    }
+    ReleaseRequest(request);
+}
+
+// -------------------------------------------------------------------
+// Finishes the expired requests and backlog calls with
+// kIOReturnTimeout. Sleeps until the next deadline of the wheel.
+//
+void VSPControllerPriv::DeadlineThread()
+{
+    std::vector<std::pair<TVSPRequest*, uint32_t>> requests;
+    std::vector<std::shared_ptr<TVSPCall>> calls;
+    std::unique_lock<std::mutex> lock(m_deadlineLock);
+
+    while (m_deadlineRunning) {
+        if (m_deadlines.Empty()) {
+            m_deadlineWakeUs = UINT64_MAX;
+            m_deadlineSignal.wait(lock);
+            continue;
+        }
+
+        const uint64_t now = MonotonicUs();
+        const uint64_t next = m_deadlines.NextUs();
+        if (next > now) {
+            m_deadlineWakeUs = next;
+            m_deadlineSignal.wait_until(lock, std::chrono::steady_clock::time_point(std::chrono::microseconds(next)));
+            continue;
+        }
+
+        // request slots or calls, the link is the first member
+        m_deadlines.Advance(now, [&](TVSPTimerLink* link) {
+            TVSPRequest* request = reinterpret_cast<TVSPRequest*>(link);
+            if (request >= m_requests && request < m_requests + MAX_REQUESTS) {
+                requests.emplace_back(request, request->armed);
+                return;
+            }
+            calls.push_back(std::move(reinterpret_cast<TVSPCall*>(link)->armed));
+        });
+
+        lock.unlock();
+        for (const auto& expired : requests) {
+            ExpireRequest(expired.first, expired.second);
+        }
+        for (const std::shared_ptr<TVSPCall>& call : calls) {
+            FinishCall(call, kIOReturnTimeout, nullptr);
+        }
+        requests.clear();
+        calls.clear();
+        lock.lock();
+    }
+}
+
+// -------------------------------------------------------------------
+// MARK: Reconnect
+// -------------------------------------------------------------------
+
+// -------------------------------------------------------------------
+//
+//
+bool VSPControllerPriv::SetReconnect(const uint32_t minDelay, const uint32_t maxDelay)
+{
+    if (minDelay > maxDelay) {
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_reconnectLock);
+        m_reconnectMin = minDelay;
+        m_reconnectMax = maxDelay;
+    }
+    m_reconnectSignal.notify_all();
+    return true;
+}
+
+// -------------------------------------------------------------------
+//
+//
+void VSPControllerPriv::SetTopologyReplay(const bool enable)
+{
+    std::lock_guard<std::mutex> lock(m_topologyLock);
+
+    m_replay.store(enable);
+    if (!enable) {
+        for (uint8_t i = 0; i < MAX_INSTANCES; i++) {
+            m_topology[i].ports.clear();
+            m_topology[i].links.clear();
+        }
+    }
+}
+
+// -------------------------------------------------------------------
+//
+//
+const TVSPReconnectStats VSPControllerPriv::GetReconnectStats() const
+{
+    TVSPReconnectStats stats = {};
+
+    stats.attempts = m_reconnectStats.attempts.load();
+    stats.reconnects = m_reconnectStats.reconnects.load();
+    stats.replayed = m_reconnectStats.replayed.load();
+    stats.failed = m_reconnectStats.failed.load();
+    stats.lastOutageUs = m_reconnectStats.lastOutageUs.load();
+    stats.lastRestoreUs = m_reconnectStats.lastRestoreUs.load();
+    stats.maxRestoreUs = m_reconnectStats.maxRestoreUs.load();
+    return stats;
+}
+
+// -------------------------------------------------------------------
+// Rematch with exponential backoff while instances are lost. A new
+// loss or a changed setting wakes the supervisor early, the driver
+// notification of the transport may match an instance meanwhile.
+//
+void VSPControllerPriv::ReconnectThread()
+{
+    std::unique_lock<std::mutex> lock(m_reconnectLock);
+    uint32_t delay = m_reconnectMin;
+
+    while (m_reconnectRunning) {
+        bool lost = false;
+        for (uint8_t i = 0; i < MAX_INSTANCES && !lost; i++) {
+            lost = m_lost[i].lost;
+        }
+        if (!lost || !m_reconnectMin) {
+            m_reconnectSignal.wait(lock);
+            delay = m_reconnectMin;
+            continue;
+        }
+
+        if (m_reconnectSignal.wait_for(lock, std::chrono::milliseconds(delay)) == std::cv_status::no_timeout) {
+            continue;
+        }
+
+        lock.unlock();
+        m_reconnectStats.attempts++;
+        m_transport->Rematch();
+        lock.lock();
+
+        delay = (delay < m_reconnectMax / 2 ? delay * 2 : m_reconnectMax);
+        if (delay < m_reconnectMin) {
+            delay = m_reconnectMin;
+        }
+    }
+}
+
+// -------------------------------------------------------------------
+//
+//
+inline void VSPControllerPriv::StopReconnect()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_reconnectLock);
+        m_reconnectRunning = false;
+        for (uint8_t i = 0; i < MAX_INSTANCES; i++) {
+            m_lost[i].lost = false;
+            m_lost[i].topology.ports.clear();
+            m_lost[i].topology.links.clear();
+        }
+    }
+    m_reconnectSignal.notify_all();
+    if (m_reconnectThread.joinable()) {
+        m_reconnectThread.join();
+    }
+}
+
+// -------------------------------------------------------------------
+// The snapshot of a removed instance waits with its path, the
+// instance may get another slot when matched again.
+//
+inline void VSPControllerPriv::LoseInstance(const uint8_t index, const char* path)
+{
+    TVSPTopology topology;
+
+    {
+        std::lock_guard<std::mutex> lock(m_topologyLock);
+        topology.ports.swap(m_topology[index].ports);
+        topology.links.swap(m_topology[index].links);
+    }
+
+    std::lock_guard<std::mutex> lock(m_reconnectLock);
+    TVSPLostInstance* lost = nullptr;
+
+    if (!m_reconnectMin) {
+        return;
+    }
+    for (uint8_t i = 0; i < MAX_INSTANCES; i++) {
+        if (m_lost[i].lost && strcmp(m_lost[i].path, path) == 0) {
+            lost = &m_lost[i];
+            break;
+        }
+        if (!lost && !m_lost[i].lost) {
+            lost = &m_lost[i];
+        }
+    }
+    if (!lost) {
+        return;
+    }
+
+    lost->lost = true;
+    memset(lost->path, 0, sizeof(TVSPDeviceName));
+    strncpy(lost->path, path, sizeof(TVSPDeviceName) - 1);
+    lost->removedUs = MonotonicUs();
+    lost->topology.ports.swap(topology.ports);
+    lost->topology.links.swap(topology.links);
+
+    if (!m_reconnectRunning) {
+        if (m_reconnectThread.joinable()) {
+            m_reconnectThread.join();
+        }
+        m_reconnectRunning = true;
+        m_reconnectThread = std::thread(&VSPControllerPriv::ReconnectThread, this);
+    }
+    m_reconnectSignal.notify_all();
+}
+
+// -------------------------------------------------------------------
+//
+//
+inline void VSPControllerPriv::MatchLostInstance(const uint8_t index, const char* path)
+{
+    std::shared_ptr<TVSPTopology> topology;
+    uint64_t removedUs = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(m_reconnectLock);
+        for (uint8_t i = 0; i < MAX_INSTANCES; i++) {
+            TVSPLostInstance* lost = &m_lost[i];
+            if (lost->lost && strcmp(lost->path, path) == 0) {
+                topology = std::make_shared<TVSPTopology>();
+                topology->ports.swap(lost->topology.ports);
+                topology->links.swap(lost->topology.links);
+                removedUs = lost->removedUs;
+                lost->lost = false;
+                break;
+            }
+        }
+    }
+    if (!topology) {
         return;
     }
 
-    if (result != kIOReturnSuccess) {
-        ReportError(result, "Driver error occured.");
+    const uint64_t now = MonotonicUs();
+    m_reconnectStats.reconnects++;
+    m_reconnectStats.lastOutageUs.store(now - removedUs);
+    RestoreInstance(index, topology, now);
+}
+
+// -------------------------------------------------------------------
+// Replay into an empty instance only, a driver that kept its ports
+// across the removal keeps the snapshot as is.
+//
+inline void VSPControllerPriv::RestoreInstance(const uint8_t index, const std::shared_ptr<TVSPTopology>& topology, const uint64_t matchedUs)
+{
+    if (!m_replay.load() || topology->ports.empty()) {
+        FinishRestore(matchedUs);
+        return;
     }
 
-#ifdef VSP_DEBUG
-    PrintArray("AsyncCallback", msg, numArgs);
-#endif
+    const uint8_t outer = t_route;
+    t_route = index;
+    const bool submitted = Call(
+       [this]() {
+           return GetStatus();
+       },
+       VSP_RESTORE_TIMEOUT,
+       [this, index, topology, matchedUs](const TVSPResult& result) {
+           if (result.result != kIOReturnSuccess || result.data.ports.total != 0) {
+               KeepTopology(index, *topology);
+               FinishRestore(matchedUs);
+               return;
+           }
+           ReplayTopology(index, *topology, matchedUs);
+       });
+    t_route = outer;
+
+    if (!submitted) {
+        KeepTopology(index, *topology);
+        FinishRestore(matchedUs);
+    }
+}
 
-    // invalid driver signature
-    if ((msg[0] & MAGIC_CONTROL) != MAGIC_CONTROL) {
-        ReportError(result, "Invalid driver signature.");
+// -------------------------------------------------------------------
+// Each link goes into one batch with its two ports, the link refers
+// to them by batch index. The results update the snapshot with the
+// new port ids like any other batch.
+//
+inline void VSPControllerPriv::ReplayTopology(const uint8_t index, const TVSPTopology& topology, const uint64_t matchedUs)
+{
+    std::vector<std::vector<TVSPBatchOperation>> batches(1);
+    std::map<uint16_t, bool> placed;
+
+    auto create = [&batches](const TVSPPortParameters& parameters) -> uint16_t {
+        TVSPBatchOperation op = {};
+        op.command = vspControlCreatePort;
+        op.parameters = parameters;
+        batches.back().push_back(op);
+        return (uint16_t) (batches.back().size() - 1);
+    };
+
+    for (const auto& link : topology.links) {
+        auto source = topology.ports.find(link.first);
+        auto target = topology.ports.find(link.second);
+        if (source == topology.ports.end() || target == topology.ports.end()) {
+            continue;
+        }
+        if (batches.back().size() + 3 > MAX_BATCH_OPS) {
+            batches.emplace_back();
+        }
+
+        TVSPBatchOperation op = {};
+        op.command = vspControlLinkPorts;
+        op.flags = BATCH_REF_SOURCE | BATCH_REF_TARGET;
+        op.source = create(source->second);
+        op.target = create(target->second);
+        batches.back().push_back(op);
+        placed[link.first] = true;
+        placed[link.second] = true;
+    }
+    for (const auto& port : topology.ports) {
+        if (placed.count(port.first)) {
+            continue;
+        }
+        if (batches.back().size() + 1 > MAX_BATCH_OPS) {
+            batches.emplace_back();
+        }
+        create(port.second);
+    }
+
+    std::shared_ptr<std::atomic<uint32_t>> remaining = std::make_shared<std::atomic<uint32_t>>((uint32_t) batches.size());
+
+    const uint8_t outer = t_route;
+    t_route = index;
+    for (const std::vector<TVSPBatchOperation>& batch : batches) {
+        const uint8_t count = (uint8_t) batch.size();
+        const bool submitted = Call(
+           [this, &batch, count]() {
+               return ExecuteBatch(batch.data(), count);
+           },
+           VSP_RESTORE_TIMEOUT,
+           [this, remaining, count, matchedUs](const TVSPResult& result) {
+               TVSPBatchOperation ops[MAX_BATCH_OPS];
+               const uint8_t done = VSPController::GetBatchResults(&result.data, ops);
+               for (uint8_t i = 0; i < done; i++) {
+                   (ops[i].status == kIOReturnSuccess ? m_reconnectStats.replayed : m_reconnectStats.failed)++;
+               }
+               m_reconnectStats.failed += count - done;
+
+               m_controller->OnIOUCCallback(result.result, (void*) &result.data, sizeof(TVSPControllerData));
+               if (--(*remaining) == 0) {
+                   FinishRestore(matchedUs);
+               }
+           });
+        if (!submitted) {
+            m_reconnectStats.failed += count;
+            if (--(*remaining) == 0) {
+                FinishRestore(matchedUs);
+            }
+        }
+    }
+    t_route = outer;
+}
+
+// -------------------------------------------------------------------
+//
+//
+inline void VSPControllerPriv::KeepTopology(const uint8_t index, const TVSPTopology& topology)
+{
+    std::lock_guard<std::mutex> lock(m_topologyLock);
+
+    if (m_replay.load()) {
+        m_topology[index].ports.insert(topology.ports.begin(), topology.ports.end());
+        m_topology[index].links.insert(topology.links.begin(), topology.links.end());
+    }
+}
+
+// -------------------------------------------------------------------
+//
+//
+inline void VSPControllerPriv::FinishRestore(const uint64_t matchedUs)
+{
+    const uint64_t now = MonotonicUs();
+    const uint64_t us = (now > matchedUs ? now - matchedUs : 0);
+
+    m_reconnectStats.lastRestoreUs.store(us);
+    uint64_t value = m_reconnectStats.maxRestoreUs.load();
+    while (us > value && !m_reconnectStats.maxRestoreUs.compare_exchange_weak(value, us)) {
+    }
+}
+
+// -------------------------------------------------------------------
+// Apply a successful port or link command to a snapshot. Removing a
+// port drops its link like the driver does.
+//
+static inline void ApplyTopology(TVSPTopology* topology, const uint8_t command, const uint16_t source, const uint16_t target, const TVSPPortParameters* parameters)
+{
+    switch (command) {
+        case vspControlCreatePort: {
+            topology->ports[source] = *parameters;
+            break;
+        }
+        case vspControlRemovePort: {
+            topology->ports.erase(source);
+            for (auto it = topology->links.begin(); it != topology->links.end(); ++it) {
+                if (it->first == source || it->second == source) {
+                    topology->links.erase(it);
+                    break;
+                }
+            }
+            break;
+        }
+        case vspControlLinkPorts: {
+            topology->links[source] = target;
+            break;
+        }
+        case vspControlUnlinkPorts: {
+            auto it = topology->links.find(source);
+            if (it != topology->links.end() && it->second == target) {
+                topology->links.erase(it);
+            }
+            else if ((it = topology->links.find(target)) != topology->links.end() && it->second == source) {
+                topology->links.erase(it);
+            }
+            break;
+        }
+    }
+}
+
+// -------------------------------------------------------------------
+//
+//
+inline void VSPControllerPriv::SnapshotResult(const TVSPRequest* request, IOReturn result)
+{
+    const TVSPControllerData* response = &request->response;
+    const uint16_t source = response->parameter.link.source;
+    const uint16_t target = response->parameter.link.target;
+
+    if (!m_replay.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_topologyLock);
+    TVSPTopology* topology = &m_topology[request->instance.load() % MAX_INSTANCES];
+
+    // the batch status is the first failed operation, each one
+    // carries its own
+    if (request->command == vspControlBatch) {
+        TVSPBatchOperation ops[MAX_BATCH_OPS];
+        const uint8_t count = VSPController::GetBatchResults(response, ops);
+        for (uint8_t i = 0; i < count; i++) {
+            if (ops[i].status == kIOReturnSuccess) {
+                ApplyTopology(topology, ops[i].command, ops[i].source, ops[i].target, &ops[i].parameters);
+            }
+        }
+        return;
+    }
+
+    if (result == kIOReturnSuccess && response->status.code == 0) {
+        ApplyTopology(topology, request->command, source, target, &request->parameters);
+    }
+}
+
+// -------------------------------------------------------------------
+// Ports and links removed by other clients are not replayed
+//
+inline void VSPControllerPriv::SnapshotEvent(const uint8_t index, const TVSPEvent* event)
+{
+    if (!m_replay.load(std::memory_order_relaxed)) {
         return;
     }
 
-    if (m_vspResponse) {
-        m_controller->OnIOUCCallback(result, m_vspResponse, sizeof(TVSPControllerData));
+    std::lock_guard<std::mutex> lock(m_topologyLock);
+    TVSPTopology* topology = &m_topology[index % MAX_INSTANCES];
+
+    if (event->kind == vspEventPortRemoved) {
+        ApplyTopology(topology, vspControlRemovePort, event->id, event->id, nullptr);
+    }
+    else if (event->kind == vspEventLinkRemoved) {
+        ApplyTopology(topology, vspControlUnlinkPorts, event->source, event->target, nullptr);
+    }
+}
+
+// -------------------------------------------------------------------
+// MARK: Topology Reconciler
+// -------------------------------------------------------------------
+
+// -------------------------------------------------------------------
+//
+//
+static inline bool SameParameters(const TVSPPortParameters& a, const TVSPPortParameters& b)
+{
+    return a.baudRate == b.baudRate && a.dataBits == b.dataBits && a.stopBits == b.stopBits && //
+           a.parity == b.parity && a.flowCtrl == b.flowCtrl;
+}
+
+// -------------------------------------------------------------------
+// The instance is fixed here, the further requests are sent from
+// the completions of the previous ones.
+//
+bool VSPControllerPriv::Reconcile(const TVSPTopologySpec& spec, const uint32_t timeout, const TVSPReconcileCompletion& completion)
+{
+    std::vector<bool> linked(spec.ports.size(), false);
+
+    if (!completion || spec.ports.size() > UINT16_MAX) {
+        return false;
+    }
+    for (const auto& link : spec.links) {
+        const uint16_t a = link.first;
+        const uint16_t b = link.second;
+        if (a >= spec.ports.size() || b >= spec.ports.size() || a == b || linked[a] || linked[b]) {
+            ReportError(kIOReturnBadArgument, "Invalid link of the topology spec.");
+            return false;
+        }
+        linked[a] = linked[b] = true;
+    }
+
+    const uint8_t instance = (t_route < MAX_INSTANCES ? t_route : m_primary.load());
+    if (instance >= MAX_INSTANCES) {
+        return false;
+    }
+
+    std::shared_ptr<TVSPReconcile> state = std::make_shared<TVSPReconcile>();
+    state->instance = instance;
+    state->timeout = timeout;
+    state->spec = spec;
+    state->completion = completion;
+    state->result.instance = instance;
+    state->result.ports.assign(spec.ports.size(), 0);
+
+    return ReconcileRead(state);
+}
+
+// -------------------------------------------------------------------
+//
+//
+inline bool VSPControllerPriv::ReconcileSubmit(const std::shared_ptr<TVSPReconcile>& state, const TVSPCommandCall& call, const TVSPCompletion& completion)
+{
+    const uint8_t outer = t_route;
+
+    // counted before, the completion may run before Call() returns
+    state->result.roundTrips++;
+
+    t_route = state->instance;
+    const bool submitted = Call(call, state->timeout, completion);
+    t_route = outer;
+
+    if (!submitted) {
+        state->result.roundTrips--;
+    }
+    return submitted;
+}
+
+// -------------------------------------------------------------------
+// GetStatus brings the first page of both lists, the further pages
+// follow one by one. Returns false if a read was not submitted.
+//
+inline bool VSPControllerPriv::ReconcileRead(const std::shared_ptr<TVSPReconcile>& state)
+{
+    TVSPCommandCall call;
+    uint8_t command = vspControlGetStatus;
+
+    if (!state->result.roundTrips) {
+        call = [this]() {
+            return GetStatus();
+        };
+    }
+    else if (state->portCursor) {
+        command = vspControlGetPortList;
+        const uint16_t cursor = state->portCursor;
+        call = [this, cursor]() {
+            return GetPortList(cursor);
+        };
+    }
+    else if (state->linkCursor) {
+        command = vspControlGetLinkList;
+        const uint16_t cursor = state->linkCursor;
+        call = [this, cursor]() {
+            return GetLinkList(cursor);
+        };
     }
     else {
-        m_controller->OnErrorOccured(kIOReturnNoSpace, "[UC] No async result buffer.");
+        ReconcilePlan(state.get());
+        ReconcileNext(state);
+        return true;
+    }
+
+    return ReconcileSubmit(state, call, [this, state, command](const TVSPResult& result) {
+        const TVSPControllerData* data = &result.data;
+
+        if (result.result != kIOReturnSuccess) {
+            ReconcileFinish(state, result.result);
+            return;
+        }
+        if (command != vspControlGetLinkList) {
+            for (uint8_t i = 0; i < data->ports.count && i < MAX_SERIAL_PORTS; i++) {
+                state->ports.push_back(data->ports.list[i].id);
+            }
+            state->portCursor = data->ports.next;
+        }
+        if (command != vspControlGetPortList) {
+            for (uint8_t i = 0; i < data->links.count && i < MAX_PORT_LINKS; i++) {
+                state->links.push_back(data->links.list[i]);
+            }
+            state->linkCursor = data->links.next;
+        }
+
+        if (!ReconcileRead(state)) {
+            ReconcileFinish(state, kIOReturnError);
+        }
+    });
+}
+
+// -------------------------------------------------------------------
+// Keep the present links matching a spec link, then give the other
+// spec ports a present port, unlinked ones first. Reusing a linked
+// port costs one unlink at most, less than removing and creating it.
+//
+// The batches run in dependency order: unlinks and removals first,
+// then each missing link with the ports it creates in one batch, so
+// it refers to them by batch index.
+//
+inline void VSPControllerPriv::ReconcilePlan(TVSPReconcile* state)
+{
+    const TVSPTopologySpec& spec = state->spec;
+    TVSPReconcileResult* result = &state->result;
+    std::vector<uint16_t>& assigned = result->ports;
+    std::map<uint16_t, TVSPPortParameters> known;
+    std::map<uint16_t, uint16_t> partner;
+    std::map<uint16_t, bool> taken;
+    std::map<uint64_t, bool> keptItems;
+    std::vector<bool> keptLinks(spec.links.size(), false);
+
+    {
+        std::lock_guard<std::mutex> lock(m_topologyLock);
+        known = m_topology[state->instance].ports;
+    }
+
+    auto matches = [&known, &spec](const uint16_t index, const uint16_t id) {
+        auto it = known.find(id);
+        return it == known.end() || SameParameters(it->second, spec.ports[index]);
+    };
+    auto assign = [&assigned, &taken](const uint16_t index, const uint16_t id) {
+        assigned[index] = id;
+        taken[id] = true;
+    };
+
+    for (const uint64_t item : state->links) {
+        partner[VSP_LINK_SOURCE(item)] = VSP_LINK_TARGET(item);
+        partner[VSP_LINK_TARGET(item)] = VSP_LINK_SOURCE(item);
+    }
+
+    for (size_t j = 0; j < spec.links.size(); j++) {
+        const uint16_t a = spec.links[j].first;
+        const uint16_t b = spec.links[j].second;
+        for (const uint64_t item : state->links) {
+            const uint16_t s = VSP_LINK_SOURCE(item);
+            const uint16_t t = VSP_LINK_TARGET(item);
+            if (taken.count(s) || taken.count(t)) {
+                continue;
+            }
+            if (matches(a, s) && matches(b, t)) {
+                assign(a, s);
+                assign(b, t);
+            }
+            else if (matches(a, t) && matches(b, s)) {
+                assign(a, t);
+                assign(b, s);
+            }
+            else {
+                continue;
+            }
+            keptLinks[j] = true;
+            keptItems[item] = true;
+            result->keptLinks++;
+            break;
+        }
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+        for (uint16_t i = 0; i < (uint16_t) spec.ports.size(); i++) {
+            if (assigned[i]) {
+                continue;
+            }
+            for (const uint16_t id : state->ports) {
+                if (taken.count(id) || (pass == 0 && partner.count(id)) || !matches(i, id)) {
+                    continue;
+                }
+                assign(i, id);
+                break;
+            }
+        }
+    }
+    result->keptPorts = (uint16_t) taken.size();
+
+    // present ids and batch indices of this batch, see BATCH_REF_xxx
+    std::vector<TVSPBatchOperation>* batch = nullptr;
+    std::vector<int32_t>* creates = nullptr;
+    auto reserve = [state, &batch, &creates](const size_t count) {
+        if (!batch || batch->size() + count > MAX_BATCH_OPS) {
+            state->batches.emplace_back();
+            state->creates.emplace_back();
+            batch = &state->batches.back();
+            creates = &state->creates.back();
+        }
+    };
+    auto add = [&batch, &creates](const uint8_t command, const uint8_t flags, const uint16_t source, const uint16_t target, const int32_t index) {
+        TVSPBatchOperation op = {};
+        op.command = command;
+        op.flags = flags;
+        op.source = source;
+        op.target = target;
+        batch->push_back(op);
+        creates->push_back(index);
+        return (uint16_t) (batch->size() - 1);
+    };
+    auto create = [&spec, &batch, &add](const uint16_t index) {
+        const uint16_t op = add(vspControlCreatePort, 0, 0, 0, index);
+        (*batch)[op].parameters = spec.ports[index];
+        return op;
+    };
+
+    // a link with a removed port is dropped by the driver
+    for (const uint64_t item : state->links) {
+        const uint16_t s = VSP_LINK_SOURCE(item);
+        const uint16_t t = VSP_LINK_TARGET(item);
+        if (taken.count(s) && taken.count(t) && !keptItems.count(item)) {
+            reserve(1);
+            add(vspControlUnlinkPorts, 0, s, t, -1);
+            result->unlinked++;
+        }
+    }
+    for (const uint16_t id : state->ports) {
+        if (!taken.count(id)) {
+            reserve(1);
+            add(vspControlRemovePort, 0, id, id, -1);
+            result->removed++;
+        }
+    }
+
+    for (size_t j = 0; j < spec.links.size(); j++) {
+        if (keptLinks[j]) {
+            continue;
+        }
+        const uint16_t a = spec.links[j].first;
+        const uint16_t b = spec.links[j].second;
+        uint8_t flags = 0;
+        uint16_t source = assigned[a];
+        uint16_t target = assigned[b];
+
+        reserve(3);
+        if (!source) {
+            source = create(a);
+            flags |= BATCH_REF_SOURCE;
+            result->created++;
+        }
+        if (!target) {
+            target = create(b);
+            flags |= BATCH_REF_TARGET;
+            result->created++;
+        }
+        add(vspControlLinkPorts, flags, source, target, -1);
+        result->linked++;
+    }
+    for (uint16_t i = 0; i < (uint16_t) spec.ports.size(); i++) {
+        bool inLink = false;
+        for (const auto& link : spec.links) {
+            inLink = inLink || link.first == i || link.second == i;
+        }
+        if (!assigned[i] && !inLink) {
+            reserve(1);
+            create(i);
+            result->created++;
+        }
+    }
+
+    result->naiveRoundTrips = result->roundTrips + (uint32_t) (state->ports.size() + spec.ports.size() + spec.links.size());
+}
+
+// -------------------------------------------------------------------
+// The next batch is sent when the previous one is complete. Ports
+// created by the driver replace the batch index in the result.
+//
+inline void VSPControllerPriv::ReconcileNext(const std::shared_ptr<TVSPReconcile>& state)
+{
+    if (state->next >= state->batches.size()) {
+        ReconcileFinish(state, kIOReturnSuccess);
+        return;
+    }
+
+    const size_t index = state->next++;
+    const std::vector<TVSPBatchOperation>* batch = &state->batches[index];
+    const uint8_t count = (uint8_t) batch->size();
+
+    const bool submitted = ReconcileSubmit(
+       state,
+       [this, batch, count]() {
+           return ExecuteBatch(batch->data(), count);
+       },
+       [this, state, index, count](const TVSPResult& result) {
+           TVSPBatchOperation ops[MAX_BATCH_OPS];
+           const uint8_t done = VSPController::GetBatchResults(&result.data, ops);
+           const std::vector<int32_t>& creates = state->creates[index];
+
+           for (uint8_t i = 0; i < done; i++) {
+               if (ops[i].status != kIOReturnSuccess) {
+                   state->result.failed++;
+                   if (!state->result.result) {
+                       state->result.result = (int) ops[i].status;
+                   }
+               }
+               else if (creates[i] >= 0) {
+                   state->result.ports[creates[i]] = ops[i].source;
+               }
+           }
+           if (done < count) {
+               state->result.failed += count - done;
+               if (!state->result.result) {
+                   state->result.result = (result.result != kIOReturnSuccess ? result.result : kIOReturnError);
+               }
+           }
+
+           ReconcileNext(state);
+       });
+
+    if (!submitted) {
+        state->result.failed += count;
+        ReconcileFinish(state, kIOReturnError);
+    }
+}
+
+// -------------------------------------------------------------------
+// Runs on the thread of the last completion, like Call() ones.
+//
+inline void VSPControllerPriv::ReconcileFinish(const std::shared_ptr<TVSPReconcile>& state, const int result)
+{
+    if (!state->result.result) {
+        state->result.result = result;
+    }
+    state->completion(state->result);
+}
+
+// -------------------------------------------------------------------
+// MARK: Callback Dispatch
+// -------------------------------------------------------------------
+
+// -------------------------------------------------------------------
+// Without control thread the callbacks run on the thread of the
+// transport, otherwise a copy is queued for DispatchCompletions().
+//
+inline void VSPControllerPriv::NotifyResult(IOReturn result, const TVSPControllerData* response)
+{
+    if (!m_controlThread) {
+        m_controller->OnIOUCCallback(result, (void*) response, sizeof(TVSPControllerData));
+        return;
+    }
+
+    TVSPDispatch* d = new TVSPDispatch();
+    d->kind = vspDispatchResult;
+    d->result = result;
+    d->response = *response;
+    Enqueue(d);
+}
+
+// -------------------------------------------------------------------
+//
+//
+inline void VSPControllerPriv::NotifyEvent(const TVSPEvent* event)
+{
+    if (!m_controlThread) {
+        m_controller->OnEvent(event);
+        return;
+    }
+
+    TVSPDispatch* d = new TVSPDispatch();
+    d->kind = vspDispatchEvent;
+    d->event = *event;
+    Enqueue(d);
+}
+
+// -------------------------------------------------------------------
+//
+//
+inline void VSPControllerPriv::NotifyError(IOReturn error, const char* message)
+{
+    if (!m_controlThread) {
+        m_controller->OnErrorOccured(error, message);
+        return;
+    }
+
+    TVSPDispatch* d = new TVSPDispatch();
+    d->kind = vspDispatchError;
+    d->result = error;
+    strncpy(d->message, message, sizeof(d->message) - 1);
+    Enqueue(d);
+}
+
+// -------------------------------------------------------------------
+//
+//
+inline void VSPControllerPriv::NotifyConnection(bool connected)
+{
+    if (!m_controlThread) {
+        if (connected) {
+            m_controller->OnConnected();
+        }
+        else {
+            m_controller->OnDisconnected();
+        }
+        return;
+    }
+
+    TVSPDispatch* d = new TVSPDispatch();
+    d->kind = (connected ? vspDispatchConnected : vspDispatchDisconnected);
+    Enqueue(d);
+}
+
+// -------------------------------------------------------------------
+// Only the first callback after a dispatch notifies the caller.
+//
+inline void VSPControllerPriv::Enqueue(TVSPDispatch* d)
+{
+    m_dispatch.Push(&d->link);
+    if (!m_dispatchPending.exchange(true, std::memory_order_acq_rel)) {
+        m_controller->OnCompletionsPending();
+    }
+}
+
+// -------------------------------------------------------------------
+//
+//
+inline void VSPControllerPriv::Deliver(TVSPDispatch* d)
+{
+    switch (d->kind) {
+        case vspDispatchResult: {
+            m_controller->OnIOUCCallback(d->result, &d->response, sizeof(TVSPControllerData));
+            break;
+        }
+        case vspDispatchEvent: {
+            m_controller->OnEvent(&d->event);
+            break;
+        }
+        case vspDispatchError: {
+            m_controller->OnErrorOccured(d->result, d->message);
+            break;
+        }
+        case vspDispatchConnected: {
+            m_controller->OnConnected();
+            break;
+        }
+        case vspDispatchDisconnected: {
+            m_controller->OnDisconnected();
+            break;
+        }
+        case vspDispatchCall: {
+            TVSPResult result = {};
+            result.result = d->result;
+            result.data = d->response;
+            result.instance = d->call->instance;
+            d->call->completion(result);
+            break;
+        }
     }
 }
 
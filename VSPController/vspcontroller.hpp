@@ -9,20 +9,35 @@
 
 extern "C" {
 #define __FAVOR_BSD
+#include <stdint.h>
 #include <stdlib.h>
 }
 
+#include <functional>
+#include <future>
+#include <utility>
+#include <vector>
 #include <vspcontroller_global.h>
 
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#include <memory>
+#define VSP_HAVE_COROUTINES 1
+#endif
+
 /* The classes below are exported */
 #pragma GCC visibility push(default)
 
 namespace VSPClient {
 
 #define MAGIC_CONTROL    0xBE6605250000L
+/* Port and link list entries per response page */
 #define MAX_SERIAL_PORTS 16
 #define MAX_PORT_LINKS   16
 #define MAX_PORT_NAME    64
+#define MAX_REQUESTS     64
+/* Driver instances served by one controller */
+#define MAX_INSTANCES    8
 
 #ifndef VSP_UCD_SIZE
 #define VSP_UCD_SIZE sizeof(TVSPControllerData)
@@ -46,15 +61,25 @@ typedef enum {
     vspControlGetLinkList,
     vspControlEnableChecks,
     vspControlEnableTrace,
+    vspControlBatch,
+    vspControlGetChanges,
+    vspControlSubscribe,
     // Has to be last
     vspLastCommand,
 } TVSPControlCommand;
 
 typedef struct {
-    uint8_t id;
+    uint16_t id;
     char name[MAX_PORT_NAME];
 } TVSPPortListItem;
 
+/* Link list items are encoded as (link id << 32 | source << 16 | target) */
+#define VSP_LINK_ITEM(id, source, target) \
+    (((uint64_t) (id) << 32) | ((uint64_t) (source) << 16) | (uint64_t) (target))
+#define VSP_LINK_ID(item)     ((uint16_t) ((item) >> 32))
+#define VSP_LINK_SOURCE(item) ((uint16_t) ((item) >> 16))
+#define VSP_LINK_TARGET(item) ((uint16_t) (item))
+
 typedef struct {
     uint32_t baudRate;
     uint8_t dataBits;
@@ -83,50 +108,424 @@ typedef struct {
 
         /* port link parameters */
         struct PortLink {
-            uint8_t source;
-            uint8_t target;
+            uint16_t source;
+            uint16_t target;
         } link;
+
+        /* first port or link id of the requested list page */
+        uint16_t cursor;
     } parameter;
 
-    /* Available serial ports */
+    /* Available serial ports, one page starting at parameter.cursor */
     struct PortList {
         uint8_t count;
+        /* number of ports of the driver */
+        uint16_t total;
+        /* cursor of the next page, 0 = last page */
+        uint16_t next;
         TVSPPortListItem list[MAX_SERIAL_PORTS];
     } ports;
 
-    /* Available serial port links */
+    /* Available serial port links, one page starting at parameter.cursor */
     struct LinkList {
         uint8_t count;
+        /* number of links of the driver */
+        uint16_t total;
+        /* cursor of the next page, 0 = last page */
+        uint16_t next;
         uint64_t list[MAX_PORT_LINKS];
     } links;
 
+    /* Request identifier, echoed by the driver. The IOKit
+     * transport translates this structure to the layout of
+     * the DEXT, which has no 16 bit ids, no list paging and
+     * ends before this field. */
+    uint32_t request;
+
+    /* Topology generation of the driver, incremented on each port
+     * or link change. Input of vspControlGetChanges. */
+    uint32_t generation;
+
 } TVSPControllerData;
 
+/* Batch operation flags: source / target is the index of an
+ * earlier vspControlCreatePort operation of the same batch */
+#define BATCH_REF_SOURCE 0x01
+#define BATCH_REF_TARGET 0x02
+
+typedef struct {
+    /* vspControlCreatePort .. vspControlUnlinkPorts,
+     * vspControlEnableChecks or vspControlEnableTrace */
+    uint8_t command;
+    /* BATCH_REF_xxx flags */
+    uint8_t flags;
+    /* Port id or batch index (BATCH_REF_SOURCE) */
+    uint16_t source;
+    /* Port id or batch index (BATCH_REF_TARGET) */
+    uint16_t target;
+    uint16_t reserved;
+    /* vspControlCreatePort only */
+    TVSPPortParameters parameters;
+    /* Operation status set by the driver */
+    uint32_t status;
+} TVSPBatchOperation;
+
+/* Batch operations are packed into ports.list */
+#define MAX_BATCH_OPS 48
+
+static_assert(MAX_BATCH_OPS * sizeof(TVSPBatchOperation) <= sizeof(TVSPControllerData::PortList::list),
+              "TVSPBatchOperation array does not fit into ports.list");
+
+typedef enum {
+    vspChangePortAdded = 0x01,
+    vspChangePortRemoved = 0x02,
+    vspChangeLinkAdded = 0x03,
+    vspChangeLinkRemoved = 0x04,
+} TVSPChangeKind;
+
+typedef struct {
+    /* TVSPChangeKind */
+    uint8_t kind;
+    uint8_t reserved;
+    /* Port or link id */
+    uint16_t id;
+    /* Linked ports, the port id itself for port changes */
+    uint16_t source;
+    uint16_t target;
+    /* Port name of vspChangePortAdded */
+    char name[MAX_PORT_NAME];
+} TVSPChangeItem;
+
+/* Change items are packed into ports.list */
+#define MAX_CHANGE_ITEMS 14
+
+static_assert(MAX_CHANGE_ITEMS * sizeof(TVSPChangeItem) <= sizeof(TVSPControllerData::PortList::list),
+              "TVSPChangeItem array does not fit into ports.list");
+
+typedef enum {
+    vspEventPortAdded = vspChangePortAdded,
+    vspEventPortRemoved = vspChangePortRemoved,
+    vspEventLinkAdded = vspChangeLinkAdded,
+    vspEventLinkRemoved = vspChangeLinkRemoved,
+    vspEventModemSignal = 0x05,
+} TVSPEventKind;
+
+/* Subscription mask of the events to deliver */
+#define VSP_EVENT_MASK(kind) (1UL << (kind))
+#define VSP_EVENT_ALL                                                                                 \
+    (VSP_EVENT_MASK(vspEventPortAdded) | VSP_EVENT_MASK(vspEventPortRemoved) |                         \
+     VSP_EVENT_MASK(vspEventLinkAdded) | VSP_EVENT_MASK(vspEventLinkRemoved) |                         \
+     VSP_EVENT_MASK(vspEventModemSignal))
+
+/* Modem signals of vspEventModemSignal */
+#define VSP_SIGNAL_DTR 0x01
+#define VSP_SIGNAL_RTS 0x02
+#define VSP_SIGNAL_CTS 0x04
+#define VSP_SIGNAL_DSR 0x08
+#define VSP_SIGNAL_DCD 0x10
+#define VSP_SIGNAL_RI  0x20
+
+typedef struct {
+    /* TVSPEventKind */
+    uint8_t kind;
+    /* Port or link id */
+    uint16_t id;
+    /* Linked ports, the port id itself for port events */
+    uint16_t source;
+    uint16_t target;
+    /* VSP_SIGNAL_xxx of vspEventModemSignal */
+    uint32_t modemLines;
+    /* Topology generation after the event */
+    uint32_t generation;
+} TVSPEvent;
+
 typedef struct {
     int system;
     int sub;
     int code;
 } TVSPSystemError;
 
+typedef struct {
+    /* Driver response mappings established */
+    uint64_t created;
+    /* Requests served by an already established mapping */
+    uint64_t reused;
+    /* Mappings released on teardown */
+    uint64_t released;
+    /* The transport maps driver responses. The loopback and the vspd
+     * socket transport do not, their counters stay 0. */
+    bool supported;
+} TVSPMappingStats;
+
+typedef struct {
+    /* Messages sent and received in compact wire format */
+    uint64_t messages;
+    /* Bytes of these messages on the wire */
+    uint64_t wireBytes;
+    /* Bytes the same messages take as TVSPControllerData */
+    uint64_t blobBytes;
+} TVSPWireStats;
+
+/* Log-linear latency buckets in microseconds, 4 per power of two:
+ * 0..3 exact, then 25% wide up to about 30 seconds */
+#define VSP_LATENCY_BUCKETS 96
+
+typedef struct {
+    /* Requests completed by the driver */
+    uint64_t completed;
+    /* Completed with an error status */
+    uint64_t errors;
+    /* Submission failed, no driver completion */
+    uint64_t rejected;
+    /* Deadline passed before the completion, see Call() and
+     * SetRequestTimeout() */
+    uint64_t timeouts;
+    /* Driver completions after the deadline, dropped */
+    uint64_t late;
+    /* Submit to completion latency of the completed requests, the
+     * minimum is at least 1 us */
+    uint64_t sumUs;
+    uint64_t minUs;
+    uint64_t maxUs;
+    uint64_t buckets[VSP_LATENCY_BUCKETS];
+} TVSPCommandStats;
+
+typedef struct {
+    /* Indexed by TVSPControlCommand */
+    TVSPCommandStats commands[vspLastCommand];
+} TVSPStatistics;
+
+typedef enum : uint8_t {
+    vspTraceOff = 0,
+    /* Errors reported through OnErrorOccured */
+    vspTraceError,
+    /* Submission and completion of each request */
+    vspTraceRequest,
+    /* Instant responses and subscription events too */
+    vspTraceVerbose,
+} TVSPTraceLevel;
+
+typedef enum : uint8_t {
+    vspTraceSubmit = 1,
+    vspTraceResponse,
+    vspTraceComplete,
+    vspTraceEvent,
+    vspTraceFailure,
+} TVSPTracePoint;
+
+typedef struct {
+    /* Position in the trace, gaps are overwritten records */
+    uint64_t sequence;
+    /* Steady clock in microseconds */
+    uint64_t timeUs;
+    /* status.flags, event: 0 */
+    uint64_t flags;
+    /* parameter.flags, event: modem lines */
+    uint64_t parameter;
+    uint32_t request;
+    /* IOReturn of the completion or error, status.code otherwise */
+    uint32_t status;
+    uint32_t generation;
+    /* Submit to completion, vspTraceComplete only */
+    uint32_t latencyUs;
+    /* parameter.link, event: source and target */
+    uint16_t source;
+    uint16_t target;
+    /* parameter.cursor, event: port or link id */
+    uint16_t cursor;
+    /* TVSPTracePoint */
+    uint8_t point;
+    /* TVSPControlCommand, event: TVSPEventKind */
+    uint8_t command;
+    /* Driver instance of the request */
+    uint8_t instance;
+    uint8_t reserved[7];
+} TVSPTraceRecord;
+
+static_assert(sizeof(TVSPTraceRecord) == 64, "Trace record must fill 64 bytes");
+
+typedef struct {
+    /* Slot of the instance, stable until it is removed */
+    uint8_t index;
+    /* Last port and link count reported by the instance */
+    uint16_t ports;
+    uint16_t links;
+    /* Requests sent to the instance */
+    uint64_t submitted;
+    /* Completed by the instance, with error status too */
+    uint64_t completed;
+    uint64_t errors;
+    /* Submission failed, no driver completion */
+    uint64_t rejected;
+    /* Submit to completion latency of the completed requests */
+    uint64_t sumUs;
+    /* Registry name and path of the driver service */
+    char name[128];
+    char path[128];
+} TVSPInstanceInfo;
+
+typedef struct {
+    /* Rematch attempts of the reconnect supervisor */
+    uint64_t attempts;
+    /* Removed instances matched again */
+    uint64_t reconnects;
+    /* Batch operations of the topology replay, failed ones */
+    uint64_t replayed;
+    uint64_t failed;
+    /* Removal to match of the last reconnect */
+    uint64_t lastOutageUs;
+    /* Match to replayed topology of the last reconnect */
+    uint64_t lastRestoreUs;
+    uint64_t maxRestoreUs;
+} TVSPReconnectStats;
+
+typedef struct {
+    /* IOReturn of the request, kIOReturnTimeout if the deadline
+     * passed, kIOReturnNotOpen if the driver instance went away,
+     * kIOReturnAborted if the connection was closed */
+    int result;
+    /* Response of the driver, empty without driver completion */
+    TVSPControllerData data;
+    /* Driver instance the request was sent to */
+    uint8_t instance;
+} TVSPResult;
+
+/* Completion of a request submitted by Call() */
+typedef std::function<void(const TVSPResult& result)> TVSPCompletion;
+
+/* Command method call, e.g. [&]() { return vsp->GetStatus(); } */
+typedef std::function<bool()> TVSPCommandCall;
+
+typedef struct {
+    /* Ports to exist on the instance */
+    std::vector<TVSPPortParameters> ports;
+    /* Links as indices into 'ports', a port is part of one link only */
+    std::vector<std::pair<uint16_t, uint16_t>> links;
+} TVSPTopologySpec;
+
+typedef struct {
+    /* IOReturn of the first failed request or batch operation */
+    int result;
+    /* Driver instance reconciled */
+    uint8_t instance;
+    /* Port id of each port of the spec, 0 if it was not created */
+    std::vector<uint16_t> ports;
+    /* Present ports and links taken over */
+    uint16_t keptPorts;
+    uint16_t keptLinks;
+    /* Batch operations issued, failed ones */
+    uint16_t removed;
+    uint16_t created;
+    uint16_t unlinked;
+    uint16_t linked;
+    uint16_t failed;
+    /* Driver round trips: list reads and batches */
+    uint32_t roundTrips;
+    /* Round trips of removing all present ports and creating the
+     * spec with one call per port and link */
+    uint32_t naiveRoundTrips;
+} TVSPReconcileResult;
+
+/* Completion of Reconcile() */
+typedef std::function<void(const TVSPReconcileResult& result)> TVSPReconcileCompletion;
+
 class VSPControllerPriv;
 
+// -------------------------------------------------------------------
+// The command methods may be called from any thread. Each request
+// takes one of MAX_REQUESTS response slots, further requests wait in
+// a backlog until a slot is released. ConnectDriver(), the control
+// thread setup and the destructor belong to the owning thread.
+//
+// Each matched driver instance (up to MAX_INSTANCES) gets its own
+// connection. Port and link ids are local to an instance. Requests
+// go to the first instance unless sent through Route(). CreatePort()
+// outside Route() picks the instance with the fewest ports.
+//
 class VSPCONTROLLER_EXPORT VSPController
 {
 public:
     VSPController();
     ~VSPController();
+    /** ----------------------
+     * Serve the driver connection on an own control thread. The
+     * callbacks (OnIOUCCallback, OnEvent, OnConnected, OnDisconnected
+     * and OnErrorOccured) are queued then and run by
+     * DispatchCompletions() on the thread of the caller. Set before
+     * ConnectDriver(), returns false while connected.
+     */
+    bool SetControlThread(const bool enable);
+    /** ----------------------
+     * Run the callbacks queued by the control thread and return their
+     * count. Call from one thread only, e.g. the UI thread after
+     * OnCompletionsPending().
+     */
+    uint32_t DispatchCompletions();
+    /** ----------------------
+     * Connect through the vspd daemon listening at 'path' instead of
+     * the driver, nullptr connects to the driver again. Many
+     * processes share the driver connection of the daemon this way.
+     * Set before ConnectDriver(), returns false while connected.
+     */
+    bool SetDaemonSocket(const char* path);
     /** ----------------------
      *
      */
     bool ConnectDriver();
     /** ----------------------
-     *
+     * Close the driver connection. No callback runs after return, so
+     * subclasses call it in their destructor. Not from a callback.
+     */
+    void DisconnectDriver();
+    /** ----------------------
+     * Registry name of the first driver instance
      */
     const char* DeviceName() const;
     /** ----------------------
-     *
+     * Registry path of the first driver instance
      */
     const char* DevicePath() const;
+    /** ----------------------
+     * Number of matched driver instances
+     */
+    uint8_t InstanceCount() const;
+    /** ----------------------
+     * Copy the info of up to 'count' matched instances into 'infos'
+     * in slot order and return their number.
+     */
+    uint8_t GetInstances(TVSPInstanceInfo* infos, const uint8_t count) const;
+    /** ----------------------
+     * Info of the instance with registry path 'devicePath'. Returns
+     * false if no such instance is matched.
+     */
+    bool GetInstance(const char* devicePath, TVSPInstanceInfo* info) const;
+    /** ----------------------
+     * Match removed driver instances again, the first attempt after
+     * 'minDelay' ms, each further one after twice the delay up to
+     * 'maxDelay' ms. 0 disables. Returns false if min > max.
+     */
+    bool SetReconnect(const uint32_t minDelay, const uint32_t maxDelay);
+    /** ----------------------
+     * Keep a snapshot of the ports and links created through this
+     * controller per instance. When a removed instance is matched
+     * again without any ports, the snapshot is replayed as batch and
+     * its results are passed to OnIOUCCallback. Port ids may differ
+     * after the replay.
+     */
+    void SetTopologyReplay(const bool enable);
+    /** ----------------------
+     * Counters of the reconnect supervisor and the topology replay
+     */
+    const TVSPReconnectStats GetReconnectStats() const;
+    /** ----------------------
+     * Run one of the command methods with its requests sent to the
+     * instance at 'devicePath', like Call() on this thread:
+     *
+     *   vsp->Route(path, [&]() { return vsp->RemovePort(id); });
+     *
+     * Returns false without calling if no such instance is matched.
+     */
+    bool Route(const char* devicePath, const TVSPCommandCall& call);
     /** ----------------------
      *
      */
@@ -136,37 +535,186 @@ public:
      */
     bool IsConnected();
     /** ----------------------
-     *
+     * Create a port on the instance with the fewest ports, or on the
+     * instance of Route(). TVSPResult::instance tells which one.
      */
     bool CreatePort(TVSPPortParameters* parameters);
     /** ----------------------
      *
      */
-    bool RemovePort(const uint8_t id);
+    bool RemovePort(const uint16_t id);
+    /** ----------------------
+     * Request one page of up to MAX_SERIAL_PORTS ports starting at
+     * port id 'cursor'. Continue with ports.next of the response
+     * until it is 0.
+     */
+    bool GetPortList(const uint16_t cursor = 0);
+    /** ----------------------
+     * Request one page of up to MAX_PORT_LINKS links starting at
+     * link id 'cursor'. Continue with links.next of the response
+     * until it is 0.
+     */
+    bool GetLinkList(const uint16_t cursor = 0);
     /** ----------------------
      *
      */
-    bool GetPortList();
+    bool LinkPorts(const uint16_t source, const uint16_t target);
     /** ----------------------
      *
      */
-    bool GetLinkList();
+    bool UnlinkPorts(const uint16_t source, const uint16_t target);
     /** ----------------------
      *
      */
-    bool LinkPorts(const uint8_t source, const uint8_t target);
+    bool EnableChecks(const uint16_t port);
     /** ----------------------
      *
      */
-    bool UnlinkPorts(const uint8_t source, const uint8_t target);
+    bool EnableTrace(const uint16_t port);
+    /** ----------------------
+     * Apply up to MAX_BATCH_OPS operations in one driver round trip.
+     * The operations are executed in order, the status of each one
+     * is returned in the response, see GetBatchResults().
+     */
+    bool ExecuteBatch(const TVSPBatchOperation* operations, const uint8_t count);
+    /** ----------------------
+     * Copy the operation results of a vspControlBatch response into
+     * 'operations' (MAX_BATCH_OPS entries) and return their count.
+     * For created ports 'source' and 'target' hold the new port id.
+     */
+    static uint8_t GetBatchResults(const TVSPControllerData* response, TVSPBatchOperation* operations);
+    /** ----------------------
+     * Request the port and link changes after topology 'generation'
+     * in order of occurrence. The response carries up to
+     * MAX_CHANGE_ITEMS changes and the generation reached, ports.next
+     * is set if more changes follow. Fails with kIOReturnOverrun if
+     * the driver no longer holds the changes or 'generation' stems
+     * from before a driver restart, reload the topology with
+     * GetStatus() then.
+     */
+    bool GetChanges(const uint32_t generation);
+    /** ----------------------
+     * Copy the change items of a vspControlGetChanges response into
+     * 'changes' (MAX_CHANGE_ITEMS entries) and return their count.
+     */
+    static uint8_t GetChangeItems(const TVSPControllerData* response, TVSPChangeItem* changes);
+    /** ----------------------
+     * Subscribe to the driver events of 'mask' (VSP_EVENT_xxx). The
+     * events are delivered through OnEvent() until Unsubscribe().
+     * A new subscription replaces the current one.
+     */
+    bool Subscribe(const uint32_t mask = VSP_EVENT_ALL);
+    /** ----------------------
+     * Cancel the event subscription
+     */
+    bool Unsubscribe();
+    /** ----------------------
+     * Event subscription is active
+     */
+    bool IsSubscribed() const;
+    /** ----------------------
+     * Response memory mapping counters of the driver connection,
+     * only the IOKit transport maps responses, see 'supported'
+     */
+    const TVSPMappingStats GetMappingStats() const;
+    /** ----------------------
+     * Compact wire format counters of the driver connection
+     */
+    const TVSPWireStats GetWireStats() const;
+    /** ----------------------
+     * Per command latency and error counters of all instances since
+     * construction, see GetInstances() for each instance. The
+     * snapshot is read without locks, counters of requests completing
+     * meanwhile may be off by one.
+     */
+    const TVSPStatistics GetStatistics() const;
+    /** ----------------------
+     * Latency bucket of 'us' microseconds
+     */
+    static uint32_t LatencyBucket(const uint64_t us);
+    /** ----------------------
+     * Lowest latency in microseconds counted in 'bucket'
+     */
+    static uint64_t LatencyBucketLow(const uint32_t bucket);
+    /** ----------------------
+     * Latency in microseconds below which 'percent' of the completed
+     * requests are, e.g. 99.0. Resolution is the bucket width.
+     */
+    static uint64_t LatencyPercentile(const TVSPCommandStats* stats, const double percent);
+    /** ----------------------
+     * Select the records taken by the trace ring, see vsptrace.hpp.
+     * Errors are printed to stderr unless the trace is off. Default
+     * vspTraceError.
+     */
+    void SetTraceLevel(const TVSPTraceLevel level);
     /** ----------------------
      *
      */
-    bool EnableChecks(const uint8_t port);
+    TVSPTraceLevel TraceLevel() const;
+    /** ----------------------
+     * Copy up to 'count' trace records starting at sequence '*cursor'
+     * and advance the cursor. Start with 0 for the oldest one.
+     */
+    uint32_t ReadTrace(TVSPTraceRecord* records, const uint32_t count, uint64_t* cursor) const;
     /** ----------------------
+     * Save the trace ring in binary trace file format, decode it with
+     * VSPTraceDecode()
+     */
+    bool SaveTrace(const char* path) const;
+    /** ----------------------
+     * Identifier of the last submitted request. The response passed
+     * to OnIOUCCallback carries the same value in 'request'.
+     */
+    uint32_t LastRequestId() const;
+    /** ----------------------
+     * Number of submitted requests waiting for a free request slot
+     * or the driver completion, the event subscription not included
+     */
+    uint32_t PendingRequests() const;
+    /** ----------------------
+     * Run one of the command methods above and bind 'completion' to
+     * the request it submits. The completion replaces OnIOUCCallback
+     * for this request and is called once: with the driver result or
+     * with kIOReturnTimeout after 'timeout' ms (0 = the deadline of
+     * SetRequestTimeout()).
+     * Runs on the transport thread or by DispatchCompletions() in
+     * control thread mode. Returns false if nothing was submitted,
+     * the completion is not called then. A command method which
+     * succeeds without submitting a request completes at once with
+     * kIOReturnUnsupported.
+     */
+    bool Call(const TVSPCommandCall& call, const uint32_t timeout, const TVSPCompletion& completion);
+    /** ----------------------
+     * Deadline in ms of the requests without one of Call(), 0 = none.
+     * A request the driver does not complete in time is finished
+     * with kIOReturnTimeout through OnErrorOccured and its slot is
+     * free for the next request, a late completion is dropped.
+     * Default 5000 ms.
+     */
+    void SetRequestTimeout(const uint32_t timeout);
+    /** ----------------------
+     * Call() with the result delivered through a future. Requests
+     * not submitted resolve at once with kIOReturnNotOpen or
+     * kIOReturnError.
+     */
+    std::future<TVSPResult> Async(const TVSPCommandCall& call, const uint32_t timeout);
+    /** ----------------------
+     * Bring the instance (the first one or the one of Route()) to the
+     * topology of 'spec' with the fewest operations. The present port
+     * and link lists are read, ports and links matching the spec are
+     * kept, the others are unlinked and removed, the missing ports
+     * are created and linked. The operations go in dependency order
+     * to the driver as batches of up to MAX_BATCH_OPS.
      *
+     * The driver does not report the parameters of a port. They are
+     * compared for the ports in the topology snapshot only (see
+     * SetTopologyReplay()), other ports match any parameters.
+     *
+     * 'completion' runs like the one of Call() when done, 'timeout'
+     * is the deadline of each request. Returns false if the spec is
+     * invalid or the first request was not submitted.
      */
-    bool EnableTrace(const uint8_t port);
+    bool Reconcile(const TVSPTopologySpec& spec, const uint32_t timeout, const TVSPReconcileCompletion& completion);
 
 protected:
     friend class VSPControllerPriv;
@@ -191,7 +739,17 @@ protected:
      */
     virtual void OnDataReady(void*) = 0;
     /** ----------------------
-     *
+     * Driver event of the subscription. Called on the completion
+     * thread of the transport like OnIOUCCallback.
+     */
+    virtual void OnEvent(const TVSPEvent* event);
+    /** ----------------------
+     * Callbacks wait for DispatchCompletions(). Called on the control
+     * thread when the first one is queued after the last dispatch.
+     */
+    virtual void OnCompletionsPending();
+    /** ----------------------
+     * Connection of the first driver instance
      */
     int GetConnection();
     /** ----------------------
@@ -203,6 +761,64 @@ private:
     VSPControllerPriv* p;
 };
 
+#ifdef VSP_HAVE_COROUTINES
+// -------------------------------------------------------------------
+// C++20 awaitable of a command call, the coroutine is resumed on the
+// thread of the completion, see VSPController::Call():
+//
+//   TVSPResult r = co_await VSPAwaitable(vsp, [&]() {
+//       return vsp->CreatePort(&parameters);
+//   }, 500);
+//
+class VSPAwaitable
+{
+public:
+    VSPAwaitable(VSPController* controller, TVSPCommandCall call, const uint32_t timeout)
+        : m_controller(controller)
+        , m_call(std::move(call))
+        , m_timeout(timeout)
+        , m_state(std::make_shared<TState>())
+    {
+    }
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+        std::shared_ptr<TState> state = m_state;
+        state->handle = handle;
+
+        const bool submitted = m_controller->Call(m_call, m_timeout, [state](const TVSPResult& result) {
+            state->result = result;
+            state->handle.resume();
+        });
+        if (!submitted) {
+            state->result.result = (int) 0xe00002bc; // kIOReturnError
+        }
+        return submitted;
+    }
+
+    TVSPResult await_resume() const
+    {
+        return m_state->result;
+    }
+
+private:
+    typedef struct {
+        std::coroutine_handle<> handle;
+        TVSPResult result;
+    } TState;
+
+    VSPController* m_controller;
+    TVSPCommandCall m_call;
+    uint32_t m_timeout;
+    std::shared_ptr<TState> m_state;
+};
+#endif
+
 } // END namespace
 
 #pragma GCC visibility pop
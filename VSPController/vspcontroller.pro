@@ -21,24 +21,49 @@ DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000
 DEFINES += VSP_DEBUG
 
 SOURCES += \
-    vspcontroller.cpp
+    vspcontroller.cpp \
+    vspsockettransport.cpp \
+    vsptrace.cpp \
+    vspwire.cpp
 
 HEADERS += \
     vspcontroller.hpp \
     vspcontroller_global.h \
-    vspcontrollerpriv.hpp
+    vspcontrollerpriv.hpp \
+    vspqueue.hpp \
+    vspring.hpp \
+    vspsocket.hpp \
+    vsptimerwheel.hpp \
+    vsptrace.hpp \
+    vsptransport.hpp \
+    vspwire.hpp
+
+# Driver transport: IOKit user client of the VSPDriver DEXT
+mac {
+    SOURCES += vspiokittransport.cpp
+}
+
+# Driver transport: in-process driver emulation (CI / benchmarks)
+linux {
+    CONFIG -= lib_bundle
+    SOURCES += vsploopback.cpp vspptyengine.cpp
+    HEADERS += vsploopback.hpp vspptyengine.hpp
+    LIBS += -lpthread
+}
 
 DISTFILES += \
     Info.plist \
     LICENSE
 
-QMAKE_CFLAGS   += -mmacosx-version-min=12.2
-QMAKE_CXXFLAGS += -mmacosx-version-min=12.2
+mac {
+    QMAKE_CFLAGS   += -mmacosx-version-min=12.2
+    QMAKE_CXXFLAGS += -mmacosx-version-min=12.2
+}
 QMAKE_CXXFLAGS += -fno-omit-frame-pointer
 QMAKE_CXXFLAGS += -funwind-tables
 QMAKE_CXXFLAGS += -ggdb3
 
-QMAKE_LFLAGS_SONAME = -Wl,-install_name,@executable_path/../Frameworks/
+mac:QMAKE_LFLAGS_SONAME = -Wl,-install_name,@executable_path/../Frameworks/
 
 QMAKE_PROJECT_NAME = VSPController
 QMAKE_FRAMEWORK_BUNDLE_NAME = VSPController
@@ -62,9 +87,11 @@ icons.path = Resources
 QMAKE_BUNDLE_DATA += icons
 
 #otool -L
-LIBS += -dead_strip
-LIBS += -framework CoreFoundation
-LIBS += -framework IOKit
-LIBS += -liconv
+mac {
+    LIBS += -dead_strip
+    LIBS += -framework CoreFoundation
+    LIBS += -framework IOKit
+    LIBS += -liconv
+}
 
 message("Build: $${TARGET}")
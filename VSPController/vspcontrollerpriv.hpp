@@ -6,11 +6,16 @@
 // SPDX-License-Identifier: MIT
 // ********************************************************************
 
-#include <CoreFoundation/CFNotificationCenter.h>
-#include <CoreFoundation/CoreFoundation.h>
-#include <IOKit/IOKitLib.h>
-#include <IOKit/IOTypes.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
 #include <vspcontroller.hpp>
+#include <vspqueue.hpp>
+#include <vsptrace.hpp>
+#include <vsptransport.hpp>
 
 namespace VSPClient {
 
@@ -19,6 +24,150 @@ class VSPController;
 /* The classes below are not exported */
 #pragma GCC visibility push(hidden)
 
+// -------------------------------------------------------------------
+// Callback of the control thread waiting for DispatchCompletions()
+//
+typedef enum {
+    vspDispatchResult = 1,
+    vspDispatchEvent,
+    vspDispatchError,
+    vspDispatchConnected,
+    vspDispatchDisconnected,
+    vspDispatchCall,
+} TVSPDispatchKind;
+
+// -------------------------------------------------------------------
+// Completion bound to a request by VSPController::Call(). Finished
+// once, either by the driver completion, the deadline or teardown.
+//
+typedef struct TVSPCall {
+    /* Deadline while waiting in the backlog, see ArmDeadline() */
+    TVSPTimerLink timer;
+    /* Keeps the call alive while its deadline is armed */
+    std::shared_ptr<TVSPCall> armed;
+    std::atomic<bool> done;
+    /* Request submitted or queued in the backlog */
+    bool accepted;
+    uint8_t command;
+    uint8_t instance;
+    /* Request identifier, 0 = not submitted yet */
+    uint32_t request;
+    uint32_t timeout;
+    TVSPCompletion completion;
+} TVSPCall;
+
+// -------------------------------------------------------------------
+// Statistics of one command, updated by the completing thread and
+// read by GetStatistics() without locks.
+//
+typedef struct {
+    std::atomic<uint64_t> completed;
+    std::atomic<uint64_t> errors;
+    std::atomic<uint64_t> rejected;
+    std::atomic<uint64_t> timeouts;
+    std::atomic<uint64_t> late;
+    std::atomic<uint64_t> sumUs;
+    std::atomic<uint64_t> minUs;
+    std::atomic<uint64_t> maxUs;
+    std::atomic<uint64_t> buckets[VSP_LATENCY_BUCKETS];
+} TVSPCommandCounters;
+
+// -------------------------------------------------------------------
+// Request waiting for a free slot, see VSPControllerPriv::QueueRequest
+//
+#define VSP_MAX_BACKLOG 1024
+
+typedef struct {
+    TVSPControllerData input;
+    uint8_t instance;
+    std::shared_ptr<TVSPCall> call;
+    /* Deadline in the backlog, steady clock in microseconds, 0 = none */
+    uint64_t due;
+} TVSPBacklogItem;
+
+// -------------------------------------------------------------------
+// Matched driver instance. Attach and detach run on the transport
+// thread under m_instanceLock, the counters are updated by the
+// submitting and completing threads.
+//
+typedef struct {
+    /* 0 = slot is free */
+    std::atomic<uint32_t> connection;
+    /* Reported by the driver, raised on each port placed here */
+    std::atomic<uint32_t> ports;
+    std::atomic<uint32_t> links;
+    std::atomic<uint64_t> submitted;
+    std::atomic<uint64_t> completed;
+    std::atomic<uint64_t> errors;
+    std::atomic<uint64_t> rejected;
+    std::atomic<uint64_t> sumUs;
+    TVSPDeviceName name;
+    TVSPDeviceName path;
+} TVSPInstance;
+
+// -------------------------------------------------------------------
+// Ports and links created through the controller on one instance,
+// replayed after a reconnect. A port is part of one link only, so
+// links are kept by their source port.
+//
+typedef struct {
+    std::map<uint16_t, TVSPPortParameters> ports;
+    std::map<uint16_t, uint16_t> links;
+} TVSPTopology;
+
+// -------------------------------------------------------------------
+// Removed instance waiting for the reconnect supervisor
+//
+typedef struct {
+    bool lost;
+    TVSPDeviceName path;
+    uint64_t removedUs;
+    TVSPTopology topology;
+} TVSPLostInstance;
+
+/* Deadline of the requests of a topology replay */
+#define VSP_RESTORE_TIMEOUT 1000
+
+/* Deadline of a request without one of its own, SetRequestTimeout() */
+#define VSP_REQUEST_TIMEOUT 5000
+
+/* Timer wheel of the deadlines: 1 ms ticks, 4 levels of 64 slots
+ * reach 4.6 hours */
+#define VSP_TIMER_TICK_US 1000
+#define VSP_TIMER_BITS    6
+#define VSP_TIMER_LEVELS  4
+
+// -------------------------------------------------------------------
+// State of a Reconcile() run shared by the completions of its
+// requests, which run one after the other.
+//
+typedef struct {
+    uint8_t instance;
+    uint32_t timeout;
+    TVSPTopologySpec spec;
+    TVSPReconcileCompletion completion;
+    /* Present topology, read page by page */
+    std::vector<uint16_t> ports;
+    std::vector<uint64_t> links;
+    uint16_t portCursor;
+    uint16_t linkCursor;
+    /* Planned batches, spec port index of each create or -1 */
+    std::vector<std::vector<TVSPBatchOperation>> batches;
+    std::vector<std::vector<int32_t>> creates;
+    size_t next;
+    TVSPReconcileResult result;
+} TVSPReconcile;
+
+typedef struct {
+    TVSPQueueLink link;
+    uint8_t kind;
+    IOReturn result;
+    TVSPEvent event;
+    char message[256];
+    std::shared_ptr<TVSPCall> call;
+    TVSPControllerData response;
+} TVSPDispatch;
+
 class VSPControllerPriv
 {
 public:
@@ -32,10 +181,26 @@ public:
      *
      */
     virtual ~VSPControllerPriv();
+    /** ----------------------
+     *
+     */
+    bool SetControlThread(const bool enable);
+    /** ----------------------
+     *
+     */
+    uint32_t DispatchCompletions();
+    /** ----------------------
+     *
+     */
+    bool SetDaemonSocket(const char* path);
     /** ----------------------
      *
      */
     bool ConnectDriver();
+    /** ----------------------
+     *
+     */
+    void DisconnectDriver();
     /** ----------------------
      *
      */
@@ -51,31 +216,95 @@ public:
     /** ----------------------
      *
      */
-    bool RemovePort(const uint8_t id);
+    bool RemovePort(const uint16_t id);
     /** ----------------------
      *
      */
-    bool GetPortList();
+    bool GetPortList(const uint16_t cursor);
     /** ----------------------
      *
      */
-    bool GetLinkList();
+    bool GetLinkList(const uint16_t cursor);
     /** ----------------------
      *
      */
-    bool LinkPorts(const uint8_t source, const uint8_t target);
+    bool LinkPorts(const uint16_t source, const uint16_t target);
     /** ----------------------
      *
      */
-    bool UnlinkPorts(const uint8_t source, const uint8_t target);
+    bool UnlinkPorts(const uint16_t source, const uint16_t target);
     /** ----------------------
      *
      */
-    bool EnableChecks(const uint8_t port);
+    bool EnableChecks(const uint16_t port);
     /** ----------------------
      *
      */
-    bool EnableTrace(const uint8_t port);
+    bool EnableTrace(const uint16_t port);
+    /** ----------------------
+     *
+     */
+    bool ExecuteBatch(const TVSPBatchOperation* operations, const uint8_t count);
+    /** ----------------------
+     *
+     */
+    bool GetChanges(const uint32_t generation);
+    /** ----------------------
+     *
+     */
+    bool Subscribe(const uint32_t mask);
+    /** ----------------------
+     *
+     */
+    bool IsSubscribed() const;
+    /** ----------------------
+     *
+     */
+    const TVSPMappingStats GetMappingStats() const;
+    /** ----------------------
+     *
+     */
+    const TVSPWireStats GetWireStats() const;
+    /** ----------------------
+     *
+     */
+    const TVSPStatistics GetStatistics() const;
+    /** ----------------------
+     *
+     */
+    void SetTraceLevel(const TVSPTraceLevel level);
+    /** ----------------------
+     *
+     */
+    TVSPTraceLevel TraceLevel() const;
+    /** ----------------------
+     *
+     */
+    uint32_t ReadTrace(TVSPTraceRecord* records, const uint32_t count, uint64_t* cursor) const;
+    /** ----------------------
+     *
+     */
+    bool SaveTrace(const char* path) const;
+    /** ----------------------
+     *
+     */
+    uint32_t LastRequestId() const;
+    /** ----------------------
+     *
+     */
+    uint32_t PendingRequests() const;
+    /** ----------------------
+     *
+     */
+    bool Call(const TVSPCommandCall& call, const uint32_t timeout, const TVSPCompletion& completion);
+    /** ----------------------
+     *
+     */
+    void SetRequestTimeout(const uint32_t timeout);
+    /** ----------------------
+     *
+     */
+    bool Reconcile(const TVSPTopologySpec& spec, const uint32_t timeout, const TVSPReconcileCompletion& completion);
     /** ----------------------
      *
      */
@@ -84,47 +313,177 @@ public:
      *
      */
     const char* DevicePath() const;
+    /** ----------------------
+     *
+     */
+    uint8_t InstanceCount() const;
+    /** ----------------------
+     *
+     */
+    uint8_t GetInstances(TVSPInstanceInfo* infos, const uint8_t count) const;
+    /** ----------------------
+     *
+     */
+    bool GetInstance(const char* devicePath, TVSPInstanceInfo* info) const;
+    /** ----------------------
+     *
+     */
+    bool Route(const char* devicePath, const TVSPCommandCall& call);
+    /** ----------------------
+     *
+     */
+    bool SetReconnect(const uint32_t minDelay, const uint32_t maxDelay);
+    /** ----------------------
+     *
+     */
+    void SetTopologyReplay(const bool enable);
+    /** ----------------------
+     *
+     */
+    const TVSPReconnectStats GetReconnectStats() const;
 
-    // called by static DeviceAdded and DeviceRemoved to set connection object
-    void SetConnection(io_connect_t connection);
+    // called by the transport on device match with the slot it assigned
+    void AttachInstance(const uint8_t index, const uint32_t connection, const char* name, const char* path);
 
-    // called by static AsyncCallback as result of IOUserClient callback
-    void AsyncCallback(IOReturn result, void** args, UInt32 numArgs);
+    // called by the transport on device removal
+    void DetachInstance(const uint8_t index);
 
-    // called by static DeviceAdded too
-    void ReportError(IOReturn error, const char* message);
+    // called by the transport as result of the driver completion
+    void AsyncCallback(TVSPRequest* request, IOReturn result, void** args, uint32_t numArgs);
 
-    // called by static DeviceAdded too
-    void SetNameAndPath(const char* name, const char* path);
+    // called by the transport too
+    void ReportError(IOReturn error, const char* message);
 
 private:
-    // If you don't know what value to use here, it should be identical to the
-    // IOUserClass value in your IOKitPersonalities. You can double check
-    // by searching with the `ioreg` command in your terminal. It will be of
-    // type "IOUserService" not "IOUserServer". The client Info.plist must
-    // contain:
-    // <key>com.apple.developer.driverkit.userclient-access</key>
-    // <array>
-    //     <string>VSPDriver</string>
-    // </array>
-    //
-    const char* dextIdentifier = "VSPDriver";
-
-    mach_port_t m_machNotificationPort;
-    CFRunLoopRef m_runLoop = NULL;
-    CFRunLoopSourceRef m_runLoopSource = NULL;
-    io_iterator_t m_deviceAddedIter = IO_OBJECT_NULL;
-    io_iterator_t m_deviceRemovedIter = IO_OBJECT_NULL;
-    IONotificationPortRef m_notificationPort = NULL;
-    io_connect_t m_connection = 0;
+    VSPTransport* m_transport = NULL;
+    std::atomic<uint32_t> m_connection;
     VSPController* m_controller = NULL;
-    io_name_t m_deviceName;
-    io_name_t m_devicePath;
-    TVSPControllerData* m_vspResponse = NULL; // mapped async buffer
 
-    inline bool UserClientSetup(void* refcon);
+    // Device name and path of the first instance are written by the
+    // transport thread into the unused buffer and published by the
+    // index, so a pointer returned by DeviceName() stays valid until
+    // the next change but one.
+    TVSPDeviceName m_deviceName[2];
+    TVSPDeviceName m_devicePath[2];
+    std::atomic<uint8_t> m_nameIndex;
+
+    // matched driver instances, the first one connected is primary
+    mutable std::mutex m_instanceLock;
+    TVSPInstance m_instances[MAX_INSTANCES];
+    std::atomic<uint8_t> m_instanceCount;
+    std::atomic<uint8_t> m_primary;
+
+    // outstanding requests with their own response slots
+    TVSPRequest m_requests[MAX_REQUESTS];
+    std::atomic<uint32_t> m_nextRequest;
+    std::atomic<uint32_t> m_lastRequest;
+    std::atomic<uint32_t> m_pending;
+
+    // requests submitted while all slots are in flight
+    std::mutex m_backlogLock;
+    std::deque<TVSPBacklogItem> m_backlog;
+    std::atomic<uint32_t> m_backlogCount;
+    // one thread submits the backlog at a time, the others kick it
+    std::atomic<bool> m_backlogBusy;
+    std::atomic<bool> m_backlogKick;
+
+    // request slot of the event subscription, kept until cancelled
+    std::atomic<TVSPRequest*> m_subscription;
+
+    // latency and error counters per command
+    TVSPCommandCounters m_stats[vspLastCommand];
+
+    // binary trace of requests, completions and errors
+    VSPTraceRing m_trace;
+
+    // callbacks queued by the control thread
+    bool m_controlThread;
+    VSPCompletionQueue m_dispatch;
+    std::atomic<bool> m_dispatchPending;
+
+    // deadlines of the request slots and of the calls waiting in the
+    // backlog, served by m_deadlineThread which sleeps until
+    // m_deadlineWakeUs
+    std::mutex m_deadlineLock;
+    std::condition_variable m_deadlineSignal;
+    VSPTimerWheel<VSP_TIMER_BITS, VSP_TIMER_LEVELS> m_deadlines;
+    std::thread m_deadlineThread;
+    bool m_deadlineRunning;
+    uint64_t m_deadlineWakeUs;
+    std::atomic<uint32_t> m_requestTimeout;
+
+    // reconnect supervisor of the removed instances, m_lost is
+    // guarded by m_reconnectLock
+    std::mutex m_reconnectLock;
+    std::condition_variable m_reconnectSignal;
+    std::thread m_reconnectThread;
+    bool m_reconnectRunning;
+    uint32_t m_reconnectMin;
+    uint32_t m_reconnectMax;
+    TVSPLostInstance m_lost[MAX_INSTANCES];
+    struct {
+        std::atomic<uint64_t> attempts{0};
+        std::atomic<uint64_t> reconnects{0};
+        std::atomic<uint64_t> replayed{0};
+        std::atomic<uint64_t> failed{0};
+        std::atomic<uint64_t> lastOutageUs{0};
+        std::atomic<uint64_t> lastRestoreUs{0};
+        std::atomic<uint64_t> maxRestoreUs{0};
+    } m_reconnectStats;
+
+    // topology snapshot per instance, guarded by m_topologyLock
+    std::mutex m_topologyLock;
+    std::atomic<bool> m_replay;
+    TVSPTopology m_topology[MAX_INSTANCES];
+
+    inline bool UserClientSetup();
     inline void UserClientTeardown(void);
     inline bool DoAsyncCall(TVSPControllerData* input);
+    inline uint8_t SelectInstance(const uint8_t command);
+    inline int SelectPrimary();
+    inline void SetNameAndPath(const char* name, const char* path);
+    inline void FillInstanceInfo(const uint8_t index, TVSPInstanceInfo* info) const;
+    inline IOReturn SubmitRequest(TVSPControllerData* input, const uint8_t instance, const std::shared_ptr<TVSPCall>& call);
+    inline IOReturn QueueRequest(const TVSPControllerData* input, const uint8_t instance, const std::shared_ptr<TVSPCall>& call);
+    inline void SubmitBacklog();
+    inline void DrainBacklog();
+    inline void ExpireBacklog(const TVSPBacklogItem* item);
+    inline TVSPRequest* AcquireRequest(const uint8_t command);
+    inline void ReleaseRequest(TVSPRequest* request);
+    inline void SubscriptionCallback(TVSPRequest* request, IOReturn result, const int64_t* msg, uint32_t numArgs);
+    inline uint64_t RecordLatency(const TVSPRequest* request, IOReturn result);
+    inline void CountTopology(const TVSPRequest* request, IOReturn result);
+    inline void Trace(const uint8_t point, const uint8_t level, const uint8_t instance, const TVSPControllerData* data, const uint32_t status, const uint64_t latency);
+    inline void TraceEvent(const TVSPEvent* event);
+    inline void CompleteRequest(TVSPRequest* request, IOReturn result);
+    inline void FinishCall(const std::shared_ptr<TVSPCall>& call, IOReturn result, const TVSPControllerData* response);
+    inline void ArmDeadline(const std::shared_ptr<TVSPCall>& call);
+    inline void ArmRequest(TVSPRequest* request, const uint32_t id, const uint32_t timeout);
+    inline void ArmTimer(TVSPTimerLink* link, const uint32_t timeout);
+    inline bool ClaimRequest(TVSPRequest* request, const uint32_t id);
+    inline void ExpireRequest(TVSPRequest* request, const uint32_t id);
+    void DeadlineThread();
+    void ReconnectThread();
+    inline void StopReconnect();
+    inline void LoseInstance(const uint8_t index, const char* path);
+    inline void MatchLostInstance(const uint8_t index, const char* path);
+    inline void RestoreInstance(const uint8_t index, const std::shared_ptr<TVSPTopology>& topology, const uint64_t matchedUs);
+    inline void ReplayTopology(const uint8_t index, const TVSPTopology& topology, const uint64_t matchedUs);
+    inline void KeepTopology(const uint8_t index, const TVSPTopology& topology);
+    inline void FinishRestore(const uint64_t matchedUs);
+    inline void SnapshotResult(const TVSPRequest* request, IOReturn result);
+    inline void SnapshotEvent(const uint8_t index, const TVSPEvent* event);
+    inline bool ReconcileSubmit(const std::shared_ptr<TVSPReconcile>& state, const TVSPCommandCall& call, const TVSPCompletion& completion);
+    inline bool ReconcileRead(const std::shared_ptr<TVSPReconcile>& state);
+    inline void ReconcilePlan(TVSPReconcile* state);
+    inline void ReconcileNext(const std::shared_ptr<TVSPReconcile>& state);
+    inline void ReconcileFinish(const std::shared_ptr<TVSPReconcile>& state, const int result);
+    inline void NotifyResult(IOReturn result, const TVSPControllerData* response);
+    inline void NotifyEvent(const TVSPEvent* event);
+    inline void NotifyError(IOReturn error, const char* message);
+    inline void NotifyConnection(bool connected);
+    inline void Enqueue(TVSPDispatch* d);
+    inline void Deliver(TVSPDispatch* d);
 };
 
 #pragma GCC visibility pop
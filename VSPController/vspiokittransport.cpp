@@ -0,0 +1,809 @@
+// ********************************************************************
+// vspiokittransport.cpp - VSPDriver IOKit user client transport
+//
+// Copyright © 2025 by EoF Software Labs
+// Copyright © 2024 Apple Inc. (some copied parts)
+// SPDX-License-Identifier: MIT
+// ********************************************************************
+#include <CoreFoundation/CFNotificationCenter.h>
+#include <CoreFoundation/CoreFoundation.h>
+#include <IOKit/IOKitLib.h>
+#include <IOKit/IOTypes.h>
+#include <condition_variable>
+#include <mutex>
+#include <string.h>
+#include <thread>
+#include <vspcontroller.hpp>
+#include <vspcontrollerpriv.hpp>
+#include <vsptransport.hpp>
+
+namespace VSPClient {
+
+/* The classes below are not exported */
+#pragma GCC visibility push(hidden)
+
+// -------------------------------------------------------------------
+// TVSPControllerData as the VSPDriver DEXT knows it: 8 bit port ids,
+// link items encoded as (link id << 16 | source << 8 | target) and
+// no list paging. Its size is the struct input size the DEXT checks,
+// nothing is appended. The controller uses TVSPControllerData
+// throughout, the transport translates on the way to and from the
+// driver. Completions are routed by the request slot of the refcon.
+//
+typedef struct {
+    uint8_t context;
+    uint8_t command;
+
+    struct Status {
+        uint32_t code;
+        uint64_t flags;
+    } status;
+
+    struct Parameter {
+        uint64_t flags;
+        struct PortLink {
+            uint8_t source;
+            uint8_t target;
+        } link;
+    } parameter;
+
+    struct PortList {
+        uint8_t count;
+        struct Item {
+            uint8_t id;
+            char name[MAX_PORT_NAME];
+        } list[MAX_SERIAL_PORTS];
+    } ports;
+
+    struct LinkList {
+        uint8_t count;
+        uint64_t list[MAX_PORT_LINKS];
+    } links;
+} TVSPDextData;
+
+// VSP_UCD_SIZE of the released controller, the DEXT checks it
+static_assert(sizeof(TVSPDextData) == 1224, "TVSPDextData differs from the DEXT layout");
+
+class VSPIOKitTransport: public VSPTransport
+{
+public:
+    VSPIOKitTransport(VSPControllerPriv* owner);
+    ~VSPIOKitTransport() override;
+
+    bool Open() override;
+    void Close() override;
+    IOReturn Submit(TVSPControllerData* input, TVSPRequest* request) override;
+    void Rematch() override;
+
+    // service already matched by an instance slot
+    bool HasInstance(io_service_t device);
+
+    // called by static DeviceAdded with the opened connection
+    void AddInstance(io_service_t device, io_connect_t connection, const char* name, const char* path);
+
+    // called by static DeviceRemoved
+    void RemoveInstance(io_service_t device);
+
+    // called by static AsyncCallback with the request slot as refcon
+    void Complete(TVSPRequest* request, IOReturn result, void** args, UInt32 numArgs);
+
+private:
+    // If you don't know what value to use here, it should be identical to the
+    // IOUserClass value in your IOKitPersonalities. You can double check
+    // by searching with the `ioreg` command in your terminal. It will be of
+    // type "IOUserService" not "IOUserServer". The client Info.plist must
+    // contain:
+    // <key>com.apple.developer.driverkit.userclient-access</key>
+    // <array>
+    //     <string>VSPDriver</string>
+    // </array>
+    //
+    const char* dextIdentifier = "VSPDriver";
+
+    mach_port_t m_machNotificationPort;
+    CFRunLoopRef m_runLoop = NULL;
+    CFRunLoopSourceRef m_runLoopSource = NULL;
+    io_iterator_t m_deviceAddedIter = IO_OBJECT_NULL;
+    io_iterator_t m_deviceRemovedIter = IO_OBJECT_NULL;
+    IONotificationPortRef m_notificationPort = NULL;
+
+    // Driver response memory per command, mapped once per connection
+    typedef struct {
+        mach_vm_address_t address;
+        mach_vm_size_t size;
+    } TResponseMap;
+
+    // Matched driver service, the slot is the instance index of the
+    // owner. 'submitted' is the request id last sent per command,
+    // 'completed' the last one which took the mapped response.
+    // Guarded by m_mapLock.
+    typedef struct {
+        io_connect_t connection;
+        uint64_t entryId;
+        TResponseMap maps[vspLastCommand];
+        uint32_t submitted[vspLastCommand];
+        uint32_t completed[vspLastCommand];
+    } TInstance;
+    TInstance m_instances[MAX_INSTANCES];
+    std::mutex m_mapLock;
+
+    // Control thread running the notification port
+    std::thread m_thread;
+    std::mutex m_threadLock;
+    std::condition_variable m_threadReady;
+
+    inline TVSPControllerData* MapResponse(TInstance* instance, uint8_t command);
+    inline void MapResponses(TInstance* instance);
+    inline void UnmapResponses(TInstance* instance);
+    inline void CloseInstance(TInstance* instance);
+    inline void StartControlThread();
+    inline void StopControlThread();
+
+    static inline IOReturn ToDext(const TVSPControllerData* input, TVSPDextData* output);
+    static inline void FromDext(const TVSPDextData* input, TVSPControllerData* output);
+};
+
+#pragma GCC visibility pop
+
+// -------------------------------------------------------------------
+//
+//
+VSPTransport* VSPTransport::Create(VSPControllerPriv* owner)
+{
+    return new VSPIOKitTransport(owner);
+}
+
+VSPIOKitTransport::VSPIOKitTransport(VSPControllerPriv* owner)
+    : VSPTransport(owner)
+    , m_machNotificationPort(0L)
+    , m_runLoop(NULL)
+    , m_runLoopSource(NULL)
+    , m_deviceAddedIter(IO_OBJECT_NULL)
+    , m_deviceRemovedIter(IO_OBJECT_NULL)
+    , m_notificationPort(NULL)
+    , m_instances()
+    , m_mapLock()
+    , m_thread()
+    , m_threadLock()
+    , m_threadReady()
+{
+    m_mapsResponses = true;
+}
+
+VSPIOKitTransport::~VSPIOKitTransport()
+{
+    Close();
+}
+
+// -------------------------------------------------------------------
+// MARK: Private Asynchronous Events
+// -------------------------------------------------------------------
+
+// -------------------------------------------------------------------
+//
+//
+static bool OpenDevices(VSPIOKitTransport* t, io_iterator_t iterator)
+{
+    VSPControllerPriv* p = t->Owner();
+    kern_return_t ret = kIOReturnNotFound;
+    io_connect_t connection = IO_OBJECT_NULL;
+    io_service_t device = IO_OBJECT_NULL;
+    bool clientFound = false;
+    io_name_t deviceName = {};
+    io_name_t devicePath = {};
+
+    while ((device = IOIteratorNext(iterator)) != IO_OBJECT_NULL) {
+        // matched before, by the notification or a former rematch
+        if (t->HasInstance(device)) {
+            IOObjectRelease(device);
+            clientFound = true;
+            continue;
+        }
+
+        // attemptedToMatchDevice = true;
+        if ((ret = IORegistryEntryGetName(device, deviceName)) != kIOReturnSuccess) {
+            p->ReportError(ret, "Get service registry name failed.");
+        }
+        if ((ret = IORegistryEntryGetPath(device, kIOServicePlane, devicePath)) != kIOReturnSuccess) {
+            p->ReportError(ret, "Get service registry path failed.");
+        }
+
+        // Open a connection to this user client as a server
+        // to that client, and store the instance in "service"
+        if ((ret = IOServiceOpen(device, mach_task_self_, 0, &connection)) != kIOReturnSuccess) {
+            if (ret == kIOReturnNotPermitted) {
+                p->ReportError(ret, "Operation 'IOServiceOpen' not permitted.");
+            }
+            else {
+                p->ReportError(ret, "Open service failed.");
+            }
+            IOObjectRelease(device);
+            continue;
+        }
+
+        //-> SwiftDeviceAdded(refcon, connection);
+        t->AddInstance(device, connection, deviceName, devicePath);
+        IOObjectRelease(device);
+
+        clientFound = true;
+        ret = kIOReturnSuccess;
+    }
+
+    return clientFound;
+}
+
+// -------------------------------------------------------------------
+//
+//
+static void DeviceAdded(void* refcon, io_iterator_t iterator)
+{
+    VSPIOKitTransport* t = (VSPIOKitTransport*) refcon;
+
+    if (!OpenDevices(t, iterator)) {
+        t->Owner()->ReportError(kIOReturnNotFound, "Unable to find VSPDriver extensions.");
+    }
+}
+
+// -------------------------------------------------------------------
+//
+//
+static void DeviceRemoved(void* refcon, io_iterator_t iterator)
+{
+    VSPIOKitTransport* t = (VSPIOKitTransport*) refcon;
+    io_service_t device = IO_OBJECT_NULL;
+
+    while ((device = IOIteratorNext(iterator)) != IO_OBJECT_NULL) {
+        t->RemoveInstance(device);
+        IOObjectRelease(device);
+    }
+}
+
+// -------------------------------------------------------------------
+// For more detail on this callback format, view the format of:
+// IOAsyncCallback, IOAsyncCallback0, IOAsyncCallback1, IOAsyncCallback2
+// Note that the variant of IOAsyncCallback called is based on the
+// number of arguments being returned
+// 0  - IOAsyncCallback0
+// 1  - IOAsyncCallback1
+// 2  - IOAsyncCallback2
+// 3+ - IOAsyncCallback
+// This is an example of the "IOAsyncCallback" format.
+// refcon will be the value you placed in asyncRef[kIOAsyncCalloutRefconIndex]
+// which is the request slot of the completed request.
+static void AsyncCallback(void* refcon, IOReturn result, void** args, UInt32 numArgs)
+{
+    //-> App API callback SwiftAsyncCallback(refcon, result, args, numArgs);
+    TVSPRequest* request = (TVSPRequest*) refcon;
+    VSPIOKitTransport* t = (VSPIOKitTransport*) request->transport;
+    t->Complete(request, result, args, numArgs);
+}
+
+// -------------------------------------------------------------------
+// MARK: Private API Implementation
+// -------------------------------------------------------------------
+
+// -------------------------------------------------------------------
+// Each matched service takes a free slot, services are told apart
+// by their registry entry id on removal.
+//
+void VSPIOKitTransport::AddInstance(io_service_t device, io_connect_t connection, const char* name, const char* path)
+{
+    uint8_t index = MAX_INSTANCES;
+    uint64_t entryId = 0;
+
+    if (IORegistryEntryGetRegistryEntryID(device, &entryId) != kIOReturnSuccess) {
+        m_owner->ReportError(kIOReturnError, "Get service registry entry id failed.");
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mapLock);
+        for (uint8_t i = 0; i < MAX_INSTANCES; i++) {
+            // the notification and a rematch raced for the service
+            if (entryId && m_instances[i].connection && m_instances[i].entryId == entryId) {
+                IOServiceClose(connection);
+                return;
+            }
+            if (!m_instances[i].connection && index == MAX_INSTANCES) {
+                index = i;
+            }
+        }
+        if (index < MAX_INSTANCES) {
+            m_instances[index].connection = connection;
+            m_instances[index].entryId = entryId;
+            MapResponses(&m_instances[index]);
+        }
+    }
+
+    if (index >= MAX_INSTANCES) {
+        m_owner->ReportError(kIOReturnNoResources, "Too many driver instances.");
+        IOServiceClose(connection);
+        return;
+    }
+
+    m_owner->AttachInstance(index, connection, name, path);
+}
+
+// -------------------------------------------------------------------
+//
+//
+bool VSPIOKitTransport::HasInstance(io_service_t device)
+{
+    uint64_t entryId = 0;
+
+    if (IORegistryEntryGetRegistryEntryID(device, &entryId) != kIOReturnSuccess) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mapLock);
+    for (uint8_t i = 0; i < MAX_INSTANCES; i++) {
+        if (m_instances[i].connection && m_instances[i].entryId == entryId) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// -------------------------------------------------------------------
+//
+//
+void VSPIOKitTransport::RemoveInstance(io_service_t device)
+{
+    uint8_t index = MAX_INSTANCES;
+    uint64_t entryId = 0;
+
+    if (IORegistryEntryGetRegistryEntryID(device, &entryId) != kIOReturnSuccess) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mapLock);
+        for (uint8_t i = 0; i < MAX_INSTANCES; i++) {
+            if (m_instances[i].connection && m_instances[i].entryId == entryId) {
+                CloseInstance(&m_instances[i]);
+                index = i;
+                break;
+            }
+        }
+    }
+
+    if (index < MAX_INSTANCES) {
+        m_owner->DetachInstance(index);
+    }
+}
+
+// -------------------------------------------------------------------
+// The driver fills the mapped response memory of the command before
+// the completion. Take it into the request slot if it belongs to this
+// request, otherwise a newer request of the same command overwrote
+// it already and the instant response of the slot is kept. The DEXT
+// does not know the request id, its response belongs to the request
+// if it is of the same command and no later request of that command
+// was sent.
+//
+void VSPIOKitTransport::Complete(TVSPRequest* request, IOReturn result, void** args, UInt32 numArgs)
+{
+    const uint32_t id = request->id.load();
+    const uint8_t instance = request->instance.load();
+    const uint8_t command = request->command;
+    const TResponseMap* map;
+    TVSPDextData mapped = {};
+
+    if (id && command < vspLastCommand && instance < MAX_INSTANCES) {
+        std::lock_guard<std::mutex> lock(m_mapLock);
+        map = &m_instances[instance].maps[command];
+        if (map->address && map->size >= sizeof(TVSPDextData)) {
+            memcpy(&mapped, reinterpret_cast<const void*>(map->address), sizeof(TVSPDextData));
+            if (mapped.command == command && m_instances[instance].submitted[command] == id) {
+                FromDext(&mapped, &request->response);
+                request->response.request = id;
+                m_instances[instance].completed[command] = id;
+            }
+        }
+    }
+
+    m_owner->AsyncCallback(request, result, args, numArgs);
+}
+
+// -------------------------------------------------------------------
+// Map the driver response memory of each command once at connect
+// time. Commands the driver does not map yet are retried on demand.
+//
+inline void VSPIOKitTransport::MapResponses(TInstance* instance)
+{
+    if (!instance->connection) {
+        return;
+    }
+    for (uint8_t command = 0; command < vspLastCommand; command++) {
+        MapResponse(instance, command);
+    }
+}
+
+// -------------------------------------------------------------------
+//
+//
+inline TVSPControllerData* VSPIOKitTransport::MapResponse(TInstance* instance, uint8_t command)
+{
+    TResponseMap* map = &instance->maps[command];
+    kern_return_t ret;
+
+    if (map->address) {
+        return reinterpret_cast<TVSPControllerData*>(map->address);
+    }
+
+    ret = IOConnectMapMemory64(instance->connection, command, mach_task_self(), &map->address, &map->size, kIOMapAnywhere);
+    if (ret != kIOReturnSuccess || !map->address || !map->size) {
+        map->address = 0;
+        map->size = 0;
+        return nullptr;
+    }
+
+    m_mapStats.created++;
+    return reinterpret_cast<TVSPControllerData*>(map->address);
+}
+
+// -------------------------------------------------------------------
+//
+//
+inline void VSPIOKitTransport::UnmapResponses(TInstance* instance)
+{
+    for (uint8_t command = 0; command < vspLastCommand; command++) {
+        TResponseMap* map = &instance->maps[command];
+        if (!map->address) {
+            continue;
+        }
+        if (instance->connection) {
+            IOConnectUnmapMemory64(instance->connection, command, mach_task_self(), map->address);
+        }
+        map->address = 0;
+        map->size = 0;
+        m_mapStats.released++;
+    }
+}
+
+// -------------------------------------------------------------------
+// Caller holds m_mapLock
+//
+inline void VSPIOKitTransport::CloseInstance(TInstance* instance)
+{
+    UnmapResponses(instance);
+    if (instance->connection) {
+        IOServiceClose(instance->connection);
+    }
+    instance->connection = IO_OBJECT_NULL;
+    instance->entryId = 0;
+    memset(instance->submitted, 0, sizeof(instance->submitted));
+    memset(instance->completed, 0, sizeof(instance->completed));
+}
+
+// -------------------------------------------------------------------
+//
+//
+bool VSPIOKitTransport::Open()
+{
+    kern_return_t ret = kIOReturnSuccess;
+    void* refcon = this;
+
+    // the control thread takes its own run loop below
+    if (!m_controlThread) {
+        m_runLoop = CFRunLoopGetCurrent();
+        if (m_runLoop == NULL) {
+            m_owner->ReportError(kIOReturnError, "Failed to initialize run loop.");
+            return false;
+        }
+        CFRetain(m_runLoop);
+    }
+
+    if (__builtin_available(macOS 12.0, *)) {
+        m_notificationPort = IONotificationPortCreate(kIOMainPortDefault);
+    }
+    else {
+        return false;
+    }
+    if (m_notificationPort == NULL) {
+        m_owner->ReportError(kIOReturnError, "Failed to initialize motification port.");
+        Close();
+        return false;
+    }
+
+    m_machNotificationPort = IONotificationPortGetMachPort(m_notificationPort);
+    if (m_machNotificationPort == 0) {
+        m_owner->ReportError(kIOReturnError, "Failed to initialize mach notification port.");
+        Close();
+        return false;
+    }
+
+    m_runLoopSource = IONotificationPortGetRunLoopSource(m_notificationPort);
+    if (m_runLoopSource == NULL) {
+        m_owner->ReportError(kIOReturnError, "Failed to initialize run loop source.");
+        return false;
+    }
+
+    // Establish our notifications in the run loop, so we can get callbacks.
+    if (m_controlThread) {
+        StartControlThread();
+    }
+    else {
+        CFRunLoopAddSource(m_runLoop, m_runLoopSource, kCFRunLoopDefaultMode);
+    }
+
+    /// - Tag: SetUpMatchingNotification
+    CFMutableDictionaryRef matchingDictionary = IOServiceNameMatching(dextIdentifier);
+    if (matchingDictionary == NULL) {
+        m_owner->ReportError(kIOReturnError, "Failed to initialize matching dictionary.");
+        Close();
+        return false;
+    }
+    matchingDictionary = (CFMutableDictionaryRef) CFRetain(matchingDictionary);
+    matchingDictionary = (CFMutableDictionaryRef) CFRetain(matchingDictionary);
+
+    ret = IOServiceAddMatchingNotification(
+       m_notificationPort, kIOFirstMatchNotification, matchingDictionary, DeviceAdded, refcon, &m_deviceAddedIter);
+    if (ret != kIOReturnSuccess) {
+        m_owner->ReportError(ret, "Add matching notification failed.");
+        Close();
+        return false;
+    }
+    DeviceAdded(refcon, m_deviceAddedIter);
+
+    ret = IOServiceAddMatchingNotification(
+       m_notificationPort, kIOTerminatedNotification, matchingDictionary, DeviceRemoved, refcon, &m_deviceRemovedIter);
+    if (ret != kIOReturnSuccess) {
+        m_owner->ReportError(ret, "Add termination notification failed.");
+        Close();
+        return false;
+    }
+    DeviceRemoved(refcon, m_deviceRemovedIter);
+
+    return true;
+}
+
+// -------------------------------------------------------------------
+// The first match notification opens a restarted DEXT at once, the
+// supervisor polls the registry in case that notification was lost.
+// The services are looked up synchronously on the calling thread.
+//
+void VSPIOKitTransport::Rematch()
+{
+    io_iterator_t iterator = IO_OBJECT_NULL;
+    kern_return_t ret;
+
+    if (!m_notificationPort) {
+        return;
+    }
+
+    if (__builtin_available(macOS 12.0, *)) {
+        // consumes the matching dictionary
+        ret = IOServiceGetMatchingServices(kIOMainPortDefault, IOServiceNameMatching(dextIdentifier), &iterator);
+    }
+    else {
+        return;
+    }
+    if (ret != kIOReturnSuccess) {
+        m_owner->ReportError(ret, "Get matching services failed.");
+        return;
+    }
+
+    OpenDevices(this, iterator);
+    IOObjectRelease(iterator);
+}
+
+// -------------------------------------------------------------------
+//
+//
+void VSPIOKitTransport::Close()
+{
+    if (m_runLoopSource) {
+        CFRunLoopRemoveSource(m_runLoop, m_runLoopSource, kCFRunLoopDefaultMode);
+        m_runLoopSource = NULL;
+    }
+
+    StopControlThread();
+
+    if (m_notificationPort) {
+        IONotificationPortDestroy(m_notificationPort);
+        m_notificationPort = NULL;
+        m_machNotificationPort = 0;
+    }
+
+    if (m_runLoop) {
+        CFRelease(m_runLoop);
+        m_runLoop = NULL;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mapLock);
+    for (uint8_t i = 0; i < MAX_INSTANCES; i++) {
+        CloseInstance(&m_instances[i]);
+    }
+
+    m_deviceAddedIter = IO_OBJECT_NULL;
+    m_deviceRemovedIter = IO_OBJECT_NULL;
+}
+
+// -------------------------------------------------------------------
+// The notification port is served by an own thread, so completions
+// are not delayed by the event processing of the application thread.
+//
+inline void VSPIOKitTransport::StartControlThread()
+{
+    std::unique_lock<std::mutex> lock(m_threadLock);
+
+    m_thread = std::thread([this]() {
+        {
+            std::lock_guard<std::mutex> lock(m_threadLock);
+            m_runLoop = CFRunLoopGetCurrent();
+            CFRetain(m_runLoop);
+            CFRunLoopAddSource(m_runLoop, m_runLoopSource, kCFRunLoopDefaultMode);
+        }
+        m_threadReady.notify_all();
+
+        // returns on CFRunLoopStop() or without a source
+        CFRunLoopRun();
+    });
+
+    m_threadReady.wait(lock, [this]() {
+        return m_runLoop != NULL;
+    });
+}
+
+// -------------------------------------------------------------------
+//
+//
+inline void VSPIOKitTransport::StopControlThread()
+{
+    if (!m_thread.joinable()) {
+        return;
+    }
+    CFRunLoopStop(m_runLoop);
+    m_thread.join();
+}
+
+// -------------------------------------------------------------------
+//
+//
+IOReturn VSPIOKitTransport::Submit(TVSPControllerData* input, TVSPRequest* request)
+{
+    kern_return_t ret = kIOReturnSuccess;
+    io_async_ref64_t asyncRef = {};
+    io_connect_t connection = IO_OBJECT_NULL;
+    const uint8_t instance = request->instance.load();
+    const uint32_t id = request->id.load();
+    TVSPDextData dextInput = {};
+    TVSPDextData dextOutput = {};
+
+    // Establish our "AsyncCallback" function as the function that will be called
+    // by our Dext when it calls its "AsyncCompletion" function.
+    // We'll use kIOAsyncCalloutFuncIndex and kIOAsyncCalloutRefconIndex
+    // to define the parameters for our async callback. This is your callback
+    // function. Check the definition for more details.
+    asyncRef[kIOAsyncCalloutFuncIndex] = (io_user_reference_t) VSPClient::AsyncCallback;
+
+    // Use this for context on the return. We'll pass the request slot
+    // so the completion is routed to the request it belongs to.
+    asyncRef[kIOAsyncCalloutRefconIndex] = (io_user_reference_t) request;
+
+    if (input->command >= vspLastCommand || instance >= MAX_INSTANCES) {
+        m_owner->ReportError(kIOReturnBadArgument, "Invalid driver command.");
+        return kIOReturnBadArgument;
+    }
+    if ((ret = ToDext(input, &dextInput)) != kIOReturnSuccess) {
+        m_owner->ReportError(ret, "Command not supported by the driver.");
+        return ret;
+    }
+
+    // Instant response of the DEXT user client instance
+    // Allocate response IOMemoryDescriptor at driver site
+    // to response data above 128 bytes. This will filled,
+    // by DEXT. The mapping is established once per connection.
+    size_t resultSize = sizeof(TVSPDextData);
+    {
+        std::lock_guard<std::mutex> lock(m_mapLock);
+        TInstance* target = &m_instances[instance];
+        if (!(connection = target->connection)) {
+            m_owner->ReportError(kIOReturnNotOpen, "Driver instance not matched.");
+            return kIOReturnNotOpen;
+        }
+        if (target->maps[input->command].address) {
+            m_mapStats.reused++;
+        }
+        else if (!MapResponse(target, input->command)) {
+            m_owner->ReportError(kIOReturnNoMemory, "Failed to get drivers mapped memory.");
+            return kIOReturnNoMemory;
+        }
+        target->submitted[input->command] = id;
+    }
+
+    // - do it --
+    ret = IOConnectCallAsyncStructMethod(
+       connection,
+       input->command,
+       m_machNotificationPort,
+       asyncRef,
+       kIOAsyncCalloutCount,
+       &dextInput,
+       sizeof(TVSPDextData),
+       &dextOutput,
+       &resultSize);
+    if (ret != kIOReturnSuccess) {
+        m_owner->ReportError(ret, "Driver async call failed.");
+        return ret;
+    }
+
+    // the completion may have taken the mapped response meanwhile
+    {
+        std::lock_guard<std::mutex> lock(m_mapLock);
+        if (m_instances[instance].completed[input->command] != id) {
+            FromDext(&dextOutput, &request->response);
+            request->response.request = id;
+        }
+    }
+
+    return kIOReturnSuccess;
+}
+
+// -------------------------------------------------------------------
+// Port ids above 255 and list pages after the first one can not be
+// expressed to the DEXT. The port list carries the raw parameters of
+// vspControlCreatePort or the batch operations, it is copied as is.
+//
+inline IOReturn VSPIOKitTransport::ToDext(const TVSPControllerData* input, TVSPDextData* output)
+{
+    if (input->parameter.link.source > UINT8_MAX || input->parameter.link.target > UINT8_MAX) {
+        return kIOReturnBadArgument;
+    }
+    if (input->parameter.cursor) {
+        return kIOReturnUnsupported;
+    }
+
+    output->context = input->context;
+    output->command = input->command;
+    output->status.code = input->status.code;
+    output->status.flags = input->status.flags;
+    output->parameter.flags = input->parameter.flags;
+    output->parameter.link.source = (uint8_t) input->parameter.link.source;
+    output->parameter.link.target = (uint8_t) input->parameter.link.target;
+    output->ports.count = input->ports.count;
+    memcpy(output->ports.list, input->ports.list, sizeof(output->ports.list));
+    output->links.count = 0;
+    return kIOReturnSuccess;
+}
+
+// -------------------------------------------------------------------
+// The DEXT answers a list in one page. Batch and change results are
+// packed into the port list, they are copied as is.
+//
+inline void VSPIOKitTransport::FromDext(const TVSPDextData* input, TVSPControllerData* output)
+{
+    const uint8_t ports = (input->ports.count < MAX_SERIAL_PORTS ? input->ports.count : MAX_SERIAL_PORTS);
+    const uint8_t links = (input->links.count < MAX_PORT_LINKS ? input->links.count : MAX_PORT_LINKS);
+
+    memset(output, 0, sizeof(TVSPControllerData));
+    output->context = input->context;
+    output->command = input->command;
+    output->status.code = input->status.code;
+    output->status.flags = input->status.flags;
+    output->parameter.flags = input->parameter.flags;
+    output->parameter.link.source = input->parameter.link.source;
+    output->parameter.link.target = input->parameter.link.target;
+
+    if (input->command >= vspControlBatch) {
+        output->ports.count = input->ports.count;
+        memcpy(output->ports.list, input->ports.list, sizeof(input->ports.list));
+    }
+    else {
+        output->ports.count = ports;
+        output->ports.total = ports;
+        for (uint8_t i = 0; i < ports; i++) {
+            output->ports.list[i].id = input->ports.list[i].id;
+            memcpy(output->ports.list[i].name, input->ports.list[i].name, MAX_PORT_NAME);
+        }
+    }
+
+    output->links.count = links;
+    output->links.total = links;
+    for (uint8_t i = 0; i < links; i++) {
+        const uint64_t item = input->links.list[i];
+        output->links.list[i] = VSP_LINK_ITEM((item >> 16) & 0xff, (item >> 8) & 0xff, item & 0xff);
+    }
+}
+
+} // END namspace VSPClient
@@ -0,0 +1,1242 @@
+// ********************************************************************
+// vsploopback.cpp - In-process VSPDriver emulation and transport
+//
+// Copyright © 2025 by EoF Software Labs
+// SPDX-License-Identifier: MIT
+// ********************************************************************
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <errno.h>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <thread>
+#include <unistd.h>
+#include <vspcontroller.hpp>
+#include <vspcontrollerpriv.hpp>
+#include <vsploopback.hpp>
+#include <vspqueue.hpp>
+#include <vsptransport.hpp>
+#include <vspwire.hpp>
+
+namespace VSPClient {
+
+#define LOOPBACK_NAME "VSPLoopback"
+#define LOOPBACK_PATH "IOService:/VSPLoopback/VSPDriver"
+
+// driver instances matched by the transport, the environment variable
+// of the same name overrides it at run time
+#ifndef VSP_LOOPBACK_INSTANCES
+#define VSP_LOOPBACK_INSTANCES 1
+#endif
+
+// ports with a pseudo terminal data path, the environment variable
+// of the same name overrides it at run time: 0, 1 or 'copy' and
+// 'splice' to select the forwarding
+#ifndef VSP_LOOPBACK_PTY
+#define VSP_LOOPBACK_PTY 0
+#endif
+
+// pty ports transmit at the character rate of their parameters, the
+// environment variable of the same name overrides it at run time
+#ifndef VSP_LOOPBACK_PACING
+#define VSP_LOOPBACK_PACING 0
+#endif
+
+// reactor threads of the pty engine, 0 = one per CPU, and whether
+// each one is pinned to a CPU. The environment variables of the same
+// names override them at run time.
+#ifndef VSP_LOOPBACK_SHARDS
+#define VSP_LOOPBACK_SHARDS 1
+#endif
+#ifndef VSP_LOOPBACK_AFFINITY
+#define VSP_LOOPBACK_AFFINITY 0
+#endif
+
+// Fault injection of VSP_LOOPBACK_STALL=<n>[:<ms>]: the completion of
+// every n-th request is lost, or delivered 'ms' late. Subscriptions
+// and events are never stalled.
+#define LOOPBACK_STALL_ENV "VSP_LOOPBACK_STALL"
+
+// port flags set by EnableChecks and EnableTrace
+#define PORT_FLAG_CHECKS 0x01
+#define PORT_FLAG_TRACE  0x02
+
+// driver limits, a port is part of one link only
+#define LOOPBACK_MAX_PORTS 2048
+#define LOOPBACK_MAX_LINKS (LOOPBACK_MAX_PORTS / 2)
+
+// changes kept for vspControlGetChanges
+#define LOOPBACK_MAX_CHANGES 256
+
+// -------------------------------------------------------------------
+// Table helpers for the id sorted port and link tables
+//
+template<typename T>
+static inline typename std::vector<T>::const_iterator LowerBound(const std::vector<T>& items, const uint16_t id)
+{
+    return std::lower_bound(items.begin(), items.end(), id, [](const T& item, uint16_t value) {
+        return item.id < value;
+    });
+}
+
+// -------------------------------------------------------------------
+// Ids are handed out from 1 and stay unique, so items[i].id == i + 1
+// holds up to the first gap. Binary search for that gap, it is the
+// lowest free id and the insert position at once.
+//
+template<typename T>
+static inline size_t FreeSlot(const std::vector<T>& items, uint16_t* id)
+{
+    size_t lo = 0;
+    size_t hi = items.size();
+    while (lo < hi) {
+        const size_t mid = (lo + hi) / 2;
+        if (items[mid].id == mid + 1) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    *id = (uint16_t) (lo + 1);
+    return lo;
+}
+
+// -------------------------------------------------------------------
+// Read per port creation, tools select it before they create ports
+//
+static inline bool PtyForwarding(TVSPPtyForwarding* forwarding)
+{
+    const char* value = getenv("VSP_LOOPBACK_PTY");
+
+    *forwarding = vspPtyCopy;
+    if (!value) {
+        return (VSP_LOOPBACK_PTY != 0);
+    }
+    if (strcmp(value, "splice") == 0) {
+        *forwarding = vspPtySplice;
+        return true;
+    }
+    return (strcmp(value, "copy") == 0 || strtol(value, nullptr, 10) != 0);
+}
+
+// -------------------------------------------------------------------
+// Read per port creation like PtyForwarding()
+//
+static inline bool PtyPacing()
+{
+    const char* value = getenv("VSP_LOOPBACK_PACING");
+    return (value ? strtol(value, nullptr, 10) != 0 : VSP_LOOPBACK_PACING != 0);
+}
+
+// -------------------------------------------------------------------
+// Read per port creation, the engine applies a change once no port
+// is open
+//
+static inline void PtyShards(uint32_t* shards, bool* affinity)
+{
+    const char* value = getenv("VSP_LOOPBACK_SHARDS");
+    *shards = (value ? (uint32_t) strtoul(value, nullptr, 10) : VSP_LOOPBACK_SHARDS);
+
+    value = getenv("VSP_LOOPBACK_AFFINITY");
+    *affinity = (value ? strtol(value, nullptr, 10) != 0 : VSP_LOOPBACK_AFFINITY != 0);
+}
+
+// -------------------------------------------------------------------
+// MARK: Driver Emulation
+// -------------------------------------------------------------------
+
+// -------------------------------------------------------------------
+//
+//
+VSPLoopbackDriver* VSPLoopbackDriver::Instance(const uint8_t index)
+{
+    static VSPLoopbackDriver drivers[MAX_INSTANCES];
+    return &drivers[index % MAX_INSTANCES];
+}
+
+// -------------------------------------------------------------------
+//
+//
+IOReturn VSPLoopbackDriver::Execute(const TVSPControllerData* input, TVSPControllerData* response, VSPLoopbackClient* client)
+{
+    IOReturn ret = kIOReturnSuccess;
+
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    memset(response, 0, sizeof(TVSPControllerData));
+    response->command = input->command;
+    response->request = input->request;
+    response->parameter = input->parameter;
+    response->status.flags = input->status.flags;
+
+    // terminated instance, like a call on a stale connection
+    if (!m_online) {
+        response->context = vspContextError;
+        response->status.code = kIOReturnNotOpen;
+        return kIOReturnNotOpen;
+    }
+
+    switch (input->command) {
+        case vspControlPingPong: {
+            break;
+        }
+        case vspControlGetStatus: {
+            FillPortList(response, 0);
+            FillLinkList(response, 0);
+            break;
+        }
+        case vspControlCreatePort: {
+            uint16_t id = 0;
+            // TVSPPortParameters are passed through ports.list
+            if (input->ports.count != sizeof(TVSPPortParameters)) {
+                ret = kIOReturnBadArgument;
+                break;
+            }
+            if ((ret = CreatePort((const TVSPPortParameters*) input->ports.list, &id)) == kIOReturnSuccess) {
+                response->parameter.link.source = id;
+                response->parameter.link.target = id;
+            }
+            break;
+        }
+        case vspControlRemovePort: {
+            ret = RemovePort(input->parameter.link.source);
+            break;
+        }
+        case vspControlLinkPorts: {
+            ret = LinkPorts(input->parameter.link.source, input->parameter.link.target);
+            break;
+        }
+        case vspControlUnlinkPorts: {
+            ret = UnlinkPorts(input->parameter.link.source, input->parameter.link.target);
+            break;
+        }
+        case vspControlGetPortList: {
+            FillPortList(response, input->parameter.cursor);
+            break;
+        }
+        case vspControlGetLinkList: {
+            FillLinkList(response, input->parameter.cursor);
+            break;
+        }
+        case vspControlEnableChecks: {
+            ret = SetPortFlags(input->parameter.link.source, PORT_FLAG_CHECKS);
+            break;
+        }
+        case vspControlEnableTrace: {
+            ret = SetPortFlags(input->parameter.link.source, PORT_FLAG_TRACE);
+            break;
+        }
+        case vspControlBatch: {
+            ret = ExecuteBatch(input, response);
+            break;
+        }
+        case vspControlGetChanges: {
+            ret = FillChanges(response, input->generation);
+            break;
+        }
+        case vspControlSubscribe: {
+            ret = Subscribe(client, (uint32_t) input->parameter.flags);
+            break;
+        }
+        default: {
+            ret = kIOReturnBadArgument;
+            break;
+        }
+    }
+
+    // mutating commands respond the first page of the resulting topology
+    if (ret == kIOReturnSuccess && input->command >= vspControlCreatePort && input->command <= vspControlUnlinkPorts) {
+        FillPortList(response, 0);
+        FillLinkList(response, 0);
+    }
+
+    // changes report the generation reached by the response
+    if (input->command != vspControlGetChanges) {
+        response->generation = m_generation;
+    }
+
+    response->context = (ret == kIOReturnSuccess ? vspContextResult : vspContextError);
+    response->status.code = ret;
+    return ret;
+}
+
+// -------------------------------------------------------------------
+//
+//
+size_t VSPLoopbackDriver::Execute(const uint8_t* request, size_t size, uint8_t* response, size_t maxSize, VSPLoopbackClient* client)
+{
+    TVSPControllerData input;
+    TVSPControllerData output;
+
+    if (!VSPWireDecode(request, size, &input)) {
+        return 0;
+    }
+
+    Execute(&input, &output, client);
+    return VSPWireEncode(&output, response, maxSize);
+}
+
+// -------------------------------------------------------------------
+//
+//
+bool VSPLoopbackDriver::Connect(VSPLoopbackClient* client)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (!m_online) {
+        return false;
+    }
+    if (std::find(m_clients.begin(), m_clients.end(), client) == m_clients.end()) {
+        m_clients.push_back(client);
+    }
+    return true;
+}
+
+// -------------------------------------------------------------------
+//
+//
+void VSPLoopbackDriver::Disconnect(VSPLoopbackClient* client)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_clients.erase(std::remove(m_clients.begin(), m_clients.end(), client), m_clients.end());
+    Subscribe(client, 0);
+}
+
+// -------------------------------------------------------------------
+//
+//
+void VSPLoopbackDriver::Detach(VSPLoopbackClient* client)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    Subscribe(client, 0);
+}
+
+// -------------------------------------------------------------------
+// The clients are told outside the lock, they detach the instance
+// from their controller which may call into the driver again.
+//
+void VSPLoopbackDriver::Terminate()
+{
+    std::vector<VSPLoopbackClient*> clients;
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (!m_online) {
+            return;
+        }
+        m_online = false;
+        for (TPort& port : m_ports) {
+            VSPPtyEngine::Instance()->ClosePort(port.pty);
+        }
+        m_ports.clear();
+        m_links.clear();
+        m_changes.clear();
+        m_subscribers.clear();
+        m_generation = 0;
+        clients.swap(m_clients);
+    }
+
+    for (VSPLoopbackClient* client : clients) {
+        client->Terminated(this);
+    }
+}
+
+// -------------------------------------------------------------------
+//
+//
+void VSPLoopbackDriver::Start()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_online = true;
+}
+
+// -------------------------------------------------------------------
+// Operations are applied in order and each one gets its own status.
+// A failed operation does not stop the batch, the batch status is
+// the status of the first failed operation.
+//
+inline IOReturn VSPLoopbackDriver::ExecuteBatch(const TVSPControllerData* input, TVSPControllerData* response)
+{
+    TVSPBatchOperation ops[MAX_BATCH_OPS];
+    const uint8_t count = input->ports.count;
+    IOReturn ret = kIOReturnSuccess;
+
+    if (!count || count > MAX_BATCH_OPS) {
+        return kIOReturnBadArgument;
+    }
+
+    // ports.list is byte aligned
+    memcpy(ops, input->ports.list, count * sizeof(TVSPBatchOperation));
+
+    for (uint8_t i = 0; i < count; i++) {
+        TVSPBatchOperation* op = &ops[i];
+        IOReturn status = kIOReturnSuccess;
+
+        // resolve reference to a port created earlier in this batch
+        auto resolve = [&ops, i](uint16_t* port) -> IOReturn {
+            if (*port >= i) {
+                return kIOReturnBadArgument;
+            }
+            const TVSPBatchOperation* created = &ops[*port];
+            if (created->command != vspControlCreatePort) {
+                return kIOReturnBadArgument;
+            }
+            *port = created->source;
+            return created->status;
+        };
+
+        if (op->flags & BATCH_REF_SOURCE) {
+            status = resolve(&op->source);
+        }
+        if (status == kIOReturnSuccess && (op->flags & BATCH_REF_TARGET)) {
+            status = resolve(&op->target);
+        }
+
+        if (status == kIOReturnSuccess) {
+            switch (op->command) {
+                case vspControlCreatePort: {
+                    if ((status = CreatePort(&op->parameters, &op->source)) == kIOReturnSuccess) {
+                        op->target = op->source;
+                    }
+                    break;
+                }
+                case vspControlRemovePort: {
+                    status = RemovePort(op->source);
+                    break;
+                }
+                case vspControlLinkPorts: {
+                    status = LinkPorts(op->source, op->target);
+                    break;
+                }
+                case vspControlUnlinkPorts: {
+                    status = UnlinkPorts(op->source, op->target);
+                    break;
+                }
+                case vspControlEnableChecks: {
+                    status = SetPortFlags(op->source, PORT_FLAG_CHECKS);
+                    break;
+                }
+                case vspControlEnableTrace: {
+                    status = SetPortFlags(op->source, PORT_FLAG_TRACE);
+                    break;
+                }
+                default: {
+                    status = kIOReturnBadArgument;
+                    break;
+                }
+            }
+        }
+
+        op->status = status;
+        if (status != kIOReturnSuccess && ret == kIOReturnSuccess) {
+            ret = status;
+        }
+    }
+
+    // ports.list holds the operation results, links the new topology
+    memcpy(response->ports.list, ops, count * sizeof(TVSPBatchOperation));
+    response->ports.count = count;
+    FillLinkList(response, 0);
+    return ret;
+}
+
+// -------------------------------------------------------------------
+//
+//
+inline IOReturn VSPLoopbackDriver::CreatePort(const TVSPPortParameters* parameters, uint16_t* id)
+{
+    TVSPPtyForwarding forwarding;
+    TPort port = {};
+    uint32_t shards;
+    bool affinity;
+
+    if (m_ports.size() >= LOOPBACK_MAX_PORTS) {
+        return kIOReturnNoResources;
+    }
+
+    // lowest free port id, 0 is reserved
+    const size_t slot = FreeSlot(m_ports, &port.id);
+
+    // may point into the byte aligned ports.list, only the copy is read
+    memcpy(&port.parameters, parameters, sizeof(TVSPPortParameters));
+    if (PtyForwarding(&forwarding)) {
+        PtyShards(&shards, &affinity);
+        VSPPtyEngine::Instance()->Configure(shards, affinity);
+        if (!(port.pty = VSPPtyEngine::Instance()->OpenPort(port.name, sizeof(port.name), forwarding, (PtyPacing() ? &port.parameters : nullptr), port.id))) {
+            return kIOReturnNoResources;
+        }
+    }
+    else {
+        snprintf(port.name, sizeof(port.name), "tty.vsp%u", port.id);
+    }
+    m_ports.insert(m_ports.begin() + slot, port);
+    LogChange(vspChangePortAdded, port.id, port.id, port.id);
+
+    *id = port.id;
+    return kIOReturnSuccess;
+}
+
+// -------------------------------------------------------------------
+//
+//
+inline IOReturn VSPLoopbackDriver::RemovePort(const uint16_t id)
+{
+    TPort* port;
+    if (!(port = FindPort(id))) {
+        return kIOReturnNotFound;
+    }
+
+    // drop the link of this port too
+    if (port->link) {
+        auto lk = LowerBound(m_links, port->link);
+        TPort* peer = FindPort(lk->source == id ? lk->target : lk->source);
+        LogChange(vspChangeLinkRemoved, lk->id, lk->source, lk->target);
+        m_links.erase(lk);
+        if (peer) {
+            peer->link = 0;
+            SetSignals(peer, 0);
+        }
+    }
+
+    // the engine drops the link of its data path too
+    VSPPtyEngine::Instance()->ClosePort(port->pty);
+    m_ports.erase(LowerBound(m_ports, id));
+    LogChange(vspChangePortRemoved, id, id, id);
+    return kIOReturnSuccess;
+}
+
+// -------------------------------------------------------------------
+//
+//
+inline IOReturn VSPLoopbackDriver::LinkPorts(const uint16_t source, const uint16_t target)
+{
+    TLink link = {};
+    TPort* sp;
+    TPort* tp;
+
+    if (source == target) {
+        return kIOReturnBadArgument;
+    }
+    if (!(sp = FindPort(source)) || !(tp = FindPort(target))) {
+        return kIOReturnNotFound;
+    }
+    if (sp->link || tp->link) {
+        return kIOReturnBusy;
+    }
+    if (m_links.size() >= LOOPBACK_MAX_LINKS) {
+        return kIOReturnNoResources;
+    }
+
+    // lowest free link id, 0 is reserved
+    const size_t slot = FreeSlot(m_links, &link.id);
+
+    link.source = source;
+    link.target = target;
+    m_links.insert(m_links.begin() + slot, link);
+
+    sp->link = link.id;
+    tp->link = link.id;
+    VSPPtyEngine::Instance()->LinkPorts(sp->pty, tp->pty);
+    LogChange(vspChangeLinkAdded, link.id, source, target);
+
+    // null modem wiring, each port sees its peer
+    SetSignals(sp, VSP_SIGNAL_CTS | VSP_SIGNAL_DSR | VSP_SIGNAL_DCD);
+    SetSignals(tp, VSP_SIGNAL_CTS | VSP_SIGNAL_DSR | VSP_SIGNAL_DCD);
+    return kIOReturnSuccess;
+}
+
+// -------------------------------------------------------------------
+//
+//
+inline IOReturn VSPLoopbackDriver::UnlinkPorts(const uint16_t source, const uint16_t target)
+{
+    TPort* sp;
+    TPort* tp;
+
+    // the ports of a link share its id, accept either order
+    if (!(sp = FindPort(source)) || !(tp = FindPort(target)) || !sp->link || sp->link != tp->link) {
+        return kIOReturnNotFound;
+    }
+
+    auto lk = LowerBound(m_links, sp->link);
+    LogChange(vspChangeLinkRemoved, lk->id, lk->source, lk->target);
+    m_links.erase(lk);
+    sp->link = 0;
+    tp->link = 0;
+    VSPPtyEngine::Instance()->UnlinkPorts(sp->pty, tp->pty);
+    SetSignals(sp, 0);
+    SetSignals(tp, 0);
+    return kIOReturnSuccess;
+}
+
+// -------------------------------------------------------------------
+//
+//
+inline IOReturn VSPLoopbackDriver::SetPortFlags(const uint16_t id, const uint64_t flags)
+{
+    TPort* port;
+    if (!(port = FindPort(id))) {
+        return kIOReturnNotFound;
+    }
+    port->flags |= flags;
+    return kIOReturnSuccess;
+}
+
+// -------------------------------------------------------------------
+//
+//
+inline VSPLoopbackDriver::TPort* VSPLoopbackDriver::FindPort(const uint16_t id)
+{
+    auto it = LowerBound(m_ports, id);
+    if (it == m_ports.end() || it->id != id) {
+        return nullptr;
+    }
+    return &m_ports[it - m_ports.begin()];
+}
+
+// -------------------------------------------------------------------
+// One page of ports starting at port id 'cursor'
+//
+inline void VSPLoopbackDriver::FillPortList(TVSPControllerData* response, const uint16_t cursor) const
+{
+    auto it = LowerBound(m_ports, cursor);
+
+    response->ports.count = 0;
+    for (; it != m_ports.end() && response->ports.count < MAX_SERIAL_PORTS; it++) {
+        TVSPPortListItem* item = &response->ports.list[response->ports.count++];
+        item->id = it->id;
+        strncpy(item->name, it->name, sizeof(item->name) - 1);
+    }
+
+    response->ports.total = (uint16_t) m_ports.size();
+    response->ports.next = (it != m_ports.end() ? it->id : 0);
+}
+
+// -------------------------------------------------------------------
+// One page of links starting at link id 'cursor', see VSP_LINK_ITEM
+//
+inline void VSPLoopbackDriver::FillLinkList(TVSPControllerData* response, const uint16_t cursor) const
+{
+    auto it = LowerBound(m_links, cursor);
+
+    response->links.count = 0;
+    for (; it != m_links.end() && response->links.count < MAX_PORT_LINKS; it++) {
+        response->links.list[response->links.count++] = VSP_LINK_ITEM(it->id, it->source, it->target);
+    }
+
+    response->links.total = (uint16_t) m_links.size();
+    response->links.next = (it != m_links.end() ? it->id : 0);
+}
+
+// -------------------------------------------------------------------
+// Each port or link change advances the generation by one, the log
+// holds the last LOOPBACK_MAX_CHANGES of them.
+//
+inline void VSPLoopbackDriver::LogChange(const uint8_t kind, const uint16_t id, const uint16_t source, const uint16_t target)
+{
+    TChange change = {};
+
+    change.generation = ++m_generation;
+    change.item.kind = kind;
+    change.item.id = id;
+    change.item.source = source;
+    change.item.target = target;
+
+    if (kind == vspChangePortAdded) {
+        const TPort* port = FindPort(id);
+        snprintf(change.item.name, sizeof(change.item.name), "%s", port->name);
+    }
+
+    m_changes.push_back(change);
+    if (m_changes.size() > LOOPBACK_MAX_CHANGES) {
+        m_changes.pop_front();
+    }
+
+    const TVSPEvent event = {kind, id, source, target, 0, m_generation};
+    Publish(&event);
+}
+
+// -------------------------------------------------------------------
+// Changes after 'generation', one page of MAX_CHANGE_ITEMS at most.
+// The generations in the log are consecutive, so the first change
+// to report is found by its distance to the oldest one.
+//
+inline IOReturn VSPLoopbackDriver::FillChanges(TVSPControllerData* response, const uint32_t generation) const
+{
+    TVSPChangeItem items[MAX_CHANGE_ITEMS];
+    uint8_t count = 0;
+
+    // a generation ahead of the log was taken before a restart,
+    // which started counting from 0 again
+    if (generation > m_generation) {
+        return kIOReturnOverrun;
+    }
+    if (generation < m_generation && m_changes.front().generation > generation + 1) {
+        return kIOReturnOverrun;
+    }
+
+    auto it = m_changes.end() - (m_generation - generation);
+    for (; it != m_changes.end() && count < MAX_CHANGE_ITEMS; it++) {
+        items[count++] = it->item;
+    }
+
+    // ports.list is byte aligned
+    memcpy(response->ports.list, items, count * sizeof(TVSPChangeItem));
+    response->ports.count = count;
+    response->ports.next = (it != m_changes.end() ? 1 : 0);
+    response->generation = generation + count;
+    return kIOReturnSuccess;
+}
+
+// -------------------------------------------------------------------
+// One subscription per connection, mask 0 removes it
+//
+inline IOReturn VSPLoopbackDriver::Subscribe(VSPLoopbackClient* client, const uint32_t mask)
+{
+    if (!client) {
+        return kIOReturnUnsupported;
+    }
+
+    for (auto it = m_subscribers.begin(); it != m_subscribers.end(); it++) {
+        if (it->client == client) {
+            m_subscribers.erase(it);
+            break;
+        }
+    }
+
+    if (mask) {
+        m_subscribers.push_back({client, mask});
+    }
+    return kIOReturnSuccess;
+}
+
+// -------------------------------------------------------------------
+//
+//
+inline void VSPLoopbackDriver::SetSignals(TPort* port, const uint32_t modemLines)
+{
+    if (port->modemLines == modemLines) {
+        return;
+    }
+    port->modemLines = modemLines;
+
+    const TVSPEvent event = {vspEventModemSignal, port->id, port->id, port->id, modemLines, m_generation};
+    Publish(&event);
+}
+
+// -------------------------------------------------------------------
+//
+//
+inline void VSPLoopbackDriver::Publish(const TVSPEvent* event) const
+{
+    for (const TSubscriber& s : m_subscribers) {
+        if (s.mask & VSP_EVENT_MASK(event->kind)) {
+            s.client->PostEvent(event);
+        }
+    }
+}
+
+// -------------------------------------------------------------------
+// MARK: Loopback Transport
+// -------------------------------------------------------------------
+
+/* The classes below are not exported */
+#pragma GCC visibility push(hidden)
+
+class VSPLoopbackTransport: public VSPTransport, public VSPLoopbackClient
+{
+public:
+    VSPLoopbackTransport(VSPControllerPriv* owner);
+    ~VSPLoopbackTransport() override;
+
+    bool Open() override;
+    void Close() override;
+    IOReturn Submit(TVSPControllerData* input, TVSPRequest* request) override;
+    void Rematch() override;
+    void PostEvent(const TVSPEvent* event) override;
+    void Terminated(VSPLoopbackDriver* driver) override;
+
+private:
+    // completion message like IOAsyncCallback arguments
+    typedef struct {
+        TVSPRequest* request;
+        IOReturn result;
+        uint32_t count;
+        uint64_t args[VSP_EVENT_ARGS];
+    } TCompletion;
+
+    typedef struct {
+        TVSPQueueLink link;
+        TCompletion completion;
+    } TNode;
+
+    typedef struct {
+        uint64_t dueUs;
+        TCompletion completion;
+    } TStalled;
+
+    // matched driver instances, slot = instance index
+    VSPLoopbackDriver* m_drivers[MAX_INSTANCES];
+    std::atomic<bool> m_attached[MAX_INSTANCES];
+    uint8_t m_instances;
+    std::thread m_thread;
+    std::mutex m_lock;
+    std::atomic<bool> m_running;
+
+    // completion queue of the run loop, woken through the eventfd
+    VSPCompletionQueue m_queue;
+    std::atomic<bool> m_wakeup;
+    int m_eventFd;
+    int m_epollFd;
+
+    // request slot of the event subscription
+    TVSPRequest* m_subscription;
+    uint32_t m_subscriptionId;
+
+    // VSP_LOOPBACK_STALL, m_stalled is guarded by m_lock
+    uint32_t m_stallEvery;
+    uint32_t m_stallMs;
+    uint32_t m_stallCount;
+    std::deque<TStalled> m_stalled;
+
+    inline uint8_t MatchCount() const;
+    inline bool Stall(const TCompletion* completion);
+    inline int ReleaseStalled();
+    inline void AttachDriver(const uint8_t index);
+    inline void Post(const TCompletion* completion);
+    inline void Drain(bool deliver);
+    void RunLoop();
+};
+
+#pragma GCC visibility pop
+
+// -------------------------------------------------------------------
+//
+//
+VSPTransport* VSPTransport::Create(VSPControllerPriv* owner)
+{
+    return new VSPLoopbackTransport(owner);
+}
+
+VSPLoopbackTransport::VSPLoopbackTransport(VSPControllerPriv* owner)
+    : VSPTransport(owner)
+    , m_drivers()
+    , m_attached()
+    , m_instances(0)
+    , m_thread()
+    , m_lock()
+    , m_running(false)
+    , m_queue()
+    , m_wakeup(false)
+    , m_eventFd(-1)
+    , m_epollFd(-1)
+    , m_subscription(nullptr)
+    , m_subscriptionId(0)
+    , m_stallEvery(0)
+    , m_stallMs(0)
+    , m_stallCount(0)
+    , m_stalled()
+{
+    const char* value = getenv(LOOPBACK_STALL_ENV);
+    if (value) {
+        char* end = nullptr;
+        m_stallEvery = (uint32_t) strtoul(value, &end, 10);
+        m_stallMs = (end && *end == ':' ? (uint32_t) strtoul(end + 1, nullptr, 10) : 0);
+    }
+}
+
+VSPLoopbackTransport::~VSPLoopbackTransport()
+{
+    Close();
+}
+
+// -------------------------------------------------------------------
+//
+//
+bool VSPLoopbackTransport::Open()
+{
+    if (m_running) {
+        return true;
+    }
+
+    // run loop of the connection, like the IOKit notification port
+    struct epoll_event ev = {};
+    if ((m_eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        m_owner->ReportError(kIOReturnNoResources, "Unable to create completion event.");
+        return false;
+    }
+    if ((m_epollFd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        m_owner->ReportError(kIOReturnNoResources, "Unable to create completion run loop.");
+        close(m_eventFd);
+        m_eventFd = -1;
+        return false;
+    }
+    ev.events = EPOLLIN;
+    ev.data.fd = m_eventFd;
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_eventFd, &ev) < 0) {
+        m_owner->ReportError(kIOReturnNoResources, "Unable to add completion event.");
+        close(m_epollFd);
+        close(m_eventFd);
+        m_epollFd = m_eventFd = -1;
+        return false;
+    }
+
+    m_instances = MatchCount();
+    for (uint8_t i = 0; i < m_instances; i++) {
+        m_drivers[i] = VSPLoopbackDriver::Instance(i);
+    }
+
+    m_running = true;
+    m_thread = std::thread(&VSPLoopbackTransport::RunLoop, this);
+
+    // terminated instances are matched later on by Rematch
+    for (uint8_t i = 0; i < m_instances; i++) {
+        AttachDriver(i);
+    }
+    return true;
+}
+
+// -------------------------------------------------------------------
+// The first instance keeps the path of the single instance setup.
+//
+inline void VSPLoopbackTransport::AttachDriver(const uint8_t index)
+{
+    TVSPDeviceName path;
+
+    if (m_attached[index] || !m_drivers[index]->Connect(this)) {
+        return;
+    }
+    m_attached[index] = true;
+
+    if (index) {
+        snprintf(path, sizeof(path), LOOPBACK_PATH "@%u", index);
+    }
+    else {
+        snprintf(path, sizeof(path), LOOPBACK_PATH);
+    }
+    m_owner->AttachInstance(index, index + 1, LOOPBACK_NAME, path);
+}
+
+// -------------------------------------------------------------------
+//
+//
+void VSPLoopbackTransport::Rematch()
+{
+    if (!m_running) {
+        return;
+    }
+    for (uint8_t i = 0; i < m_instances; i++) {
+        AttachDriver(i);
+    }
+}
+
+// -------------------------------------------------------------------
+//
+//
+inline uint8_t VSPLoopbackTransport::MatchCount() const
+{
+    const char* value = getenv("VSP_LOOPBACK_INSTANCES");
+    const long count = (value ? strtol(value, nullptr, 10) : VSP_LOOPBACK_INSTANCES);
+    return (uint8_t) (count < 1 ? 1 : (count > MAX_INSTANCES ? MAX_INSTANCES : count));
+}
+
+// -------------------------------------------------------------------
+//
+//
+void VSPLoopbackTransport::Close()
+{
+    // no events after this point, the driver lock orders before ours
+    for (uint8_t i = 0; i < m_instances; i++) {
+        m_drivers[i]->Disconnect(this);
+        m_attached[i] = false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (!m_running) {
+            return;
+        }
+        m_running = false;
+        m_subscription = nullptr;
+        m_stalled.clear();
+    }
+
+    const uint64_t one = 1;
+    if (write(m_eventFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        fprintf(stderr, "[LOOP] Wakeup of run loop failed: %s\n", strerror(errno));
+    }
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+
+    // completions queued while closing are dropped
+    Drain(false);
+
+    close(m_epollFd);
+    close(m_eventFd);
+    m_epollFd = m_eventFd = -1;
+}
+
+// -------------------------------------------------------------------
+//
+//
+IOReturn VSPLoopbackTransport::Submit(TVSPControllerData* input, TVSPRequest* request)
+{
+    const uint8_t instance = request->instance.load();
+    TCompletion completion = {};
+
+    if (input->command >= vspLastCommand) {
+        m_owner->ReportError(kIOReturnBadArgument, "Driver async call failed.");
+        return kIOReturnBadArgument;
+    }
+    if (instance >= m_instances || !m_attached[instance]) {
+        m_owner->ReportError(kIOReturnNotOpen, "Driver instance not matched.");
+        return kIOReturnNotOpen;
+    }
+
+    // Instant response like IOConnectCallAsyncStructMethod. Request
+    // and response cross the driver boundary in compact wire format.
+    uint8_t txBuffer[VSP_WIRE_MAX_SIZE];
+    uint8_t rxBuffer[VSP_WIRE_MAX_SIZE];
+    size_t txSize, rxSize;
+
+    TVSPControllerData* vspResponse = &request->response;
+    if (!(txSize = VSPWireEncode(input, txBuffer, sizeof(txBuffer)))) {
+        m_owner->ReportError(kIOReturnNoSpace, "Driver request encoding failed.");
+        return kIOReturnNoSpace;
+    }
+    rxSize = m_drivers[instance]->Execute(txBuffer, txSize, rxBuffer, sizeof(rxBuffer), this);
+    if (!rxSize || !VSPWireDecode(rxBuffer, rxSize, vspResponse)) {
+        m_owner->ReportError(kIOReturnBadArgument, "Driver response decoding failed.");
+        return kIOReturnBadArgument;
+    }
+
+    // one subscription per connection, the other instances stop
+    // their events outside our lock
+    if (input->command == vspControlSubscribe && vspResponse->status.code == kIOReturnSuccess) {
+        for (uint8_t i = 0; i < m_instances; i++) {
+            if (i != instance) {
+                m_drivers[i]->Detach(this);
+            }
+        }
+    }
+
+    m_wireStats.messages += 2;
+    m_wireStats.wireBytes += txSize + rxSize;
+    m_wireStats.blobBytes += 2 * VSP_UCD_SIZE;
+
+    completion.request = request;
+    completion.result = (IOReturn) vspResponse->status.code;
+    completion.count = VSP_ASYNC_ARGS;
+    completion.args[VSP_ARG_FLAGS] = vspResponse->status.flags;
+    completion.args[VSP_ARG_COMMAND] = vspResponse->command;
+    completion.args[VSP_ARG_CODE] = vspResponse->status.code;
+    completion.args[VSP_ARG_REQUEST] = vspResponse->request;
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (!m_running) {
+            m_owner->ReportError(kIOReturnNotOpen, "Driver async call failed.");
+            return kIOReturnNotOpen;
+        }
+
+        // a new subscription or its cancellation ends the current one
+        if (input->command == vspControlSubscribe && completion.result == kIOReturnSuccess) {
+            if (m_subscription) {
+                TCompletion ended = completion;
+                ended.request = m_subscription;
+                ended.result = kIOReturnAborted;
+                ended.args[VSP_ARG_CODE] = (uint32_t) kIOReturnAborted;
+                ended.args[VSP_ARG_REQUEST] = m_subscriptionId;
+                Post(&ended);
+            }
+            m_subscription = (input->parameter.flags ? request : nullptr);
+            m_subscriptionId = vspResponse->request;
+        }
+
+        if (input->command == vspControlSubscribe || !Stall(&completion)) {
+            Post(&completion);
+        }
+    }
+
+    return kIOReturnSuccess;
+}
+
+// -------------------------------------------------------------------
+// Driver events complete the subscription slot again and again, like
+// an OSAction of the DEXT kept for repeated AsyncCompletion calls.
+//
+void VSPLoopbackTransport::PostEvent(const TVSPEvent* event)
+{
+    TCompletion completion = {};
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (!m_running || !m_subscription) {
+            return;
+        }
+
+        completion.request = m_subscription;
+        completion.result = kIOReturnSuccess;
+        completion.count = VSP_EVENT_ARGS;
+        completion.args[VSP_ARG_FLAGS] = (MAGIC_CONTROL | (1 << vspControlSubscribe));
+        completion.args[VSP_ARG_COMMAND] = vspControlSubscribe;
+        completion.args[VSP_ARG_REQUEST] = m_subscriptionId;
+        VSPEventToArgs(event, completion.args);
+        Post(&completion);
+    }
+}
+
+// -------------------------------------------------------------------
+// Like the termination of an IOService, the subscription of the
+// instance ends without completion and the owner drops its slots.
+//
+void VSPLoopbackTransport::Terminated(VSPLoopbackDriver* driver)
+{
+    uint8_t index = 0;
+
+    for (; index < m_instances; index++) {
+        if (m_drivers[index] == driver) {
+            break;
+        }
+    }
+    if (index == m_instances || !m_attached[index].exchange(false)) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (!m_running) {
+            return;
+        }
+        if (m_subscription && m_subscription->instance == index) {
+            m_subscription = nullptr;
+        }
+    }
+
+    m_owner->DetachInstance(index);
+}
+
+// -------------------------------------------------------------------
+// Queue a copy of the completion. The eventfd is written only if the
+// run loop has not been woken since it drained the queue.
+//
+inline void VSPLoopbackTransport::Post(const TCompletion* completion)
+{
+    TNode* node = new TNode();
+    node->completion = *completion;
+    m_queue.Push(&node->link);
+
+    if (!m_wakeup.exchange(true, std::memory_order_acq_rel)) {
+        const uint64_t one = 1;
+        if (write(m_eventFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            fprintf(stderr, "[LOOP] Wakeup of run loop failed: %s\n", strerror(errno));
+        }
+    }
+}
+
+// -------------------------------------------------------------------
+// Caller holds m_lock. Returns true if the completion is lost or
+// held back by ReleaseStalled().
+//
+inline bool VSPLoopbackTransport::Stall(const TCompletion* completion)
+{
+    if (!m_stallEvery || ++m_stallCount % m_stallEvery) {
+        return false;
+    }
+    if (m_stallMs) {
+        const uint64_t now = std::chrono::duration_cast<std::chrono::microseconds>( //
+                                std::chrono::steady_clock::now().time_since_epoch())
+                                .count();
+        m_stalled.push_back({now + m_stallMs * 1000ULL, *completion});
+
+        // the run loop waits without a timeout while none is held
+        // back, it takes the timeout of this one once woken
+        if (m_stalled.size() == 1) {
+            const uint64_t one = 1;
+            if (write(m_eventFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+                fprintf(stderr, "[LOOP] Wakeup of run loop failed: %s\n", strerror(errno));
+            }
+        }
+    }
+    return true;
+}
+
+// -------------------------------------------------------------------
+// Posts the stalled completions which are due. Returns the epoll
+// timeout in ms until the next one, -1 if none is held back.
+//
+inline int VSPLoopbackTransport::ReleaseStalled()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    if (m_stalled.empty()) {
+        return -1;
+    }
+
+    const uint64_t now = std::chrono::duration_cast<std::chrono::microseconds>( //
+                            std::chrono::steady_clock::now().time_since_epoch())
+                            .count();
+    // same delay for all, the front is due first
+    while (!m_stalled.empty() && m_stalled.front().dueUs <= now) {
+        Post(&m_stalled.front().completion);
+        m_stalled.pop_front();
+    }
+    return (m_stalled.empty() ? -1 : (int) ((m_stalled.front().dueUs - now + 999) / 1000));
+}
+
+// -------------------------------------------------------------------
+//
+//
+inline void VSPLoopbackTransport::Drain(bool deliver)
+{
+    TVSPQueueLink* link;
+    while ((link = m_queue.Pop())) {
+        TNode* node = reinterpret_cast<TNode*>(link);
+        TCompletion* c = &node->completion;
+        if (deliver && m_running) {
+            m_owner->AsyncCallback(c->request, c->result, (void**) c->args, c->count);
+        }
+        delete node;
+    }
+}
+
+// -------------------------------------------------------------------
+// Delivers the driver completions asynchronously like the IOKit
+// notification port does on the run loop. Further descriptors of
+// the connection may join the epoll set later on.
+//
+void VSPLoopbackTransport::RunLoop()
+{
+    struct epoll_event events[4];
+
+    while (m_running) {
+        const int count = epoll_wait(m_epollFd, events, 4, ReleaseStalled());
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            m_owner->ReportError(kIOReturnIOError, "Completion run loop failed.");
+            return;
+        }
+
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.fd == m_eventFd) {
+                uint64_t value;
+                if (read(m_eventFd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+                    fprintf(stderr, "[LOOP] Read of wakeup failed: %s\n", strerror(errno));
+                }
+                // re-arm before draining, a later Post wakes us again
+                m_wakeup.store(false, std::memory_order_release);
+                Drain(true);
+            }
+        }
+    }
+}
+
+} // END namespace
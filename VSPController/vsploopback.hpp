@@ -0,0 +1,161 @@
+// ********************************************************************
+// vsploopback.hpp - In-process VSPDriver emulation (private)
+//
+// Copyright © 2025 by EoF Software Labs
+// SPDX-License-Identifier: MIT
+// ********************************************************************
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <vspcontroller.hpp>
+#include <vspptyengine.hpp>
+#include <vsptransport.hpp>
+
+namespace VSPClient {
+
+/* The classes below are not exported */
+#pragma GCC visibility push(hidden)
+
+// -------------------------------------------------------------------
+// Connection of the driver emulation, receives the events of its
+// subscription.
+//
+class VSPLoopbackClient
+{
+public:
+    virtual ~VSPLoopbackClient() {}
+
+    /** ----------------------
+     * Driver event, called with the driver lock held
+     */
+    virtual void PostEvent(const TVSPEvent* event) = 0;
+
+    /** ----------------------
+     * Driver instance terminated, the connection is gone. Called
+     * without the driver lock.
+     */
+    virtual void Terminated(class VSPLoopbackDriver* driver) = 0;
+};
+
+// -------------------------------------------------------------------
+// Emulates the user client of the VSPDriver DEXT in user space. It
+// implements the TVSPControlCommand semantics on an in-memory port
+// and link table, so the controller can be driven without the DEXT.
+// With VSP_LOOPBACK_PTY set the ports carry data too: each one is a
+// pseudo terminal of the VSPPtyEngine, named by its slave path, and
+// with VSP_LOOPBACK_PACING they transmit at the rate of their baud.
+// Each emulated instance is shared by all connections of the process
+// like a DEXT instance on macOS, the transport matches the first
+// VSP_LOOPBACK_INSTANCES of them.
+//
+class VSPLoopbackDriver
+{
+public:
+    /** ----------------------
+     * Process wide driver instance 'index' (0..MAX_INSTANCES-1)
+     */
+    static VSPLoopbackDriver* Instance(const uint8_t index = 0);
+
+    /** ----------------------
+     * Execute command and fill the response. Returns the command
+     * status which is also stored in response->status.code
+     */
+    IOReturn Execute(const TVSPControllerData* input, TVSPControllerData* response, VSPLoopbackClient* client = nullptr);
+
+    /** ----------------------
+     * Execute a request in compact wire format (vspwire.hpp) and
+     * encode the response into 'response'. Returns the response
+     * size or 0 on malformed requests.
+     */
+    size_t Execute(const uint8_t* request, size_t size, uint8_t* response, size_t maxSize, VSPLoopbackClient* client = nullptr);
+
+    /** ----------------------
+     * Open a connection, fails while the instance is terminated
+     */
+    bool Connect(VSPLoopbackClient* client);
+
+    /** ----------------------
+     * Close the connection and drop its subscription
+     */
+    void Disconnect(VSPLoopbackClient* client);
+
+    /** ----------------------
+     * Drop the subscription of a connection
+     */
+    void Detach(VSPLoopbackClient* client);
+
+    /** ----------------------
+     * Emulate a driver restart: Terminate drops all ports, links and
+     * connections like an unloaded DEXT and rejects all commands
+     * until Start matches the instance again.
+     */
+    void Terminate();
+    void Start();
+
+private:
+    typedef struct {
+        uint16_t id;
+        /* link id of the port, 0 = not linked */
+        uint16_t link;
+        /* VSP_SIGNAL_xxx */
+        uint32_t modemLines;
+        char name[MAX_PORT_NAME];
+        TVSPPortParameters parameters;
+        uint64_t flags;
+        /* data path, nullptr without VSP_LOOPBACK_PTY */
+        TVSPPtyPort* pty;
+    } TPort;
+
+    typedef struct {
+        uint16_t id;
+        uint16_t source;
+        uint16_t target;
+    } TLink;
+
+    typedef struct {
+        uint32_t generation;
+        TVSPChangeItem item;
+    } TChange;
+
+    typedef struct {
+        VSPLoopbackClient* client;
+        uint32_t mask;
+    } TSubscriber;
+
+    /* Both tables are sorted by id */
+    std::mutex m_lock;
+    std::vector<TPort> m_ports;
+    std::vector<TLink> m_links;
+
+    /* Topology generation and the latest changes leading to it */
+    uint32_t m_generation = 0;
+    std::deque<TChange> m_changes;
+
+    /* Connections with an event subscription */
+    std::vector<TSubscriber> m_subscribers;
+
+    /* Open connections, none while terminated */
+    std::vector<VSPLoopbackClient*> m_clients;
+    bool m_online = true;
+
+    inline IOReturn ExecuteBatch(const TVSPControllerData* input, TVSPControllerData* response);
+    inline IOReturn CreatePort(const TVSPPortParameters* parameters, uint16_t* id);
+    inline IOReturn RemovePort(const uint16_t id);
+    inline IOReturn LinkPorts(const uint16_t source, const uint16_t target);
+    inline IOReturn UnlinkPorts(const uint16_t source, const uint16_t target);
+    inline IOReturn SetPortFlags(const uint16_t id, const uint64_t flags);
+    inline TPort* FindPort(const uint16_t id);
+    inline void FillPortList(TVSPControllerData* response, const uint16_t cursor) const;
+    inline void FillLinkList(TVSPControllerData* response, const uint16_t cursor) const;
+    inline void LogChange(const uint8_t kind, const uint16_t id, const uint16_t source, const uint16_t target);
+    inline IOReturn FillChanges(TVSPControllerData* response, const uint32_t generation) const;
+    inline IOReturn Subscribe(VSPLoopbackClient* client, const uint32_t mask);
+    inline void SetSignals(TPort* port, const uint32_t modemLines);
+    inline void Publish(const TVSPEvent* event) const;
+};
+
+#pragma GCC visibility pop
+
+} // END namespace
@@ -0,0 +1,870 @@
+// ********************************************************************
+// vspptyengine.cpp - Pseudo terminal data path of the loopback driver
+//
+// Copyright © 2025 by EoF Software Labs
+// SPDX-License-Identifier: MIT
+// ********************************************************************
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <vspptyengine.hpp>
+
+namespace VSPClient {
+
+// bytes of a port read but not yet written to its target, the ring
+// holds a few reads of the master while the target is full
+#define PTY_RING_SIZE 16384
+
+// a pipe is drained through a buffer of this size when it is dropped
+#define PTY_DRAIN_SIZE 4096
+
+// bytes moved by one splice(), the pipe of a port holds 64 KB
+#define PTY_SPLICE_SIZE 65536
+
+// reads of one port per wakeup, the other ports get their turn
+#define PTY_READ_BUDGET 16
+
+// epoll events per wait
+#define PTY_MAX_EVENTS 64
+
+// a throttled port waits for the credit of a quantum of line time,
+// one character at least, like the latency timer of a USB serial
+// adapter. An idle port saves up two ticks more, a port with a
+// backlog catches up on a late reactor.
+#define PTY_PACING_QUANTUM_NS 1000000ull
+#define PTY_PACING_SLACK_NS   (2 * PTY_PACING_TICK_US * 1000ull)
+#define PTY_PACING_CATCHUP_NS 10000000ull
+
+// parity of the port parameters as in SerialDriverKit, none, default
+// and any put no parity bit on the line
+#define PTY_PARITY_ODD   2
+#define PTY_PARITY_SPACE 5
+
+// -------------------------------------------------------------------
+// Port state, owned by the reactor thread of its shard once the port
+// is open.
+// A port transmits into the pending ring or pipe of its own, the
+// pending bytes are written to the master of the target: the linked
+// port or the port itself. The reactor is producer and consumer of
+// the ring, reading the master into it and writing it out to the
+// target, one ring per direction of a link.
+//
+struct TVSPPtyPort {
+    /* pacing timer, first member for the wheel */
+    TVSPTimerLink timer;
+    /* driver port id and the shard the port is on, control side */
+    uint16_t id;
+    uint32_t shard;
+    int master;
+    /* kept open, the master never sees a hangup that way */
+    int slave;
+    /* pending bytes of vspPtySplice, -1 with vspPtyCopy */
+    int pipe[2];
+    /* pending bytes of vspPtyCopy, nullptr with vspPtySplice */
+    std::unique_ptr<VSPByteRing> ring;
+    /* linked port, nullptr = echo */
+    TVSPPtyPort* peer;
+    /* port whose master is full, the pending bytes wait for it */
+    TVSPPtyPort* waiting;
+    /* port waiting for this master to take its pending bytes */
+    TVSPPtyPort* writer;
+    /* epoll events of the master, 0 = not in the epoll set */
+    uint32_t events;
+    /* bytes in the pipe */
+    uint32_t length;
+    /* character time of a paced port, 0 = not paced */
+    uint64_t charNs;
+    /* token bucket: transmit time saved up and when it was */
+    uint64_t creditNs;
+    uint64_t creditAtNs;
+    /* out of credit, not read until its timer expires */
+    bool throttled;
+    /* the last read was cut short by the credit */
+    bool backlog;
+};
+
+// -------------------------------------------------------------------
+// Steady clock of the timerfd
+//
+static inline uint64_t MonotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+// -------------------------------------------------------------------
+// Pending bytes of the port, waiting for its target
+//
+static inline size_t Pending(TVSPPtyPort* port)
+{
+    return (port->ring ? port->ring->Pending() : port->length);
+}
+
+// -------------------------------------------------------------------
+// No room left to read the master into, a pipe is refilled once its
+// bytes are all gone
+//
+static inline bool Full(TVSPPtyPort* port)
+{
+    return (port->ring ? !port->ring->Room() : port->length != 0);
+}
+
+// -------------------------------------------------------------------
+// Line time a throttled port waits for
+//
+static inline uint64_t Quantum(const TVSPPtyPort* port)
+{
+    return (port->charNs > PTY_PACING_QUANTUM_NS ? port->charNs : PTY_PACING_QUANTUM_NS);
+}
+
+// -------------------------------------------------------------------
+// A character on the line is a start bit, the data bits, the parity
+// bit and the stop bits. The stop bits are counted in half bits like
+// SerialDriverKit does (2 = 1, 3 = 1.5, 4 = 2), less than 2 is taken
+// as the number of whole stop bits.
+//
+static inline uint64_t CharacterNs(const TVSPPortParameters* parameters)
+{
+    if (!parameters || !parameters->baudRate) {
+        return 0;
+    }
+
+    const uint64_t data = (parameters->dataBits ? parameters->dataBits : 8);
+    const uint64_t parity = (parameters->parity >= PTY_PARITY_ODD && parameters->parity <= PTY_PARITY_SPACE ? 1 : 0);
+    const uint64_t stop = (parameters->stopBits < 2 ? 2 * (parameters->stopBits ? parameters->stopBits : 1) : parameters->stopBits);
+    const uint64_t halfBits = 2 * (1 + data + parity) + stop;
+
+    return (halfBits * 1000000000ull + parameters->baudRate) / (2ull * parameters->baudRate);
+}
+
+// -------------------------------------------------------------------
+// MARK: Engine
+// -------------------------------------------------------------------
+
+// -------------------------------------------------------------------
+//
+//
+VSPPtyEngine* VSPPtyEngine::Instance()
+{
+    static VSPPtyEngine engine;
+    return &engine;
+}
+
+VSPPtyEngine::VSPPtyEngine()
+    : m_lock()
+    , m_shards()
+    , m_shardCount(1)
+    , m_affinity(false)
+    , m_reconfigure(false)
+    , m_open(0)
+{
+}
+
+// -------------------------------------------------------------------
+// The ports still open at exit are closed with the process.
+//
+VSPPtyEngine::~VSPPtyEngine()
+{
+    Stop();
+}
+
+// -------------------------------------------------------------------
+// Called with each port created, the shards only restart for a
+// different configuration.
+//
+void VSPPtyEngine::Configure(const uint32_t shards, const bool affinity)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    if (shards != m_shardCount || affinity != m_affinity) {
+        m_shardCount = shards;
+        m_affinity = affinity;
+        m_reconfigure = true;
+    }
+}
+
+// -------------------------------------------------------------------
+// Caller holds m_lock. With affinity shard i runs on the i-th CPU
+// the process may use.
+//
+inline bool VSPPtyEngine::Start()
+{
+    std::vector<int> cpus;
+    cpu_set_t allowed;
+
+    if (m_reconfigure && !m_open) {
+        Stop();
+        m_reconfigure = false;
+    }
+    if (!m_shards.empty()) {
+        return true;
+    }
+
+    const uint32_t count = (m_shardCount ? m_shardCount : std::max(1u, std::thread::hardware_concurrency()));
+    if (m_affinity && sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        std::unique_ptr<VSPPtyReactor> shard(new VSPPtyReactor());
+        if (!shard->Start(cpus.empty() ? -1 : cpus[i % cpus.size()])) {
+            Stop();
+            return false;
+        }
+        m_shards.push_back(std::move(shard));
+    }
+    return true;
+}
+
+// -------------------------------------------------------------------
+// Caller holds m_lock
+//
+inline void VSPPtyEngine::Stop()
+{
+    for (std::unique_ptr<VSPPtyReactor>& shard : m_shards) {
+        shard->Stop();
+    }
+    m_shards.clear();
+}
+
+// -------------------------------------------------------------------
+// Pairs of consecutive ids from 1 share a shard
+//
+inline uint32_t VSPPtyEngine::ShardOf(const uint16_t id) const
+{
+    return (uint32_t) ((((uint32_t) id - 1) >> 1) % m_shards.size());
+}
+
+// -------------------------------------------------------------------
+// Caller holds m_lock, so no other command of the port is queued
+// until the shard it is on has let it go.
+//
+inline void VSPPtyEngine::Move(TVSPPtyPort* port, const uint32_t shard)
+{
+    if (port->shard == shard) {
+        return;
+    }
+
+    std::promise<void> done;
+    std::future<void> detached = done.get_future();
+    m_shards[port->shard]->Post(VSPPtyReactor::ptyCommandDetach, port, nullptr, &done);
+    detached.wait();
+    port->shard = shard;
+}
+
+// -------------------------------------------------------------------
+// The slave is raw: no echo, no line editing, no character mapping.
+// The engine echoes by itself while the port is not linked.
+//
+TVSPPtyPort* VSPPtyEngine::OpenPort(char* name, const size_t size, const TVSPPtyForwarding forwarding, const TVSPPortParameters* pacing, const uint16_t id)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    int pipes[2] = {-1, -1};
+    struct termios tio;
+    int master, slave;
+
+    if (!Start()) {
+        return nullptr;
+    }
+
+    if ((master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC)) < 0) {
+        fprintf(stderr, "[PTY] Unable to open pseudo terminal: %s\n", strerror(errno));
+        return nullptr;
+    }
+    if (grantpt(master) < 0 || unlockpt(master) < 0 || ptsname_r(master, name, size) != 0) {
+        fprintf(stderr, "[PTY] Unable to unlock pseudo terminal: %s\n", strerror(errno));
+        close(master);
+        return nullptr;
+    }
+    if ((slave = open(name, O_RDWR | O_NOCTTY | O_CLOEXEC)) < 0) {
+        fprintf(stderr, "[PTY] Unable to open %s: %s\n", name, strerror(errno));
+        close(master);
+        return nullptr;
+    }
+
+    if (forwarding == vspPtySplice && pipe2(pipes, O_NONBLOCK | O_CLOEXEC) < 0) {
+        fprintf(stderr, "[PTY] Unable to create pipe of %s: %s\n", name, strerror(errno));
+        close(slave);
+        close(master);
+        return nullptr;
+    }
+
+    if (tcgetattr(slave, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(slave, TCSANOW, &tio);
+    }
+
+    TVSPPtyPort* port = new TVSPPtyPort();
+    port->id = id;
+    port->shard = ShardOf(id);
+    port->master = master;
+    port->slave = slave;
+    port->pipe[0] = pipes[0];
+    port->pipe[1] = pipes[1];
+    if (forwarding == vspPtyCopy) {
+        port->ring.reset(new VSPByteRing(PTY_RING_SIZE));
+    }
+    port->charNs = CharacterNs(pacing);
+    port->creditNs = port->charNs;
+    port->creditAtNs = MonotonicNs();
+
+    m_open++;
+    m_shards[port->shard]->Post(VSPPtyReactor::ptyCommandOpen, port, nullptr);
+    return port;
+}
+
+// -------------------------------------------------------------------
+//
+//
+void VSPPtyEngine::ClosePort(TVSPPtyPort* port)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    if (port) {
+        m_open--;
+        m_shards[port->shard]->Post(VSPPtyReactor::ptyCommandClose, port, nullptr);
+    }
+}
+
+// -------------------------------------------------------------------
+// The driver links unlinked ports only, the moved port has no peer
+// on the shard it leaves.
+//
+void VSPPtyEngine::LinkPorts(TVSPPtyPort* source, TVSPPtyPort* target)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    if (source && target) {
+        const uint32_t shard = ShardOf(std::min(source->id, target->id));
+        Move(source, shard);
+        Move(target, shard);
+        m_shards[shard]->Post(VSPPtyReactor::ptyCommandLink, source, target);
+    }
+}
+
+// -------------------------------------------------------------------
+// Both ports stay on the shard of the link
+//
+void VSPPtyEngine::UnlinkPorts(TVSPPtyPort* source, TVSPPtyPort* target)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    if (source && target) {
+        m_shards[source->shard]->Post(VSPPtyReactor::ptyCommandUnlink, source, target);
+    }
+}
+
+// -------------------------------------------------------------------
+// MARK: Reactor
+// -------------------------------------------------------------------
+
+VSPPtyReactor::VSPPtyReactor()
+    : m_thread()
+    , m_running(false)
+    , m_epollFd(-1)
+    , m_eventFd(-1)
+    , m_timerFd(-1)
+    , m_timerUs(0)
+    , m_pacing(PTY_PACING_TICK_US)
+    , m_paced()
+    , m_commands()
+    , m_wakeup(false)
+{
+}
+
+VSPPtyReactor::~VSPPtyReactor()
+{
+    Stop();
+}
+
+// -------------------------------------------------------------------
+// A reactor that cannot be pinned runs unpinned.
+//
+bool VSPPtyReactor::Start(const int cpu)
+{
+    struct epoll_event ev = {};
+
+    if ((m_eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        fprintf(stderr, "[PTY] Unable to create reactor event: %s\n", strerror(errno));
+        return false;
+    }
+    if ((m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+        fprintf(stderr, "[PTY] Unable to create pacing timer: %s\n", strerror(errno));
+        close(m_eventFd);
+        m_eventFd = -1;
+        return false;
+    }
+    if ((m_epollFd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        fprintf(stderr, "[PTY] Unable to create reactor: %s\n", strerror(errno));
+        close(m_timerFd);
+        close(m_eventFd);
+        m_timerFd = m_eventFd = -1;
+        return false;
+    }
+
+    // the eventfd and the timerfd are the descriptors without a port
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_eventFd, &ev) < 0) {
+        fprintf(stderr, "[PTY] Unable to add reactor event: %s\n", strerror(errno));
+        close(m_epollFd);
+        close(m_timerFd);
+        close(m_eventFd);
+        m_epollFd = m_timerFd = m_eventFd = -1;
+        return false;
+    }
+    ev.data.ptr = &m_timerFd;
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_timerFd, &ev) < 0) {
+        fprintf(stderr, "[PTY] Unable to add pacing timer: %s\n", strerror(errno));
+        close(m_epollFd);
+        close(m_timerFd);
+        close(m_eventFd);
+        m_epollFd = m_timerFd = m_eventFd = -1;
+        return false;
+    }
+
+    m_running = true;
+    m_thread = std::thread(&VSPPtyReactor::Run, this);
+
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        const int error = pthread_setaffinity_np(m_thread.native_handle(), sizeof(set), &set);
+        if (error) {
+            fprintf(stderr, "[PTY] Unable to pin reactor to CPU %d: %s\n", cpu, strerror(error));
+        }
+    }
+    return true;
+}
+
+// -------------------------------------------------------------------
+// The commands the thread left are run here, the ports closed by
+// them are gone. Ports still open stay with the process.
+//
+void VSPPtyReactor::Stop()
+{
+    if (!m_running.exchange(false)) {
+        return;
+    }
+
+    const uint64_t one = 1;
+    if (write(m_eventFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        fprintf(stderr, "[PTY] Wakeup of reactor failed: %s\n", strerror(errno));
+    }
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    RunCommands();
+
+    close(m_epollFd);
+    close(m_eventFd);
+    close(m_timerFd);
+    m_epollFd = m_eventFd = m_timerFd = -1;
+}
+
+// -------------------------------------------------------------------
+// The eventfd is written only if the reactor has not been woken
+// since it ran the commands, like VSPLoopbackTransport::Post().
+//
+void VSPPtyReactor::Post(const TCommandKind kind, TVSPPtyPort* port, TVSPPtyPort* peer, std::promise<void>* done)
+{
+    TCommand* command = new TCommand();
+    command->kind = kind;
+    command->port = port;
+    command->peer = peer;
+    command->done = done;
+    m_commands.Push(&command->link);
+
+    if (!m_wakeup.exchange(true, std::memory_order_acq_rel)) {
+        const uint64_t one = 1;
+        if (write(m_eventFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            fprintf(stderr, "[PTY] Wakeup of reactor failed: %s\n", strerror(errno));
+        }
+    }
+}
+
+// -------------------------------------------------------------------
+// Reactor thread only.
+//
+inline void VSPPtyReactor::RunCommands()
+{
+    TVSPQueueLink* link;
+
+    while ((link = m_commands.Pop())) {
+        TCommand* command = reinterpret_cast<TCommand*>(link);
+        TVSPPtyPort* port = command->port;
+        TVSPPtyPort* peer = command->peer;
+
+        switch (command->kind) {
+            case ptyCommandOpen: {
+                Watch(port);
+                break;
+            }
+            case ptyCommandClose: {
+                if (port->peer) {
+                    port->peer->peer = nullptr;
+                    Drop(port->peer);
+                }
+                Destroy(port);
+                break;
+            }
+            case ptyCommandLink: {
+                Drop(port);
+                Drop(peer);
+                port->peer = peer;
+                peer->peer = port;
+                break;
+            }
+            case ptyCommandUnlink: {
+                Drop(port);
+                Drop(peer);
+                port->peer = nullptr;
+                peer->peer = nullptr;
+                break;
+            }
+            case ptyCommandDetach: {
+                Release(port);
+                break;
+            }
+        }
+        if (command->done) {
+            command->done->set_value();
+        }
+        delete command;
+    }
+}
+
+// -------------------------------------------------------------------
+// Moves the bytes transmitted by 'port' to its target until either
+// side runs dry. A full target master parks the rest in the pending
+// ring or pipe, the port reads on into the room of its ring and
+// stops once it is full until the target is writable.
+//
+inline void VSPPtyReactor::Forward(TVSPPtyPort* port)
+{
+    TVSPPtyPort* target = (port->peer ? port->peer : port);
+
+    for (int reads = 0; reads < PTY_READ_BUDGET; reads++) {
+        const bool full = Full(port);
+        const ssize_t filled = (full ? 0 : Fill(port));
+
+        if (!port->waiting && Pending(port)) {
+            const ssize_t size = Flush(port, target);
+            if (size < 0 && errno != EAGAIN) {
+                // the bytes are lost like on a broken line
+                Discard(port);
+            }
+            else if (Pending(port)) {
+                port->waiting = target;
+                target->writer = port;
+                Watch(target);
+            }
+        }
+
+        // a full port goes on reading once the target took it all
+        if (filled <= 0 && (!full || port->waiting)) {
+            break;
+        }
+    }
+    Watch(port);
+}
+
+// -------------------------------------------------------------------
+// Transmitted bytes of the master into the pending ring or pipe. A
+// paced port reads the characters its credit pays for, without any
+// it is throttled until a quantum is paid.
+//
+inline ssize_t VSPPtyReactor::Fill(TVSPPtyPort* port)
+{
+    // as much as the ring takes, the room it last saw may be stale
+    size_t limit = (port->ring ? port->ring->Size() : PTY_SPLICE_SIZE);
+    struct iovec spans[2];
+    ssize_t size;
+
+    if (port->throttled) {
+        errno = EAGAIN;
+        return -1;
+    }
+    if (port->charNs) {
+        const uint64_t now = MonotonicNs();
+        const size_t chars = Credit(port, now);
+        if (!chars) {
+            port->throttled = true;
+            port->backlog = true;
+            m_pacing.Add(&port->timer, now / 1000, (Quantum(port) - port->creditNs + 999) / 1000);
+            errno = EAGAIN;
+            return -1;
+        }
+        limit = (chars < limit ? chars : limit);
+    }
+
+    if (port->ring) {
+        // published per read, the batch of one syscall
+        size = readv(port->master, spans, port->ring->WriteSpans(spans, limit));
+        if (size > 0) {
+            port->ring->Produce((size_t) size);
+            port->ring->Publish();
+        }
+    }
+    else if ((size = splice(port->master, nullptr, port->pipe[1], nullptr, limit, SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) > 0) {
+        port->length += (uint32_t) size;
+    }
+
+    if (port->charNs) {
+        port->backlog = (size == (ssize_t) limit);
+        if (size > 0) {
+            port->creditNs -= (uint64_t) size * port->charNs;
+        }
+    }
+    return size;
+}
+
+// -------------------------------------------------------------------
+// Refills the token bucket of a paced port by the time passed, an
+// idle port saves up a quantum and the slack at most. Returns the
+// characters the credit pays for.
+//
+inline size_t VSPPtyReactor::Credit(TVSPPtyPort* port, const uint64_t nowNs)
+{
+    const uint64_t burst = Quantum(port) + (port->backlog ? PTY_PACING_CATCHUP_NS : PTY_PACING_SLACK_NS);
+
+    port->creditNs += nowNs - port->creditAtNs;
+    port->creditAtNs = nowNs;
+    if (port->creditNs > burst) {
+        port->creditNs = burst;
+    }
+    return (size_t) (port->creditNs / port->charNs);
+}
+
+// -------------------------------------------------------------------
+// Forwards the ports whose next character is paid and sets the
+// timerfd to the first port still throttled
+//
+inline void VSPPtyReactor::Pace()
+{
+    if (!m_pacing.Empty()) {
+        // the port is collected, Forward() may throttle it again
+        m_pacing.Advance(MonotonicNs() / 1000, [this](TVSPTimerLink* link) {
+            m_paced.push_back(reinterpret_cast<TVSPPtyPort*>(link));
+        });
+        for (TVSPPtyPort* port : m_paced) {
+            port->throttled = false;
+            if (!Full(port)) {
+                Forward(port);
+            }
+        }
+        m_paced.clear();
+    }
+
+    const uint64_t next = (m_pacing.Empty() ? 0 : m_pacing.NextUs());
+    if (next == m_timerUs) {
+        return;
+    }
+
+    // absolute, 0 disarms it
+    struct itimerspec its = {};
+    its.it_value.tv_sec = (time_t) (next / 1000000);
+    its.it_value.tv_nsec = (long) (next % 1000000) * 1000;
+    if (timerfd_settime(m_timerFd, TFD_TIMER_ABSTIME, &its, nullptr) < 0) {
+        fprintf(stderr, "[PTY] Unable to set pacing timer: %s\n", strerror(errno));
+        return;
+    }
+    m_timerUs = next;
+}
+
+// -------------------------------------------------------------------
+// Pending bytes into the master of the target, as many as it takes
+//
+inline ssize_t VSPPtyReactor::Flush(TVSPPtyPort* port, TVSPPtyPort* target)
+{
+    struct iovec spans[2];
+    ssize_t size;
+
+    if (port->ring) {
+        // released per write, the batch of one syscall
+        size = writev(target->master, spans, port->ring->ReadSpans(spans, port->ring->Size()));
+        if (size > 0) {
+            port->ring->Consume((size_t) size);
+            port->ring->Release();
+        }
+    }
+    else if ((size = splice(port->pipe[0], nullptr, target->master, nullptr, port->length, SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) > 0) {
+        port->length -= (uint32_t) size;
+    }
+    return size;
+}
+
+// -------------------------------------------------------------------
+// The pending bytes are dropped, a pipe is drained through a buffer
+//
+inline void VSPPtyReactor::Discard(TVSPPtyPort* port)
+{
+    if (port->ring) {
+        port->ring->Drain();
+        return;
+    }
+
+    uint8_t buffer[PTY_DRAIN_SIZE];
+    while (port->length && read(port->pipe[0], buffer, sizeof(buffer)) > 0) {
+    }
+    port->length = 0;
+}
+
+// -------------------------------------------------------------------
+// Bytes in flight of a port are lost when its wiring changes
+//
+inline void VSPPtyReactor::Drop(TVSPPtyPort* port)
+{
+    if (port->waiting) {
+        TVSPPtyPort* target = port->waiting;
+        port->waiting = nullptr;
+        target->writer = nullptr;
+        Watch(target);
+    }
+    if (port->writer) {
+        TVSPPtyPort* writer = port->writer;
+        port->writer = nullptr;
+        writer->waiting = nullptr;
+        Discard(writer);
+        Watch(writer);
+    }
+    Discard(port);
+    Watch(port);
+}
+
+// -------------------------------------------------------------------
+// Level triggered: the master is read while there is room for its
+// bytes and the port is not throttled, and watched for room while a writer
+// waits for it.
+//
+inline void VSPPtyReactor::Watch(TVSPPtyPort* port)
+{
+    struct epoll_event ev = {};
+
+    ev.events = (Full(port) || port->throttled ? 0 : (uint32_t) EPOLLIN) | (port->writer ? (uint32_t) EPOLLOUT : 0);
+    ev.data.ptr = port;
+    if (ev.events == port->events) {
+        return;
+    }
+
+    const int op = (port->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD);
+    if (epoll_ctl(m_epollFd, (ev.events ? op : EPOLL_CTL_DEL), port->master, &ev) < 0) {
+        fprintf(stderr, "[PTY] Unable to watch port: %s\n", strerror(errno));
+        return;
+    }
+    port->events = ev.events;
+}
+
+// -------------------------------------------------------------------
+// Takes the port out of the epoll set and the pacing wheel, it keeps
+// the credit it has
+//
+inline void VSPPtyReactor::Release(TVSPPtyPort* port)
+{
+    m_pacing.Remove(&port->timer);
+    port->throttled = false;
+    Drop(port);
+    if (port->events) {
+        epoll_ctl(m_epollFd, EPOLL_CTL_DEL, port->master, nullptr);
+        port->events = 0;
+    }
+}
+
+// -------------------------------------------------------------------
+//
+//
+inline void VSPPtyReactor::Destroy(TVSPPtyPort* port)
+{
+    Release(port);
+    close(port->master);
+    close(port->slave);
+    if (port->pipe[0] >= 0) {
+        close(port->pipe[0]);
+        close(port->pipe[1]);
+    }
+    delete port;
+}
+
+// -------------------------------------------------------------------
+// The commands run after the I/O of a wakeup, a port closed by one
+// of them may still have events in the same batch. The paced ports
+// run last, their timers are checked on every wakeup.
+//
+void VSPPtyReactor::Run()
+{
+    struct epoll_event events[PTY_MAX_EVENTS];
+
+    while (m_running) {
+        const int count = epoll_wait(m_epollFd, events, PTY_MAX_EVENTS, -1);
+        bool commands = false;
+
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "[PTY] Reactor failed: %s\n", strerror(errno));
+            return;
+        }
+
+        for (int i = 0; i < count; i++) {
+            TVSPPtyPort* port = (TVSPPtyPort*) events[i].data.ptr;
+            if (events[i].data.ptr == &m_timerFd) {
+                uint64_t value;
+                if (read(m_timerFd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+                    fprintf(stderr, "[PTY] Read of pacing timer failed: %s\n", strerror(errno));
+                }
+                continue;
+            }
+            if (!port) {
+                uint64_t value;
+                if (read(m_eventFd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+                    fprintf(stderr, "[PTY] Read of wakeup failed: %s\n", strerror(errno));
+                }
+                commands = true;
+                continue;
+            }
+
+            // room for the pending bytes of the waiting writer
+            if ((events[i].events & EPOLLOUT) && port->writer) {
+                TVSPPtyPort* writer = port->writer;
+                port->writer = nullptr;
+                writer->waiting = nullptr;
+                Watch(port);
+                Forward(writer);
+            }
+            if ((events[i].events & (EPOLLIN | EPOLLHUP)) && !Full(port) && !port->throttled) {
+                Forward(port);
+            }
+        }
+
+        if (commands) {
+            // re-arm before running, a later Post wakes us again
+            m_wakeup.store(false, std::memory_order_release);
+            RunCommands();
+        }
+        Pace();
+    }
+}
+
+} // END namespace
@@ -0,0 +1,191 @@
+// ********************************************************************
+// vspptyengine.hpp - Pseudo terminal data path of the loopback driver
+//
+// Copyright © 2025 by EoF Software Labs
+// SPDX-License-Identifier: MIT
+// ********************************************************************
+#pragma once
+
+#include <atomic>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <sys/types.h>
+#include <thread>
+#include <vector>
+#include <vspcontroller.hpp>
+#include <vspqueue.hpp>
+#include <vspring.hpp>
+#include <vsptimerwheel.hpp>
+
+namespace VSPClient {
+
+/* The classes below are not exported */
+#pragma GCC visibility push(hidden)
+
+typedef struct TVSPPtyPort TVSPPtyPort;
+
+/* Pacing wheel: 100 us ticks, 3 levels of 64 slots reach 26 seconds */
+#define PTY_PACING_TICK_US 100
+#define PTY_PACING_BITS    6
+#define PTY_PACING_LEVELS  3
+
+// -------------------------------------------------------------------
+// How the bytes of a port get to its target: readv() and writev()
+// through a ring, or splice() through a pipe of the port without
+// passing user space
+//
+typedef enum {
+    vspPtyCopy,
+    vspPtySplice,
+} TVSPPtyForwarding;
+
+// -------------------------------------------------------------------
+// Event loop of one shard of the engine. The reactor thread owns the
+// state of the ports on its shard and serves their masters through
+// epoll. Open, close, link, unlink and detach are queued commands it
+// runs in order, so the forwarding needs no lock.
+//
+// A paced port transmits at the character rate of its parameters:
+// a token bucket meters its reads, a throttled port waits on the
+// timer wheel of the reactor, which wakes through a timerfd.
+//
+class VSPPtyReactor
+{
+public:
+    typedef enum {
+        ptyCommandOpen,
+        ptyCommandClose,
+        ptyCommandLink,
+        ptyCommandUnlink,
+        /* take the port out of this shard, it is linked on another */
+        ptyCommandDetach,
+    } TCommandKind;
+
+    VSPPtyReactor();
+    ~VSPPtyReactor();
+
+    /** ----------------------
+     * Start the thread, pinned to 'cpu' unless it is negative
+     */
+    bool Start(const int cpu);
+
+    /** ----------------------
+     * Stop the thread and run the commands still queued
+     */
+    void Stop();
+
+    /** ----------------------
+     * Queue a command, 'done' is set once it ran
+     */
+    void Post(const TCommandKind kind, TVSPPtyPort* port, TVSPPtyPort* peer, std::promise<void>* done = nullptr);
+
+private:
+    typedef struct {
+        TVSPQueueLink link;
+        TCommandKind kind;
+        TVSPPtyPort* port;
+        TVSPPtyPort* peer;
+        std::promise<void>* done;
+    } TCommand;
+
+    std::thread m_thread;
+    std::atomic<bool> m_running;
+    int m_epollFd;
+    int m_eventFd;
+
+    // throttled ports, the timerfd is set to the first of them
+    int m_timerFd;
+    uint64_t m_timerUs;
+    VSPTimerWheel<PTY_PACING_BITS, PTY_PACING_LEVELS> m_pacing;
+    std::vector<TVSPPtyPort*> m_paced;
+
+    // commands of the control side, woken through the eventfd
+    VSPCompletionQueue m_commands;
+    std::atomic<bool> m_wakeup;
+
+    inline void RunCommands();
+    inline void Forward(TVSPPtyPort* port);
+    inline ssize_t Fill(TVSPPtyPort* port);
+    inline size_t Credit(TVSPPtyPort* port, const uint64_t nowNs);
+    inline void Pace();
+    inline ssize_t Flush(TVSPPtyPort* port, TVSPPtyPort* target);
+    inline void Discard(TVSPPtyPort* port);
+    inline void Drop(TVSPPtyPort* port);
+    inline void Watch(TVSPPtyPort* port);
+    inline void Release(TVSPPtyPort* port);
+    inline void Destroy(TVSPPtyPort* port);
+    void Run();
+};
+
+// -------------------------------------------------------------------
+// Data path of the emulated ports. Each port is a pseudo terminal
+// pair, applications open the slave like the tty of a DEXT port. The
+// engine holds the master: it forwards the bytes a port transmits to
+// the receive side of its linked port and echoes them back to the
+// port itself while it is not linked.
+//
+// The ports are partitioned across shards, each with a reactor
+// thread of its own. A port starts on the shard of its id, a link
+// runs on the shard of its lower port id and takes the other port
+// there. Ports created pairwise with consecutive ids share a shard,
+// linking them moves nothing.
+//
+class VSPPtyEngine
+{
+public:
+    /** ----------------------
+     * Process wide engine, the reactors start with the first port
+     */
+    static VSPPtyEngine* Instance();
+
+    ~VSPPtyEngine();
+
+    /** ----------------------
+     * Number of shards, 0 = one per CPU, and whether each reactor
+     * is pinned to a CPU of its own. Takes effect with the next port
+     * opened while none is open.
+     */
+    void Configure(const uint32_t shards, const bool affinity);
+
+    /** ----------------------
+     * Create the pseudo terminal of port 'id' and store the path of
+     * its slave in 'name'. The port transmits at the character rate
+     * of 'pacing', at once without it. Returns nullptr if none is
+     * left.
+     */
+    TVSPPtyPort* OpenPort(char* name, const size_t size, const TVSPPtyForwarding forwarding, const TVSPPortParameters* pacing, const uint16_t id);
+
+    /** ----------------------
+     * Close the port, bytes in flight to or from it are dropped
+     */
+    void ClosePort(TVSPPtyPort* port);
+
+    /** ----------------------
+     * Wire both ports to each other or back to themselves (echo),
+     * bytes in flight of both ports are dropped
+     */
+    void LinkPorts(TVSPPtyPort* source, TVSPPtyPort* target);
+    void UnlinkPorts(TVSPPtyPort* source, TVSPPtyPort* target);
+
+private:
+    // control side, callers of all driver instances
+    std::mutex m_lock;
+    std::vector<std::unique_ptr<VSPPtyReactor>> m_shards;
+    uint32_t m_shardCount;
+    bool m_affinity;
+    bool m_reconfigure;
+    uint32_t m_open;
+
+    VSPPtyEngine();
+
+    inline bool Start();
+    inline void Stop();
+    inline uint32_t ShardOf(const uint16_t id) const;
+    inline void Move(TVSPPtyPort* port, const uint32_t shard);
+};
+
+#pragma GCC visibility pop
+
+} // END namespace
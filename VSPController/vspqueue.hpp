@@ -0,0 +1,94 @@
+// ********************************************************************
+// vspqueue.hpp - Lock-free completion queue (private)
+//
+// Copyright © 2025 by EoF Software Labs
+// SPDX-License-Identifier: MIT
+// ********************************************************************
+#pragma once
+
+#include <atomic>
+
+namespace VSPClient {
+
+/* The classes below are not exported */
+#pragma GCC visibility push(hidden)
+
+// -------------------------------------------------------------------
+// Queue link, embedded as first member of the queued node.
+//
+typedef struct TVSPQueueLink {
+    std::atomic<TVSPQueueLink*> next;
+} TVSPQueueLink;
+
+// -------------------------------------------------------------------
+// Intrusive multi producer / single consumer queue (D. Vyukov). Push
+// is wait-free and may be called from any thread, Pop is lock-free
+// and must be called from one consumer thread only. The queue does
+// not own the nodes.
+//
+class VSPCompletionQueue
+{
+public:
+    VSPCompletionQueue()
+        : m_head(&m_stub)
+        , m_tail(&m_stub)
+    {
+        m_stub.next.store(nullptr, std::memory_order_relaxed);
+    }
+
+    /** ----------------------
+     * Append node, any thread
+     */
+    inline void Push(TVSPQueueLink* node)
+    {
+        node->next.store(nullptr, std::memory_order_relaxed);
+        TVSPQueueLink* prev = m_head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    /** ----------------------
+     * Remove the oldest node, consumer thread only. Returns nullptr
+     * if empty or if a producer is just between its two stores, the
+     * producer signals its node afterwards in that case.
+     */
+    inline TVSPQueueLink* Pop()
+    {
+        TVSPQueueLink* tail = m_tail;
+        TVSPQueueLink* next = tail->next.load(std::memory_order_acquire);
+
+        if (tail == &m_stub) {
+            if (!next) {
+                return nullptr;
+            }
+            m_tail = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+
+        if (next) {
+            m_tail = next;
+            return tail;
+        }
+
+        if (tail != m_head.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+
+        // last node, put the stub behind it to detach it
+        Push(&m_stub);
+        if ((next = tail->next.load(std::memory_order_acquire))) {
+            m_tail = next;
+            return tail;
+        }
+        return nullptr;
+    }
+
+private:
+    std::atomic<TVSPQueueLink*> m_head;
+    TVSPQueueLink* m_tail;
+    TVSPQueueLink m_stub;
+};
+
+#pragma GCC visibility pop
+
+} // END namespace
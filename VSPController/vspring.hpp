@@ -0,0 +1,245 @@
+// ********************************************************************
+// vspring.hpp - Single producer, single consumer byte ring (private)
+//
+// Copyright © 2025 by EoF Software Labs
+// SPDX-License-Identifier: MIT
+// ********************************************************************
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/uio.h>
+
+namespace VSPClient {
+
+// size of a cache line, the producer and consumer indexes get one each
+#define VSP_CACHE_LINE 64
+
+/* The classes below are not exported */
+#pragma GCC visibility push(hidden)
+
+// -------------------------------------------------------------------
+// Lock free byte ring of one producer and one consumer thread. The
+// indexes run freely, the capacity is a power of 2. Each side works
+// on a private index and a cached copy of the index of the other
+// side, which it loads again only when the cached copy shows too
+// little room or data. Produce() and Consume() advance the private
+// index only, Publish() and Release() hand a whole batch of them to
+// the other side with one store, so the cache lines of the indexes
+// move once per batch and not once per write. The ring is aligned to
+// a cache line as a whole, nothing else shares the consumer line.
+//
+class alignas(VSP_CACHE_LINE) VSPByteRing
+{
+public:
+    VSPByteRing(const size_t capacity)
+        : m_size(Capacity(capacity))
+        , m_mask(m_size - 1)
+        , m_buffer(new uint8_t[m_size])
+        , m_tail(0)
+        , m_write(0)
+        , m_headCache(0)
+        , m_head(0)
+        , m_read(0)
+        , m_tailCache(0)
+    {
+    }
+
+    ~VSPByteRing()
+    {
+        delete[] m_buffer;
+    }
+
+    VSPByteRing(const VSPByteRing&) = delete;
+    VSPByteRing& operator=(const VSPByteRing&) = delete;
+
+    inline size_t Size() const
+    {
+        return m_size;
+    }
+
+    // ---------------------------------------------------------------
+    // MARK: Producer
+    // ---------------------------------------------------------------
+
+    /** ----------------------
+     * Free bytes, the consumer index is loaded again if the cached
+     * one leaves less than 'want'
+     */
+    inline size_t Room(const size_t want = 1)
+    {
+        size_t room = m_size - (m_write - m_headCache);
+        if (room < want) {
+            m_headCache = m_head.load(std::memory_order_acquire);
+            room = m_size - (m_write - m_headCache);
+        }
+        return room;
+    }
+
+    /** ----------------------
+     * Free bytes as up to two spans for readv(), 'want' at most.
+     * Returns the number of spans, 0 if the ring is full.
+     */
+    inline int WriteSpans(struct iovec spans[2], const size_t want)
+    {
+        const size_t room = Room(want);
+        return Spans(spans, m_write, (room < want ? room : want));
+    }
+
+    /** ----------------------
+     * Advance the producer index over 'size' bytes written into the
+     * spans, the consumer sees them with the next Publish()
+     */
+    inline void Produce(const size_t size)
+    {
+        m_write += size;
+    }
+
+    /** ----------------------
+     * Copy as much of 'data' as fits, returns the bytes produced
+     */
+    inline size_t Write(const void* data, const size_t size)
+    {
+        struct iovec spans[2];
+        const int count = WriteSpans(spans, size);
+        size_t done = 0;
+
+        for (int i = 0; i < count; i++) {
+            memcpy(spans[i].iov_base, (const uint8_t*) data + done, spans[i].iov_len);
+            done += spans[i].iov_len;
+        }
+        Produce(done);
+        return done;
+    }
+
+    /** ----------------------
+     * Hand the bytes produced so far to the consumer
+     */
+    inline void Publish()
+    {
+        m_tail.store(m_write, std::memory_order_release);
+    }
+
+    // ---------------------------------------------------------------
+    // MARK: Consumer
+    // ---------------------------------------------------------------
+
+    /** ----------------------
+     * Published bytes, the producer index is loaded again if the
+     * cached one shows less than 'want'
+     */
+    inline size_t Pending(const size_t want = 1)
+    {
+        size_t pending = m_tailCache - m_read;
+        if (pending < want) {
+            m_tailCache = m_tail.load(std::memory_order_acquire);
+            pending = m_tailCache - m_read;
+        }
+        return pending;
+    }
+
+    /** ----------------------
+     * Published bytes as up to two spans for writev(), 'want' at
+     * most. Returns the number of spans, 0 if the ring is empty.
+     */
+    inline int ReadSpans(struct iovec spans[2], const size_t want)
+    {
+        const size_t pending = Pending(want);
+        return Spans(spans, m_read, (pending < want ? pending : want));
+    }
+
+    /** ----------------------
+     * Advance the consumer index over 'size' bytes taken from the
+     * spans, the producer gets the room with the next Release()
+     */
+    inline void Consume(const size_t size)
+    {
+        m_read += size;
+    }
+
+    /** ----------------------
+     * Copy up to 'size' published bytes, returns the bytes consumed
+     */
+    inline size_t Read(void* data, const size_t size)
+    {
+        struct iovec spans[2];
+        const int count = ReadSpans(spans, size);
+        size_t done = 0;
+
+        for (int i = 0; i < count; i++) {
+            memcpy((uint8_t*) data + done, spans[i].iov_base, spans[i].iov_len);
+            done += spans[i].iov_len;
+        }
+        Consume(done);
+        return done;
+    }
+
+    /** ----------------------
+     * Consume all published bytes
+     */
+    inline void Drain()
+    {
+        Consume(Pending());
+        Release();
+    }
+
+    /** ----------------------
+     * Hand the room consumed so far back to the producer
+     */
+    inline void Release()
+    {
+        m_head.store(m_read, std::memory_order_release);
+    }
+
+private:
+    // shared, read only
+    alignas(VSP_CACHE_LINE) const size_t m_size;
+    const size_t m_mask;
+    uint8_t* const m_buffer;
+
+    // producer: published and private index, cached consumer index
+    alignas(VSP_CACHE_LINE) std::atomic<size_t> m_tail;
+    size_t m_write;
+    size_t m_headCache;
+
+    // consumer: published and private index, cached producer index
+    alignas(VSP_CACHE_LINE) std::atomic<size_t> m_head;
+    size_t m_read;
+    size_t m_tailCache;
+
+    static inline size_t Capacity(const size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        return size;
+    }
+
+    /** ----------------------
+     * Split 'size' bytes at 'index' where the ring wraps around
+     */
+    inline int Spans(struct iovec spans[2], const size_t index, const size_t size) const
+    {
+        if (!size) {
+            return 0;
+        }
+
+        const size_t offset = (index & m_mask);
+        const size_t first = (size < m_size - offset ? size : m_size - offset);
+        spans[0].iov_base = m_buffer + offset;
+        spans[0].iov_len = first;
+        if (first == size) {
+            return 1;
+        }
+        spans[1].iov_base = m_buffer;
+        spans[1].iov_len = size - first;
+        return 2;
+    }
+};
+
+#pragma GCC visibility pop
+
+} // END namespace
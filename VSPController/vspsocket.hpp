@@ -0,0 +1,171 @@
+// ********************************************************************
+// vspsocket.hpp - Unix socket protocol of the vspd daemon
+//
+// Copyright © 2025 by EoF Software Labs
+// SPDX-License-Identifier: MIT
+// ********************************************************************
+#pragma once
+
+#include <string.h>
+#include <vspcontroller.hpp>
+#include <vspwire.hpp>
+
+/* The classes below are exported */
+#pragma GCC visibility push(default)
+
+namespace VSPClient {
+
+// -------------------------------------------------------------------
+// The daemon owns the driver connection and serves its clients over
+// a Unix stream socket. Each message is a frame (little endian):
+//
+//   uint8_t  kind      TVSPFrameKind
+//   uint8_t  instance  driver instance slot of the daemon
+//   uint16_t length    payload size
+//   uint32_t tag       request id of the client, echoed
+//   payload...
+//
+// vspFrameRequest and vspFrameResponse carry a message in compact
+// wire format (vspwire.hpp). The daemon announces its instances with
+// vspFrameAttach right after accept, ends that list with vspFrameReady
+// and sends vspFrameAttach again on each later match, vspFrameDetach
+// on removal. Subscription events arrive as vspFrameEvent.
+//
+#define VSP_SOCKET_PATH       "/tmp/vspd.sock"
+#define VSP_FRAME_HEADER_SIZE 8
+#define VSP_FRAME_EVENT_SIZE  15
+#define VSP_FRAME_MAX_SIZE    (VSP_FRAME_HEADER_SIZE + VSP_WIRE_MAX_SIZE)
+
+typedef enum : uint8_t {
+    /* payload: index, name length, name, path length, path */
+    vspFrameAttach = 1,
+    /* no payload */
+    vspFrameDetach,
+    /* payload: wire message */
+    vspFrameRequest,
+    vspFrameResponse,
+    /* payload: VSP_FRAME_EVENT_SIZE bytes of TVSPEvent */
+    vspFrameEvent,
+    /* no payload, instances of the accept announced */
+    vspFrameReady,
+} TVSPFrameKind;
+
+typedef struct {
+    uint8_t kind;
+    uint8_t instance;
+    uint16_t length;
+    uint32_t tag;
+} TVSPFrameHeader;
+
+/** ----------------------
+ * Store the frame header at 'buffer' (VSP_FRAME_HEADER_SIZE bytes)
+ */
+static inline void VSPFrameEncodeHeader(const TVSPFrameHeader* header, uint8_t* buffer)
+{
+    buffer[0] = header->kind;
+    buffer[1] = header->instance;
+    buffer[2] = (uint8_t) header->length;
+    buffer[3] = (uint8_t) (header->length >> 8);
+    for (int i = 0; i < 4; i++) {
+        buffer[4 + i] = (uint8_t) (header->tag >> (8 * i));
+    }
+}
+
+/** ----------------------
+ * Load the frame header from 'buffer' (VSP_FRAME_HEADER_SIZE bytes)
+ */
+static inline void VSPFrameDecodeHeader(const uint8_t* buffer, TVSPFrameHeader* header)
+{
+    header->kind = buffer[0];
+    header->instance = buffer[1];
+    header->length = (uint16_t) (buffer[2] | (buffer[3] << 8));
+    header->tag = 0;
+    for (int i = 0; i < 4; i++) {
+        header->tag |= (uint32_t) buffer[4 + i] << (8 * i);
+    }
+}
+
+/** ----------------------
+ * Store the event payload at 'buffer' (VSP_FRAME_EVENT_SIZE bytes)
+ */
+static inline void VSPFrameEncodeEvent(const TVSPEvent* event, uint8_t* buffer)
+{
+    const uint16_t ids[3] = {event->id, event->source, event->target};
+
+    buffer[0] = event->kind;
+    for (int i = 0; i < 3; i++) {
+        buffer[1 + 2 * i] = (uint8_t) ids[i];
+        buffer[2 + 2 * i] = (uint8_t) (ids[i] >> 8);
+    }
+    for (int i = 0; i < 4; i++) {
+        buffer[7 + i] = (uint8_t) (event->modemLines >> (8 * i));
+        buffer[11 + i] = (uint8_t) (event->generation >> (8 * i));
+    }
+}
+
+/** ----------------------
+ * Load the event payload from 'buffer' (VSP_FRAME_EVENT_SIZE bytes)
+ */
+static inline void VSPFrameDecodeEvent(const uint8_t* buffer, TVSPEvent* event)
+{
+    uint16_t ids[3];
+
+    event->kind = buffer[0];
+    for (int i = 0; i < 3; i++) {
+        ids[i] = (uint16_t) (buffer[1 + 2 * i] | (buffer[2 + 2 * i] << 8));
+    }
+    event->id = ids[0];
+    event->source = ids[1];
+    event->target = ids[2];
+    event->modemLines = 0;
+    event->generation = 0;
+    for (int i = 0; i < 4; i++) {
+        event->modemLines |= (uint32_t) buffer[7 + i] << (8 * i);
+        event->generation |= (uint32_t) buffer[11 + i] << (8 * i);
+    }
+}
+
+/** ----------------------
+ * Store the attach payload of an instance and return its size, at
+ * most 3 + 2 * 127 bytes. Longer names are cut.
+ */
+static inline uint16_t VSPFrameEncodeAttach(const uint8_t index, const char* name, const char* path, uint8_t* buffer)
+{
+    const size_t nameLength = strnlen(name, 127);
+    const size_t pathLength = strnlen(path, 127);
+
+    buffer[0] = index;
+    buffer[1] = (uint8_t) nameLength;
+    memcpy(&buffer[2], name, nameLength);
+    buffer[2 + nameLength] = (uint8_t) pathLength;
+    memcpy(&buffer[3 + nameLength], path, pathLength);
+    return (uint16_t) (3 + nameLength + pathLength);
+}
+
+/** ----------------------
+ * Load the attach payload into 'name' and 'path' (128 bytes each).
+ * Returns false if the payload is malformed.
+ */
+static inline bool VSPFrameDecodeAttach(const uint8_t* buffer, const uint16_t size, uint8_t* index, char* name, char* path)
+{
+    if (size < 3 || 2 + buffer[1] + 1 > size) {
+        return false;
+    }
+
+    const uint8_t nameLength = buffer[1];
+    const uint8_t pathLength = buffer[2 + nameLength];
+    if (nameLength > 127 || pathLength > 127 || 3 + nameLength + pathLength != size) {
+        return false;
+    }
+
+    *index = buffer[0];
+    memcpy(name, &buffer[2], nameLength);
+    name[nameLength] = 0;
+    memcpy(path, &buffer[3 + nameLength], pathLength);
+    path[pathLength] = 0;
+    return true;
+}
+
+} // END namespace
+
+#pragma GCC visibility pop
@@ -0,0 +1,686 @@
+// ********************************************************************
+// vspsockettransport.cpp - VSPDriver transport through the vspd daemon
+//
+// Copyright © 2025 by EoF Software Labs
+// SPDX-License-Identifier: MIT
+// ********************************************************************
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <errno.h>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#include <vspcontroller.hpp>
+#include <vspcontrollerpriv.hpp>
+#include <vspsocket.hpp>
+#include <vsptransport.hpp>
+#include <vspwire.hpp>
+
+namespace VSPClient {
+
+// wait for the daemon response of a request in ms
+#define VSP_SOCKET_TIMEOUT 5000
+
+// wait for the instance list after connect in ms
+#define VSP_SOCKET_HELLO_TIMEOUT 1000
+
+#ifdef MSG_NOSIGNAL
+#define VSP_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define VSP_SEND_FLAGS 0
+#endif
+
+/* The classes below are not exported */
+#pragma GCC visibility push(hidden)
+
+// -------------------------------------------------------------------
+// Client of the vspd daemon, the daemon owns the driver connection.
+// Submit sends the request and waits for the response of the daemon,
+// which is both the instant response and the completion. A reader
+// thread receives the frames, a delivery thread calls the owner in
+// order of arrival, so a completion may submit the next request.
+//
+class VSPSocketTransport: public VSPTransport
+{
+public:
+    VSPSocketTransport(VSPControllerPriv* owner, const char* path);
+    ~VSPSocketTransport() override;
+
+    bool Open() override;
+    void Close() override;
+    IOReturn Submit(TVSPControllerData* input, TVSPRequest* request) override;
+    void Rematch() override;
+
+private:
+    typedef enum : uint8_t {
+        kDeliverAttach,
+        kDeliverDetach,
+        kDeliverCompletion,
+    } TDeliveryKind;
+
+    // owner call of the delivery thread
+    typedef struct {
+        TDeliveryKind kind;
+        uint8_t index;
+        TVSPRequest* request;
+        IOReturn result;
+        uint32_t count;
+        uint64_t args[VSP_EVENT_ARGS];
+        TVSPDeviceName name;
+        TVSPDeviceName path;
+    } TDelivery;
+
+    // submitting thread waiting for the daemon response
+    typedef struct {
+        TVSPRequest* request;
+        std::condition_variable signal;
+        size_t rxSize;
+        IOReturn result;
+        bool done;
+    } TWaiter;
+
+    char m_path[sizeof(((struct sockaddr_un*) 0)->sun_path)];
+    int m_fd;
+    std::atomic<bool> m_running;
+    std::atomic<bool> m_connected;
+    std::atomic<bool> m_attached[MAX_INSTANCES];
+    std::thread m_reader;
+    std::thread m_delivery;
+
+    // serializes the frames of the submitting threads
+    std::mutex m_writeLock;
+
+    // waiters, delivery queue and subscription
+    std::mutex m_lock;
+    std::condition_variable m_signal;
+    std::unordered_map<uint32_t, TWaiter*> m_waiters;
+    std::deque<TDelivery> m_queue;
+
+    // request slot of the event subscription
+    TVSPRequest* m_subscription;
+    uint32_t m_subscriptionId;
+
+    bool Connect(std::vector<TDelivery>* instances);
+    bool Receive(const int fd, uint8_t* buffer, const size_t size);
+    bool Send(const uint8_t* buffer, const size_t size);
+    void Frame(const TVSPFrameHeader* header, const uint8_t* payload);
+    void Disconnected();
+    inline void Queue(const TDelivery* delivery);
+    void Deliver(const TDelivery* delivery);
+    void ReadLoop();
+    void DeliveryLoop();
+};
+
+#pragma GCC visibility pop
+
+// -------------------------------------------------------------------
+//
+//
+VSPTransport* VSPTransport::CreateSocket(VSPControllerPriv* owner, const char* path)
+{
+    return new VSPSocketTransport(owner, path);
+}
+
+VSPSocketTransport::VSPSocketTransport(VSPControllerPriv* owner, const char* path)
+    : VSPTransport(owner)
+    , m_path()
+    , m_fd(-1)
+    , m_running(false)
+    , m_connected(false)
+    , m_attached()
+    , m_reader()
+    , m_delivery()
+    , m_writeLock()
+    , m_lock()
+    , m_signal()
+    , m_waiters()
+    , m_queue()
+    , m_subscription(nullptr)
+    , m_subscriptionId(0)
+{
+    // a path that does not fit stays empty, Open() refuses it
+    const char* socket = (path ? path : VSP_SOCKET_PATH);
+    const size_t length = strlen(socket);
+    if (length < sizeof(m_path)) {
+        memcpy(m_path, socket, length + 1);
+    }
+}
+
+VSPSocketTransport::~VSPSocketTransport()
+{
+    Close();
+}
+
+// -------------------------------------------------------------------
+// The instances announced by the daemon are attached on this thread,
+// so the controller is connected when ConnectDriver() returns.
+//
+bool VSPSocketTransport::Open()
+{
+    std::vector<TDelivery> instances;
+
+    if (m_running) {
+        return true;
+    }
+    if (!m_path[0]) {
+        m_owner->ReportError(kIOReturnBadArgument, "Socket path of the vspd daemon too long.");
+        return false;
+    }
+    if (!Connect(&instances)) {
+        m_owner->ReportError(kIOReturnNotOpen, "Unable to connect to the vspd daemon.");
+        return false;
+    }
+
+    m_running = true;
+    m_reader = std::thread(&VSPSocketTransport::ReadLoop, this);
+    m_delivery = std::thread(&VSPSocketTransport::DeliveryLoop, this);
+
+    for (const TDelivery& instance : instances) {
+        Deliver(&instance);
+    }
+    return true;
+}
+
+// -------------------------------------------------------------------
+// A daemon gone away is connected again, its instances follow the
+// pending detach deliveries of the old connection.
+//
+void VSPSocketTransport::Rematch()
+{
+    std::vector<TDelivery> instances;
+
+    if (!m_running || m_connected) {
+        return;
+    }
+    if (m_reader.joinable()) {
+        m_reader.join();
+    }
+    if (!Connect(&instances)) {
+        return;
+    }
+
+    m_reader = std::thread(&VSPSocketTransport::ReadLoop, this);
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (const TDelivery& instance : instances) {
+        Queue(&instance);
+    }
+}
+
+// -------------------------------------------------------------------
+//
+//
+void VSPSocketTransport::Close()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (!m_running) {
+            return;
+        }
+        m_running = false;
+        m_subscription = nullptr;
+    }
+    m_signal.notify_all();
+
+    // the reader fails the waiting submitters on its way out
+    {
+        std::lock_guard<std::mutex> lock(m_writeLock);
+        if (m_fd >= 0) {
+            shutdown(m_fd, SHUT_RDWR);
+        }
+    }
+    if (m_reader.joinable()) {
+        m_reader.join();
+    }
+    if (m_delivery.joinable()) {
+        m_delivery.join();
+    }
+
+    // deliveries queued while closing are dropped
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_queue.clear();
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_writeLock);
+        if (m_fd >= 0) {
+            close(m_fd);
+            m_fd = -1;
+        }
+    }
+    for (uint8_t i = 0; i < MAX_INSTANCES; i++) {
+        m_attached[i] = false;
+    }
+}
+
+// -------------------------------------------------------------------
+// Connect to the daemon and read its instance list up to
+// vspFrameReady.
+//
+bool VSPSocketTransport::Connect(std::vector<TDelivery>* instances)
+{
+    struct sockaddr_un address = {};
+    struct timeval timeout = {};
+    uint8_t buffer[VSP_FRAME_MAX_SIZE];
+    int fd;
+
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, m_path, sizeof(address.sun_path));
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        return false;
+    }
+    if (connect(fd, (struct sockaddr*) &address, sizeof(address)) < 0) {
+        close(fd);
+        return false;
+    }
+#ifdef SO_NOSIGPIPE
+    const int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+    timeout.tv_sec = VSP_SOCKET_HELLO_TIMEOUT / 1000;
+    timeout.tv_usec = (VSP_SOCKET_HELLO_TIMEOUT % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    for (;;) {
+        TVSPFrameHeader header;
+        TDelivery instance = {};
+
+        if (!Receive(fd, buffer, VSP_FRAME_HEADER_SIZE)) {
+            close(fd);
+            return false;
+        }
+        VSPFrameDecodeHeader(buffer, &header);
+        if (header.length > VSP_WIRE_MAX_SIZE || !Receive(fd, buffer, header.length)) {
+            close(fd);
+            return false;
+        }
+        if (header.kind == vspFrameReady) {
+            break;
+        }
+        if (header.kind != vspFrameAttach) {
+            continue;
+        }
+
+        instance.kind = kDeliverAttach;
+        if (VSPFrameDecodeAttach(buffer, header.length, &instance.index, instance.name, instance.path)) {
+            instances->push_back(instance);
+        }
+    }
+
+    timeout = {};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    std::lock_guard<std::mutex> lock(m_writeLock);
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+    m_fd = fd;
+    m_connected = true;
+    return true;
+}
+
+// -------------------------------------------------------------------
+//
+//
+bool VSPSocketTransport::Receive(const int fd, uint8_t* buffer, const size_t size)
+{
+    size_t done = 0;
+
+    while (done < size) {
+        const ssize_t n = recv(fd, buffer + done, size - done, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        done += (size_t) n;
+    }
+    return true;
+}
+
+// -------------------------------------------------------------------
+// Called with m_writeLock held
+//
+bool VSPSocketTransport::Send(const uint8_t* buffer, const size_t size)
+{
+    size_t done = 0;
+
+    while (done < size) {
+        const ssize_t n = send(m_fd, buffer + done, size - done, VSP_SEND_FLAGS);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        done += (size_t) n;
+    }
+    return true;
+}
+
+// -------------------------------------------------------------------
+//
+//
+IOReturn VSPSocketTransport::Submit(TVSPControllerData* input, TVSPRequest* request)
+{
+    const uint8_t instance = request->instance.load();
+    TDelivery completion = {};
+    TWaiter waiter;
+
+    if (input->command >= vspLastCommand) {
+        m_owner->ReportError(kIOReturnBadArgument, "Driver async call failed.");
+        return kIOReturnBadArgument;
+    }
+    if (instance >= MAX_INSTANCES || !m_attached[instance]) {
+        m_owner->ReportError(kIOReturnNotOpen, "Driver instance not matched.");
+        return kIOReturnNotOpen;
+    }
+
+    // The request crosses the socket in compact wire format, the
+    // frame tag is the request id.
+    uint8_t txBuffer[VSP_FRAME_MAX_SIZE];
+    TVSPFrameHeader header = {};
+    size_t txSize;
+
+    if (!(txSize = VSPWireEncode(input, txBuffer + VSP_FRAME_HEADER_SIZE, VSP_WIRE_MAX_SIZE))) {
+        m_owner->ReportError(kIOReturnNoSpace, "Driver request encoding failed.");
+        return kIOReturnNoSpace;
+    }
+    header.kind = vspFrameRequest;
+    header.instance = instance;
+    header.length = (uint16_t) txSize;
+    header.tag = input->request;
+    VSPFrameEncodeHeader(&header, txBuffer);
+
+    waiter.request = request;
+    waiter.rxSize = 0;
+    waiter.result = kIOReturnNotOpen;
+    waiter.done = false;
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (!m_running || !m_connected) {
+            m_owner->ReportError(kIOReturnNotOpen, "Driver async call failed.");
+            return kIOReturnNotOpen;
+        }
+        m_waiters[header.tag] = &waiter;
+    }
+
+    bool sent;
+    {
+        std::lock_guard<std::mutex> lock(m_writeLock);
+        sent = (m_fd >= 0 && Send(txBuffer, VSP_FRAME_HEADER_SIZE + txSize));
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        if (sent) {
+            waiter.signal.wait_for(lock, std::chrono::milliseconds(VSP_SOCKET_TIMEOUT), [&waiter]() {
+                return waiter.done;
+            });
+        }
+        if (!waiter.done) {
+            m_waiters.erase(header.tag);
+            waiter.result = (sent ? kIOReturnTimeout : kIOReturnIOError);
+        }
+    }
+
+    if (waiter.result != kIOReturnSuccess) {
+        m_owner->ReportError(waiter.result, "Daemon request failed.");
+        return waiter.result;
+    }
+
+    TVSPControllerData* vspResponse = &request->response;
+
+    m_wireStats.messages += 2;
+    m_wireStats.wireBytes += txSize + waiter.rxSize;
+    m_wireStats.blobBytes += 2 * VSP_UCD_SIZE;
+
+    completion.kind = kDeliverCompletion;
+    completion.request = request;
+    completion.result = (IOReturn) vspResponse->status.code;
+    completion.count = VSP_ASYNC_ARGS;
+    completion.args[VSP_ARG_FLAGS] = vspResponse->status.flags;
+    completion.args[VSP_ARG_COMMAND] = vspResponse->command;
+    completion.args[VSP_ARG_CODE] = vspResponse->status.code;
+    completion.args[VSP_ARG_REQUEST] = vspResponse->request;
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (!m_running) {
+            m_owner->ReportError(kIOReturnNotOpen, "Driver async call failed.");
+            return kIOReturnNotOpen;
+        }
+
+        // a new subscription or its cancellation ends the current one
+        if (input->command == vspControlSubscribe && completion.result == kIOReturnSuccess) {
+            if (m_subscription) {
+                TDelivery ended = completion;
+                ended.request = m_subscription;
+                ended.result = kIOReturnAborted;
+                ended.args[VSP_ARG_CODE] = (uint32_t) kIOReturnAborted;
+                ended.args[VSP_ARG_REQUEST] = m_subscriptionId;
+                Queue(&ended);
+            }
+            m_subscription = (input->parameter.flags ? request : nullptr);
+            m_subscriptionId = vspResponse->request;
+        }
+
+        Queue(&completion);
+    }
+
+    return kIOReturnSuccess;
+}
+
+// -------------------------------------------------------------------
+// Runs on the reader thread. The response is decoded into the slot
+// of the waiting submitter, all else goes to the delivery thread.
+//
+void VSPSocketTransport::Frame(const TVSPFrameHeader* header, const uint8_t* payload)
+{
+    TDelivery delivery = {};
+
+    switch (header->kind) {
+        case vspFrameResponse: {
+            std::lock_guard<std::mutex> lock(m_lock);
+            auto it = m_waiters.find(header->tag);
+            if (it == m_waiters.end()) {
+                // submitter gave up
+                return;
+            }
+            TWaiter* waiter = it->second;
+            m_waiters.erase(it);
+            if (VSPWireDecode(payload, header->length, &waiter->request->response)) {
+                waiter->result = kIOReturnSuccess;
+                waiter->rxSize = header->length;
+            }
+            else {
+                waiter->result = kIOReturnBadArgument;
+            }
+            waiter->done = true;
+            waiter->signal.notify_one();
+            return;
+        }
+        case vspFrameEvent: {
+            TVSPEvent event = {};
+            if (header->length != VSP_FRAME_EVENT_SIZE) {
+                return;
+            }
+            VSPFrameDecodeEvent(payload, &event);
+
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (!m_subscription || m_subscription->instance != header->instance) {
+                return;
+            }
+            delivery.kind = kDeliverCompletion;
+            delivery.request = m_subscription;
+            delivery.result = kIOReturnSuccess;
+            delivery.count = VSP_EVENT_ARGS;
+            delivery.args[VSP_ARG_FLAGS] = (MAGIC_CONTROL | (1 << vspControlSubscribe));
+            delivery.args[VSP_ARG_COMMAND] = vspControlSubscribe;
+            delivery.args[VSP_ARG_REQUEST] = m_subscriptionId;
+            VSPEventToArgs(&event, delivery.args);
+            Queue(&delivery);
+            return;
+        }
+        case vspFrameAttach: {
+            delivery.kind = kDeliverAttach;
+            if (!VSPFrameDecodeAttach(payload, header->length, &delivery.index, delivery.name, delivery.path)) {
+                return;
+            }
+            break;
+        }
+        case vspFrameDetach: {
+            delivery.kind = kDeliverDetach;
+            delivery.index = header->instance;
+            break;
+        }
+        default: {
+            return;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    Queue(&delivery);
+}
+
+// -------------------------------------------------------------------
+// The daemon went away: the submitters fail at once and each
+// attached instance is removed, which starts the reconnect.
+//
+void VSPSocketTransport::Disconnected()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    m_connected = false;
+    for (auto& it : m_waiters) {
+        it.second->result = kIOReturnNotOpen;
+        it.second->done = true;
+        it.second->signal.notify_one();
+    }
+    m_waiters.clear();
+    m_subscription = nullptr;
+
+    if (!m_running) {
+        return;
+    }
+    for (uint8_t i = 0; i < MAX_INSTANCES; i++) {
+        if (m_attached[i]) {
+            TDelivery delivery = {};
+            delivery.kind = kDeliverDetach;
+            delivery.index = i;
+            Queue(&delivery);
+        }
+    }
+}
+
+// -------------------------------------------------------------------
+// Called with m_lock held
+//
+inline void VSPSocketTransport::Queue(const TDelivery* delivery)
+{
+    m_queue.push_back(*delivery);
+    m_signal.notify_one();
+}
+
+// -------------------------------------------------------------------
+// Like the termination of an IOService, the subscription of a
+// removed instance ends without completion.
+//
+void VSPSocketTransport::Deliver(const TDelivery* d)
+{
+    switch (d->kind) {
+        case kDeliverAttach: {
+            if (d->index < MAX_INSTANCES && !m_attached[d->index].exchange(true)) {
+                m_owner->AttachInstance(d->index, d->index + 1, d->name, d->path);
+            }
+            break;
+        }
+        case kDeliverDetach: {
+            if (d->index >= MAX_INSTANCES || !m_attached[d->index].exchange(false)) {
+                break;
+            }
+            {
+                std::lock_guard<std::mutex> lock(m_lock);
+                if (m_subscription && m_subscription->instance == d->index) {
+                    m_subscription = nullptr;
+                }
+            }
+            m_owner->DetachInstance(d->index);
+            break;
+        }
+        case kDeliverCompletion: {
+            m_owner->AsyncCallback(d->request, d->result, (void**) d->args, d->count);
+            break;
+        }
+    }
+}
+
+// -------------------------------------------------------------------
+//
+//
+void VSPSocketTransport::ReadLoop()
+{
+    uint8_t buffer[VSP_FRAME_MAX_SIZE];
+    const int fd = m_fd;
+
+    while (m_running) {
+        TVSPFrameHeader header;
+
+        if (!Receive(fd, buffer, VSP_FRAME_HEADER_SIZE)) {
+            break;
+        }
+        VSPFrameDecodeHeader(buffer, &header);
+        if (header.length > VSP_WIRE_MAX_SIZE) {
+            m_owner->ReportError(kIOReturnBadArgument, "Invalid daemon frame.");
+            break;
+        }
+        if (!Receive(fd, buffer + VSP_FRAME_HEADER_SIZE, header.length)) {
+            break;
+        }
+        Frame(&header, buffer + VSP_FRAME_HEADER_SIZE);
+    }
+
+    if (m_running) {
+        m_owner->ReportError(kIOReturnNotOpen, "Connection to the vspd daemon lost.");
+    }
+    Disconnected();
+}
+
+// -------------------------------------------------------------------
+// Calls the owner without our lock, a completion may submit.
+//
+void VSPSocketTransport::DeliveryLoop()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    for (;;) {
+        m_signal.wait(lock, [this]() {
+            return !m_running || !m_queue.empty();
+        });
+        if (!m_running) {
+            return;
+        }
+
+        const TDelivery delivery = m_queue.front();
+        m_queue.pop_front();
+
+        lock.unlock();
+        Deliver(&delivery);
+        lock.lock();
+    }
+}
+
+} // END namespace
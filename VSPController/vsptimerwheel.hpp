@@ -0,0 +1,246 @@
+// ********************************************************************
+// vsptimerwheel.hpp - Hierarchical timer wheel (private)
+//
+// Copyright © 2025 by EoF Software Labs
+// SPDX-License-Identifier: MIT
+// ********************************************************************
+#pragma once
+
+#include <stdint.h>
+
+namespace VSPClient {
+
+// -------------------------------------------------------------------
+// Timer link, embedded as first member of the timed item. Not armed
+// while next is nullptr.
+//
+typedef struct TVSPTimerLink {
+    TVSPTimerLink* next;
+    TVSPTimerLink* prev;
+    /* Expiry tick */
+    uint64_t due;
+    /* Wheel level the link is in */
+    uint32_t level;
+} TVSPTimerLink;
+
+/* The classes below are not exported */
+#pragma GCC visibility push(hidden)
+
+// -------------------------------------------------------------------
+// Hierarchical timer wheel (Varghese, Lauck). Level 0 has a slot per
+// tick, each level above a slot per turn of the level below. A timer
+// is linked into the slot of its expiry on the lowest level that
+// reaches it and moves down a level each time the wheel turns into
+// its slot, so Add and Remove are O(1) and Advance skips the ticks of
+// empty levels. Timers beyond the top level wait in its last slot.
+// Not thread safe, the owner locks. The wheel does not own the links.
+//
+template<uint32_t Bits, uint32_t Levels>
+class VSPTimerWheel
+{
+    static constexpr uint32_t Slots = (1u << Bits);
+    static constexpr uint64_t Mask = Slots - 1;
+
+public:
+    VSPTimerWheel(const uint64_t tickUs)
+        : m_tickUs(tickUs)
+        , m_tick(0)
+        , m_count(0)
+    {
+        for (uint32_t level = 0; level < Levels; level++) {
+            m_counts[level] = 0;
+            for (TVSPTimerLink& slot : m_slots[level]) {
+                slot.next = slot.prev = &slot;
+                slot.due = 0;
+                slot.level = level;
+            }
+        }
+    }
+
+    inline bool Empty() const
+    {
+        return !m_count;
+    }
+
+    /** ----------------------
+     * Arm 'link' to expire 'delayUs' after 'nowUs' (steady clock),
+     * one tick later at the earliest
+     */
+    inline void Add(TVSPTimerLink* link, const uint64_t nowUs, const uint64_t delayUs)
+    {
+        // an idle wheel starts over at now
+        if (!m_count) {
+            m_tick = nowUs / m_tickUs;
+        }
+
+        uint64_t due = (nowUs + delayUs + m_tickUs - 1) / m_tickUs;
+        if (due <= m_tick) {
+            due = m_tick + 1;
+        }
+
+        link->due = due;
+        Insert(link);
+        m_count++;
+    }
+
+    /** ----------------------
+     * Disarm 'link', nothing if it is not armed
+     */
+    inline void Remove(TVSPTimerLink* link)
+    {
+        if (!link->next) {
+            return;
+        }
+        Unlink(link);
+        m_count--;
+    }
+
+    /** ----------------------
+     * Steady time of the first tick a timer expires at, UINT64_MAX
+     * if none is armed
+     */
+    inline uint64_t NextUs() const
+    {
+        uint64_t next = UINT64_MAX;
+
+        for (uint32_t level = 0; level < Levels; level++) {
+            if (!m_counts[level]) {
+                continue;
+            }
+
+            // a slot holds no timer before its first tick, the scan ends
+            // at the first slot starting after the earliest timer found
+            const uint64_t base = (m_tick >> (Bits * level));
+            for (uint64_t index = base + 1; index <= base + Slots; index++) {
+                if (((index << (Bits * level)) * m_tickUs) >= next) {
+                    break;
+                }
+                const TVSPTimerLink* slot = &m_slots[level][index & Mask];
+                for (const TVSPTimerLink* link = slot->next; link != slot; link = link->next) {
+                    if (link->due * m_tickUs < next) {
+                        next = link->due * m_tickUs;
+                    }
+                }
+            }
+        }
+        return next;
+    }
+
+    /** ----------------------
+     * Disarm the timers expired at 'nowUs' and pass each of them to
+     * 'expire'
+     */
+    template<typename F>
+    inline void Advance(const uint64_t nowUs, F expire)
+    {
+        const uint64_t now = nowUs / m_tickUs;
+        TVSPTimerLink expired;
+
+        while (m_tick < now && m_count) {
+            // nothing happens before the next turn of the lowest used level
+            uint32_t lowest = 0;
+            while (!m_counts[lowest]) {
+                lowest++;
+            }
+            if (lowest) {
+                const uint64_t last = (m_tick | ((1ull << (Bits * lowest)) - 1));
+                m_tick = (last < now ? last : now);
+                if (m_tick == now) {
+                    break;
+                }
+            }
+
+            // the upper levels move the timers of the new turn down
+            m_tick++;
+            for (uint32_t level = 1; level < Levels; level++) {
+                if (m_tick & ((1ull << (Bits * level)) - 1)) {
+                    break;
+                }
+                Cascade(level);
+            }
+
+            // the slot is detached, 'expire' may arm timers
+            TVSPTimerLink* slot = &m_slots[0][m_tick & Mask];
+            if (slot->next == slot) {
+                continue;
+            }
+            expired.next = slot->next;
+            expired.prev = slot->prev;
+            expired.next->prev = &expired;
+            expired.prev->next = &expired;
+            slot->next = slot->prev = slot;
+
+            while (expired.next != &expired) {
+                TVSPTimerLink* link = expired.next;
+                link->prev->next = link->next;
+                link->next->prev = link->prev;
+                link->next = link->prev = nullptr;
+                m_counts[0]--;
+                m_count--;
+                expire(link);
+            }
+        }
+        if (m_tick < now) {
+            m_tick = now;
+        }
+    }
+
+private:
+    const uint64_t m_tickUs;
+    uint64_t m_tick;
+    uint32_t m_count;
+    uint32_t m_counts[Levels];
+    TVSPTimerLink m_slots[Levels][Slots];
+
+    /** ----------------------
+     * Link into the slot of the lowest level reaching the expiry
+     */
+    inline void Insert(TVSPTimerLink* link)
+    {
+        const uint64_t delta = (link->due > m_tick ? link->due - m_tick : 0);
+        uint64_t due = link->due;
+        uint32_t level = 0;
+
+        while (level < Levels - 1 && delta >> (Bits * (level + 1))) {
+            level++;
+        }
+        if (level == Levels - 1 && Bits * Levels < 64 && delta >> (Bits * Levels)) {
+            // beyond the top level, moved down again in the last slot
+            due = m_tick + ((1ull << (Bits * Levels)) - 1);
+        }
+
+        TVSPTimerLink* slot = &m_slots[level][(due >> (Bits * level)) & Mask];
+        link->level = level;
+        link->next = slot;
+        link->prev = slot->prev;
+        slot->prev->next = link;
+        slot->prev = link;
+        m_counts[level]++;
+    }
+
+    inline void Unlink(TVSPTimerLink* link)
+    {
+        link->prev->next = link->next;
+        link->next->prev = link->prev;
+        link->next = link->prev = nullptr;
+        m_counts[link->level]--;
+    }
+
+    /** ----------------------
+     * Relink the timers of the slot the wheel turned into on 'level'
+     */
+    inline void Cascade(const uint32_t level)
+    {
+        TVSPTimerLink* slot = &m_slots[level][(m_tick >> (Bits * level)) & Mask];
+
+        while (slot->next != slot) {
+            TVSPTimerLink* link = slot->next;
+            Unlink(link);
+            Insert(link);
+        }
+    }
+};
+
+#pragma GCC visibility pop
+
+} // END namespace
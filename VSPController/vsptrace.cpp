@@ -0,0 +1,203 @@
+// ********************************************************************
+// vsptrace.cpp - Binary trace ring of the VSPDriver user client
+//
+// Copyright © 2025 by EoF Software Labs
+// SPDX-License-Identifier: MIT
+// ********************************************************************
+#include <stdio.h>
+#include <string.h>
+#include <vspcontroller.hpp>
+#include <vsptrace.hpp>
+
+namespace VSPClient {
+
+static const char* const s_points[] = {
+   "?", "submit", "response", "complete", "event", "error",
+};
+
+static const char* const s_commands[] = {
+   "PingPong",
+   "GetStatus",
+   "CreatePort",
+   "RemovePort",
+   "LinkPorts",
+   "UnlinkPorts",
+   "GetPortList",
+   "GetLinkList",
+   "EnableChecks",
+   "EnableTrace",
+   "Batch",
+   "GetChanges",
+   "Subscribe",
+};
+
+static_assert(sizeof(s_commands) / sizeof(s_commands[0]) == vspLastCommand, "Command names out of date");
+
+// -------------------------------------------------------------------
+// MARK: Trace Ring
+// -------------------------------------------------------------------
+
+// the level does not follow VSP_DEBUG, the project files define it
+// for every build
+VSPTraceRing::VSPTraceRing()
+    : m_level(vspTraceError)
+    , m_head(0)
+    , m_slots()
+{
+}
+
+// -------------------------------------------------------------------
+// The slot state tells the reader whether the words belong to the
+// sequence it expects, a torn copy is detected by a changed state.
+//
+void VSPTraceRing::Write(TVSPTraceRecord* record)
+{
+    const uint64_t sequence = m_head.fetch_add(1, std::memory_order_relaxed);
+    TSlot* slot = &m_slots[sequence % VSP_TRACE_RECORDS];
+    uint64_t words[kWords];
+
+    record->sequence = sequence;
+    memcpy(words, record, sizeof(words));
+
+    slot->state.store(2 * sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (uint32_t i = 0; i < kWords; i++) {
+        slot->words[i].store(words[i], std::memory_order_relaxed);
+    }
+    slot->state.store(2 * sequence + 2, std::memory_order_release);
+}
+
+// -------------------------------------------------------------------
+//
+//
+uint32_t VSPTraceRing::Read(TVSPTraceRecord* records, uint32_t count, uint64_t* cursor) const
+{
+    const uint64_t head = m_head.load(std::memory_order_acquire);
+    const uint64_t oldest = (head > VSP_TRACE_RECORDS ? head - VSP_TRACE_RECORDS : 0);
+    uint64_t sequence = (*cursor > oldest ? *cursor : oldest);
+    uint32_t n = 0;
+
+    for (; sequence < head && n < count; sequence++) {
+        const TSlot* slot = &m_slots[sequence % VSP_TRACE_RECORDS];
+        uint64_t words[kWords];
+
+        const uint64_t before = slot->state.load(std::memory_order_acquire);
+        if (before < 2 * sequence + 2) {
+            // still written, continue there next time
+            break;
+        }
+        for (uint32_t i = 0; i < kWords; i++) {
+            words[i] = slot->words[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (before != 2 * sequence + 2 || slot->state.load(std::memory_order_relaxed) != before) {
+            // overwritten by a newer record
+            continue;
+        }
+
+        memcpy(&records[n++], words, sizeof(words));
+    }
+
+    *cursor = sequence;
+    return n;
+}
+
+// -------------------------------------------------------------------
+// MARK: Offline Decoder
+// -------------------------------------------------------------------
+
+// -------------------------------------------------------------------
+//
+//
+size_t VSPTraceFormat(const TVSPTraceRecord* r, char* text, size_t size)
+{
+    const char* point = (r->point < sizeof(s_points) / sizeof(s_points[0]) ? s_points[r->point] : "?");
+    int length;
+
+    if (r->point == vspTraceEvent) {
+        length = snprintf(
+           text,
+           size,
+           "%10llu.%06llu #%-8llu %-8s kind %u id %u %u-%u lines 0x%llx gen %u",
+           (unsigned long long) (r->timeUs / 1000000),
+           (unsigned long long) (r->timeUs % 1000000),
+           (unsigned long long) r->sequence,
+           point,
+           r->command,
+           r->cursor,
+           r->source,
+           r->target,
+           (unsigned long long) r->parameter,
+           r->generation);
+    }
+    else {
+        const char* command = (r->command < vspLastCommand ? s_commands[r->command] : "?");
+        length = snprintf(
+           text,
+           size,
+           "%10llu.%06llu #%-8llu %-8s %-12s req %-6u inst %u status 0x%08x flags 0x%llx param 0x%llx link %u-%u cursor %u gen %u lat %uus",
+           (unsigned long long) (r->timeUs / 1000000),
+           (unsigned long long) (r->timeUs % 1000000),
+           (unsigned long long) r->sequence,
+           point,
+           command,
+           r->request,
+           r->instance,
+           r->status,
+           (unsigned long long) r->flags,
+           (unsigned long long) r->parameter,
+           r->source,
+           r->target,
+           r->cursor,
+           r->generation,
+           r->latencyUs);
+    }
+
+    if (length < 0) {
+        return 0;
+    }
+    return ((size_t) length < size ? (size_t) length : size - 1);
+}
+
+// -------------------------------------------------------------------
+//
+//
+bool VSPTraceWrite(FILE* file, const TVSPTraceRecord* records, uint64_t count)
+{
+    const TVSPTraceFileHeader header = {VSP_TRACE_MAGIC, VSP_TRACE_VERSION, sizeof(TVSPTraceRecord), count};
+
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        return false;
+    }
+    if (count && fwrite(records, sizeof(TVSPTraceRecord), count, file) != count) {
+        return false;
+    }
+    return true;
+}
+
+// -------------------------------------------------------------------
+//
+//
+int64_t VSPTraceDecode(FILE* file, FILE* out)
+{
+    TVSPTraceFileHeader header = {};
+    TVSPTraceRecord record;
+    char text[VSP_TRACE_TEXT_SIZE];
+    int64_t count = 0;
+
+    if (fread(&header, sizeof(header), 1, file) != 1) {
+        return -1;
+    }
+    if (header.magic != VSP_TRACE_MAGIC || header.version != VSP_TRACE_VERSION || header.recordSize != sizeof(record)) {
+        return -1;
+    }
+
+    while ((uint64_t) count < header.count && fread(&record, sizeof(record), 1, file) == 1) {
+        VSPTraceFormat(&record, text, sizeof(text));
+        fprintf(out, "%s\n", text);
+        count++;
+    }
+    return count;
+}
+
+} // END namespace
@@ -0,0 +1,123 @@
+// ********************************************************************
+// vsptrace.hpp - Binary trace ring of the VSPDriver user client
+//
+// Copyright © 2025 by EoF Software Labs
+// SPDX-License-Identifier: MIT
+// ********************************************************************
+#pragma once
+
+#include <atomic>
+#include <stdio.h>
+#include <vspcontroller.hpp>
+
+/* The classes below are exported */
+#pragma GCC visibility push(default)
+
+namespace VSPClient {
+
+// -------------------------------------------------------------------
+// Trace file layout (host byte order):
+//
+//   uint32_t magic       VSP_TRACE_MAGIC
+//   uint16_t version     VSP_TRACE_VERSION
+//   uint16_t recordSize  sizeof(TVSPTraceRecord)
+//   uint64_t count       number of records
+//   TVSPTraceRecord...   oldest first
+//
+#define VSP_TRACE_MAGIC   0x54505356 // "VSPT"
+#define VSP_TRACE_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recordSize;
+    uint64_t count;
+} TVSPTraceFileHeader;
+
+/* Number of text bytes VSPTraceFormat needs at most */
+#define VSP_TRACE_TEXT_SIZE 256
+
+/**
+ * Format one record as a text line without line feed
+ */
+size_t VSPTraceFormat(const TVSPTraceRecord* record, char* text, size_t size);
+
+/**
+ * Write the records in trace file format. Returns false on I/O errors.
+ */
+bool VSPTraceWrite(FILE* file, const TVSPTraceRecord* records, uint64_t count);
+
+/**
+ * Decode a trace file into text lines on 'out'. Returns the number of
+ * records or -1 if the file is no trace file of this version.
+ */
+int64_t VSPTraceDecode(FILE* file, FILE* out);
+
+} // END namespace
+
+#pragma GCC visibility pop
+
+namespace VSPClient {
+
+/* The classes below are not exported */
+#pragma GCC visibility push(hidden)
+
+// -------------------------------------------------------------------
+// Fixed size ring of trace records, the oldest are overwritten. Any
+// thread may write, a record claims its slot with one fetch_add and
+// publishes it through the slot sequence, so writers never wait. The
+// reader drops records overwritten while it copies them.
+//
+#define VSP_TRACE_RECORDS 4096
+
+class VSPTraceRing
+{
+public:
+    VSPTraceRing();
+
+    /** ----------------------
+     * Record is taken at 'level'
+     */
+    inline bool Enabled(const uint8_t level) const
+    {
+        return level <= m_level.load(std::memory_order_relaxed);
+    }
+
+    inline void SetLevel(const uint8_t level)
+    {
+        m_level.store(level, std::memory_order_relaxed);
+    }
+
+    inline uint8_t Level() const
+    {
+        return m_level.load(std::memory_order_relaxed);
+    }
+
+    /** ----------------------
+     * Store record, the sequence number is assigned here
+     */
+    void Write(TVSPTraceRecord* record);
+
+    /** ----------------------
+     * Copy up to 'count' records starting at sequence '*cursor' and
+     * advance the cursor behind the last one returned.
+     */
+    uint32_t Read(TVSPTraceRecord* records, uint32_t count, uint64_t* cursor) const;
+
+private:
+    static const uint32_t kWords = sizeof(TVSPTraceRecord) / sizeof(uint64_t);
+
+    typedef struct {
+        /* 2 * sequence + 1 while written, 2 * sequence + 2 when done */
+        std::atomic<uint64_t> state;
+        std::atomic<uint64_t> words[kWords];
+    } TSlot;
+
+    std::atomic<uint8_t> m_level;
+    std::atomic<uint64_t> m_head;
+    TSlot m_slots[VSP_TRACE_RECORDS];
+};
+
+#pragma GCC visibility pop
+
+} // END namespace
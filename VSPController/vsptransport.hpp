@@ -0,0 +1,247 @@
+// ********************************************************************
+// vsptransport.hpp - VSPDriver user client transport (private)
+//
+// Copyright © 2025 by EoF Software Labs
+// Copyright © 2024 Apple Inc. (some copied parts)
+// SPDX-License-Identifier: MIT
+// ********************************************************************
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vspcontroller.hpp>
+#include <vsptimerwheel.hpp>
+
+#if defined(__APPLE__)
+#include <IOKit/IOReturn.h>
+#else
+extern "C" {
+#include <stdint.h>
+}
+
+// IOKit compatible return codes for the non Darwin transports. The
+// values are identical to <IOKit/IOReturn.h>, so the error handling
+// of the clients (e.g. kIOErrorNotFound) works on each platform.
+typedef int kern_return_t;
+typedef kern_return_t IOReturn;
+
+#define err_get_system(err) (((err) >> 26) & 0x3f)
+#define err_get_sub(err)    (((err) >> 14) & 0xfff)
+#define err_get_code(err)   ((err) & 0x3fff)
+
+#define iokit_common_err(ret) ((IOReturn) (0xe0000000 | (ret)))
+
+#define kIOReturnSuccess      0
+#define kIOReturnError        iokit_common_err(0x2bc)
+#define kIOReturnNoMemory     iokit_common_err(0x2bd)
+#define kIOReturnNoResources  iokit_common_err(0x2be)
+#define kIOReturnBadArgument  iokit_common_err(0x2c2)
+#define kIOReturnUnsupported  iokit_common_err(0x2c7)
+#define kIOReturnIOError      iokit_common_err(0x2ca)
+#define kIOReturnNotOpen      iokit_common_err(0x2cd)
+#define kIOReturnBusy         iokit_common_err(0x2d5)
+#define kIOReturnTimeout      iokit_common_err(0x2d6)
+#define kIOReturnNotReady     iokit_common_err(0x2d8)
+#define kIOReturnNoSpace      iokit_common_err(0x2db)
+#define kIOReturnNotPermitted iokit_common_err(0x2e2)
+#define kIOReturnOverrun      iokit_common_err(0x2e8)
+#define kIOReturnAborted      iokit_common_err(0x2eb)
+#define kIOReturnNotFound     iokit_common_err(0x2f0)
+#endif
+
+namespace VSPClient {
+
+// Same size as io_name_t of IOKit
+typedef char TVSPDeviceName[128];
+
+class VSPControllerPriv;
+class VSPTransport;
+struct TVSPCall;
+
+/* The classes below are not exported */
+#pragma GCC visibility push(hidden)
+
+// -------------------------------------------------------------------
+// Outstanding request slot. Owned by VSPControllerPriv, the address
+// is stable while the request is in flight and is used by the
+// transport to route the driver completion (e.g. as IOKit refcon).
+//
+typedef struct {
+    /* Deadline of the driver completion, see VSPTimerWheel */
+    TVSPTimerLink timer;
+    /* Request identifier the deadline was armed for, the deadline
+     * thread expires this one. Guarded by m_deadlineLock. */
+    uint32_t armed;
+    /* Request identifier, 0 = slot is free */
+    std::atomic<uint32_t> id;
+    /* Request identifier until the driver completion, the deadline
+     * or teardown claims the request, see ClaimRequest() */
+    std::atomic<uint32_t> waiting;
+    /* The submitter and the claimer of the request hold the slot,
+     * the last one to release it frees it, see ReleaseRequest() */
+    std::atomic<uint8_t> holds;
+    /* Submitting transport */
+    VSPTransport* transport;
+    /* Driver instance the request is sent to */
+    std::atomic<uint8_t> instance;
+    /* Command of the request */
+    uint8_t command;
+    /* Submission time, steady clock in microseconds */
+    uint64_t submitted;
+    /* Completion bound by VSPController::Call(), otherwise empty */
+    std::shared_ptr<TVSPCall> call;
+    /* Port parameters of vspControlCreatePort for the snapshot */
+    TVSPPortParameters parameters;
+    /* Response of this request only */
+    TVSPControllerData response;
+} TVSPRequest;
+
+// -------------------------------------------------------------------
+// Asynchronous completion arguments of the driver. Subscription
+// events append the event to the common arguments, IOKit delivers up
+// to 16 of them.
+//
+#define VSP_ARG_FLAGS      0
+#define VSP_ARG_COMMAND    1
+#define VSP_ARG_CODE       2
+#define VSP_ARG_REQUEST    3
+#define VSP_ARG_EVENT      4
+#define VSP_ARG_EVENT_IDS  5
+#define VSP_ARG_SIGNALS    6
+#define VSP_ARG_GENERATION 7
+#define VSP_ASYNC_ARGS     4
+#define VSP_EVENT_ARGS     8
+
+static inline void VSPEventToArgs(const TVSPEvent* event, uint64_t* args)
+{
+    args[VSP_ARG_EVENT] = event->kind;
+    args[VSP_ARG_EVENT_IDS] = ((uint64_t) event->id << 32) | ((uint64_t) event->source << 16) | event->target;
+    args[VSP_ARG_SIGNALS] = event->modemLines;
+    args[VSP_ARG_GENERATION] = event->generation;
+}
+
+static inline void VSPEventFromArgs(const int64_t* args, TVSPEvent* event)
+{
+    event->kind = (uint8_t) args[VSP_ARG_EVENT];
+    event->id = (uint16_t) (args[VSP_ARG_EVENT_IDS] >> 32);
+    event->source = (uint16_t) (args[VSP_ARG_EVENT_IDS] >> 16);
+    event->target = (uint16_t) args[VSP_ARG_EVENT_IDS];
+    event->modemLines = (uint32_t) args[VSP_ARG_SIGNALS];
+    event->generation = (uint32_t) args[VSP_ARG_GENERATION];
+}
+
+// -------------------------------------------------------------------
+// Abstract driver transport. VSPControllerPriv builds the requests,
+// the transport delivers them to the driver instance of the request
+// slot and reports the asynchronous completions back through the
+// owner:
+//
+//   owner->AttachInstance()  - driver instance matched and opened
+//   owner->DetachInstance()  - driver instance removed
+//   owner->AsyncCallback()   - driver completion of a request slot
+//   owner->ReportError()     - transport failure
+//
+// The transport assigns the instance slots (0..MAX_INSTANCES-1), the
+// controller addresses the instance by that slot.
+//
+class VSPTransport
+{
+public:
+    VSPTransport(VSPControllerPriv* owner)
+        : m_owner(owner)
+    {
+    }
+
+    virtual ~VSPTransport() {}
+
+    /** ----------------------
+     * Match the driver instance and open the connection.
+     */
+    virtual bool Open() = 0;
+
+    /** ----------------------
+     * Close connection and release all transport resources.
+     */
+    virtual void Close() = 0;
+
+    /** ----------------------
+     * Match the driver instances not connected while open, called by
+     * the reconnect supervisor of the owner.
+     */
+    virtual void Rematch() = 0;
+
+    /** ----------------------
+     * Send request to the driver instance request->instance. The
+     * instant response is stored in request->response, the
+     * asynchronous completion of the same request slot follows
+     * through the owner.
+     */
+    virtual IOReturn Submit(TVSPControllerData* input, TVSPRequest* request) = 0;
+
+    /** ----------------------
+     * Response mapping counters
+     */
+    inline const TVSPMappingStats MappingStats() const
+    {
+        return {m_mapStats.created.load(), m_mapStats.reused.load(), m_mapStats.released.load(), m_mapsResponses};
+    }
+
+    /** ----------------------
+     * Compact wire format counters
+     */
+    inline const TVSPWireStats WireStats() const
+    {
+        return {m_wireStats.messages.load(), m_wireStats.wireBytes.load(), m_wireStats.blobBytes.load()};
+    }
+
+    /** ----------------------
+     * Serve the driver notifications on an own control thread instead
+     * of the run loop of the thread calling Open(). Set before Open().
+     */
+    inline void UseControlThread(bool enable)
+    {
+        m_controlThread = enable;
+    }
+
+    /** ----------------------
+     * Owner of the transport
+     */
+    inline VSPControllerPriv* Owner() const
+    {
+        return m_owner;
+    }
+
+    /** ----------------------
+     * Create the transport of the current platform.
+     */
+    static VSPTransport* Create(VSPControllerPriv* owner);
+
+    /** ----------------------
+     * Create the transport to the vspd daemon listening at 'path',
+     * which shares its driver connection, see vspsocket.hpp.
+     */
+    static VSPTransport* CreateSocket(VSPControllerPriv* owner, const char* path);
+
+protected:
+    VSPControllerPriv* m_owner;
+    bool m_controlThread = false;
+    // set by transports mapping the driver responses
+    bool m_mapsResponses = false;
+
+    // counters of TVSPMappingStats and TVSPWireStats, submitting
+    // threads update them concurrently
+    struct {
+        std::atomic<uint64_t> created{0};
+        std::atomic<uint64_t> reused{0};
+        std::atomic<uint64_t> released{0};
+    } m_mapStats;
+    struct {
+        std::atomic<uint64_t> messages{0};
+        std::atomic<uint64_t> wireBytes{0};
+        std::atomic<uint64_t> blobBytes{0};
+    } m_wireStats;
+};
+
+#pragma GCC visibility pop
+
+} // END namespace
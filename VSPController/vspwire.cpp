@@ -0,0 +1,320 @@
+// ********************************************************************
+// vspwire.cpp - Compact VSPDriver user client wire format
+//
+// Copyright © 2025 by EoF Software Labs
+// SPDX-License-Identifier: MIT
+// ********************************************************************
+#include <string.h>
+#include <vspcontroller.hpp>
+#include <vspwire.hpp>
+
+namespace VSPClient {
+
+// -------------------------------------------------------------------
+// MARK: Encoder
+// -------------------------------------------------------------------
+
+typedef struct {
+    uint8_t* buffer;
+    size_t size;
+    size_t offset;
+    bool overflow;
+} TWireWriter;
+
+static inline void PutField(TWireWriter* w, uint8_t tag, const void* value, uint8_t length)
+{
+    if (w->overflow || w->offset + VSP_WIRE_FIELD_SIZE + length > w->size) {
+        w->overflow = true;
+        return;
+    }
+    w->buffer[w->offset++] = tag;
+    w->buffer[w->offset++] = length;
+    memcpy(&w->buffer[w->offset], value, length);
+    w->offset += length;
+}
+
+static inline void PutUInt(TWireWriter* w, uint8_t tag, uint64_t value, uint8_t length)
+{
+    uint8_t le[8];
+    for (uint8_t i = 0; i < length; i++) {
+        le[i] = (uint8_t) (value >> (i * 8));
+    }
+    PutField(w, tag, le, length);
+}
+
+// -------------------------------------------------------------------
+// ports.list carries port parameters in a CreatePort request, batch
+// operations in vspControlBatch, change items in vspControlGetChanges
+// and port items otherwise.
+//
+static inline uint8_t PortListTag(const TVSPControllerData* data)
+{
+    if (data->command == vspControlBatch) {
+        return vspTagBatchOperation;
+    }
+    if (data->command == vspControlGetChanges) {
+        return vspTagChangeItem;
+    }
+    if (data->command == vspControlCreatePort && data->context == vspContextPort) {
+        return vspTagPortParameters;
+    }
+    return vspTagPortItem;
+}
+
+size_t VSPWireEncode(const TVSPControllerData* data, uint8_t* buffer, size_t size)
+{
+    TWireWriter w = {buffer, size, VSP_WIRE_HEADER_SIZE, false};
+
+    if (!data || !buffer || size < VSP_WIRE_HEADER_SIZE) {
+        return 0;
+    }
+
+    PutUInt(&w, vspTagContext, data->context, 1);
+    PutUInt(&w, vspTagCommand, data->command, 1);
+    if (data->request) {
+        PutUInt(&w, vspTagRequest, data->request, 4);
+    }
+    if (data->generation) {
+        PutUInt(&w, vspTagGeneration, data->generation, 4);
+    }
+    if (data->status.code) {
+        PutUInt(&w, vspTagStatusCode, data->status.code, 4);
+    }
+    if (data->status.flags) {
+        PutUInt(&w, vspTagStatusFlags, data->status.flags, 8);
+    }
+    if (data->parameter.flags) {
+        PutUInt(&w, vspTagParameterFlags, data->parameter.flags, 8);
+    }
+    if (data->parameter.link.source || data->parameter.link.target) {
+        PutUInt(&w, vspTagLink, ((uint32_t) data->parameter.link.target << 16) | data->parameter.link.source, 4);
+    }
+    if (data->parameter.cursor) {
+        PutUInt(&w, vspTagCursor, data->parameter.cursor, 2);
+    }
+
+    switch (PortListTag(data)) {
+        case vspTagPortParameters: {
+            if (data->ports.count == sizeof(TVSPPortParameters)) {
+                PutField(&w, vspTagPortParameters, data->ports.list, sizeof(TVSPPortParameters));
+            }
+            break;
+        }
+        case vspTagBatchOperation: {
+            const uint8_t* ops = (const uint8_t*) data->ports.list;
+            for (uint8_t i = 0; i < data->ports.count && i < MAX_BATCH_OPS; i++) {
+                PutField(&w, vspTagBatchOperation, &ops[i * sizeof(TVSPBatchOperation)], sizeof(TVSPBatchOperation));
+            }
+            break;
+        }
+        case vspTagChangeItem: {
+            for (uint8_t i = 0; i < data->ports.count && i < MAX_CHANGE_ITEMS; i++) {
+                TVSPChangeItem change;
+                uint8_t item[7 + MAX_PORT_NAME];
+                // ports.list is byte aligned
+                memcpy(&change, ((const uint8_t*) data->ports.list) + i * sizeof(TVSPChangeItem), sizeof(change));
+                const size_t nlen = strnlen(change.name, MAX_PORT_NAME);
+                item[0] = change.kind;
+                item[1] = (uint8_t) (change.id);
+                item[2] = (uint8_t) (change.id >> 8);
+                item[3] = (uint8_t) (change.source);
+                item[4] = (uint8_t) (change.source >> 8);
+                item[5] = (uint8_t) (change.target);
+                item[6] = (uint8_t) (change.target >> 8);
+                memcpy(&item[7], change.name, nlen);
+                PutField(&w, vspTagChangeItem, item, (uint8_t) (7 + nlen));
+            }
+            if (data->ports.total || data->ports.next) {
+                PutUInt(&w, vspTagPortPage, ((uint32_t) data->ports.next << 16) | data->ports.total, 4);
+            }
+            break;
+        }
+        default: {
+            for (uint8_t i = 0; i < data->ports.count && i < MAX_SERIAL_PORTS; i++) {
+                uint8_t item[2 + MAX_PORT_NAME];
+                const TVSPPortListItem* pli = &data->ports.list[i];
+                const size_t nlen = strnlen(pli->name, MAX_PORT_NAME);
+                item[0] = (uint8_t) (pli->id);
+                item[1] = (uint8_t) (pli->id >> 8);
+                memcpy(&item[2], pli->name, nlen);
+                PutField(&w, vspTagPortItem, item, (uint8_t) (2 + nlen));
+            }
+            if (data->ports.total || data->ports.next) {
+                PutUInt(&w, vspTagPortPage, ((uint32_t) data->ports.next << 16) | data->ports.total, 4);
+            }
+            break;
+        }
+    }
+
+    for (uint8_t i = 0; i < data->links.count && i < MAX_PORT_LINKS; i++) {
+        PutUInt(&w, vspTagLinkItem, data->links.list[i], 8);
+    }
+    if (data->links.total || data->links.next) {
+        PutUInt(&w, vspTagLinkPage, ((uint32_t) data->links.next << 16) | data->links.total, 4);
+    }
+
+    if (w.overflow) {
+        return 0;
+    }
+
+    buffer[0] = VSP_WIRE_MAGIC;
+    buffer[1] = VSP_WIRE_VERSION;
+    buffer[2] = (uint8_t) (w.offset);
+    buffer[3] = (uint8_t) (w.offset >> 8);
+    return w.offset;
+}
+
+// -------------------------------------------------------------------
+// MARK: Decoder
+// -------------------------------------------------------------------
+
+static inline uint64_t GetUInt(const uint8_t* value, uint8_t length)
+{
+    uint64_t result = 0;
+    for (uint8_t i = 0; i < length; i++) {
+        result |= ((uint64_t) value[i]) << (i * 8);
+    }
+    return result;
+}
+
+bool VSPWireDecode(const uint8_t* buffer, size_t size, TVSPControllerData* data)
+{
+    uint8_t counts[vspLastTag] = {};
+    uint8_t portTag = 0;
+    size_t length;
+    size_t offset;
+
+    if (!buffer || !data || size < VSP_WIRE_HEADER_SIZE) {
+        return false;
+    }
+    if (buffer[0] != VSP_WIRE_MAGIC || buffer[1] != VSP_WIRE_VERSION) {
+        return false;
+    }
+    length = (size_t) buffer[2] | ((size_t) buffer[3] << 8);
+    if (length < VSP_WIRE_HEADER_SIZE || length > size) {
+        return false;
+    }
+
+    memset(data, 0, sizeof(TVSPControllerData));
+
+    for (offset = VSP_WIRE_HEADER_SIZE; offset < length;) {
+        if (offset + VSP_WIRE_FIELD_SIZE > length) {
+            return false;
+        }
+
+        const uint8_t tag = buffer[offset];
+        const uint8_t flen = buffer[offset + 1];
+        const uint8_t* value = &buffer[offset + VSP_WIRE_FIELD_SIZE];
+
+        offset += VSP_WIRE_FIELD_SIZE + flen;
+        if (offset > length) {
+            return false;
+        }
+
+        // skip fields of newer peers
+        if (tag == 0 || tag >= vspLastTag) {
+            continue;
+        }
+
+        const TVSPWireField& f = VSPWireSchema[tag - 1];
+        if (flen < f.minLength || flen > f.maxLength || counts[tag] >= f.maxCount) {
+            return false;
+        }
+        counts[tag]++;
+
+        // ports.list holds one kind of entries only
+        if (tag == vspTagPortParameters || tag == vspTagPortItem || tag == vspTagBatchOperation ||
+            tag == vspTagChangeItem) {
+            if (portTag && portTag != tag) {
+                return false;
+            }
+            portTag = tag;
+        }
+
+        switch (tag) {
+            case vspTagContext: {
+                data->context = value[0];
+                break;
+            }
+            case vspTagCommand: {
+                data->command = value[0];
+                break;
+            }
+            case vspTagRequest: {
+                data->request = (uint32_t) GetUInt(value, flen);
+                break;
+            }
+            case vspTagGeneration: {
+                data->generation = (uint32_t) GetUInt(value, flen);
+                break;
+            }
+            case vspTagStatusCode: {
+                data->status.code = (uint32_t) GetUInt(value, flen);
+                break;
+            }
+            case vspTagStatusFlags: {
+                data->status.flags = GetUInt(value, flen);
+                break;
+            }
+            case vspTagParameterFlags: {
+                data->parameter.flags = GetUInt(value, flen);
+                break;
+            }
+            case vspTagLink: {
+                data->parameter.link.source = (uint16_t) GetUInt(&value[0], 2);
+                data->parameter.link.target = (uint16_t) GetUInt(&value[2], 2);
+                break;
+            }
+            case vspTagCursor: {
+                data->parameter.cursor = (uint16_t) GetUInt(value, flen);
+                break;
+            }
+            case vspTagPortParameters: {
+                memcpy(data->ports.list, value, flen);
+                data->ports.count = flen;
+                break;
+            }
+            case vspTagPortItem: {
+                TVSPPortListItem* pli = &data->ports.list[data->ports.count++];
+                pli->id = (uint16_t) GetUInt(value, 2);
+                memcpy(pli->name, &value[2], flen - 2);
+                break;
+            }
+            case vspTagPortPage: {
+                data->ports.total = (uint16_t) GetUInt(&value[0], 2);
+                data->ports.next = (uint16_t) GetUInt(&value[2], 2);
+                break;
+            }
+            case vspTagLinkItem: {
+                data->links.list[data->links.count++] = GetUInt(value, flen);
+                break;
+            }
+            case vspTagLinkPage: {
+                data->links.total = (uint16_t) GetUInt(&value[0], 2);
+                data->links.next = (uint16_t) GetUInt(&value[2], 2);
+                break;
+            }
+            case vspTagBatchOperation: {
+                uint8_t* ops = (uint8_t*) data->ports.list;
+                memcpy(&ops[data->ports.count * sizeof(TVSPBatchOperation)], value, flen);
+                data->ports.count++;
+                break;
+            }
+            case vspTagChangeItem: {
+                TVSPChangeItem change = {};
+                change.kind = value[0];
+                change.id = (uint16_t) GetUInt(&value[1], 2);
+                change.source = (uint16_t) GetUInt(&value[3], 2);
+                change.target = (uint16_t) GetUInt(&value[5], 2);
+                memcpy(change.name, &value[7], flen - 7);
+                memcpy(((uint8_t*) data->ports.list) + data->ports.count * sizeof(TVSPChangeItem), &change, sizeof(change));
+                data->ports.count++;
+                break;
+            }
+        }
+    }
+
+    return (counts[vspTagContext] == 1 && counts[vspTagCommand] == 1);
+}
+
+} // END namespace
@@ -0,0 +1,146 @@
+// ********************************************************************
+// vspwire.hpp - Compact VSPDriver user client wire format
+//
+// Copyright © 2025 by EoF Software Labs
+// SPDX-License-Identifier: MIT
+// ********************************************************************
+#pragma once
+
+#include <vspcontroller.hpp>
+
+/* The classes below are exported */
+#pragma GCC visibility push(default)
+
+namespace VSPClient {
+
+// -------------------------------------------------------------------
+// Message layout (little endian):
+//
+//   uint8_t  magic    VSP_WIRE_MAGIC
+//   uint8_t  version  VSP_WIRE_VERSION
+//   uint16_t length   total message size including this header
+//   fields...         uint8_t tag, uint8_t length, value[length]
+//
+// Only fields carrying a value are encoded. Unknown tags are
+// skipped by the decoder, so newer peers can add fields without
+// breaking older ones. The version is bumped for incompatible
+// changes only.
+//
+#define VSP_WIRE_MAGIC       0x56
+#define VSP_WIRE_VERSION     2
+#define VSP_WIRE_HEADER_SIZE 4
+#define VSP_WIRE_FIELD_SIZE  2
+
+typedef enum : uint8_t {
+    vspTagContext = 1,
+    vspTagCommand,
+    vspTagRequest,
+    vspTagStatusCode,
+    vspTagStatusFlags,
+    vspTagParameterFlags,
+    vspTagLink,
+    vspTagPortParameters,
+    vspTagPortItem,
+    vspTagLinkItem,
+    vspTagBatchOperation,
+    vspTagCursor,
+    vspTagPortPage,
+    vspTagLinkPage,
+    vspTagGeneration,
+    vspTagChangeItem,
+    // Has to be last
+    vspLastTag,
+} TVSPWireTag;
+
+typedef struct {
+    uint8_t tag;
+    /* value length limits */
+    uint8_t minLength;
+    uint8_t maxLength;
+    /* field may occur more than once */
+    bool repeated;
+    /* maximum occurrences */
+    uint8_t maxCount;
+} TVSPWireField;
+
+// -------------------------------------------------------------------
+// Wire schema, indexed by tag - 1
+//
+constexpr TVSPWireField VSPWireSchema[] = {
+   {vspTagContext, 1, 1, false, 1},
+   {vspTagCommand, 1, 1, false, 1},
+   {vspTagRequest, 4, 4, false, 1},
+   {vspTagStatusCode, 4, 4, false, 1},
+   {vspTagStatusFlags, 8, 8, false, 1},
+   {vspTagParameterFlags, 8, 8, false, 1},
+   {vspTagLink, 4, 4, false, 1},
+   {vspTagPortParameters, sizeof(TVSPPortParameters), sizeof(TVSPPortParameters), false, 1},
+   {vspTagPortItem, 2, 2 + MAX_PORT_NAME, true, MAX_SERIAL_PORTS},
+   {vspTagLinkItem, 8, 8, true, MAX_PORT_LINKS},
+   {vspTagBatchOperation, sizeof(TVSPBatchOperation), sizeof(TVSPBatchOperation), true, MAX_BATCH_OPS},
+   {vspTagCursor, 2, 2, false, 1},
+   {vspTagPortPage, 4, 4, false, 1},
+   {vspTagLinkPage, 4, 4, false, 1},
+   {vspTagGeneration, 4, 4, false, 1},
+   {vspTagChangeItem, 7, 7 + MAX_PORT_NAME, true, MAX_CHANGE_ITEMS},
+};
+
+constexpr bool VSPWireSchemaValid()
+{
+    if (sizeof(VSPWireSchema) / sizeof(VSPWireSchema[0]) != vspLastTag - 1) {
+        return false;
+    }
+    for (uint8_t i = 0; i < vspLastTag - 1; i++) {
+        const TVSPWireField& f = VSPWireSchema[i];
+        if (f.tag != i + 1 || f.minLength > f.maxLength || !f.maxCount) {
+            return false;
+        }
+        if (!f.repeated && f.maxCount != 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+constexpr size_t VSPWireMaxSize()
+{
+    size_t size = VSP_WIRE_HEADER_SIZE;
+    size_t ports = 0;
+    for (uint8_t i = 0; i < vspLastTag - 1; i++) {
+        const TVSPWireField& f = VSPWireSchema[i];
+        const size_t field = (size_t) f.maxCount * (VSP_WIRE_FIELD_SIZE + f.maxLength);
+        // port parameters, port items, batch operations and change items share ports.list
+        if (f.tag == vspTagPortParameters || f.tag == vspTagPortItem || f.tag == vspTagBatchOperation ||
+            f.tag == vspTagChangeItem) {
+            ports = (field > ports ? field : ports);
+            continue;
+        }
+        size += field;
+    }
+    return size + ports;
+}
+
+static_assert(VSPWireSchemaValid(), "VSPWireSchema does not match TVSPWireTag");
+static_assert(sizeof(TVSPPortParameters) <= 0xff, "TVSPPortParameters exceeds field length");
+static_assert(sizeof(TVSPBatchOperation) <= 0xff, "TVSPBatchOperation exceeds field length");
+static_assert(2 + MAX_PORT_NAME <= 0xff, "Port item exceeds field length");
+static_assert(7 + MAX_PORT_NAME <= 0xff, "Change item exceeds field length");
+static_assert(VSPWireMaxSize() <= 0xffff, "Wire message exceeds 16 bit length");
+
+#define VSP_WIRE_MAX_SIZE VSPWireMaxSize()
+
+/** ----------------------
+ * Encode the fields of 'data' in use. Returns the message size or
+ * 0 if the buffer is too small.
+ */
+VSPCONTROLLER_EXPORT size_t VSPWireEncode(const TVSPControllerData* data, uint8_t* buffer, size_t size);
+
+/** ----------------------
+ * Decode a message into 'data'. Fields not present are zero.
+ * Returns false on malformed messages or unsupported versions.
+ */
+VSPCONTROLLER_EXPORT bool VSPWireDecode(const uint8_t* buffer, size_t size, TVSPControllerData* data);
+
+} // END namespace
+
+#pragma GCC visibility pop
@@ -0,0 +1,2659 @@
+// ********************************************************************
+// vspctl.cpp - VSPDriver command line tool
+//
+// Copyright © 2025 by EoF Software Labs
+// SPDX-License-Identifier: MIT
+// ********************************************************************
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <future>
+#include <mutex>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/resource.h>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#endif
+#include <termios.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include <deque>
+#include <vspcontroller.hpp>
+#include <vspring.hpp>
+#include <vspwire.hpp>
+
+using namespace VSPClient;
+
+#define VSPCTL_VERSION "1.0"
+
+// exit codes besides EXIT_SUCCESS and EXIT_FAILURE
+#define EXIT_USAGE    2
+#define EXIT_NODRIVER 3
+
+// deadline of each request in ms, 0 = none
+#define DEFAULT_TIMEOUT 1000
+
+// bench pty: write size, latency samples and the deadline of a read
+#define BENCH_CHUNK_SIZE      4096
+#define BENCH_LATENCY_SAMPLES 2000
+#define BENCH_READ_TIMEOUT    5000
+
+// bench pace: run time in seconds, bytes per write, wait and events
+// of an epoll_wait
+#define BENCH_PACE_SECONDS 2
+#define BENCH_PACE_CHUNK   256
+#define BENCH_PACE_POLL    10
+#define BENCH_PACE_EVENTS  256
+
+// bench shards: most links swept and bytes a link carries at least
+#define BENCH_SHARD_LINKS 1024
+#define BENCH_SHARD_BYTES 65536
+
+// bench stress: requests in flight of all threads, below the request
+// slots and the backlog of the controller together
+#define BENCH_STRESS_WINDOW 512
+
+// bench ring: bytes the buffers hold and the producer publishes at once
+#define BENCH_RING_CAPACITY 65536
+#define BENCH_RING_BATCH    1024
+
+// IOReturn codes reported by the driver, see vsptransport.hpp
+#define kIOErrorNotFound    -536870160
+#define kIOErrorBadArgument -536870206
+
+typedef struct {
+    /* One JSON object per line instead of text */
+    bool json;
+    /* Latency report instead of the results */
+    bool bench;
+    /* Runs of the command or script */
+    uint32_t repeat;
+    /* Request deadline in ms */
+    uint32_t timeout;
+    /* Registry path of the driver instance, see Route() */
+    const char* instance;
+    /* Socket of the vspd daemon, nullptr = driver */
+    const char* socket;
+} TCtlOptions;
+
+class VSPCtl;
+
+typedef int (VSPCtl::*TCtlHandler)(int argc, char** argv);
+
+typedef struct {
+    uint32_t number;
+    std::vector<std::string> words;
+    /* argv of the words */
+    std::vector<char*> args;
+} TCtlLine;
+
+typedef struct {
+    TVSPTopologySpec spec;
+    /* Name of each port of the spec */
+    std::vector<std::string> names;
+} TCtlSpec;
+
+typedef struct {
+    double avgUs;
+    double p50Us;
+    double p99Us;
+    double maxUs;
+} TCtlLatency;
+
+typedef struct {
+    uint32_t links;
+    uint32_t megabytes;
+    double seconds;
+    /* MB/s of all links together */
+    double rate;
+    double nsPerByte;
+    /* process CPU seconds per GB forwarded */
+    double cpuPerGB;
+    /* single byte over a link and through the echo */
+    TCtlLatency latency[2];
+} TCtlPtyRun;
+
+typedef struct {
+    const char* name;
+    /* Number of arguments after the name */
+    int minArgs;
+    int maxArgs;
+    const char* usage;
+    TCtlHandler handler;
+    /* Allowed as line of a script */
+    bool script;
+} TCtlCommand;
+
+static const char* const s_commandNames[] = {
+   "PingPong",
+   "GetStatus",
+   "CreatePort",
+   "RemovePort",
+   "LinkPorts",
+   "UnlinkPorts",
+   "GetPortList",
+   "GetLinkList",
+   "EnableChecks",
+   "EnableTrace",
+   "Batch",
+   "GetChanges",
+   "Subscribe",
+};
+
+static_assert(sizeof(s_commandNames) / sizeof(s_commandNames[0]) == vspLastCommand, "Command names out of date");
+
+// -------------------------------------------------------------------
+// Headless VSPController. All requests go through Call(), the
+// completions are dispatched on the thread waiting for them.
+//
+class VSPCtl: public VSPController
+{
+public:
+    VSPCtl(const TCtlOptions& options);
+    ~VSPCtl();
+
+    /** ----------------------
+     * Execute the command line after the options
+     */
+    int Run(int argc, char** argv);
+
+protected:
+    void OnIOUCCallback(int result, void* data, uint32_t size) override;
+    void OnConnected() override;
+    void OnDisconnected() override;
+    void OnErrorOccured(int error, const char* message) override;
+    void OnDataReady(void*) override;
+    void OnCompletionsPending() override;
+
+private:
+    TCtlOptions m_options;
+
+    // set by OnCompletionsPending, reset by the dispatching thread
+    std::mutex m_pendingLock;
+    std::condition_variable m_pendingSignal;
+    bool m_pending;
+
+    // no results and errors while benchmarking
+    bool m_quiet;
+
+    // results without a completion of their own, none is expected
+    std::atomic<uint64_t> m_stray;
+
+    // parsed by the first run of the script command
+    std::vector<TCtlLine> m_script;
+    bool m_scriptLoaded;
+
+    // parsed by the first run of the apply command
+    TCtlSpec m_spec;
+    bool m_specLoaded;
+
+    static const TCtlCommand s_commands[];
+
+    static const TCtlCommand* FindCommand(int argc, char** argv, const bool inScript);
+    static bool ParseNumber(const char* text, const uint32_t max, uint32_t* value);
+    static bool ParseSpec(const char* text, TCtlSpec* spec);
+    static void PrintJsonString(const char* text);
+    static void PrintLatency(const TVSPStatistics& stats, const bool json);
+    static int OpenDevice(const char* name);
+    static bool ReadFully(int fd, uint8_t* buffer, const size_t size);
+    static bool MeasureLatency(int tx, int rx, std::vector<double>* samples);
+    static void PrintPtyRun(const TCtlPtyRun& run, const bool json);
+    static bool ForwardLinks(const std::vector<int>& fds, const uint32_t links, const uint64_t bytes);
+
+    int Dispatch(int argc, char** argv, const bool inScript);
+    TVSPResult Execute(const TVSPCommandCall& call);
+    void WaitPending();
+    int PrintError(const char* name, const TVSPResult& result);
+    void PrintTopology(const char* name, const TVSPResult& result);
+
+    int CmdStatus(int argc, char** argv);
+    int CmdList(int argc, char** argv);
+    int CmdCreate(int argc, char** argv);
+    int CmdRemove(int argc, char** argv);
+    int CmdLink(int argc, char** argv);
+    int CmdUnlink(int argc, char** argv);
+    int CmdChecks(int argc, char** argv);
+    int CmdTrace(int argc, char** argv);
+    int CmdInstances(int argc, char** argv);
+    int LoadScript(const char* path);
+    int CmdScript(int argc, char** argv);
+    int LoadSpec(const char* path);
+    int CmdApply(int argc, char** argv);
+    int CmdBench(int argc, char** argv);
+
+    int BenchWire(int argc, char** argv);
+    int BenchRing(int argc, char** argv);
+    int BenchStress(int argc, char** argv);
+    int BenchPty(int argc, char** argv);
+    int BenchSplice(int argc, char** argv);
+    int BenchPace(int argc, char** argv);
+    int BenchShards(int argc, char** argv);
+    int RunPtyBench(const uint32_t links, const uint32_t megabytes, TCtlPtyRun* run);
+    int CreateBenchPorts(const uint32_t count, const uint32_t baudRate, std::vector<uint16_t>* ids, std::vector<std::string>* names);
+    int OpenBenchLinks(const uint32_t links, const uint32_t baudRate, std::vector<uint16_t>* ids, std::vector<int>* fds);
+    void CloseBenchLinks(const std::vector<uint16_t>& ids, const std::vector<int>& fds);
+    void RemoveBenchPorts(const std::vector<uint16_t>& ids);
+};
+
+const TCtlCommand VSPCtl::s_commands[] = {
+   {"status", 0, 0, "status", &VSPCtl::CmdStatus, true},
+   {"list", 0, 0, "list", &VSPCtl::CmdList, true},
+   {"create", 0, 5, "create [baud [data bits [stop bits [parity [flow control]]]]]", &VSPCtl::CmdCreate, true},
+   {"remove", 1, 1, "remove <port>", &VSPCtl::CmdRemove, true},
+   {"link", 2, 2, "link <source> <target>", &VSPCtl::CmdLink, true},
+   {"unlink", 2, 2, "unlink <source> <target>", &VSPCtl::CmdUnlink, true},
+   {"checks", 1, 1, "checks <port>", &VSPCtl::CmdChecks, true},
+   {"trace", 1, 1, "trace <port>", &VSPCtl::CmdTrace, true},
+   {"instances", 0, 0, "instances", &VSPCtl::CmdInstances, true},
+   {"script", 1, 1, "script <file | ->", &VSPCtl::CmdScript, false},
+   {"apply", 1, 1, "apply <file | ->", &VSPCtl::CmdApply, false},
+   {"bench", 1, 4, "bench wire [count] | ring [megabytes] | stress [threads [count]] | pty|splice [links [megabytes]] | pace [links [baud]] | shards [links [megabytes [shards]]]", &VSPCtl::CmdBench, false},
+};
+
+// -------------------------------------------------------------------
+//
+//
+VSPCtl::VSPCtl(const TCtlOptions& options)
+    : VSPController()
+    , m_options(options)
+    , m_pendingLock()
+    , m_pendingSignal()
+    , m_pending(false)
+    , m_quiet(options.bench)
+    , m_stray(0)
+    , m_script()
+    , m_scriptLoaded(false)
+    , m_spec()
+    , m_specLoaded(false)
+{
+    // the IOKit transport needs a run loop, the control thread has
+    // one and this tool waits on the main thread
+    SetControlThread(true);
+    SetTraceLevel(vspTraceOff);
+    // --timeout 0 waits for the driver as long as it takes
+    SetRequestTimeout(options.timeout);
+
+    if (options.socket) {
+        SetDaemonSocket(options.socket);
+    }
+}
+
+VSPCtl::~VSPCtl()
+{
+    DisconnectDriver();
+}
+
+// -------------------------------------------------------------------
+// MARK: Controller Callbacks
+// -------------------------------------------------------------------
+
+void VSPCtl::OnIOUCCallback(int, void*, uint32_t)
+{
+    // all requests carry their own completion, see BenchStress()
+    m_stray++;
+}
+
+void VSPCtl::OnConnected()
+{
+}
+
+void VSPCtl::OnDisconnected()
+{
+}
+
+void VSPCtl::OnErrorOccured(int error, const char* message)
+{
+    if (!m_quiet) {
+        fprintf(stderr, "vspctl: %s (0x%08x)\n", message, (uint32_t) error);
+    }
+}
+
+void VSPCtl::OnDataReady(void*)
+{
+}
+
+void VSPCtl::OnCompletionsPending()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_pendingLock);
+        m_pending = true;
+    }
+    m_pendingSignal.notify_one();
+}
+
+// -------------------------------------------------------------------
+// MARK: Helpers
+// -------------------------------------------------------------------
+
+// -------------------------------------------------------------------
+// Command of argv[0] taking the arguments given, nullptr after the
+// usage is printed.
+//
+const TCtlCommand* VSPCtl::FindCommand(int argc, char** argv, const bool inScript)
+{
+    for (const TCtlCommand& command : s_commands) {
+        if (strcmp(command.name, argv[0]) != 0 || (inScript && !command.script)) {
+            continue;
+        }
+        if (argc - 1 < command.minArgs || argc - 1 > command.maxArgs) {
+            fprintf(stderr, "usage: %s%s\n", (inScript ? "" : "vspctl [options] "), command.usage);
+            return nullptr;
+        }
+        return &command;
+    }
+
+    fprintf(stderr, "vspctl: Unknown command '%s'.\n", argv[0]);
+    return nullptr;
+}
+
+// -------------------------------------------------------------------
+//
+//
+bool VSPCtl::ParseNumber(const char* text, const uint32_t max, uint32_t* value)
+{
+    char* end = nullptr;
+
+    errno = 0;
+    const unsigned long number = strtoul(text, &end, 0);
+    if (errno || end == text || *end || number > max) {
+        fprintf(stderr, "vspctl: Invalid number '%s', 0..%u expected.\n", text, max);
+        return false;
+    }
+    *value = (uint32_t) number;
+    return true;
+}
+
+// -------------------------------------------------------------------
+// Topology spec of the apply command, for example
+//
+//   {"ports":[{"name":"a","baud":115200},{"name":"b"}],
+//    "links":[["a","b"]]}
+//
+// Port members: name, baud, data, stop, parity, flow, defaults as
+// for the create command. A link names its ports or gives their
+// index in the ports array.
+//
+bool VSPCtl::ParseSpec(const char* text, TCtlSpec* spec)
+{
+    const char* c = text;
+
+    auto skip = [&c]() {
+        while (*c == ' ' || *c == '\t' || *c == '\r' || *c == '\n') {
+            c++;
+        }
+    };
+    auto expect = [&c, &skip](const char token) {
+        skip();
+        if (*c != token) {
+            return false;
+        }
+        c++;
+        skip();
+        return true;
+    };
+    // member separator or end of the object or array
+    auto next = [&c, &expect](const char end, bool* more) {
+        *more = expect(',');
+        return *more || expect(end);
+    };
+    auto string = [&c, &expect](std::string* value) {
+        if (!expect('"')) {
+            return false;
+        }
+        value->clear();
+        for (; *c && *c != '"'; c++) {
+            if (*c == '\\' && c[1]) {
+                c++;
+            }
+            value->push_back(*c);
+        }
+        return expect('"');
+    };
+    auto number = [&c, &skip](const uint32_t max, uint32_t* value) {
+        char* end = nullptr;
+        errno = 0;
+        const unsigned long n = strtoul(c, &end, 10);
+        if (errno || end == c || n > max) {
+            return false;
+        }
+        *value = (uint32_t) n;
+        c = end;
+        skip();
+        return true;
+    };
+    auto port = [&](bool* more) {
+        TVSPPortParameters parameters = {9600, 8, 1, 0, 0};
+        std::string name = std::to_string(spec->names.size());
+        std::string key;
+        uint32_t value = 0;
+        bool member = true;
+
+        if (!expect('{')) {
+            return false;
+        }
+        member = !expect('}');
+        while (member) {
+            if (!string(&key) || !expect(':')) {
+                return false;
+            }
+            if (key == "name") {
+                if (!string(&name)) {
+                    return false;
+                }
+            }
+            else if (key == "baud" && number(0xffffffff, &value)) {
+                parameters.baudRate = value;
+            }
+            else if (key == "data" && number(8, &value)) {
+                parameters.dataBits = (uint8_t) value;
+            }
+            else if (key == "stop" && number(2, &value)) {
+                parameters.stopBits = (uint8_t) value;
+            }
+            else if (key == "parity" && number(0xff, &value)) {
+                parameters.parity = (uint8_t) value;
+            }
+            else if (key == "flow" && number(0xff, &value)) {
+                parameters.flowCtrl = (uint8_t) value;
+            }
+            else {
+                return false;
+            }
+            if (!next('}', &member)) {
+                return false;
+            }
+        }
+        spec->spec.ports.push_back(parameters);
+        spec->names.push_back(name);
+        return next(']', more);
+    };
+    auto end = [&spec](const std::string& name, uint16_t* index) {
+        for (size_t i = 0; i < spec->names.size(); i++) {
+            if (spec->names[i] == name) {
+                *index = (uint16_t) i;
+                return true;
+            }
+        }
+        return false;
+    };
+    auto link = [&](bool* more) {
+        uint16_t ends[2];
+        std::string name;
+        uint32_t value = 0;
+
+        if (!expect('[')) {
+            return false;
+        }
+        for (int i = 0; i < 2; i++) {
+            if (i && !expect(',')) {
+                return false;
+            }
+            if (*c == '"') {
+                if (!string(&name) || !end(name, &ends[i])) {
+                    return false;
+                }
+            }
+            else if (number(0xffff, &value) && value < spec->names.size()) {
+                ends[i] = (uint16_t) value;
+            }
+            else {
+                return false;
+            }
+        }
+        if (!expect(']')) {
+            return false;
+        }
+        spec->spec.links.push_back(std::make_pair(ends[0], ends[1]));
+        return next(']', more);
+    };
+
+    std::string key;
+    bool member = true;
+    bool more = true;
+
+    if (!expect('{')) {
+        return false;
+    }
+    member = !expect('}');
+    while (member) {
+        if (!string(&key) || !expect(':') || !expect('[')) {
+            return false;
+        }
+        more = !expect(']');
+        // links refer to the ports given before them
+        while (more) {
+            if (key == "ports" ? !port(&more) : key == "links" ? !link(&more) : true) {
+                return false;
+            }
+        }
+        if (!next('}', &member)) {
+            return false;
+        }
+    }
+    return !*c;
+}
+
+// -------------------------------------------------------------------
+//
+//
+void VSPCtl::PrintJsonString(const char* text)
+{
+    putchar('"');
+    for (const char* c = text; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            printf("\\%c", *c);
+        }
+        else if ((unsigned char) *c < 0x20) {
+            printf("\\u%04x", (unsigned char) *c);
+        }
+        else {
+            putchar(*c);
+        }
+    }
+    putchar('"');
+}
+
+// -------------------------------------------------------------------
+// Submit one request and dispatch the completions on this thread
+// until its result is there.
+//
+TVSPResult VSPCtl::Execute(const TVSPCommandCall& call)
+{
+    std::future<TVSPResult> future;
+    auto submit = [this, &call, &future]() {
+        future = Async(call, m_options.timeout);
+        return true;
+    };
+
+    if (m_options.instance) {
+        if (!Route(m_options.instance, submit)) {
+            TVSPResult result = {};
+            result.result = kIOErrorNotFound;
+            return result;
+        }
+    }
+    else {
+        submit();
+    }
+
+    while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        WaitPending();
+        DispatchCompletions();
+    }
+    return future.get();
+}
+
+// -------------------------------------------------------------------
+//
+//
+void VSPCtl::WaitPending()
+{
+    std::unique_lock<std::mutex> lock(m_pendingLock);
+    m_pendingSignal.wait_for(lock, std::chrono::milliseconds(100), [this]() {
+        return m_pending;
+    });
+    m_pending = false;
+}
+
+// -------------------------------------------------------------------
+//
+//
+int VSPCtl::PrintError(const char* name, const TVSPResult& result)
+{
+    const TVSPSystemError e = GetSystemError(result.result);
+
+    if (m_quiet) {
+        return EXIT_FAILURE;
+    }
+    if (m_options.json) {
+        printf("{\"command\":\"%s\",\"result\":%d,\"system\":%d,\"sub\":%d,\"code\":%d}\n", //
+               name, result.result, e.system, e.sub, e.code);
+    }
+    else {
+        printf("%s: failed 0x%08x (system 0x%02x sub 0x%03x code 0x%04x)\n", //
+               name, (uint32_t) result.result, e.system, e.sub, e.code);
+    }
+    return EXIT_FAILURE;
+}
+
+// -------------------------------------------------------------------
+// First page of ports and links carried by the response
+//
+void VSPCtl::PrintTopology(const char* name, const TVSPResult& result)
+{
+    const TVSPControllerData* data = &result.data;
+
+    if (m_quiet) {
+        return;
+    }
+
+    if (m_options.json) {
+        printf("{\"command\":\"%s\",\"result\":0,\"instance\":%u,\"generation\":%u", name, result.instance, data->generation);
+        printf(",\"ports\":{\"total\":%u,\"list\":[", data->ports.total);
+        for (uint8_t i = 0; i < data->ports.count && i < MAX_SERIAL_PORTS; i++) {
+            printf("%s{\"id\":%u,\"name\":", (i ? "," : ""), data->ports.list[i].id);
+            PrintJsonString(data->ports.list[i].name);
+            putchar('}');
+        }
+        printf("]},\"links\":{\"total\":%u,\"list\":[", data->links.total);
+        for (uint8_t i = 0; i < data->links.count && i < MAX_PORT_LINKS; i++) {
+            const uint64_t item = data->links.list[i];
+            printf("%s{\"id\":%u,\"source\":%u,\"target\":%u}", (i ? "," : ""), //
+                   VSP_LINK_ID(item), VSP_LINK_SOURCE(item), VSP_LINK_TARGET(item));
+        }
+        printf("]}}\n");
+        return;
+    }
+
+    printf("%s: instance %u, %u ports, %u links, generation %u\n", //
+           name, result.instance, data->ports.total, data->links.total, data->generation);
+    for (uint8_t i = 0; i < data->ports.count && i < MAX_SERIAL_PORTS; i++) {
+        printf("  port %-5u %s\n", data->ports.list[i].id, data->ports.list[i].name);
+    }
+    for (uint8_t i = 0; i < data->links.count && i < MAX_PORT_LINKS; i++) {
+        const uint64_t item = data->links.list[i];
+        printf("  link %-5u %u <-> %u\n", VSP_LINK_ID(item), VSP_LINK_SOURCE(item), VSP_LINK_TARGET(item));
+    }
+}
+
+// -------------------------------------------------------------------
+// Per command table of the controller latency histograms
+//
+void VSPCtl::PrintLatency(const TVSPStatistics& stats, const bool json)
+{
+    bool first = true;
+
+    if (json) {
+        printf("\"commands\":[");
+    }
+    else {
+        printf("%-12s %9s %7s %7s %7s %8s %8s %8s %8s %8s %8s\n", //
+               "command", "count", "errors", "timeout", "late", "min us", "avg us", "p50 us", "p90 us", "p99 us", "max us");
+    }
+
+    for (uint8_t i = 0; i < vspLastCommand; i++) {
+        const TVSPCommandStats* s = &stats.commands[i];
+        if (!s->completed && !s->timeouts) {
+            continue;
+        }
+
+        const double avg = (s->completed ? (double) s->sumUs / s->completed : 0);
+        const uint64_t p50 = LatencyPercentile(s, 50.0);
+        const uint64_t p90 = LatencyPercentile(s, 90.0);
+        const uint64_t p99 = LatencyPercentile(s, 99.0);
+
+        if (json) {
+            printf("%s{\"command\":\"%s\",\"count\":%llu,\"errors\":%llu,\"timeouts\":%llu,\"late\":%llu,\"rejected\":%llu,"
+                   "\"minUs\":%llu,\"avgUs\":%.1f,\"p50Us\":%llu,\"p90Us\":%llu,\"p99Us\":%llu,\"maxUs\":%llu}",
+                   (first ? "" : ","),
+                   s_commandNames[i],
+                   (unsigned long long) s->completed,
+                   (unsigned long long) s->errors,
+                   (unsigned long long) s->timeouts,
+                   (unsigned long long) s->late,
+                   (unsigned long long) s->rejected,
+                   (unsigned long long) s->minUs,
+                   avg,
+                   (unsigned long long) p50,
+                   (unsigned long long) p90,
+                   (unsigned long long) p99,
+                   (unsigned long long) s->maxUs);
+        }
+        else {
+            printf("%-12s %9llu %7llu %7llu %7llu %8llu %8.1f %8llu %8llu %8llu %8llu\n",
+                   s_commandNames[i],
+                   (unsigned long long) s->completed,
+                   (unsigned long long) s->errors,
+                   (unsigned long long) s->timeouts,
+                   (unsigned long long) s->late,
+                   (unsigned long long) s->minUs,
+                   avg,
+                   (unsigned long long) p50,
+                   (unsigned long long) p90,
+                   (unsigned long long) p99,
+                   (unsigned long long) s->maxUs);
+        }
+        first = false;
+    }
+
+    if (json) {
+        printf("]");
+    }
+}
+
+// -------------------------------------------------------------------
+// MARK: Command Line
+// -------------------------------------------------------------------
+
+// -------------------------------------------------------------------
+// The command runs 'repeat' times, the latency report of the bench
+// mode covers all runs. On the IOKit transport it fails if the runs
+// did not reuse the response mappings of the first one.
+//
+int VSPCtl::Run(int argc, char** argv)
+{
+    const TCtlCommand* command = FindCommand(argc, argv, false);
+    int ret = EXIT_SUCCESS;
+
+    if (!command) {
+        return EXIT_USAGE;
+    }
+
+    if (!ConnectDriver() || !IsConnected()) {
+        fputs((m_options.socket ? "vspctl: vspd daemon not found.\n" : "vspctl: VSPDriver not found.\n"), stderr);
+        return EXIT_NODRIVER;
+    }
+
+    // a bench command reports by itself
+    if (command->handler == &VSPCtl::CmdBench) {
+        return (this->*command->handler)(argc, argv);
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < m_options.repeat; i++) {
+        const int status = Dispatch(argc, argv, false);
+        if (status != EXIT_SUCCESS) {
+            ret = status;
+        }
+        if (ret == EXIT_USAGE) {
+            return ret;
+        }
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (m_options.bench) {
+        const TVSPStatistics stats = GetStatistics();
+        const TVSPMappingStats maps = GetMappingStats();
+        uint64_t requests = 0;
+        for (uint8_t i = 0; i < vspLastCommand; i++) {
+            requests += stats.commands[i].completed + stats.commands[i].timeouts;
+        }
+
+        if (m_options.json) {
+            printf("{\"bench\":\"%s\",\"repeat\":%u,\"requests\":%llu,\"seconds\":%.6f,\"rate\":%.1f,", //
+                   argv[0], m_options.repeat, (unsigned long long) requests, seconds, requests / seconds);
+            if (maps.supported) {
+                printf("\"mappings\":{\"created\":%llu,\"reused\":%llu,\"released\":%llu},", //
+                       (unsigned long long) maps.created, (unsigned long long) maps.reused, (unsigned long long) maps.released);
+            }
+            PrintLatency(stats, true);
+            printf("}\n");
+        }
+        else {
+            printf("%s x %u: %llu requests in %.3f s, %.0f req/s\n", //
+                   argv[0], m_options.repeat, (unsigned long long) requests, seconds, requests / seconds);
+            if (maps.supported) {
+                printf("mappings: %llu created, %llu reused, %llu released\n", //
+                       (unsigned long long) maps.created, (unsigned long long) maps.reused, (unsigned long long) maps.released);
+            }
+            PrintLatency(stats, false);
+        }
+
+        // a repeated command runs on the mapping of its first run
+        if (maps.supported && m_options.repeat > 1 && !maps.reused) {
+            fputs("vspctl: Driver response mappings not reused.\n", stderr);
+            ret = EXIT_FAILURE;
+        }
+    }
+    return ret;
+}
+
+// -------------------------------------------------------------------
+//
+//
+int VSPCtl::Dispatch(int argc, char** argv, const bool inScript)
+{
+    const TCtlCommand* command = FindCommand(argc, argv, inScript);
+
+    if (!command) {
+        return EXIT_USAGE;
+    }
+    return (this->*command->handler)(argc, argv);
+}
+
+// -------------------------------------------------------------------
+// MARK: Commands
+// -------------------------------------------------------------------
+
+// -------------------------------------------------------------------
+//
+//
+int VSPCtl::CmdStatus(int, char**)
+{
+    const TVSPResult result = Execute([this]() {
+        return GetStatus();
+    });
+
+    if (result.result) {
+        return PrintError("status", result);
+    }
+    PrintTopology("status", result);
+    return EXIT_SUCCESS;
+}
+
+// -------------------------------------------------------------------
+// Page through the port and link lists of the instance
+//
+int VSPCtl::CmdList(int, char**)
+{
+    std::vector<TVSPPortListItem> ports;
+    std::vector<uint64_t> links;
+    TVSPResult result = {};
+    uint16_t cursor = 0;
+
+    do {
+        result = Execute([this, cursor]() {
+            return GetPortList(cursor);
+        });
+        if (result.result) {
+            return PrintError("list", result);
+        }
+        for (uint8_t i = 0; i < result.data.ports.count && i < MAX_SERIAL_PORTS; i++) {
+            ports.push_back(result.data.ports.list[i]);
+        }
+    } while ((cursor = result.data.ports.next));
+
+    do {
+        result = Execute([this, cursor]() {
+            return GetLinkList(cursor);
+        });
+        if (result.result) {
+            return PrintError("list", result);
+        }
+        for (uint8_t i = 0; i < result.data.links.count && i < MAX_PORT_LINKS; i++) {
+            links.push_back(result.data.links.list[i]);
+        }
+    } while ((cursor = result.data.links.next));
+
+    if (m_quiet) {
+        return EXIT_SUCCESS;
+    }
+
+    if (m_options.json) {
+        printf("{\"command\":\"list\",\"result\":0,\"instance\":%u,\"ports\":[", result.instance);
+        for (size_t i = 0; i < ports.size(); i++) {
+            printf("%s{\"id\":%u,\"name\":", (i ? "," : ""), ports[i].id);
+            PrintJsonString(ports[i].name);
+            putchar('}');
+        }
+        printf("],\"links\":[");
+        for (size_t i = 0; i < links.size(); i++) {
+            printf("%s{\"id\":%u,\"source\":%u,\"target\":%u}", (i ? "," : ""), //
+                   VSP_LINK_ID(links[i]), VSP_LINK_SOURCE(links[i]), VSP_LINK_TARGET(links[i]));
+        }
+        printf("]}\n");
+        return EXIT_SUCCESS;
+    }
+
+    printf("list: instance %u, %zu ports, %zu links\n", result.instance, ports.size(), links.size());
+    for (const TVSPPortListItem& port : ports) {
+        printf("  port %-5u %s\n", port.id, port.name);
+    }
+    for (const uint64_t item : links) {
+        printf("  link %-5u %u <-> %u\n", VSP_LINK_ID(item), VSP_LINK_SOURCE(item), VSP_LINK_TARGET(item));
+    }
+    return EXIT_SUCCESS;
+}
+
+// -------------------------------------------------------------------
+// Defaults to 9600 8N1 without flow control
+//
+int VSPCtl::CmdCreate(int argc, char** argv)
+{
+    TVSPPortParameters parameters = {9600, 8, 1, 0, 0};
+    uint32_t value;
+
+    if (argc > 1) {
+        if (!ParseNumber(argv[1], 0xffffffff, &value)) {
+            return EXIT_USAGE;
+        }
+        parameters.baudRate = value;
+    }
+    if (argc > 2) {
+        if (!ParseNumber(argv[2], 8, &value)) {
+            return EXIT_USAGE;
+        }
+        parameters.dataBits = (uint8_t) value;
+    }
+    if (argc > 3) {
+        if (!ParseNumber(argv[3], 2, &value)) {
+            return EXIT_USAGE;
+        }
+        parameters.stopBits = (uint8_t) value;
+    }
+    if (argc > 4) {
+        if (!ParseNumber(argv[4], 0xff, &value)) {
+            return EXIT_USAGE;
+        }
+        parameters.parity = (uint8_t) value;
+    }
+    if (argc > 5) {
+        if (!ParseNumber(argv[5], 0xff, &value)) {
+            return EXIT_USAGE;
+        }
+        parameters.flowCtrl = (uint8_t) value;
+    }
+
+    const TVSPResult result = Execute([this, &parameters]() {
+        return CreatePort(&parameters);
+    });
+    if (result.result) {
+        return PrintError("create", result);
+    }
+    if (m_quiet) {
+        return EXIT_SUCCESS;
+    }
+
+    const uint16_t id = result.data.parameter.link.source;
+    if (m_options.json) {
+        printf("{\"command\":\"create\",\"result\":0,\"instance\":%u,\"port\":%u}\n", result.instance, id);
+    }
+    else {
+        printf("create: instance %u, port %u\n", result.instance, id);
+    }
+    return EXIT_SUCCESS;
+}
+
+// -------------------------------------------------------------------
+//
+//
+int VSPCtl::CmdRemove(int, char** argv)
+{
+    uint32_t id;
+
+    if (!ParseNumber(argv[1], 0xffff, &id)) {
+        return EXIT_USAGE;
+    }
+
+    const TVSPResult result = Execute([this, id]() {
+        return RemovePort((uint16_t) id);
+    });
+    if (result.result) {
+        return PrintError("remove", result);
+    }
+    PrintTopology("remove", result);
+    return EXIT_SUCCESS;
+}
+
+// -------------------------------------------------------------------
+//
+//
+int VSPCtl::CmdLink(int, char** argv)
+{
+    uint32_t source, target;
+
+    if (!ParseNumber(argv[1], 0xffff, &source) || !ParseNumber(argv[2], 0xffff, &target)) {
+        return EXIT_USAGE;
+    }
+
+    const TVSPResult result = Execute([this, source, target]() {
+        return LinkPorts((uint16_t) source, (uint16_t) target);
+    });
+    if (result.result) {
+        return PrintError("link", result);
+    }
+    PrintTopology("link", result);
+    return EXIT_SUCCESS;
+}
+
+// -------------------------------------------------------------------
+//
+//
+int VSPCtl::CmdUnlink(int, char** argv)
+{
+    uint32_t source, target;
+
+    if (!ParseNumber(argv[1], 0xffff, &source) || !ParseNumber(argv[2], 0xffff, &target)) {
+        return EXIT_USAGE;
+    }
+
+    const TVSPResult result = Execute([this, source, target]() {
+        return UnlinkPorts((uint16_t) source, (uint16_t) target);
+    });
+    if (result.result) {
+        return PrintError("unlink", result);
+    }
+    PrintTopology("unlink", result);
+    return EXIT_SUCCESS;
+}
+
+// -------------------------------------------------------------------
+//
+//
+int VSPCtl::CmdChecks(int, char** argv)
+{
+    uint32_t id;
+
+    if (!ParseNumber(argv[1], 0xffff, &id)) {
+        return EXIT_USAGE;
+    }
+
+    const TVSPResult result = Execute([this, id]() {
+        return EnableChecks((uint16_t) id);
+    });
+    if (result.result) {
+        return PrintError("checks", result);
+    }
+    if (!m_quiet) {
+        printf(m_options.json ? "{\"command\":\"checks\",\"result\":0,\"port\":%u}\n" : "checks: port %u\n", id);
+    }
+    return EXIT_SUCCESS;
+}
+
+// -------------------------------------------------------------------
+//
+//
+int VSPCtl::CmdTrace(int, char** argv)
+{
+    uint32_t id;
+
+    if (!ParseNumber(argv[1], 0xffff, &id)) {
+        return EXIT_USAGE;
+    }
+
+    const TVSPResult result = Execute([this, id]() {
+        return EnableTrace((uint16_t) id);
+    });
+    if (result.result) {
+        return PrintError("trace", result);
+    }
+    if (!m_quiet) {
+        printf(m_options.json ? "{\"command\":\"trace\",\"result\":0,\"port\":%u}\n" : "trace: port %u\n", id);
+    }
+    return EXIT_SUCCESS;
+}
+
+// -------------------------------------------------------------------
+// Matched driver instances with their counters of this process
+//
+int VSPCtl::CmdInstances(int, char**)
+{
+    TVSPInstanceInfo infos[MAX_INSTANCES];
+    const uint8_t count = GetInstances(infos, MAX_INSTANCES);
+
+    if (m_quiet) {
+        return EXIT_SUCCESS;
+    }
+
+    if (m_options.json) {
+        printf("{\"command\":\"instances\",\"result\":0,\"instances\":[");
+        for (uint8_t i = 0; i < count; i++) {
+            printf("%s{\"index\":%u,\"name\":", (i ? "," : ""), infos[i].index);
+            PrintJsonString(infos[i].name);
+            printf(",\"path\":");
+            PrintJsonString(infos[i].path);
+            printf(",\"ports\":%u,\"links\":%u,\"submitted\":%llu,\"completed\":%llu,\"errors\":%llu}",
+                   infos[i].ports,
+                   infos[i].links,
+                   (unsigned long long) infos[i].submitted,
+                   (unsigned long long) infos[i].completed,
+                   (unsigned long long) infos[i].errors);
+        }
+        printf("]}\n");
+        return EXIT_SUCCESS;
+    }
+
+    printf("instances: %u\n", count);
+    for (uint8_t i = 0; i < count; i++) {
+        printf("  [%u] %s %s\n", infos[i].index, infos[i].name, infos[i].path);
+    }
+    return EXIT_SUCCESS;
+}
+
+// -------------------------------------------------------------------
+// One command per line, '#' starts a comment. All lines are checked
+// before the first one changes the topology. Kept for the further
+// runs of 'repeat', stdin is read once.
+//
+int VSPCtl::LoadScript(const char* path)
+{
+    FILE* file = (strcmp(path, "-") == 0 ? stdin : fopen(path, "r"));
+    char buffer[512];
+    uint32_t number = 0;
+
+    if (!file) {
+        fprintf(stderr, "vspctl: Unable to open '%s': %s\n", path, strerror(errno));
+        return EXIT_USAGE;
+    }
+
+    while (fgets(buffer, sizeof(buffer), file)) {
+        TCtlLine line;
+        char* comment = strchr(buffer, '#');
+        char* save = nullptr;
+
+        line.number = ++number;
+        if (comment) {
+            *comment = 0;
+        }
+        for (char* word = strtok_r(buffer, " \t\r\n", &save); word; word = strtok_r(nullptr, " \t\r\n", &save)) {
+            line.words.push_back(word);
+        }
+        if (!line.words.empty()) {
+            m_script.push_back(line);
+        }
+    }
+    if (file != stdin) {
+        fclose(file);
+    }
+
+    for (TCtlLine& line : m_script) {
+        for (std::string& word : line.words) {
+            line.args.push_back(&word[0]);
+        }
+        if (!FindCommand((int) line.args.size(), line.args.data(), true)) {
+            fprintf(stderr, "vspctl: %s line %u\n", path, line.number);
+            m_script.clear();
+            return EXIT_USAGE;
+        }
+    }
+
+    m_scriptLoaded = true;
+    return EXIT_SUCCESS;
+}
+
+// -------------------------------------------------------------------
+// A failed line does not stop the script, the exit code tells
+// about it.
+//
+int VSPCtl::CmdScript(int, char** argv)
+{
+    int ret = EXIT_SUCCESS;
+
+    if (!m_scriptLoaded && (ret = LoadScript(argv[1])) != EXIT_SUCCESS) {
+        return ret;
+    }
+
+    for (TCtlLine& line : m_script) {
+        const int status = Dispatch((int) line.args.size(), line.args.data(), true);
+        if (status == EXIT_USAGE) {
+            fprintf(stderr, "vspctl: %s line %u\n", argv[1], line.number);
+            return EXIT_USAGE;
+        }
+        if (status != EXIT_SUCCESS) {
+            ret = status;
+        }
+    }
+    return ret;
+}
+
+// -------------------------------------------------------------------
+// Kept for the further runs of 'repeat' like the script
+//
+int VSPCtl::LoadSpec(const char* path)
+{
+    FILE* file = (strcmp(path, "-") == 0 ? stdin : fopen(path, "r"));
+    std::string text;
+    char buffer[512];
+    size_t size;
+
+    if (!file) {
+        fprintf(stderr, "vspctl: Unable to open '%s': %s\n", path, strerror(errno));
+        return EXIT_USAGE;
+    }
+    while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        text.append(buffer, size);
+    }
+    if (file != stdin) {
+        fclose(file);
+    }
+
+    if (!ParseSpec(text.c_str(), &m_spec)) {
+        fprintf(stderr, "vspctl: Invalid topology spec '%s'.\n", path);
+        m_spec = TCtlSpec();
+        return EXIT_USAGE;
+    }
+
+    m_specLoaded = true;
+    return EXIT_SUCCESS;
+}
+
+// -------------------------------------------------------------------
+// Only the difference of the present topology and the spec is sent
+// to the driver, a second apply of the same spec reads the lists and
+// changes nothing.
+//
+int VSPCtl::CmdApply(int, char** argv)
+{
+    std::promise<TVSPReconcileResult> promise;
+    std::future<TVSPReconcileResult> future = promise.get_future();
+    int ret;
+
+    if (!m_specLoaded && (ret = LoadSpec(argv[1])) != EXIT_SUCCESS) {
+        return ret;
+    }
+
+    auto submit = [this, &promise]() {
+        return Reconcile(m_spec.spec, m_options.timeout, [&promise](const TVSPReconcileResult& result) {
+            promise.set_value(result);
+        });
+    };
+    if (!(m_options.instance ? Route(m_options.instance, submit) : submit())) {
+        TVSPResult result = {};
+        result.result = (m_options.instance ? kIOErrorNotFound : kIOErrorBadArgument);
+        return PrintError("apply", result);
+    }
+
+    while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        WaitPending();
+        DispatchCompletions();
+    }
+
+    const TVSPReconcileResult r = future.get();
+    if (r.result) {
+        TVSPResult result = {};
+        result.result = r.result;
+        result.instance = r.instance;
+        ret = PrintError("apply", result);
+    }
+    if (m_quiet || r.result) {
+        return (r.result ? ret : EXIT_SUCCESS);
+    }
+
+    if (m_options.json) {
+        printf("{\"command\":\"apply\",\"result\":0,\"instance\":%u,\"kept\":{\"ports\":%u,\"links\":%u}", //
+               r.instance, r.keptPorts, r.keptLinks);
+        printf(",\"removed\":%u,\"created\":%u,\"unlinked\":%u,\"linked\":%u,\"failed\":%u", //
+               r.removed, r.created, r.unlinked, r.linked, r.failed);
+        printf(",\"roundTrips\":%u,\"naiveRoundTrips\":%u,\"ports\":[", r.roundTrips, r.naiveRoundTrips);
+        for (size_t i = 0; i < r.ports.size(); i++) {
+            printf("%s{\"name\":", (i ? "," : ""));
+            PrintJsonString(m_spec.names[i].c_str());
+            printf(",\"id\":%u}", r.ports[i]);
+        }
+        printf("]}\n");
+        return EXIT_SUCCESS;
+    }
+
+    printf("apply: instance %u, kept %u ports %u links, removed %u, created %u, unlinked %u, linked %u\n", //
+           r.instance, r.keptPorts, r.keptLinks, r.removed, r.created, r.unlinked, r.linked);
+    printf("  %u round trips, %u one by one\n", r.roundTrips, r.naiveRoundTrips);
+    for (size_t i = 0; i < r.ports.size(); i++) {
+        printf("  port %-5u %s\n", r.ports[i], m_spec.names[i].c_str());
+    }
+    return EXIT_SUCCESS;
+}
+
+// -------------------------------------------------------------------
+//
+//
+int VSPCtl::CmdBench(int argc, char** argv)
+{
+    if (strcmp(argv[1], "wire") == 0) {
+        return BenchWire(argc, argv);
+    }
+    if (strcmp(argv[1], "ring") == 0) {
+        return BenchRing(argc, argv);
+    }
+    if (strcmp(argv[1], "stress") == 0) {
+        return BenchStress(argc, argv);
+    }
+    if (strcmp(argv[1], "pty") == 0) {
+        return BenchPty(argc, argv);
+    }
+    if (strcmp(argv[1], "splice") == 0) {
+        return BenchSplice(argc, argv);
+    }
+    if (strcmp(argv[1], "pace") == 0) {
+        return BenchPace(argc, argv);
+    }
+    if (strcmp(argv[1], "shards") == 0) {
+        return BenchShards(argc, argv);
+    }
+
+    fprintf(stderr, "vspctl: Unknown bench '%s'.\n", argv[1]);
+    return EXIT_USAGE;
+}
+
+// -------------------------------------------------------------------
+// MARK: Benchmarks
+// -------------------------------------------------------------------
+
+// -------------------------------------------------------------------
+// Encode and decode of the compact wire format compared to the copy
+// of the fixed TVSPControllerData blob, for a PingPong request and a
+// GetStatus response with a full page of ports and links.
+//
+int VSPCtl::BenchWire(int argc, char** argv)
+{
+    uint32_t count = 1000000;
+    TVSPControllerData messages[2] = {};
+    TVSPControllerData decoded;
+    uint8_t buffer[VSP_WIRE_MAX_SIZE];
+    const char* names[2] = {"PingPong", "GetStatus"};
+    volatile size_t sink = 0;
+
+    if (argc > 2 && !ParseNumber(argv[2], 0xffffffff, &count)) {
+        return EXIT_USAGE;
+    }
+    if (!count) {
+        count = 1;
+    }
+
+    messages[0].context = vspContextPing;
+    messages[0].command = vspControlPingPong;
+    messages[0].status.flags = MAGIC_CONTROL | 1;
+    messages[0].request = 1;
+
+    messages[1].context = vspContextResult;
+    messages[1].command = vspControlGetStatus;
+    messages[1].status.flags = MAGIC_CONTROL | 2;
+    messages[1].request = 2;
+    messages[1].generation = 2 * MAX_SERIAL_PORTS;
+    messages[1].ports.count = MAX_SERIAL_PORTS;
+    messages[1].ports.total = MAX_SERIAL_PORTS;
+    for (uint8_t i = 0; i < MAX_SERIAL_PORTS; i++) {
+        messages[1].ports.list[i].id = i + 1;
+        snprintf(messages[1].ports.list[i].name, MAX_PORT_NAME, "tty.serial-vsp%u", i + 1);
+    }
+    messages[1].links.count = MAX_SERIAL_PORTS / 2;
+    messages[1].links.total = MAX_SERIAL_PORTS / 2;
+    for (uint8_t i = 0; i < MAX_SERIAL_PORTS / 2; i++) {
+        messages[1].links.list[i] = VSP_LINK_ITEM(i + 1, 2 * i + 1, 2 * i + 2);
+    }
+
+    if (m_options.json) {
+        printf("{\"bench\":\"wire\",\"count\":%u,\"messages\":[", count);
+    }
+    else {
+        printf("wire x %u: %zu bytes as TVSPControllerData\n", count, sizeof(TVSPControllerData));
+        printf("%-10s %6s %10s %10s %10s\n", "message", "bytes", "encode ns", "decode ns", "copy ns");
+    }
+
+    for (int m = 0; m < 2; m++) {
+        const size_t size = VSPWireEncode(&messages[m], buffer, sizeof(buffer));
+
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < count; i++) {
+            sink = sink + VSPWireEncode(&messages[m], buffer, sizeof(buffer));
+        }
+        const double encodeNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+
+        start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < count; i++) {
+            sink = sink + VSPWireDecode(buffer, size, &decoded);
+        }
+        const double decodeNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+
+        start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < count; i++) {
+            memcpy(&decoded, &messages[m], sizeof(decoded));
+            sink = sink + decoded.ports.count;
+            // keep the copy
+            __asm__ volatile("" : : "r"(&decoded) : "memory");
+        }
+        const double copyNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+
+        if (m_options.json) {
+            printf("%s{\"message\":\"%s\",\"bytes\":%zu,\"blobBytes\":%zu,\"encodeNs\":%.1f,\"decodeNs\":%.1f,\"copyNs\":%.1f}", //
+                   (m ? "," : ""), names[m], size, sizeof(TVSPControllerData), encodeNs, decodeNs, copyNs);
+        }
+        else {
+            printf("%-10s %6zu %10.1f %10.1f %10.1f\n", names[m], size, encodeNs, decodeNs, copyNs);
+        }
+    }
+
+    if (m_options.json) {
+        printf("]}\n");
+    }
+    return EXIT_SUCCESS;
+}
+
+// -------------------------------------------------------------------
+// A producer thread passes 'total' bytes in writes of 'size' to the
+// consumer, which takes what there is up to BENCH_CHUNK_SIZE at a
+// time and checks the byte pattern. 'write' takes a whole write or
+// nothing, 'last' marks the final one. Returns the seconds taken, a
+// negative value if the bytes were corrupted.
+//
+template<typename W, typename R>
+static double TransferBytes(const uint64_t total, const size_t size, W write, R read)
+{
+    static uint8_t pattern[BENCH_CHUNK_SIZE + 256];
+    uint8_t chunk[BENCH_CHUNK_SIZE];
+    uint64_t received = 0;
+    bool intact = true;
+
+    for (size_t i = 0; i < sizeof(pattern); i++) {
+        pattern[i] = (uint8_t) i;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    std::thread producer([&]() {
+        for (uint64_t sent = 0; sent < total;) {
+            const size_t length = (size_t) std::min<uint64_t>(size, total - sent);
+            if (!write(pattern + (sent & 0xff), length, sent + length == total)) {
+                std::this_thread::yield();
+                continue;
+            }
+            sent += length;
+        }
+    });
+
+    while (received < total) {
+        const size_t length = read(chunk, sizeof(chunk));
+        if (!length) {
+            std::this_thread::yield();
+            continue;
+        }
+        intact = intact && memcmp(chunk, pattern + (received & 0xff), length) == 0;
+        received += length;
+    }
+    producer.join();
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return (intact ? seconds : -1);
+}
+
+// -------------------------------------------------------------------
+// The lock free byte ring a pty port forwards through compared to a
+// deque under a mutex, both BENCH_RING_CAPACITY bytes, between two
+// threads at writes of 1, 64 and 4096 bytes. The ring publishes each
+// write, then BENCH_RING_BATCH bytes at once. The consumer releases
+// the room of each read.
+//
+int VSPCtl::BenchRing(int argc, char** argv)
+{
+    const size_t sizes[] = {1, 64, BENCH_CHUNK_SIZE};
+    const char* names[] = {"deque", "ring", "batched"};
+    uint32_t megabytes = 16;
+
+    if (argc > 2 && !ParseNumber(argv[2], 65536, &megabytes)) {
+        return EXIT_USAGE;
+    }
+    megabytes = (megabytes ? megabytes : 1);
+    const uint64_t total = (uint64_t) megabytes << 20;
+
+    if (m_options.json) {
+        printf("{\"bench\":\"ring\",\"megabytes\":%u,\"capacity\":%u,\"batch\":%u,\"runs\":[", megabytes, BENCH_RING_CAPACITY, BENCH_RING_BATCH);
+    }
+    else {
+        printf("ring %u MB per write size, %u bytes buffered, %u bytes a batch, MB/s and ns per write\n", megabytes, BENCH_RING_CAPACITY, BENCH_RING_BATCH);
+        printf("%-6s", "write");
+        for (const char* name : names) {
+            printf(" %9s %7s", name, "ns");
+        }
+        printf("\n");
+    }
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        const size_t size = sizes[s];
+        double seconds[3];
+
+        {
+            std::mutex lock;
+            std::deque<uint8_t> queue;
+
+            seconds[0] = TransferBytes(
+                total, size,
+                [&](const uint8_t* data, const size_t length, bool) {
+                    std::lock_guard<std::mutex> guard(lock);
+                    if (queue.size() + length > BENCH_RING_CAPACITY) {
+                        return false;
+                    }
+                    queue.insert(queue.end(), data, data + length);
+                    return true;
+                },
+                [&](uint8_t* data, const size_t length) {
+                    std::lock_guard<std::mutex> guard(lock);
+                    const size_t n = std::min(length, queue.size());
+                    std::copy(queue.begin(), queue.begin() + (ptrdiff_t) n, data);
+                    queue.erase(queue.begin(), queue.begin() + (ptrdiff_t) n);
+                    return n;
+                });
+        }
+
+        for (int batched = 0; batched < 2; batched++) {
+            VSPByteRing ring(BENCH_RING_CAPACITY);
+            const size_t batch = (batched ? BENCH_RING_BATCH : 1);
+            size_t unpublished = 0;
+
+            seconds[1 + batched] = TransferBytes(
+                total, size,
+                [&](const uint8_t* data, const size_t length, const bool last) {
+                    // a full ring hands over what it has, the consumer
+                    // would wait for it otherwise
+                    if (ring.Room(length) < length) {
+                        ring.Publish();
+                        unpublished = 0;
+                        return false;
+                    }
+                    ring.Write(data, length);
+                    if ((unpublished += length) >= batch || last) {
+                        ring.Publish();
+                        unpublished = 0;
+                    }
+                    return true;
+                },
+                [&](uint8_t* data, const size_t length) {
+                    const size_t n = ring.Read(data, length);
+                    if (n) {
+                        ring.Release();
+                    }
+                    return n;
+                });
+        }
+
+        for (int i = 0; i < 3; i++) {
+            if (seconds[i] < 0) {
+                fprintf(stderr, "vspctl: Bytes of the %s corrupted.\n", names[i]);
+                return EXIT_FAILURE;
+            }
+        }
+
+        const double writes = (double) ((total + size - 1) / size);
+        if (m_options.json) {
+            printf("%s{\"size\":%zu", (s ? "," : ""), size);
+            for (int i = 0; i < 3; i++) {
+                printf(",\"%s\":{\"rate\":%.1f,\"nsPerWrite\":%.1f}", names[i], (double) total / seconds[i] / (1 << 20), seconds[i] * 1e9 / writes);
+            }
+            printf("}");
+        }
+        else {
+            printf("%-6zu", size);
+            for (int i = 0; i < 3; i++) {
+                printf(" %9.1f %7.1f", (double) total / seconds[i] / (1 << 20), seconds[i] * 1e9 / writes);
+            }
+            printf("\n");
+        }
+    }
+
+    if (m_options.json) {
+        printf("]}\n");
+    }
+    return EXIT_SUCCESS;
+}
+
+// -------------------------------------------------------------------
+// Threads issue LinkPorts, UnlinkPorts and GetStatus on their own
+// pair of ports as fast as the controller takes them, each with its
+// share of BENCH_STRESS_WINDOW in flight. A refused request is sent
+// again. The run fails on a failed, lost, duplicate or stray result,
+// and if refusals outnumber the completions. The pairs are removed
+// afterwards.
+//
+int VSPCtl::BenchStress(int argc, char** argv)
+{
+    TVSPPortParameters parameters = {9600, 8, 1, 0, 0};
+    std::vector<uint16_t> ports;
+    std::vector<std::thread> workers;
+    std::atomic<uint64_t> submitted(0);
+    std::atomic<uint64_t> completed(0);
+    std::atomic<uint64_t> failed(0);
+    std::atomic<uint64_t> duplicates(0);
+    std::atomic<uint64_t> refused(0);
+    std::atomic<uint32_t> running(0);
+    uint32_t threads = 4;
+    uint32_t count = 10000;
+
+    if (argc > 2 && !ParseNumber(argv[2], 256, &threads)) {
+        return EXIT_USAGE;
+    }
+    if (argc > 3 && !ParseNumber(argv[3], 0xffffffff, &count)) {
+        return EXIT_USAGE;
+    }
+    if (!threads) {
+        threads = 1;
+    }
+    const uint32_t window = std::max<uint32_t>(1, BENCH_STRESS_WINDOW / threads);
+
+    // refused requests report an error each
+    m_quiet = true;
+
+    for (uint32_t i = 0; i < 2 * threads; i++) {
+        const TVSPResult result = Execute([this, &parameters]() {
+            return CreatePort(&parameters);
+        });
+        if (result.result) {
+            m_quiet = m_options.bench;
+            PrintError("create", result);
+            for (const uint16_t id : ports) {
+                Execute([this, id]() {
+                    return RemovePort(id);
+                });
+            }
+            return EXIT_FAILURE;
+        }
+        ports.push_back(result.data.parameter.link.source);
+    }
+
+    const TVSPStatistics before = GetStatistics();
+    const uint64_t strayBefore = m_stray.load();
+    const auto start = std::chrono::steady_clock::now();
+
+    running = threads;
+    for (uint32_t k = 0; k < threads; k++) {
+        const uint16_t a = ports[2 * k];
+        const uint16_t b = ports[2 * k + 1];
+        workers.emplace_back([this, a, b, count, window, &submitted, &completed, &failed, &duplicates, &refused, &running]() {
+            std::atomic<uint32_t> inflight(0);
+            for (uint32_t i = 0; i < count; i++) {
+                // each completion runs once, a second one is a race
+                std::shared_ptr<std::atomic<bool>> once = std::make_shared<std::atomic<bool>>(false);
+                const TVSPCompletion done = [once, &completed, &failed, &duplicates, &inflight](const TVSPResult& result) {
+                    if (once->exchange(true)) {
+                        duplicates++;
+                        return;
+                    }
+                    if (result.result) {
+                        failed++;
+                    }
+                    completed++;
+                    inflight--;
+                };
+
+                while (inflight.load() >= window) {
+                    std::this_thread::yield();
+                }
+                inflight++;
+
+                for (;;) {
+                    bool ok;
+                    switch (i % 3) {
+                        case 0: {
+                            ok = Call([this, a, b]() { return LinkPorts(a, b); }, 0, done);
+                            break;
+                        }
+                        case 1: {
+                            ok = Call([this, a, b]() { return UnlinkPorts(a, b); }, 0, done);
+                            break;
+                        }
+                        default: {
+                            ok = Call([this]() { return GetStatus(); }, 0, done);
+                            break;
+                        }
+                    }
+                    if (ok) {
+                        submitted++;
+                        break;
+                    }
+                    refused++;
+                    std::this_thread::yield();
+                }
+            }
+
+            // the completions refer to inflight
+            while (inflight.load()) {
+                std::this_thread::yield();
+            }
+            running--;
+        });
+    }
+
+    // completions are dispatched here while the workers submit
+    while (running || completed < submitted) {
+        WaitPending();
+        DispatchCompletions();
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    TVSPStatistics stats = GetStatistics();
+
+    // report the stress requests only
+    for (uint8_t i = 0; i < vspLastCommand; i++) {
+        TVSPCommandStats* s = &stats.commands[i];
+        const TVSPCommandStats* b = &before.commands[i];
+        s->completed -= b->completed;
+        s->errors -= b->errors;
+        s->rejected -= b->rejected;
+        s->timeouts -= b->timeouts;
+        s->late -= b->late;
+        s->sumUs -= b->sumUs;
+        for (uint32_t j = 0; j < VSP_LATENCY_BUCKETS; j++) {
+            s->buckets[j] -= b->buckets[j];
+        }
+    }
+    const uint64_t stray = m_stray.load() - strayBefore;
+
+    for (const uint16_t id : ports) {
+        Execute([this, id]() {
+            return RemovePort(id);
+        });
+    }
+    m_quiet = m_options.bench;
+
+    const uint64_t total = (uint64_t) threads * count;
+    const bool ok = (completed == total && !failed && !duplicates && !stray && refused <= completed);
+    if (m_options.json) {
+        printf("{\"bench\":\"stress\",\"threads\":%u,\"count\":%u,\"completed\":%llu,\"failed\":%llu,\"duplicates\":%llu,\"stray\":%llu,\"refused\":%llu,\"seconds\":%.6f,\"rate\":%.1f,\"ok\":%s,", //
+               threads, count, (unsigned long long) completed.load(), (unsigned long long) failed.load(), (unsigned long long) duplicates.load(),
+               (unsigned long long) stray, (unsigned long long) refused.load(), seconds, completed / seconds, (ok ? "true" : "false"));
+        PrintLatency(stats, true);
+        printf("}\n");
+    }
+    else {
+        printf("stress %u x %u: %llu completed, %llu failed, %llu duplicate, %llu stray, %llu refused in %.3f s, %.0f req/s\n", //
+               threads, count, (unsigned long long) completed.load(), (unsigned long long) failed.load(), (unsigned long long) duplicates.load(),
+               (unsigned long long) stray, (unsigned long long) refused.load(), seconds, completed / seconds);
+        PrintLatency(stats, false);
+    }
+    return (ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+// -------------------------------------------------------------------
+// Data path of the ports, see RunPtyBench()
+//
+int VSPCtl::BenchPty(int argc, char** argv)
+{
+    TCtlPtyRun run = {};
+    uint32_t links = 1;
+    uint32_t megabytes = 64;
+    int ret;
+
+    if (argc > 2 && !ParseNumber(argv[2], 64, &links)) {
+        return EXIT_USAGE;
+    }
+    if (argc > 3 && !ParseNumber(argv[3], 65536, &megabytes)) {
+        return EXIT_USAGE;
+    }
+
+#if defined(__linux__)
+    // the ports of the loopback driver need a data path
+    if (!m_options.socket) {
+        setenv("VSP_LOOPBACK_PTY", "1", 0);
+    }
+#endif
+
+    if ((ret = RunPtyBench((links ? links : 1), (megabytes ? megabytes : 1), &run)) != EXIT_SUCCESS) {
+        return ret;
+    }
+
+    if (m_options.json) {
+        printf("{\"bench\":\"pty\",\"links\":%u,\"megabytes\":%u,", run.links, run.megabytes);
+        PrintPtyRun(run, true);
+        printf("}\n");
+    }
+    else {
+        printf("pty %u x %u MB: %.1f MB/s in %.3f s, %.2f ns/byte, %.2f cpu s/GB\n", //
+               run.links, run.megabytes, run.rate, run.seconds, run.nsPerByte, run.cpuPerGB);
+        PrintPtyRun(run, false);
+    }
+    return EXIT_SUCCESS;
+}
+
+// -------------------------------------------------------------------
+// The same pty bench with copy and with splice forwarding of the
+// loopback driver, which reads the mode at port creation.
+//
+int VSPCtl::BenchSplice(int argc, char** argv)
+{
+    const char* modes[2] = {"copy", "splice"};
+    TCtlPtyRun runs[2] = {};
+    uint32_t links = 1;
+    uint32_t megabytes = 64;
+    int ret;
+
+    if (argc > 2 && !ParseNumber(argv[2], 64, &links)) {
+        return EXIT_USAGE;
+    }
+    if (argc > 3 && !ParseNumber(argv[3], 65536, &megabytes)) {
+        return EXIT_USAGE;
+    }
+
+#if defined(__linux__)
+    if (m_options.socket) {
+        fprintf(stderr, "vspctl: The forwarding of the daemon is set by its VSP_LOOPBACK_PTY.\n");
+        return EXIT_USAGE;
+    }
+#else
+    fprintf(stderr, "vspctl: Splice forwarding needs the Linux loopback driver.\n");
+    return EXIT_USAGE;
+#endif
+
+    for (int i = 0; i < 2; i++) {
+        setenv("VSP_LOOPBACK_PTY", modes[i], 1);
+        if ((ret = RunPtyBench((links ? links : 1), (megabytes ? megabytes : 1), &runs[i])) != EXIT_SUCCESS) {
+            return ret;
+        }
+    }
+
+    if (m_options.json) {
+        printf("{\"bench\":\"splice\",\"links\":%u,\"megabytes\":%u,\"modes\":[", runs[0].links, runs[0].megabytes);
+        for (int i = 0; i < 2; i++) {
+            printf("%s{\"mode\":\"%s\",", (i ? "," : ""), modes[i]);
+            PrintPtyRun(runs[i], true);
+            putchar('}');
+        }
+        printf("]}\n");
+    }
+    else {
+        printf("splice %u x %u MB\n", runs[0].links, runs[0].megabytes);
+        printf("%-10s %8s %8s %9s %8s %8s\n", "mode", "MB/s", "ns/byte", "cpu s/GB", "link us", "echo us");
+        for (int i = 0; i < 2; i++) {
+            printf("%-10s %8.1f %8.2f %9.2f %8.1f %8.1f\n", //
+                   modes[i], runs[i].rate, runs[i].nsPerByte, runs[i].cpuPerGB, runs[i].latency[0].avgUs, runs[i].latency[1].avgUs);
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+// -------------------------------------------------------------------
+// 'links' pairs of paced ports at 'baud' 8N1 transmit as fast as
+// they can for BENCH_PACE_SECONDS, one thread serves all of them.
+// Reports the character rate each link achieved against the rate of
+// the wire, how far a link got ahead of the wire and the CPU of the
+// process without the bench thread: the engine of the loopback driver.
+//
+int VSPCtl::BenchPace(int argc, char** argv)
+{
+    uint32_t links = 100;
+    uint32_t baud = 115200;
+
+    if (argc > 2 && !ParseNumber(argv[2], 500, &links)) {
+        return EXIT_USAGE;
+    }
+    if (argc > 3 && !ParseNumber(argv[3], 4000000, &baud)) {
+        return EXIT_USAGE;
+    }
+    links = (links ? links : 1);
+    baud = (baud ? baud : 115200);
+
+#if defined(__linux__)
+    std::vector<uint16_t> ids;
+    std::vector<int> fds;
+    struct epoll_event events[BENCH_PACE_EVENTS];
+    struct rusage before, after, self[2];
+    uint8_t chunk[BENCH_PACE_CHUNK];
+    int ret;
+
+    if (m_options.socket) {
+        fprintf(stderr, "vspctl: The pacing of the daemon is set by its VSP_LOOPBACK_PACING.\n");
+        return EXIT_USAGE;
+    }
+    setenv("VSP_LOOPBACK_PTY", "1", 0);
+    setenv("VSP_LOOPBACK_PACING", "1", 1);
+
+    const int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0) {
+        fprintf(stderr, "vspctl: Unable to create epoll: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    if ((ret = OpenBenchLinks(links, baud, &ids, &fds)) != EXIT_SUCCESS) {
+        close(epollFd);
+        return ret;
+    }
+    for (size_t i = 0; i < fds.size(); i++) {
+        // the index of the port, even ones transmit, odd ones receive
+        struct epoll_event ev = {};
+        ev.events = (i % 2 ? EPOLLIN : EPOLLOUT);
+        ev.data.u32 = (uint32_t) i;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fds[i], &ev) < 0) {
+            fprintf(stderr, "vspctl: Unable to watch port %u: %s\n", ids[i], strerror(errno));
+            CloseBenchLinks(ids, fds);
+            close(epollFd);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // 8N1 is 10 bits per character, the byte pattern shows lost bytes
+    const double charSec = 10.0 / baud;
+    std::vector<uint64_t> sent(links, 0);
+    std::vector<uint64_t> received(links, 0);
+    std::vector<double> first(links, 0);
+    std::vector<double> last(links, 0);
+    double ahead = 0;
+    bool failed = false;
+
+    for (size_t i = 0; i < sizeof(chunk); i++) {
+        chunk[i] = (uint8_t) i;
+    }
+
+    getrusage(RUSAGE_SELF, &before);
+    getrusage(RUSAGE_THREAD, &self[0]);
+    const auto start = std::chrono::steady_clock::now();
+    double now = 0;
+    while (!failed && now < BENCH_PACE_SECONDS) {
+        const int count = epoll_wait(epollFd, events, BENCH_PACE_EVENTS, BENCH_PACE_POLL);
+        if (count < 0 && errno != EINTR) {
+            failed = true;
+            break;
+        }
+        now = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        for (int e = 0; e < count && !failed; e++) {
+            const uint32_t k = events[e].data.u32 / 2;
+            if (!(events[e].data.u32 % 2)) {
+                const size_t offset = sent[k] % sizeof(chunk);
+                const ssize_t size = write(fds[2 * k], chunk + offset, sizeof(chunk) - offset);
+                if (size > 0) {
+                    sent[k] += (uint64_t) size;
+                }
+                continue;
+            }
+
+            uint8_t data[BENCH_PACE_CHUNK];
+            const ssize_t size = read(fds[2 * k + 1], data, sizeof(data));
+            if (size <= 0) {
+                failed = (size == 0 || errno != EAGAIN);
+                continue;
+            }
+            for (ssize_t i = 0; i < size; i++) {
+                if (data[i] != (uint8_t) (received[k] + i)) {
+                    failed = true;
+                }
+            }
+            if (!received[k]) {
+                first[k] = now;
+            }
+            received[k] += (uint64_t) size;
+            last[k] = now;
+
+            // characters beyond the ones the wire carried since the first
+            const double excess = received[k] - 1 - (now - first[k]) / charSec;
+            ahead = (excess > ahead ? excess : ahead);
+        }
+    }
+    getrusage(RUSAGE_THREAD, &self[1]);
+    getrusage(RUSAGE_SELF, &after);
+
+    close(epollFd);
+    CloseBenchLinks(ids, fds);
+
+    double minRate = 0;
+    double maxRate = 0;
+    double sumRate = 0;
+    for (uint32_t k = 0; k < links && !failed; k++) {
+        if (received[k] < 2 || last[k] <= first[k]) {
+            failed = true;
+            break;
+        }
+        const double rate = (received[k] - 1) / (last[k] - first[k]);
+        minRate = (!k || rate < minRate ? rate : minRate);
+        maxRate = (rate > maxRate ? rate : maxRate);
+        sumRate += rate;
+    }
+    if (failed) {
+        fprintf(stderr, "vspctl: Port data lost or corrupted.\n");
+        return EXIT_FAILURE;
+    }
+
+    auto cpu = [](const struct rusage& u) {
+        return u.ru_utime.tv_sec + u.ru_stime.tv_sec + (u.ru_utime.tv_usec + u.ru_stime.tv_usec) / 1e6;
+    };
+    const double expected = 1.0 / charSec;
+    const double avgRate = sumRate / links;
+    const double engine = ((cpu(after) - cpu(before)) - (cpu(self[1]) - cpu(self[0]))) / now * 100;
+
+    if (m_options.json) {
+        printf("{\"bench\":\"pace\",\"links\":%u,\"baud\":%u,\"seconds\":%.6f,\"expected\":%.1f,\"rate\":%.1f,"
+               "\"minRate\":%.1f,\"maxRate\":%.1f,\"ahead\":%.2f,\"cpu\":%.2f}\n", //
+               links, baud, now, expected, avgRate, minRate, maxRate, ahead, engine);
+    }
+    else {
+        printf("pace %u x %u baud: %.1f chars/s expected, %.1f avg (%.2f%%), %.2f%% min, %.2f%% max\n", //
+               links, baud, expected, avgRate, avgRate / expected * 100, minRate / expected * 100, maxRate / expected * 100);
+        printf("ahead of the wire %.2f chars at most, engine %.1f%% of a core\n", ahead, engine);
+    }
+    return EXIT_SUCCESS;
+#else
+    fprintf(stderr, "vspctl: Pacing needs the Linux loopback driver.\n");
+    return EXIT_USAGE;
+#endif
+}
+
+// -------------------------------------------------------------------
+// Forwarding of the loopback driver across 1, 2, 4.. up to 'shards'
+// reactor threads, one per CPU by default. For each shard count the
+// links swept from 1 up to 'links' in powers of two carry 'megabytes'
+// together. The engine takes a new shard count once none of its
+// ports is open, so the driver should have no other ports.
+//
+int VSPCtl::BenchShards(int argc, char** argv)
+{
+    uint32_t links = 256;
+    uint32_t megabytes = 64;
+    uint32_t shards = std::max(1u, std::thread::hardware_concurrency());
+
+    if (argc > 2 && !ParseNumber(argv[2], BENCH_SHARD_LINKS, &links)) {
+        return EXIT_USAGE;
+    }
+    if (argc > 3 && !ParseNumber(argv[3], 65536, &megabytes)) {
+        return EXIT_USAGE;
+    }
+    if (argc > 4 && !ParseNumber(argv[4], 256, &shards)) {
+        return EXIT_USAGE;
+    }
+    links = (links ? links : 1);
+    megabytes = (megabytes ? megabytes : 1);
+    shards = (shards ? shards : 1);
+
+#if defined(__linux__)
+    std::vector<uint32_t> counts[2];
+    std::vector<double> rates;
+    std::vector<double> cpuPerGB;
+
+    if (m_options.socket) {
+        fprintf(stderr, "vspctl: The shards of the daemon are set by its VSP_LOOPBACK_SHARDS.\n");
+        return EXIT_USAGE;
+    }
+    setenv("VSP_LOOPBACK_PTY", "1", 0);
+
+    // powers of two and the limit itself
+    for (int i = 0; i < 2; i++) {
+        const uint32_t limit = (i ? links : shards);
+        for (uint32_t n = 1; n < limit; n *= 2) {
+            counts[i].push_back(n);
+        }
+        counts[i].push_back(limit);
+    }
+
+    auto cpu = [](const struct rusage& u) {
+        return u.ru_utime.tv_sec + u.ru_stime.tv_sec + (u.ru_utime.tv_usec + u.ru_stime.tv_usec) / 1e6;
+    };
+
+    for (const uint32_t shardCount : counts[0]) {
+        std::vector<uint16_t> ids;
+        std::vector<int> fds;
+        int ret;
+
+        setenv("VSP_LOOPBACK_SHARDS", std::to_string(shardCount).c_str(), 1);
+        if ((ret = OpenBenchLinks(links, 115200, &ids, &fds)) != EXIT_SUCCESS) {
+            return ret;
+        }
+
+        for (const uint32_t linkCount : counts[1]) {
+            const uint64_t total = (uint64_t) megabytes << 20;
+            const uint64_t bytes = std::max<uint64_t>(total / linkCount, BENCH_SHARD_BYTES);
+            struct rusage before, after;
+
+            getrusage(RUSAGE_SELF, &before);
+            const auto start = std::chrono::steady_clock::now();
+            if (!ForwardLinks(fds, linkCount, bytes)) {
+                fprintf(stderr, "vspctl: Port data lost or corrupted.\n");
+                CloseBenchLinks(ids, fds);
+                return EXIT_FAILURE;
+            }
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            getrusage(RUSAGE_SELF, &after);
+
+            const double moved = (double) bytes * linkCount;
+            rates.push_back(moved / seconds / (1 << 20));
+            cpuPerGB.push_back((cpu(after) - cpu(before)) / (moved / (1 << 30)));
+        }
+        CloseBenchLinks(ids, fds);
+    }
+
+    const size_t columns = counts[0].size();
+    if (m_options.json) {
+        printf("{\"bench\":\"shards\",\"megabytes\":%u,\"runs\":[", megabytes);
+        for (size_t i = 0; i < rates.size(); i++) {
+            printf("%s{\"shards\":%u,\"links\":%u,\"rate\":%.1f,\"cpuPerGB\":%.3f}", //
+                   (i ? "," : ""), counts[0][i / counts[1].size()], counts[1][i % counts[1].size()], rates[i], cpuPerGB[i]);
+        }
+        printf("]}\n");
+    }
+    else {
+        printf("shards %u MB per step, MB/s by shards\n", megabytes);
+        printf("%-8s", "links");
+        for (const uint32_t shardCount : counts[0]) {
+            printf(" %9u", shardCount);
+        }
+        printf(" %9s\n", "speedup");
+        for (size_t row = 0; row < counts[1].size(); row++) {
+            printf("%-8u", counts[1][row]);
+            for (size_t column = 0; column < columns; column++) {
+                printf(" %9.1f", rates[column * counts[1].size() + row]);
+            }
+            printf(" %8.2fx\n", rates[(columns - 1) * counts[1].size() + row] / rates[row]);
+        }
+    }
+    return EXIT_SUCCESS;
+#else
+    fprintf(stderr, "vspctl: Shards need the Linux loopback driver.\n");
+    return EXIT_USAGE;
+#endif
+}
+
+// -------------------------------------------------------------------
+// 'links' pairs of linked ports carry 'megabytes' each from the first
+// port to the second at once, then single bytes measure the latency
+// of a link and of the echo of an unlinked port. The device of a
+// port is its name, below /dev unless the name is a path. The CPU
+// time is the one of the whole process, the engine of the loopback
+// driver included. The ports are removed afterwards.
+//
+int VSPCtl::RunPtyBench(const uint32_t links, const uint32_t megabytes, TCtlPtyRun* run)
+{
+    std::vector<uint16_t> ids;
+    std::vector<std::string> names;
+    std::vector<int> fds;
+    std::vector<std::thread> workers;
+    std::vector<double> samples[2];
+    std::atomic<uint32_t> failed(0);
+    struct rusage before, after;
+    int ret;
+
+    // linked pairs and one unlinked port for the echo
+    if ((ret = CreateBenchPorts(2 * links + 1, 115200, &ids, &names)) != EXIT_SUCCESS) {
+        return ret;
+    }
+    for (uint32_t k = 0; k < links && ret == EXIT_SUCCESS; k++) {
+        const uint16_t a = ids[2 * k];
+        const uint16_t b = ids[2 * k + 1];
+        const TVSPResult result = Execute([this, a, b]() {
+            return LinkPorts(a, b);
+        });
+        if (result.result) {
+            ret = PrintError("link", result);
+        }
+    }
+    for (size_t i = 0; i < names.size() && ret == EXIT_SUCCESS; i++) {
+        const int fd = OpenDevice(names[i].c_str());
+        if (fd < 0) {
+            fprintf(stderr, "vspctl: Unable to open port %u device '%s': %s\n", ids[i], names[i].c_str(), strerror(errno));
+            ret = EXIT_FAILURE;
+            break;
+        }
+        fds.push_back(fd);
+    }
+    if (ret != EXIT_SUCCESS) {
+        for (const int fd : fds) {
+            close(fd);
+        }
+        RemoveBenchPorts(ids);
+        return ret;
+    }
+
+    // the byte pattern shows lost or reordered bytes
+    const uint64_t total = (uint64_t) megabytes << 20;
+    getrusage(RUSAGE_SELF, &before);
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t k = 0; k < links; k++) {
+        const int tx = fds[2 * k];
+        const int rx = fds[2 * k + 1];
+        workers.emplace_back([tx, total, &failed]() {
+            uint8_t chunk[BENCH_CHUNK_SIZE];
+            for (size_t i = 0; i < sizeof(chunk); i++) {
+                chunk[i] = (uint8_t) i;
+            }
+            for (uint64_t sent = 0; sent < total;) {
+                const ssize_t size = write(tx, chunk + (sent % sizeof(chunk)), sizeof(chunk) - (sent % sizeof(chunk)));
+                if (size < 0) {
+                    failed++;
+                    return;
+                }
+                sent += (uint64_t) size;
+            }
+        });
+        workers.emplace_back([rx, total, &failed]() {
+            uint8_t chunk[BENCH_CHUNK_SIZE];
+            uint64_t received = 0;
+            while (received < total) {
+                struct pollfd pfd = {rx, POLLIN, 0};
+                if (poll(&pfd, 1, BENCH_READ_TIMEOUT) <= 0) {
+                    failed++;
+                    return;
+                }
+                const ssize_t size = read(rx, chunk, sizeof(chunk));
+                if (size <= 0) {
+                    failed++;
+                    return;
+                }
+                for (ssize_t i = 0; i < size; i++) {
+                    if (chunk[i] != (uint8_t) (received + i)) {
+                        failed++;
+                        return;
+                    }
+                }
+                received += (uint64_t) size;
+            }
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    run->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    getrusage(RUSAGE_SELF, &after);
+
+    if (!failed && (!MeasureLatency(fds[0], fds[1], &samples[0]) || !MeasureLatency(fds[2 * links], fds[2 * links], &samples[1]))) {
+        failed++;
+    }
+
+    for (const int fd : fds) {
+        close(fd);
+    }
+    RemoveBenchPorts(ids);
+
+    if (failed) {
+        fprintf(stderr, "vspctl: Port data lost or corrupted.\n");
+        return EXIT_FAILURE;
+    }
+
+    auto cpu = [](const struct rusage& u) {
+        return u.ru_utime.tv_sec + u.ru_stime.tv_sec + (u.ru_utime.tv_usec + u.ru_stime.tv_usec) / 1e6;
+    };
+    const double bytes = (double) total * links;
+    run->links = links;
+    run->megabytes = megabytes;
+    run->rate = bytes / run->seconds / (1 << 20);
+    run->nsPerByte = run->seconds * 1e9 / bytes;
+    run->cpuPerGB = (cpu(after) - cpu(before)) / (bytes / (1 << 30));
+
+    for (int i = 0; i < 2; i++) {
+        std::vector<double>& v = samples[i];
+        double sum = 0;
+        for (const double us : v) {
+            sum += us;
+        }
+        std::sort(v.begin(), v.end());
+        run->latency[i].avgUs = sum / v.size();
+        run->latency[i].p50Us = v[v.size() / 2];
+        run->latency[i].p99Us = v[v.size() * 99 / 100];
+        run->latency[i].maxUs = v.back();
+    }
+    return EXIT_SUCCESS;
+}
+
+// -------------------------------------------------------------------
+// The first 'links' pairs of 'fds' carry 'bytes' each, served by one
+// thread per CPU at most. The byte pattern shows lost or reordered
+// bytes, a link without progress for BENCH_READ_TIMEOUT fails.
+//
+bool VSPCtl::ForwardLinks(const std::vector<int>& fds, const uint32_t links, const uint64_t bytes)
+{
+#if defined(__linux__)
+    const uint32_t threads = std::min(links, std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::thread> workers;
+    std::atomic<uint32_t> failed(0);
+
+    for (uint32_t w = 0; w < threads; w++) {
+        workers.emplace_back([&fds, links, bytes, threads, w, &failed]() {
+            struct epoll_event events[BENCH_PACE_EVENTS];
+            std::vector<uint64_t> sent(links, 0);
+            std::vector<uint64_t> received(links, 0);
+            uint8_t chunk[BENCH_CHUNK_SIZE];
+            uint32_t pending = 0;
+
+            const int epollFd = epoll_create1(EPOLL_CLOEXEC);
+            if (epollFd < 0) {
+                failed++;
+                return;
+            }
+            for (uint32_t k = w; k < links; k += threads) {
+                for (uint32_t i = 2 * k; i < 2 * k + 2; i++) {
+                    struct epoll_event ev = {};
+                    ev.events = (i % 2 ? EPOLLIN : EPOLLOUT);
+                    ev.data.u32 = i;
+                    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fds[i], &ev) < 0) {
+                        failed++;
+                    }
+                }
+                pending++;
+            }
+            for (size_t i = 0; i < sizeof(chunk); i++) {
+                chunk[i] = (uint8_t) i;
+            }
+
+            while (pending && !failed) {
+                const int count = epoll_wait(epollFd, events, BENCH_PACE_EVENTS, BENCH_READ_TIMEOUT);
+                if (count <= 0) {
+                    if (count < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    failed++;
+                    break;
+                }
+                for (int e = 0; e < count; e++) {
+                    const uint32_t i = events[e].data.u32;
+                    const uint32_t k = i / 2;
+                    if (!(i % 2)) {
+                        const size_t offset = sent[k] % sizeof(chunk);
+                        const size_t size = (size_t) std::min<uint64_t>(sizeof(chunk) - offset, bytes - sent[k]);
+                        const ssize_t n = write(fds[i], chunk + offset, size);
+                        if (n > 0 && (sent[k] += (uint64_t) n) == bytes) {
+                            epoll_ctl(epollFd, EPOLL_CTL_DEL, fds[i], nullptr);
+                        }
+                        continue;
+                    }
+
+                    uint8_t data[BENCH_CHUNK_SIZE];
+                    const ssize_t n = read(fds[i], data, sizeof(data));
+                    if (n <= 0) {
+                        if (n == 0 || errno != EAGAIN) {
+                            failed++;
+                        }
+                        continue;
+                    }
+                    for (ssize_t b = 0; b < n; b++) {
+                        if (data[b] != (uint8_t) (received[k] + b)) {
+                            failed++;
+                            break;
+                        }
+                    }
+                    if ((received[k] += (uint64_t) n) >= bytes) {
+                        epoll_ctl(epollFd, EPOLL_CTL_DEL, fds[i], nullptr);
+                        pending--;
+                    }
+                }
+            }
+            close(epollFd);
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    return !failed;
+#else
+    (void) fds;
+    (void) links;
+    (void) bytes;
+    return false;
+#endif
+}
+
+// -------------------------------------------------------------------
+//
+//
+void VSPCtl::PrintPtyRun(const TCtlPtyRun& run, const bool json)
+{
+    const char* paths[2] = {"link", "echo"};
+
+    if (json) {
+        printf("\"seconds\":%.6f,\"rate\":%.1f,\"nsPerByte\":%.2f,\"cpuPerGB\":%.3f,\"latency\":[", //
+               run.seconds, run.rate, run.nsPerByte, run.cpuPerGB);
+    }
+    else {
+        printf("%-10s %8s %8s %8s %8s\n", "latency", "avg us", "p50 us", "p99 us", "max us");
+    }
+    for (int i = 0; i < 2; i++) {
+        const TCtlLatency* l = &run.latency[i];
+        if (json) {
+            printf("%s{\"path\":\"%s\",\"avgUs\":%.1f,\"p50Us\":%.1f,\"p99Us\":%.1f,\"maxUs\":%.1f}", //
+                   (i ? "," : ""), paths[i], l->avgUs, l->p50Us, l->p99Us, l->maxUs);
+        }
+        else {
+            printf("%-10s %8.1f %8.1f %8.1f %8.1f\n", paths[i], l->avgUs, l->p50Us, l->p99Us, l->maxUs);
+        }
+    }
+    if (json) {
+        printf("]");
+    }
+}
+
+// -------------------------------------------------------------------
+// Ports for a bench with the name of each, all or none are created
+//
+int VSPCtl::CreateBenchPorts(const uint32_t count, const uint32_t baudRate, std::vector<uint16_t>* ids, std::vector<std::string>* names)
+{
+    TVSPPortParameters parameters = {baudRate, 8, 1, 0, 0};
+    TVSPResult result = {};
+    uint16_t cursor = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        result = Execute([this, &parameters]() {
+            return CreatePort(&parameters);
+        });
+        if (result.result) {
+            RemoveBenchPorts(*ids);
+            return PrintError("create", result);
+        }
+        ids->push_back(result.data.parameter.link.source);
+    }
+
+    names->resize(count);
+    do {
+        result = Execute([this, cursor]() {
+            return GetPortList(cursor);
+        });
+        if (result.result) {
+            RemoveBenchPorts(*ids);
+            return PrintError("list", result);
+        }
+        for (uint8_t i = 0; i < result.data.ports.count && i < MAX_SERIAL_PORTS; i++) {
+            const TVSPPortListItem* item = &result.data.ports.list[i];
+            auto it = std::find(ids->begin(), ids->end(), item->id);
+            if (it != ids->end()) {
+                (*names)[it - ids->begin()] = std::string(item->name, strnlen(item->name, MAX_PORT_NAME));
+            }
+        }
+    } while ((cursor = result.data.ports.next));
+    return EXIT_SUCCESS;
+}
+
+// -------------------------------------------------------------------
+// 'links' linked pairs of ports with the device of each opened non
+// blocking, port 2k transmits to port 2k+1. All or none are opened.
+//
+int VSPCtl::OpenBenchLinks(const uint32_t links, const uint32_t baudRate, std::vector<uint16_t>* ids, std::vector<int>* fds)
+{
+    std::vector<std::string> names;
+    struct rlimit limit;
+    int ret;
+
+    // the engine holds two descriptors per port in this process
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    if ((ret = CreateBenchPorts(2 * links, baudRate, ids, &names)) != EXIT_SUCCESS) {
+        return ret;
+    }
+    for (uint32_t k = 0; k < links && ret == EXIT_SUCCESS; k++) {
+        const uint16_t a = (*ids)[2 * k];
+        const uint16_t b = (*ids)[2 * k + 1];
+        const TVSPResult result = Execute([this, a, b]() {
+            return LinkPorts(a, b);
+        });
+        if (result.result) {
+            ret = PrintError("link", result);
+        }
+    }
+    for (size_t i = 0; i < names.size() && ret == EXIT_SUCCESS; i++) {
+        const int fd = OpenDevice(names[i].c_str());
+        if (fd < 0) {
+            fprintf(stderr, "vspctl: Unable to open port %u device '%s': %s\n", (*ids)[i], names[i].c_str(), strerror(errno));
+            ret = EXIT_FAILURE;
+            break;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fds->push_back(fd);
+    }
+
+    if (ret != EXIT_SUCCESS) {
+        CloseBenchLinks(*ids, *fds);
+        ids->clear();
+        fds->clear();
+    }
+    return ret;
+}
+
+// -------------------------------------------------------------------
+//
+//
+void VSPCtl::CloseBenchLinks(const std::vector<uint16_t>& ids, const std::vector<int>& fds)
+{
+    for (const int fd : fds) {
+        close(fd);
+    }
+    RemoveBenchPorts(ids);
+}
+
+// -------------------------------------------------------------------
+//
+//
+void VSPCtl::RemoveBenchPorts(const std::vector<uint16_t>& ids)
+{
+    for (const uint16_t id : ids) {
+        Execute([this, id]() {
+            return RemovePort(id);
+        });
+    }
+}
+
+// -------------------------------------------------------------------
+// Raw like a serial device opened by a terminal program
+//
+int VSPCtl::OpenDevice(const char* name)
+{
+    const std::string path = (name[0] == '/' ? std::string(name) : std::string("/dev/") + name);
+    struct termios tio;
+    int fd;
+
+    if ((fd = open(path.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC)) < 0) {
+        return -1;
+    }
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+    return fd;
+}
+
+// -------------------------------------------------------------------
+//
+//
+bool VSPCtl::ReadFully(int fd, uint8_t* buffer, const size_t size)
+{
+    for (size_t done = 0; done < size;) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, BENCH_READ_TIMEOUT) <= 0) {
+            return false;
+        }
+        const ssize_t n = read(fd, buffer + done, size - done);
+        if (n <= 0) {
+            return false;
+        }
+        done += (size_t) n;
+    }
+    return true;
+}
+
+// -------------------------------------------------------------------
+// One byte at a time from 'tx' until it arrives at 'rx'
+//
+bool VSPCtl::MeasureLatency(int tx, int rx, std::vector<double>* samples)
+{
+    for (uint32_t i = 0; i < BENCH_LATENCY_SAMPLES; i++) {
+        uint8_t byte = (uint8_t) i;
+        const auto start = std::chrono::steady_clock::now();
+        if (write(tx, &byte, 1) != 1 || !ReadFully(rx, &byte, 1) || byte != (uint8_t) i) {
+            return false;
+        }
+        samples->push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    }
+    return true;
+}
+
+// -------------------------------------------------------------------
+// MARK: Main
+// -------------------------------------------------------------------
+
+static void Usage(FILE* out)
+{
+    fprintf(out,
+            "usage: vspctl [options] <command> [arguments]\n"
+            "\n"
+            "options:\n"
+            "  --json            one JSON object per result\n"
+            "  --repeat <n>      run the command n times\n"
+            "  --bench           report the latency per command instead of the results\n"
+            "  --timeout <ms>    request deadline, 0 = none (default %u)\n"
+            "  --instance <path> send the requests to the driver instance at path\n"
+            "  --socket <path>   share the driver connection of the vspd daemon at path\n"
+            "                    (default $VSPD_SOCKET if set)\n"
+            "  --driver          connect to the driver even if $VSPD_SOCKET is set\n"
+            "  --help, --version\n"
+            "\n"
+            "commands:\n",
+            DEFAULT_TIMEOUT);
+    fprintf(out,
+            "  status\n"
+            "  list\n"
+            "  create [baud [data bits [stop bits [parity [flow control]]]]]\n"
+            "  remove <port>\n"
+            "  link <source> <target>\n"
+            "  unlink <source> <target>\n"
+            "  checks <port>\n"
+            "  trace <port>\n"
+            "  instances\n"
+            "  script <file | ->   commands above, one per line\n"
+            "  apply <file | ->    bring the topology to the JSON spec\n"
+            "  bench wire [count]\n"
+            "  bench ring [megabytes]\n"
+            "  bench stress [threads [count]]\n"
+            "  bench pty [links [megabytes]]\n"
+            "  bench splice [links [megabytes]]\n"
+            "  bench pace [links [baud]]\n"
+            "  bench shards [links [megabytes [shards]]]\n");
+}
+
+int main(int argc, char* argv[])
+{
+    const char* path = getenv("VSPD_SOCKET");
+    TCtlOptions options = {false, false, 1, DEFAULT_TIMEOUT, nullptr, (path && *path ? path : nullptr)};
+    int i = 1;
+
+    for (; i < argc && strncmp(argv[i], "--", 2) == 0; i++) {
+        const char* option = argv[i];
+        const bool hasValue = (i + 1 < argc);
+        uint32_t value = 0;
+
+        if (strcmp(option, "--json") == 0) {
+            options.json = true;
+        }
+        else if (strcmp(option, "--bench") == 0) {
+            options.bench = true;
+        }
+        else if (strcmp(option, "--repeat") == 0 && hasValue) {
+            const char* text = argv[++i];
+            char* end = nullptr;
+            value = (uint32_t) strtoul(text, &end, 0);
+            if (end == text || *end || !value) {
+                fprintf(stderr, "vspctl: Invalid repeat count '%s'.\n", text);
+                return EXIT_USAGE;
+            }
+            options.repeat = value;
+        }
+        else if (strcmp(option, "--timeout") == 0 && hasValue) {
+            const char* text = argv[++i];
+            char* end = nullptr;
+            value = (uint32_t) strtoul(text, &end, 0);
+            if (end == text || *end) {
+                fprintf(stderr, "vspctl: Invalid timeout '%s'.\n", text);
+                return EXIT_USAGE;
+            }
+            options.timeout = value;
+        }
+        else if (strcmp(option, "--instance") == 0 && hasValue) {
+            options.instance = argv[++i];
+        }
+        else if (strcmp(option, "--socket") == 0 && hasValue) {
+            options.socket = argv[++i];
+        }
+        else if (strcmp(option, "--driver") == 0) {
+            options.socket = nullptr;
+        }
+        else if (strcmp(option, "--help") == 0) {
+            Usage(stdout);
+            return EXIT_SUCCESS;
+        }
+        else if (strcmp(option, "--version") == 0) {
+            printf("vspctl %s\n", VSPCTL_VERSION);
+            return EXIT_SUCCESS;
+        }
+        else {
+            fprintf(stderr, "vspctl: Unknown option '%s'.\n", option);
+            Usage(stderr);
+            return EXIT_USAGE;
+        }
+    }
+
+    if (i >= argc) {
+        Usage(stderr);
+        return EXIT_USAGE;
+    }
+
+    VSPCtl ctl(options);
+    return ctl.Run(argc - i, &argv[i]);
+}
@@ -0,0 +1,986 @@
+// ********************************************************************
+// vspd.cpp - VSPDriver multiplexing daemon
+//
+// Copyright © 2025 by EoF Software Labs
+// SPDX-License-Identifier: MIT
+// ********************************************************************
+#include <errno.h>
+#include <fcntl.h>
+#include <map>
+#include <memory>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+#include <vspcontroller.hpp>
+#include <vspsocket.hpp>
+#include <vspwire.hpp>
+
+using namespace VSPClient;
+
+#define VSPD_VERSION "1.0"
+
+// exit codes besides EXIT_SUCCESS and EXIT_FAILURE
+#define EXIT_USAGE    2
+#define EXIT_NODRIVER 3
+
+// deadline of a forwarded request in ms
+#define FORWARD_TIMEOUT 2000
+
+// pending output of a client not reading its responses
+#define MAX_CLIENT_OUTPUT (4 * 1024 * 1024)
+
+// poll period in ms, instance changes are found by this tick
+#define POLL_PERIOD 100
+
+// IOReturn codes answered by the daemon, see vsptransport.hpp
+#define kIOReturnNoResources ((int) 0xe00002be)
+#define kIOReturnBadArgument ((int) 0xe00002c2)
+#define kIOReturnNotOpen     ((int) 0xe00002cd)
+#define kIOReturnUnsupported ((int) 0xe00002c7)
+#define kIOReturnNotReady    ((int) 0xe00002d8)
+
+typedef struct {
+    /* Path of the listening socket */
+    const char* socket;
+    /* Client and driver errors to stderr */
+    bool verbose;
+} TDaemonOptions;
+
+typedef struct {
+    uint32_t id;
+    int fd;
+    /* Received bytes of the incomplete frame */
+    std::vector<uint8_t> input;
+    /* Frames not yet written from 'sent' on */
+    std::vector<uint8_t> output;
+    size_t sent;
+    /* Event subscription of the client, mask 0 = none */
+    uint8_t eventInstance;
+    uint32_t eventMask;
+} TClient;
+
+// Clients waiting for the result of the same read request
+typedef struct {
+    uint64_t key;
+    /* Mutation sequence of the instance at submission */
+    uint64_t sequence;
+    /* client id, frame tag */
+    std::vector<std::pair<uint32_t, uint32_t>> waiters;
+} TSharedRead;
+
+typedef struct {
+    uint64_t clients;
+    /* Request frames of the clients */
+    uint64_t requests;
+    /* Submitted to the driver */
+    uint64_t forwarded;
+    /* Served by a read already in flight */
+    uint64_t coalesced;
+    /* Answered by the daemon itself (PingPong, Subscribe) */
+    uint64_t local;
+    /* Answered with an error without driver request */
+    uint64_t refused;
+    /* Event frames sent */
+    uint64_t events;
+} TDaemonStats;
+
+static volatile sig_atomic_t s_stop = 0;
+static volatile sig_atomic_t s_report = 0;
+
+// -------------------------------------------------------------------
+// Owns the driver connection and serves the clients of the socket on
+// one thread: the control thread queues the completions, the poll
+// loop dispatches them. Identical reads of an instance in flight are
+// sent to the driver once, unless a mutation of that instance was
+// submitted or completed meanwhile.
+//
+class VSPDaemon: public VSPController
+{
+public:
+    VSPDaemon(const TDaemonOptions& options);
+    ~VSPDaemon();
+
+    /** ----------------------
+     * Serve the clients until SIGINT or SIGTERM
+     */
+    int Run();
+
+protected:
+    void OnIOUCCallback(int result, void* data, uint32_t size) override;
+    void OnConnected() override;
+    void OnDisconnected() override;
+    void OnErrorOccured(int error, const char* message) override;
+    void OnDataReady(void*) override;
+    void OnEvent(const TVSPEvent* event) override;
+    void OnCompletionsPending() override;
+
+private:
+    TDaemonOptions m_options;
+    int m_listenFd;
+    int m_wakeFd[2];
+    uint32_t m_nextClient;
+    std::map<uint32_t, std::unique_ptr<TClient>> m_clients;
+
+    // latest joinable read per key
+    std::map<uint64_t, std::shared_ptr<TSharedRead>> m_reads;
+
+    // per instance slot: mutation sequence, last generation seen
+    uint64_t m_sequence[MAX_INSTANCES];
+    uint32_t m_generation[MAX_INSTANCES];
+
+    // instances announced to the clients
+    TVSPInstanceInfo m_instances[MAX_INSTANCES];
+    bool m_announced[MAX_INSTANCES];
+
+    // slot of the daemon subscription, one per controller
+    uint8_t m_eventInstance;
+    bool m_subscribing;
+
+    TDaemonStats m_stats;
+
+    bool Listen();
+    void Accept();
+    void Announce(TClient* client, const uint8_t index);
+    void UpdateInstances();
+    void Resubscribe();
+    bool ReadClient(TClient* client);
+    bool WriteClient(TClient* client);
+    void DropClient(const uint32_t id);
+    void SendFrame(TClient* client, const uint8_t kind, const uint8_t instance, const uint32_t tag, const uint8_t* payload, const uint16_t length);
+    void Respond(const uint32_t id, const uint8_t instance, const uint32_t tag, TVSPControllerData* response);
+    void Answer(TClient* client, const uint8_t instance, const uint32_t tag, const TVSPControllerData* input, const int code);
+    void Request(TClient* client, const TVSPFrameHeader* header, const uint8_t* payload);
+    int Forward(const TVSPControllerData* input, const uint8_t instance, const TVSPCompletion& completion);
+    void PrintStats();
+
+    static bool IsRead(const uint8_t command);
+    static uint64_t ReadKey(const TVSPControllerData* input, const uint8_t instance);
+};
+
+// -------------------------------------------------------------------
+//
+//
+VSPDaemon::VSPDaemon(const TDaemonOptions& options)
+    : VSPController()
+    , m_options(options)
+    , m_listenFd(-1)
+    , m_wakeFd {-1, -1}
+    , m_nextClient(1)
+    , m_clients()
+    , m_reads()
+    , m_sequence()
+    , m_generation()
+    , m_instances()
+    , m_announced()
+    , m_eventInstance(MAX_INSTANCES)
+    , m_subscribing(false)
+    , m_stats()
+{
+    SetControlThread(true);
+    SetTraceLevel(options.verbose ? vspTraceError : vspTraceOff);
+
+    // the clients replay their own topology, see SetTopologyReplay()
+    SetReconnect(25, 800);
+}
+
+VSPDaemon::~VSPDaemon()
+{
+    DisconnectDriver();
+
+    for (auto& it : m_clients) {
+        close(it.second->fd);
+    }
+    if (m_listenFd >= 0) {
+        close(m_listenFd);
+        unlink(m_options.socket);
+    }
+    if (m_wakeFd[0] >= 0) {
+        close(m_wakeFd[0]);
+        close(m_wakeFd[1]);
+    }
+}
+
+// -------------------------------------------------------------------
+// MARK: Controller Callbacks
+// -------------------------------------------------------------------
+
+void VSPDaemon::OnIOUCCallback(int, void*, uint32_t)
+{
+    // all requests carry their own completion
+}
+
+void VSPDaemon::OnConnected()
+{
+}
+
+void VSPDaemon::OnDisconnected()
+{
+}
+
+void VSPDaemon::OnErrorOccured(int error, const char* message)
+{
+    if (m_options.verbose) {
+        fprintf(stderr, "vspd: %s (0x%08x)\n", message, (uint32_t) error);
+    }
+}
+
+void VSPDaemon::OnDataReady(void*)
+{
+}
+
+// -------------------------------------------------------------------
+// A topology event of another driver client invalidates the reads in
+// flight like a mutation of ours.
+//
+void VSPDaemon::OnEvent(const TVSPEvent* event)
+{
+    uint8_t payload[VSP_FRAME_EVENT_SIZE];
+
+    if (m_eventInstance >= MAX_INSTANCES) {
+        return;
+    }
+    if (event->kind != vspEventModemSignal) {
+        m_sequence[m_eventInstance]++;
+        m_generation[m_eventInstance] = event->generation;
+    }
+
+    VSPFrameEncodeEvent(event, payload);
+    for (auto& it : m_clients) {
+        TClient* client = it.second.get();
+        if (client->eventInstance == m_eventInstance && (client->eventMask & VSP_EVENT_MASK(event->kind))) {
+            SendFrame(client, vspFrameEvent, m_eventInstance, 0, payload, sizeof(payload));
+            m_stats.events++;
+        }
+    }
+}
+
+void VSPDaemon::OnCompletionsPending()
+{
+    const uint8_t one = 1;
+    if (write(m_wakeFd[1], &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        fprintf(stderr, "vspd: Wakeup of poll loop failed: %s\n", strerror(errno));
+    }
+}
+
+// -------------------------------------------------------------------
+// MARK: Clients
+// -------------------------------------------------------------------
+
+// -------------------------------------------------------------------
+// A socket file nobody answers on is left over by a crashed daemon.
+//
+bool VSPDaemon::Listen()
+{
+    struct sockaddr_un address = {};
+    int fd;
+
+    if (strlen(m_options.socket) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "vspd: Socket path '%s' too long.\n", m_options.socket);
+        return false;
+    }
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, m_options.socket, sizeof(address.sun_path) - 1);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        fprintf(stderr, "vspd: Unable to create socket: %s\n", strerror(errno));
+        return false;
+    }
+    if (connect(fd, (struct sockaddr*) &address, sizeof(address)) == 0) {
+        fprintf(stderr, "vspd: Another daemon listens at '%s'.\n", m_options.socket);
+        close(fd);
+        return false;
+    }
+    unlink(m_options.socket);
+
+    if (bind(fd, (struct sockaddr*) &address, sizeof(address)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        fprintf(stderr, "vspd: Unable to listen at '%s': %s\n", m_options.socket, strerror(errno));
+        close(fd);
+        return false;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    m_listenFd = fd;
+    return true;
+}
+
+// -------------------------------------------------------------------
+// The new client learns the instances first, vspFrameReady ends the
+// list.
+//
+void VSPDaemon::Accept()
+{
+    int fd;
+
+    while ((fd = accept(m_listenFd, nullptr, nullptr)) >= 0) {
+        std::unique_ptr<TClient> client(new TClient());
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+        const int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+        client->id = m_nextClient++;
+        client->fd = fd;
+        client->sent = 0;
+        client->eventInstance = MAX_INSTANCES;
+        client->eventMask = 0;
+
+        for (uint8_t i = 0; i < MAX_INSTANCES; i++) {
+            if (m_announced[i]) {
+                Announce(client.get(), i);
+            }
+        }
+        SendFrame(client.get(), vspFrameReady, 0, 0, nullptr, 0);
+
+        if (m_options.verbose) {
+            fprintf(stderr, "vspd: Client %u connected.\n", client->id);
+        }
+        m_stats.clients++;
+        m_clients[client->id] = std::move(client);
+    }
+}
+
+// -------------------------------------------------------------------
+//
+//
+void VSPDaemon::Announce(TClient* client, const uint8_t index)
+{
+    uint8_t payload[3 + 2 * 127];
+    const uint16_t length = VSPFrameEncodeAttach(index, m_instances[index].name, m_instances[index].path, payload);
+
+    SendFrame(client, vspFrameAttach, index, 0, payload, length);
+}
+
+// -------------------------------------------------------------------
+// Runs each poll tick. Matched and removed instances are forwarded
+// to the clients, their transport attaches or detaches the slot.
+//
+void VSPDaemon::UpdateInstances()
+{
+    TVSPInstanceInfo infos[MAX_INSTANCES] = {};
+    bool matched[MAX_INSTANCES] = {};
+    const uint8_t count = GetInstances(infos, MAX_INSTANCES);
+
+    for (uint8_t i = 0; i < count; i++) {
+        const uint8_t index = infos[i].index;
+        if (index >= MAX_INSTANCES) {
+            continue;
+        }
+        matched[index] = true;
+        if (m_announced[index] && strcmp(m_instances[index].path, infos[i].path) == 0) {
+            continue;
+        }
+
+        m_instances[index] = infos[i];
+        m_announced[index] = true;
+        m_sequence[index]++;
+        for (auto& it : m_clients) {
+            Announce(it.second.get(), index);
+        }
+    }
+
+    for (uint8_t i = 0; i < MAX_INSTANCES; i++) {
+        if (!m_announced[i] || matched[i]) {
+            continue;
+        }
+        m_announced[i] = false;
+        m_sequence[i]++;
+        if (m_eventInstance == i) {
+            m_eventInstance = MAX_INSTANCES;
+        }
+        for (auto& it : m_clients) {
+            SendFrame(it.second.get(), vspFrameDetach, i, 0, nullptr, 0);
+        }
+    }
+
+    Resubscribe();
+}
+
+// -------------------------------------------------------------------
+// The controller holds one subscription, it follows the first
+// instance. Subscriptions of clients to another instance are refused
+// with kIOReturnUnsupported.
+//
+void VSPDaemon::Resubscribe()
+{
+    uint8_t index = 0;
+
+    if (m_subscribing || (m_eventInstance < MAX_INSTANCES && IsSubscribed())) {
+        return;
+    }
+    for (; index < MAX_INSTANCES && !m_announced[index]; index++) {
+    }
+    if (index == MAX_INSTANCES) {
+        return;
+    }
+
+    m_subscribing = true;
+    const bool submitted = Route(m_instances[index].path, [this, index]() {
+        return Call([this]() { return Subscribe(VSP_EVENT_ALL); }, FORWARD_TIMEOUT, [this, index](const TVSPResult& result) {
+            m_subscribing = false;
+            m_eventInstance = (result.result == 0 ? index : MAX_INSTANCES);
+        });
+    });
+    if (!submitted) {
+        m_subscribing = false;
+    }
+}
+
+// -------------------------------------------------------------------
+// Returns false if the client is gone or sent a malformed frame.
+//
+bool VSPDaemon::ReadClient(TClient* client)
+{
+    uint8_t buffer[16384];
+    ssize_t n;
+
+    while ((n = recv(client->fd, buffer, sizeof(buffer), 0)) > 0) {
+        client->input.insert(client->input.end(), buffer, buffer + n);
+    }
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        return false;
+    }
+
+    size_t offset = 0;
+    while (client->input.size() - offset >= VSP_FRAME_HEADER_SIZE) {
+        TVSPFrameHeader header;
+        VSPFrameDecodeHeader(&client->input[offset], &header);
+        if (header.length > VSP_WIRE_MAX_SIZE) {
+            return false;
+        }
+        if (client->input.size() - offset < (size_t) VSP_FRAME_HEADER_SIZE + header.length) {
+            break;
+        }
+        if (header.kind == vspFrameRequest) {
+            Request(client, &header, &client->input[offset + VSP_FRAME_HEADER_SIZE]);
+        }
+        offset += VSP_FRAME_HEADER_SIZE + header.length;
+    }
+    client->input.erase(client->input.begin(), client->input.begin() + offset);
+    return true;
+}
+
+// -------------------------------------------------------------------
+// Returns false if the client is gone.
+//
+bool VSPDaemon::WriteClient(TClient* client)
+{
+    while (client->sent < client->output.size()) {
+        const ssize_t n = send(client->fd, &client->output[client->sent], client->output.size() - client->sent, MSG_DONTWAIT
+#ifdef MSG_NOSIGNAL
+                                  | MSG_NOSIGNAL
+#endif
+        );
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            break;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        client->sent += (size_t) n;
+    }
+
+    if (client->sent == client->output.size()) {
+        client->output.clear();
+        client->sent = 0;
+    }
+    return (client->output.size() - client->sent <= MAX_CLIENT_OUTPUT);
+}
+
+// -------------------------------------------------------------------
+// Its requests in flight complete without it.
+//
+void VSPDaemon::DropClient(const uint32_t id)
+{
+    auto it = m_clients.find(id);
+    if (it == m_clients.end()) {
+        return;
+    }
+    if (m_options.verbose) {
+        fprintf(stderr, "vspd: Client %u disconnected.\n", id);
+    }
+    close(it->second->fd);
+    m_clients.erase(it);
+}
+
+// -------------------------------------------------------------------
+// Queued in the output of the client, written by the poll loop.
+//
+void VSPDaemon::SendFrame(TClient* client, const uint8_t kind, const uint8_t instance, const uint32_t tag, const uint8_t* payload, const uint16_t length)
+{
+    const TVSPFrameHeader header = {kind, instance, length, tag};
+    const size_t offset = client->output.size();
+
+    client->output.resize(offset + VSP_FRAME_HEADER_SIZE + length);
+    VSPFrameEncodeHeader(&header, &client->output[offset]);
+    if (length) {
+        memcpy(&client->output[offset + VSP_FRAME_HEADER_SIZE], payload, length);
+    }
+}
+
+// -------------------------------------------------------------------
+// MARK: Requests
+// -------------------------------------------------------------------
+
+// -------------------------------------------------------------------
+//
+//
+bool VSPDaemon::IsRead(const uint8_t command)
+{
+    return command == vspControlGetStatus || command == vspControlGetPortList || //
+           command == vspControlGetLinkList || command == vspControlGetChanges;
+}
+
+// -------------------------------------------------------------------
+// Instance, command and the cursor or generation of the page
+//
+uint64_t VSPDaemon::ReadKey(const TVSPControllerData* input, const uint8_t instance)
+{
+    uint64_t argument = 0;
+
+    if (input->command == vspControlGetPortList || input->command == vspControlGetLinkList) {
+        argument = input->parameter.cursor;
+    }
+    else if (input->command == vspControlGetChanges) {
+        argument = input->generation;
+    }
+    return ((uint64_t) instance << 56) | ((uint64_t) input->command << 48) | argument;
+}
+
+// -------------------------------------------------------------------
+// The response echoes the request id of the client in the tag and
+// in the message.
+//
+void VSPDaemon::Respond(const uint32_t id, const uint8_t instance, const uint32_t tag, TVSPControllerData* response)
+{
+    uint8_t payload[VSP_WIRE_MAX_SIZE];
+    size_t length;
+
+    auto it = m_clients.find(id);
+    if (it == m_clients.end()) {
+        return;
+    }
+
+    response->request = tag;
+    if (!(length = VSPWireEncode(response, payload, sizeof(payload)))) {
+        return;
+    }
+    SendFrame(it->second.get(), vspFrameResponse, instance, tag, payload, (uint16_t) length);
+}
+
+// -------------------------------------------------------------------
+// Response of the daemon itself, built like the driver does.
+//
+void VSPDaemon::Answer(TClient* client, const uint8_t instance, const uint32_t tag, const TVSPControllerData* input, const int code)
+{
+    TVSPControllerData response = {};
+
+    response.command = input->command;
+    response.parameter = input->parameter;
+    response.status.flags = input->status.flags;
+    response.status.code = (uint32_t) code;
+    response.context = (code == 0 ? vspContextResult : vspContextError);
+    response.generation = (instance < MAX_INSTANCES ? m_generation[instance] : 0);
+    Respond(client->id, instance, tag, &response);
+}
+
+// -------------------------------------------------------------------
+//
+//
+void VSPDaemon::Request(TClient* client, const TVSPFrameHeader* header, const uint8_t* payload)
+{
+    const uint8_t instance = header->instance;
+    const uint32_t tag = header->tag;
+    const uint32_t id = client->id;
+    TVSPControllerData input;
+
+    m_stats.requests++;
+
+    if (!VSPWireDecode(payload, header->length, &input) || input.command >= vspLastCommand) {
+        TVSPControllerData invalid = {};
+        invalid.status.flags = MAGIC_CONTROL;
+        Answer(client, instance, tag, &invalid, kIOReturnBadArgument);
+        m_stats.refused++;
+        return;
+    }
+    if (instance >= MAX_INSTANCES || !m_announced[instance]) {
+        Answer(client, instance, tag, &input, kIOReturnNotOpen);
+        m_stats.refused++;
+        return;
+    }
+
+    // the connection of the daemon stays subscribed, the client gets
+    // the events of its mask. The events follow one instance only, the
+    // first announced, a subscription to another would stay silent.
+    if (input.command == vspControlSubscribe) {
+        if (input.parameter.flags && instance != m_eventInstance) {
+            uint8_t first = 0;
+            for (; first < MAX_INSTANCES && !m_announced[first]; first++) {
+            }
+            if (instance != first || m_eventInstance < MAX_INSTANCES) {
+                Answer(client, instance, tag, &input, kIOReturnUnsupported);
+                m_stats.refused++;
+                return;
+            }
+            if (!m_subscribing) {
+                Answer(client, instance, tag, &input, kIOReturnNotReady);
+                m_stats.refused++;
+                return;
+            }
+        }
+        client->eventInstance = instance;
+        client->eventMask = (uint32_t) input.parameter.flags;
+        Answer(client, instance, tag, &input, 0);
+        m_stats.local++;
+        return;
+    }
+    if (input.command == vspControlPingPong) {
+        Answer(client, instance, tag, &input, 0);
+        m_stats.local++;
+        return;
+    }
+
+    if (IsRead(input.command)) {
+        const uint64_t key = ReadKey(&input, instance);
+        auto it = m_reads.find(key);
+        if (it != m_reads.end() && it->second->sequence == m_sequence[instance]) {
+            it->second->waiters.push_back({id, tag});
+            m_stats.coalesced++;
+            return;
+        }
+
+        std::shared_ptr<TSharedRead> read = std::make_shared<TSharedRead>();
+        read->key = key;
+        read->sequence = m_sequence[instance];
+        read->waiters.push_back({id, tag});
+
+        const TVSPControllerData request = input;
+        const int ret = Forward(&input, instance, [this, read, request, instance](const TVSPResult& result) {
+            TVSPControllerData response = ((result.data.status.flags & MAGIC_CONTROL) ? result.data : request);
+            response.status.code = (uint32_t) result.result;
+            if (result.result == 0) {
+                m_generation[instance] = response.generation;
+            }
+
+            auto it = m_reads.find(read->key);
+            if (it != m_reads.end() && it->second == read) {
+                m_reads.erase(it);
+            }
+            for (const auto& waiter : read->waiters) {
+                Respond(waiter.first, instance, waiter.second, &response);
+            }
+        });
+        if (ret != 0) {
+            Answer(client, instance, tag, &input, ret);
+            m_stats.refused++;
+            return;
+        }
+        m_reads[key] = read;
+        return;
+    }
+
+    // mutations: reads submitted before are not joined any more
+    m_sequence[instance]++;
+
+    const TVSPControllerData request = input;
+    const int ret = Forward(&input, instance, [this, id, tag, request, instance](const TVSPResult& result) {
+        TVSPControllerData response = ((result.data.status.flags & MAGIC_CONTROL) ? result.data : request);
+        response.status.code = (uint32_t) result.result;
+        if (result.result == 0) {
+            m_generation[instance] = response.generation;
+        }
+        m_sequence[instance]++;
+        Respond(id, instance, tag, &response);
+    });
+    if (ret != 0) {
+        Answer(client, instance, tag, &input, ret);
+        m_stats.refused++;
+    }
+}
+
+// -------------------------------------------------------------------
+// Run the command method of the request on its instance. Returns 0
+// if submitted, the IOReturn to answer otherwise.
+//
+int VSPDaemon::Forward(const TVSPControllerData* input, const uint8_t instance, const TVSPCompletion& completion)
+{
+    TVSPCommandCall call;
+
+    switch (input->command) {
+        case vspControlGetStatus: {
+            call = [this]() {
+                return GetStatus();
+            };
+            break;
+        }
+        case vspControlCreatePort: {
+            TVSPPortParameters parameters = {};
+            if (input->ports.count != sizeof(TVSPPortParameters)) {
+                return kIOReturnBadArgument;
+            }
+            memcpy(&parameters, input->ports.list, sizeof(parameters));
+            call = [this, parameters]() mutable {
+                return CreatePort(&parameters);
+            };
+            break;
+        }
+        case vspControlRemovePort: {
+            const uint16_t id = input->parameter.link.source;
+            call = [this, id]() {
+                return RemovePort(id);
+            };
+            break;
+        }
+        case vspControlLinkPorts:
+        case vspControlUnlinkPorts: {
+            const bool link = (input->command == vspControlLinkPorts);
+            const uint16_t source = input->parameter.link.source;
+            const uint16_t target = input->parameter.link.target;
+            call = [this, link, source, target]() {
+                return (link ? LinkPorts(source, target) : UnlinkPorts(source, target));
+            };
+            break;
+        }
+        case vspControlGetPortList:
+        case vspControlGetLinkList: {
+            const bool ports = (input->command == vspControlGetPortList);
+            const uint16_t cursor = input->parameter.cursor;
+            call = [this, ports, cursor]() {
+                return (ports ? GetPortList(cursor) : GetLinkList(cursor));
+            };
+            break;
+        }
+        case vspControlEnableChecks:
+        case vspControlEnableTrace: {
+            const bool checks = (input->command == vspControlEnableChecks);
+            const uint16_t port = input->parameter.link.source;
+            call = [this, checks, port]() {
+                return (checks ? EnableChecks(port) : EnableTrace(port));
+            };
+            break;
+        }
+        case vspControlBatch: {
+            std::vector<TVSPBatchOperation> operations(MAX_BATCH_OPS);
+            const uint8_t count = input->ports.count;
+            if (!count || count > MAX_BATCH_OPS) {
+                return kIOReturnBadArgument;
+            }
+            memcpy(operations.data(), input->ports.list, count * sizeof(TVSPBatchOperation));
+            call = [this, operations, count]() {
+                return ExecuteBatch(operations.data(), count);
+            };
+            break;
+        }
+        case vspControlGetChanges: {
+            const uint32_t generation = input->generation;
+            call = [this, generation]() {
+                return GetChanges(generation);
+            };
+            break;
+        }
+        default: {
+            return kIOReturnBadArgument;
+        }
+    }
+
+    // not submitted: instance gone or all slots and the backlog taken
+    const bool submitted = Route(m_instances[instance].path, [this, &call, &completion]() {
+        return Call(call, FORWARD_TIMEOUT, completion);
+    });
+    if (!submitted) {
+        return kIOReturnNoResources;
+    }
+    m_stats.forwarded++;
+    return 0;
+}
+
+// -------------------------------------------------------------------
+//
+//
+void VSPDaemon::PrintStats()
+{
+    const uint64_t served = m_stats.requests - m_stats.refused;
+
+    fprintf(stderr,
+            "vspd: %zu clients (%llu accepted), %llu requests, %llu forwarded, %llu coalesced, %llu local, %llu refused, %llu events\n",
+            m_clients.size(),
+            (unsigned long long) m_stats.clients,
+            (unsigned long long) m_stats.requests,
+            (unsigned long long) m_stats.forwarded,
+            (unsigned long long) m_stats.coalesced,
+            (unsigned long long) m_stats.local,
+            (unsigned long long) m_stats.refused,
+            (unsigned long long) m_stats.events);
+    if (served) {
+        fprintf(stderr, "vspd: %.1f%% of the requests served without a driver round trip\n", //
+                100.0 * (double) (served - m_stats.forwarded) / (double) served);
+    }
+}
+
+// -------------------------------------------------------------------
+// MARK: Poll Loop
+// -------------------------------------------------------------------
+
+// -------------------------------------------------------------------
+//
+//
+int VSPDaemon::Run()
+{
+    if (pipe(m_wakeFd) < 0) {
+        fprintf(stderr, "vspd: Unable to create wakeup pipe: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    fcntl(m_wakeFd[0], F_SETFL, fcntl(m_wakeFd[0], F_GETFL) | O_NONBLOCK);
+    fcntl(m_wakeFd[1], F_SETFL, fcntl(m_wakeFd[1], F_GETFL) | O_NONBLOCK);
+
+    if (!ConnectDriver() || !IsConnected()) {
+        fprintf(stderr, "vspd: VSPDriver not found.\n");
+        return EXIT_NODRIVER;
+    }
+    if (!Listen()) {
+        return EXIT_FAILURE;
+    }
+    UpdateInstances();
+
+    if (m_options.verbose) {
+        fprintf(stderr, "vspd: Listening at '%s'.\n", m_options.socket);
+    }
+
+    std::vector<struct pollfd> fds;
+    std::vector<uint32_t> ids;
+
+    while (!s_stop) {
+        fds.clear();
+        ids.clear();
+        fds.push_back({m_listenFd, POLLIN, 0});
+        fds.push_back({m_wakeFd[0], POLLIN, 0});
+        for (auto& it : m_clients) {
+            TClient* client = it.second.get();
+            fds.push_back({client->fd, (short) (POLLIN | (client->output.empty() ? 0 : POLLOUT)), 0});
+            ids.push_back(client->id);
+        }
+
+        if (poll(fds.data(), (nfds_t) fds.size(), POLL_PERIOD) < 0 && errno != EINTR) {
+            fprintf(stderr, "vspd: Poll failed: %s\n", strerror(errno));
+            break;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            uint8_t drain[64];
+            while (read(m_wakeFd[0], drain, sizeof(drain)) > 0) {
+            }
+        }
+        DispatchCompletions();
+
+        if (fds[0].revents & POLLIN) {
+            Accept();
+        }
+        for (size_t i = 0; i < ids.size(); i++) {
+            auto it = m_clients.find(ids[i]);
+            if (it == m_clients.end()) {
+                continue;
+            }
+            if ((fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)) && !ReadClient(it->second.get())) {
+                DropClient(ids[i]);
+            }
+        }
+
+        UpdateInstances();
+
+        // responses of this round, clients not reading are dropped
+        std::vector<uint32_t> gone;
+        for (auto& it : m_clients) {
+            if (!it.second->output.empty() && !WriteClient(it.second.get())) {
+                gone.push_back(it.first);
+            }
+        }
+        for (const uint32_t id : gone) {
+            DropClient(id);
+        }
+
+        if (s_report) {
+            s_report = 0;
+            PrintStats();
+        }
+    }
+
+    PrintStats();
+    return EXIT_SUCCESS;
+}
+
+// -------------------------------------------------------------------
+// MARK: Main
+// -------------------------------------------------------------------
+
+static void OnSignal(int signal)
+{
+    if (signal == SIGUSR1) {
+        s_report = 1;
+    }
+    else {
+        s_stop = 1;
+    }
+}
+
+static void Usage(FILE* out)
+{
+    fprintf(out,
+            "usage: vspd [options]\n"
+            "\n"
+            "options:\n"
+            "  --socket <path>   listen at path (default $VSPD_SOCKET or %s)\n"
+            "  --verbose         report clients and driver errors\n"
+            "  --help, --version\n"
+            "\n"
+            "SIGUSR1 prints the request counters, SIGINT and SIGTERM stop.\n",
+            VSP_SOCKET_PATH);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* path = getenv("VSPD_SOCKET");
+    TDaemonOptions options = {(path && *path ? path : VSP_SOCKET_PATH), false};
+    struct sigaction action = {};
+
+    for (int i = 1; i < argc; i++) {
+        const char* option = argv[i];
+        const bool hasValue = (i + 1 < argc);
+
+        if (strcmp(option, "--socket") == 0 && hasValue) {
+            options.socket = argv[++i];
+        }
+        else if (strcmp(option, "--verbose") == 0) {
+            options.verbose = true;
+        }
+        else if (strcmp(option, "--help") == 0) {
+            Usage(stdout);
+            return EXIT_SUCCESS;
+        }
+        else if (strcmp(option, "--version") == 0) {
+            printf("vspd %s\n", VSPD_VERSION);
+            return EXIT_SUCCESS;
+        }
+        else {
+            fprintf(stderr, "vspd: Unknown option '%s'.\n", option);
+            Usage(stderr);
+            return EXIT_USAGE;
+        }
+    }
+
+    // no SA_RESTART, the signals interrupt poll()
+    action.sa_handler = OnSignal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    sigaction(SIGUSR1, &action, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    VSPDaemon daemon(options);
+    return daemon.Run();
+}
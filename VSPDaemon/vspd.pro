@@ -0,0 +1,38 @@
+TEMPLATE = app
+TARGET = vspd
+
+CONFIG -= qt
+CONFIG -= app_bundle
+CONFIG += console
+CONFIG += c++17
+CONFIG += sdk_no_version_check
+CONFIG += nostrip
+CONFIG += debug
+
+SOURCES += \
+    vspd.cpp
+
+INCLUDEPATH += $$PWD/../VSPController
+
+DISTFILES += \
+    LICENSE
+
+mac {
+    QMAKE_CFLAGS   += -mmacosx-version-min=12.2
+    QMAKE_CXXFLAGS += -mmacosx-version-min=12.2
+    QMAKE_LFLAGS   += -Wl,-rpath,$$OUT_PWD/../VSPController
+    LIBS += -F$$OUT_PWD/../VSPController -framework VSPController
+}
+
+# Linux: VSPController with the in-process loopback driver
+linux {
+    QMAKE_LFLAGS += -Wl,-rpath,$$OUT_PWD/../VSPController
+    LIBS += -L$$OUT_PWD/../VSPController -lVSPController
+    LIBS += -lpthread
+}
+
+QMAKE_CXXFLAGS += -fno-omit-frame-pointer
+QMAKE_CXXFLAGS += -funwind-tables
+QMAKE_CXXFLAGS += -ggdb3
+
+message("Build: $${TARGET}")
@@ -0,0 +1,47 @@
+// ********************************************************************
+// VSPDriverSetup.cpp - VSPDriver setup for the in-process driver
+//
+// Copyright © 2025 by EoF Software Labs
+// SPDX-License-Identifier: MIT
+// ********************************************************************
+#include <vspdriversetup.hpp>
+
+// ---------------------------------------------------
+// The Linux build of VSPController uses the in-process
+// loopback driver, there is nothing to install.
+// ---------------------------------------------------
+
+VSPDriverSetup::VSPDriverSetup()
+    : _loader(nullptr)
+{
+}
+
+void VSPDriverSetup::activateDriver()
+{
+    OnDidFinishWithResult(0, "VSP loopback driver is active.");
+}
+
+void VSPDriverSetup::deactivateDriver()
+{
+    OnDidFinishWithResult(0, "VSP loopback driver cannot be deactivated.");
+}
+
+std::string VSPDriverSetup::getDriverState() const
+{
+    return "VSP loopback driver active";
+}
+
+void VSPDriverSetup::OnDidFailWithError(uint32_t /*code*/, const char* /*message*/)
+{
+    // nothing, override this method
+}
+
+void VSPDriverSetup::OnDidFinishWithResult(uint32_t /*code*/, const char* /*message*/)
+{
+    // nothing, override this method
+}
+
+void VSPDriverSetup::OnNeedsUserApproval()
+{
+    // nothing, override this method
+}
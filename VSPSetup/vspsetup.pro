@@ -21,6 +21,7 @@ DEFINES += VSP_DEBUG
 
 INCLUDEPATH += $$PWD
 
+mac {
 OBJECTIVE_SOURCES += $$PWD/vsploadermodel.m
 OBJECTIVE_SOURCES += $$PWD/vspsmloader.m
 OBJECTIVE_SOURCES += $$PWD/vspdrivercpp.mm
@@ -30,18 +31,27 @@ OBJECTIVE_HEADERS += $$PWD/vspdriversetup.hpp
 OBJECTIVE_HEADERS += $$PWD/vsploadermodel.h
 OBJECTIVE_HEADERS += $$PWD/vspsmloader.h
 OBJECTIVE_HEADERS += $$PWD/vspsetup.h
+}
+
+# No system extension on Linux, VSPController uses the loopback driver
+linux {
+CONFIG -= lib_bundle
+SOURCES += $$PWD/vspdriversetup.cpp
+HEADERS += $$PWD/vspsetup_global.h
+HEADERS += $$PWD/vspdriversetup.hpp
+}
 
 DISTFILES += \
     Info.plist \
     LICENSE
 
-QMAKE_CFLAGS += -mmacosx-version-min=12.2
-QMAKE_CXXFLAGS += -mmacosx-version-min=12.2
+mac:QMAKE_CFLAGS += -mmacosx-version-min=12.2
+mac:QMAKE_CXXFLAGS += -mmacosx-version-min=12.2
 QMAKE_CXXFLAGS += -fno-omit-frame-pointer
 QMAKE_CXXFLAGS += -funwind-tables
 QMAKE_CXXFLAGS += -ggdb3
 
-QMAKE_LFLAGS_SONAME = -Wl,-install_name,@executable_path/../Frameworks/
+mac:QMAKE_LFLAGS_SONAME = -Wl,-install_name,@executable_path/../Frameworks/
 
 QMAKE_PROJECT_NAME = VSPSetup
 QMAKE_FRAMEWORK_BUNDLE_NAME = VSPSetup
@@ -65,6 +75,7 @@ icons.path = Resources
 QMAKE_BUNDLE_DATA += icons
 
 #otool -L
+mac {
 LIBS += -dead_strip
 LIBS += -framework IOKit
 LIBS += -framework CoreFoundation
@@ -72,5 +83,6 @@ LIBS += -framework Foundation
 LIBS += -framework SystemExtensions
 LIBS += -framework SystemConfiguration
 LIBS += -liconv
+}
 
 message("Build: $${TARGET}")